@@ -26,7 +26,8 @@ local ducible = cc.binary {
     },
     includes = {"src"},
     warnings = {"all", "error"},
-    compiler_opts = {"-g"},
+    compiler_opts = {"-g", "-pthread"},
+    linker_opts = {"-pthread"},
 }
 
 local ducible_exe = path.join(".", ducible:path())
@@ -60,7 +61,8 @@ local pdbdump = cc.binary {
     },
     includes = {"src"},
     warnings = {"all", "error"},
-    compiler_opts = {"-g"},
+    compiler_opts = {"-g", "-pthread"},
+    linker_opts = {"-pthread"},
 }
 
 local pdbdump_exe = path.join(".", pdbdump:path())
@@ -85,3 +87,31 @@ rule {
     task = {{pdbdump_exe, "vs/vs2015/x64/Debug/test_dll.pdb"}},
     outputs = {},
 }
+
+local bench = cc.binary {
+    name = "bench",
+    srcs = glob {
+        "src/bench/*.cpp",
+        "src/ducible/patch_pdb.cpp",
+        "src/ducible/symbol_padding.cpp",
+        "src/util/*.cpp",
+        "src/util/*.c",
+        "src/msf/*.cpp",
+        "src/pdb/*.cpp",
+    },
+    includes = {"src"},
+    warnings = {"all", "error"},
+    compiler_opts = {"-g", "-pthread"},
+    linker_opts = {"-pthread"},
+}
+
+local bench_exe = path.join(".", bench:path())
+
+--
+-- Test bench
+--
+rule {
+    inputs = {bench:path()},
+    task = {{bench_exe, "--help"}},
+    outputs = {},
+}
@@ -52,12 +52,18 @@ class Test:
     Represents a single test.
     """
 
-    def __init__(self, name, workdir, commands, args, clean_files):
+    def __init__(self, name, workdir, commands, args, clean_files,
+            variants=None, options=None):
         self.name = name
         self.workdir = workdir
         self.commands = commands
         self.args = args
         self.clean_files = clean_files
+        self.variants = variants or []
+
+        # Extra arguments passed to every run of Ducible. Unlike 'args', these
+        # are not output files.
+        self.options = options or []
 
     def run(self, bin_dir):
         """
@@ -75,8 +81,12 @@ class Test:
         for command in self.commands:
             subprocess.check_call(command, cwd=self.workdir)
 
+        if self.variants:
+            self.run_variants(ducible, outputs)
+
         # Attempt to eliminate nondeterminism
-        subprocess.check_call([ducible] + self.args, cwd=self.workdir)
+        subprocess.check_call([ducible] + self.args + self.options,
+                cwd=self.workdir)
 
         checksums_1 = [hash_file(o).digest() for o in outputs]
 
@@ -87,7 +97,8 @@ class Test:
             subprocess.check_call(command, cwd=self.workdir)
 
         # Attempt to eliminate nondeterminism (again)
-        subprocess.check_call([ducible] + self.args, cwd=self.workdir)
+        subprocess.check_call([ducible] + self.args + self.options,
+                cwd=self.workdir)
 
         checksums_2 = [hash_file(o).digest() for o in outputs]
 
@@ -103,6 +114,48 @@ class Test:
 
             raise MismatchException('Some files are not reproducible')
 
+    def run_variants(self, ducible, outputs):
+        """
+        Runs Ducible on the same build outputs with each set of extra arguments
+        in the 'variants' array. The results must be identical for all of
+        them. For example, this checks that patching with multiple threads
+        gives the same result as patching with a single thread.
+
+        The build outputs are left unmodified.
+
+        Throws an exception if the results differ.
+        """
+        originals = [o + '.orig' for o in outputs]
+
+        for o, orig in zip(outputs, originals):
+            shutil.copyfile(o, orig)
+
+        checksums = []
+
+        try:
+            for variant in self.variants:
+                for o, orig in zip(outputs, originals):
+                    shutil.copyfile(orig, o)
+
+                subprocess.check_call(
+                        [ducible] + self.args + self.options + variant,
+                        cwd=self.workdir)
+
+                checksums.append([hash_file(o).digest() for o in outputs])
+        finally:
+            for o, orig in zip(outputs, originals):
+                shutil.move(orig, o)
+
+        mismatches = [i for i in range(len(outputs))
+                        if any(c[i] != checksums[0][i] for c in checksums)]
+
+        if mismatches:
+            print('Error: The following files differ between variants:')
+            for m in mismatches:
+                print('  {}'.format(self.args[m]))
+
+            raise MismatchException('Some files differ between variants')
+
     def analyze(self, bin_dir):
         """
         Creates an environment to make analyzing non-determinism easier.
@@ -137,7 +190,8 @@ class Test:
                 subprocess.check_call([pdbdump, '--verbose', '--', pdb], stdout=f)
 
         # Attempt to eliminate nondeterminism
-        subprocess.check_call([ducible] + self.args, cwd=self.workdir)
+        subprocess.check_call([ducible] + self.args + self.options,
+                cwd=self.workdir)
 
         # Copy *rewritten* outputs to the analysis directory (round 1)
         for o in outputs:
@@ -168,7 +222,8 @@ class Test:
                 subprocess.check_call([pdbdump, '--verbose', '--', pdb], stdout=f)
 
         # Attempt to eliminate nondeterminism (again)
-        subprocess.check_call([ducible] + self.args, cwd=self.workdir)
+        subprocess.check_call([ducible] + self.args + self.options,
+                cwd=self.workdir)
 
         # Copy *rewritten* outputs to the analysis directory (round 2)
         for o in outputs:
@@ -226,7 +281,9 @@ def tests(tests_dir):
                 yield Test(d, os.path.join(root, d),
                         obj['commands'],
                         obj['ducible_args'],
-                        obj['clean'])
+                        obj['clean'],
+                        obj.get('variants', []),
+                        obj.get('options', []))
         except FileNotFoundError:
             # Directory doesn't have a test in it
             pass
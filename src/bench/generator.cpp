@@ -0,0 +1,639 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "bench/generator.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "msf/format.h"
+#include "msf/msf.h"
+#include "msf/stream.h"
+#include "msf/memory_stream.h"
+
+#include "pdb/format.h"
+#include "pdb/cvinfo.h"
+
+namespace {
+
+// Size of the block of symbol records that is repeated to fill the large
+// streams.
+const size_t kBlockSize = 1024 * 1024;
+
+// Streams must stay below 4 GB since their lengths are 32-bit.
+const uint64_t kMaxStreamSize = 0xF0000000;
+
+// The signature and age of the PDB before it is patched.
+const uint8_t kSignature[16] = {
+    0x8d, 0x2b, 0x4c, 0x91, 0x5e, 0x07, 0x43, 0xa6,
+    0x9f, 0x31, 0xd4, 0x0b, 0x7e, 0x62, 0xc5, 0x18,
+};
+
+const uint32_t kAge = 3;
+const uint32_t kTimestamp = 0x5a5a5a5a;
+
+/**
+ * A small, fast, deterministic random number generator (xorshift64*). The same
+ * options always give the same PDB.
+ */
+class Random {
+private:
+    uint64_t _state;
+
+public:
+    explicit Random(uint64_t seed) : _state(seed) {}
+
+    uint32_t next() {
+        _state ^= _state >> 12;
+        _state ^= _state << 25;
+        _state ^= _state >> 27;
+        return (uint32_t)((_state * 0x2545F4914F6CDD1DULL) >> 32);
+    }
+
+    uint32_t below(uint32_t n) {
+        return next() % n;
+    }
+
+    /**
+     * Returns a random byte that is never zero.
+     */
+    uint8_t garbage() {
+        return (uint8_t)(below(255) + 1);
+    }
+};
+
+/**
+ * Appends the raw bytes of a value to a buffer.
+ */
+template<typename T>
+void put(std::vector<uint8_t>& buf, const T& value) {
+    const uint8_t* p = (const uint8_t*)&value;
+    buf.insert(buf.end(), p, p + sizeof(value));
+}
+
+/**
+ * Appends a string and its null terminator to a buffer.
+ */
+void putString(std::vector<uint8_t>& buf, const std::string& s) {
+    buf.insert(buf.end(), s.begin(), s.end());
+    buf.push_back(0);
+}
+
+/**
+ * Pads a buffer to a multiple of 4 bytes.
+ */
+void align(std::vector<uint8_t>& buf) {
+    while (buf.size() % 4 != 0)
+        buf.push_back(0);
+}
+
+/**
+ * Returns a random GUID string of the form
+ * "{xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx}".
+ */
+std::string randomGuid(Random& random) {
+    static const char digits[] = "0123456789ABCDEF";
+
+    std::string guid = "{";
+
+    for (size_t i = 0; i < 32; ++i) {
+        if (i == 8 || i == 12 || i == 16 || i == 20)
+            guid += '-';
+        guid += digits[random.below(16)];
+    }
+
+    guid += '}';
+    return guid;
+}
+
+/**
+ * A read-only stream that repeats a block of data after an optional prefix.
+ * The data is generated as it is read, so these streams take up no memory
+ * beyond the block itself.
+ */
+class PatternStream : public MsfStream {
+private:
+
+    std::vector<uint8_t> _prefix;
+    std::shared_ptr<const std::vector<uint8_t>> _block;
+    size_t _length;
+    size_t _pos;
+
+public:
+
+    PatternStream(const std::vector<uint8_t>& prefix,
+            std::shared_ptr<const std::vector<uint8_t>> block, size_t length)
+        : _prefix(prefix), _block(block), _length(length), _pos(0) {}
+
+    size_t length() const {
+        return _length;
+    }
+
+    size_t getPos() const {
+        return _pos;
+    }
+
+    void setPos(size_t p) {
+        _pos = std::min(p, _length);
+    }
+
+    size_t read(size_t length, void* buf) {
+        length = std::min(length, _length - _pos);
+
+        uint8_t* out = (uint8_t*)buf;
+
+        for (size_t n = length; n > 0; ) {
+            size_t count;
+
+            if (_pos < _prefix.size()) {
+                count = std::min(n, _prefix.size() - _pos);
+                memcpy(out, _prefix.data() + _pos, count);
+            }
+            else {
+                const size_t offset = (_pos - _prefix.size()) % _block->size();
+                count = std::min(n, _block->size() - offset);
+                memcpy(out, _block->data() + offset, count);
+            }
+
+            out += count;
+            _pos += count;
+            n -= count;
+        }
+
+        return length;
+    }
+
+    size_t read(void* buf) {
+        setPos(0);
+        return read(_length, buf);
+    }
+
+    size_t write(size_t length, const void* buf) {
+        return 0;
+    }
+};
+
+/**
+ * Generates a block of public symbol records of exactly `size` bytes. The
+ * sizes of the records are spread around `recordSize`. Each one has up to 2
+ * bytes of garbage padding after its name.
+ */
+std::vector<uint8_t> symbolRecords(Random& random, size_t size,
+        size_t recordSize) {
+
+    // Flags, offset, and segment of PUBSYM32.
+    static const size_t kFixedSize = 10;
+
+    recordSize = std::max<size_t>(16, std::min<size_t>(recordSize, 4096)) & ~3;
+
+    std::vector<uint8_t> block;
+    block.reserve(size);
+
+    while (block.size() < size) {
+        const size_t left = size - block.size();
+
+        // Pick a size between half and one and a half times the average.
+        size_t total = (recordSize / 2 + random.below(recordSize + 1)) & ~3;
+        total = std::max<size_t>(total, 16);
+
+        // The last record takes up the rest of the block.
+        if (left < total + 16)
+            total = left;
+
+        const size_t dataLength = total - sizeof(SymbolRecord);
+        const size_t padding = std::min<size_t>(random.below(3),
+                dataLength - kFixedSize - 2);
+        const size_t nameLength = dataLength - kFixedSize - padding - 1;
+
+        put(block, (uint16_t)(total - sizeof(uint16_t)));
+        put(block, (uint16_t)S_PUB32);
+
+        for (size_t i = 0; i < kFixedSize; ++i)
+            block.push_back((uint8_t)random.next());
+
+        for (size_t i = 0; i < nameLength; ++i)
+            block.push_back((uint8_t)('a' + random.below(26)));
+
+        block.push_back(0);
+
+        for (size_t i = 0; i < padding; ++i)
+            block.push_back(random.garbage());
+    }
+
+    return block;
+}
+
+/**
+ * Generates the PDB header stream with the table of named streams.
+ */
+std::vector<uint8_t> headerStream(uint32_t linkInfoStream,
+        uint32_t namesStream) {
+
+    std::vector<uint8_t> buf;
+
+    PdbStream70 header;
+    header.version = PdbVersion::vc70;
+    header.timestamp = kTimestamp;
+    header.age = kAge;
+    memcpy(header.sig70, kSignature, sizeof(header.sig70));
+    put(buf, header);
+
+    static const char strings[] = "/LinkInfo\0/names";
+
+    put(buf, (uint32_t)sizeof(strings));
+    buf.insert(buf.end(), strings, strings + sizeof(strings));
+
+    put(buf, (uint32_t)2);          // Number of elements
+    put(buf, (uint32_t)4);          // Capacity
+    put(buf, (uint32_t)1);          // Words in the "present" bitset
+    put(buf, (uint32_t)0x3);
+    put(buf, (uint32_t)0);          // Words in the "deleted" bitset
+    put(buf, (uint32_t)0);
+    put(buf, linkInfoStream);
+    put(buf, (uint32_t)10);
+    put(buf, namesStream);
+    put(buf, (uint32_t)0);
+
+    // Feature codes
+    put(buf, (uint32_t)PdbVersion::vc140);
+
+    return buf;
+}
+
+/**
+ * Generates the /LinkInfo stream. Like real ones, there is garbage after the
+ * strings.
+ */
+std::vector<uint8_t> linkInfoStream(Random& random) {
+
+    static const char cwd[] = "C:\\build";
+    static const char command[] = "link.exe /DEBUG /OUT:bench.dll";
+
+    LinkInfo info;
+    memset(&info, 0, sizeof(info));
+    info.version = 1;
+    info.cwdOffset = sizeof(info);
+    info.commandOffset = info.cwdOffset + sizeof(cwd);
+    info.outputFileOffset = 22;
+    info.libsOffset = info.commandOffset + sizeof(command);
+    info.size = info.libsOffset + 1;
+
+    std::vector<uint8_t> buf;
+    put(buf, info);
+    buf.insert(buf.end(), cwd, cwd + sizeof(cwd));
+    buf.insert(buf.end(), command, command + sizeof(command));
+    buf.push_back(0);
+
+    for (size_t i = 0; i < 64; ++i)
+        buf.push_back(random.garbage());
+
+    return buf;
+}
+
+/**
+ * Generates the /names string table. Some of the names contain GUIDs and the
+ * offsets are in no particular order.
+ */
+std::vector<uint8_t> namesStream(Random& random, size_t count) {
+
+    std::vector<uint8_t> strings(1, 0);
+    std::vector<uint32_t> offsets;
+    offsets.reserve(count);
+
+    for (size_t i = 0; i < count; ++i) {
+        offsets.push_back((uint32_t)strings.size());
+
+        std::string name = "C:\\src\\dir" + std::to_string(i % 97) +
+            "\\file" + std::to_string(i);
+
+        if (i % 8 == 0)
+            name += "." + randomGuid(random) + ".tmp";
+        else
+            name += ".h";
+
+        putString(strings, name);
+    }
+
+    // The offsets form a hash table with empty buckets in between.
+    const size_t buckets = count + count / 4 + 1;
+    std::vector<uint32_t> table(buckets, 0);
+
+    for (auto offset: offsets) {
+        size_t i = random.below((uint32_t)buckets);
+        while (table[i] != 0)
+            i = (i + 1) % buckets;
+        table[i] = offset;
+    }
+
+    StringTableHeader header;
+    header.signature = kHashTableSignature;
+    header.version = 1;
+    header.stringsSize = (uint32_t)strings.size();
+
+    std::vector<uint8_t> buf;
+    put(buf, header);
+    buf.insert(buf.end(), strings.begin(), strings.end());
+    put(buf, (uint32_t)buckets);
+
+    for (auto offset: table)
+        put(buf, offset);
+
+    put(buf, (uint32_t)count);
+
+    return buf;
+}
+
+/**
+ * Generates the module stream of the linker generated manifest. This has an
+ * object name with a GUID in it.
+ */
+std::vector<uint8_t> manifestStream(Random& random) {
+
+    const std::string name = "C:\\Users\\build\\AppData\\Local\\Temp\\lnk" +
+        randomGuid(random) + ".tmp";
+
+    std::vector<uint8_t> buf;
+    put(buf, (uint32_t)CV_SIGNATURE_C13);
+
+    const size_t start = buf.size();
+
+    put(buf, (uint16_t)0);
+    put(buf, (uint16_t)S_OBJNAME);
+    put(buf, (uint32_t)0);
+    putString(buf, name);
+    align(buf);
+
+    const uint16_t reclen = (uint16_t)(buf.size() - start - sizeof(uint16_t));
+    memcpy(&buf[start], &reclen, sizeof(reclen));
+
+    return buf;
+}
+
+/**
+ * Generates the DBI stream. `symbolsSizes` has the size of the symbols in each
+ * module stream.
+ */
+std::vector<uint8_t> dbiStream(Random& random,
+        const std::vector<uint32_t>& symbolsSizes,
+        uint16_t firstModuleStream, uint16_t symbolRecords,
+        uint16_t publicSymbols, uint16_t globalSymbols) {
+
+    const size_t moduleCount = symbolsSizes.size();
+
+    // Module info. The first module is the linker generated manifest.
+    std::vector<uint8_t> modules;
+
+    for (size_t i = 0; i < moduleCount; ++i) {
+        ModuleInfo info;
+        memset(&info, 0, sizeof(info));
+        info.sc.section = 1;
+        info.sc.padding1 = (uint16_t)random.next();
+        info.sc.padding2 = (uint16_t)random.next();
+        info.sc.offset = (int32_t)(i * 0x100);
+        info.sc.size = 0x100;
+        info.sc.imod = (uint16_t)i;
+        info.stream = (uint16_t)(firstModuleStream + i);
+        info.symbolsSize = symbolsSizes[i];
+        info.fileCount = 1;
+        info.offsets = random.next();
+        put(modules, info);
+
+        if (i == 0) {
+            putString(modules, "* Linker Generated Manifest RES *");
+            putString(modules, "");
+        }
+        else {
+            const std::string obj = "C:\\build\\obj\\module" +
+                std::to_string(i) + ".obj";
+            putString(modules, obj);
+            putString(modules, obj);
+        }
+
+        align(modules);
+    }
+
+    // Section contributions, with garbage in their padding.
+    std::vector<uint8_t> contribs;
+    put(contribs, SectionContribVersion::v1);
+
+    for (size_t i = 0; i < moduleCount; ++i) {
+        SectionContribution sc;
+        memset(&sc, 0, sizeof(sc));
+        sc.section = 1;
+        sc.padding1 = (uint16_t)random.next();
+        sc.offset = (int32_t)(i * 0x100);
+        sc.size = 0x100;
+        sc.imod = (uint16_t)i;
+        sc.padding2 = (uint16_t)random.next();
+        put(contribs, sc);
+    }
+
+    // File info. Each module has one source file. Some of the file names have
+    // GUIDs in them.
+    std::vector<uint8_t> files;
+    FileInfoHeader fileHeader = {0, (uint16_t)moduleCount};
+    put(files, fileHeader);
+
+    for (size_t i = 0; i < moduleCount; ++i)
+        put(files, (uint16_t)i);
+
+    for (size_t i = 0; i < moduleCount; ++i)
+        put(files, (uint16_t)1);
+
+    std::vector<uint8_t> fileNames;
+    for (size_t i = 0; i < moduleCount; ++i) {
+        put(files, (uint32_t)fileNames.size());
+
+        std::string name = "C:\\src\\module" + std::to_string(i);
+        if (i % 16 == 0)
+            name += randomGuid(random);
+        putString(fileNames, name + ".cpp");
+    }
+
+    files.insert(files.end(), fileNames.begin(), fileNames.end());
+    align(files);
+
+    DbiHeader header;
+    memset(&header, 0, sizeof(header));
+    header.signature = dbiHeaderSignature;
+    header.version = DbiVersion::v70;
+    header.age = kAge;
+    header.globalSymbolStream = globalSymbols;
+    header.publicSymbolStream = publicSymbols;
+    header.symbolRecordsStream = symbolRecords;
+    header.gpModInfoSize = (uint32_t)modules.size();
+    header.sectionContributionSize = (uint32_t)contribs.size();
+    header.fileInfoSize = (uint32_t)files.size();
+    header.machine = 0x8664;
+
+    std::vector<uint8_t> buf;
+    put(buf, header);
+    buf.insert(buf.end(), modules.begin(), modules.end());
+    buf.insert(buf.end(), contribs.begin(), contribs.end());
+    buf.insert(buf.end(), files.begin(), files.end());
+
+    return buf;
+}
+
+/**
+ * Generates the public symbols stream. The header has garbage in the fields
+ * that Ducible patches.
+ */
+std::vector<uint8_t> publicSymbolStream(Random& random) {
+
+    PublicSymbolHeader header;
+    memset(&header, 0, sizeof(header));
+    header.hashTableSize = sizeof(GsiHashHeader);
+    header.padding1 = (uint16_t)random.next();
+    header.sectionCount = random.next();
+
+    GsiHashHeader hash = {gsiHashSignature, gsiHashVersion, 0, 0};
+
+    std::vector<uint8_t> buf;
+    put(buf, header);
+    put(buf, hash);
+    return buf;
+}
+
+/**
+ * Adds a stream holding a copy of the given buffer.
+ */
+size_t addStream(MsfFile& msf, const std::vector<uint8_t>& buf) {
+    return msf.addStream(new MsfMemoryStream(buf.size(), buf.data()));
+}
+
+}
+
+void generatePdb(FileRef f, const GeneratorOptions& options,
+        CV_INFO_PDB70& pdbInfo) {
+
+    Random random(0x9e3779b97f4a7c15ULL);
+
+    // Split the size between the symbol records stream and the module
+    // streams.
+    uint64_t symbolsSize = options.size * options.symbolPercent / 100;
+    symbolsSize = std::min(symbolsSize, kMaxStreamSize);
+
+    // If there is too little space for a meaningful block of symbol records,
+    // the symbol records stream is left empty.
+    size_t blockSize = (size_t)std::min<uint64_t>(kBlockSize,
+            symbolsSize & ~3ULL);
+    if (blockSize < 64) {
+        blockSize = 0;
+        symbolsSize = 0;
+    }
+
+    const uint64_t bulkSize = options.size - std::min(options.size,
+            symbolsSize);
+
+    size_t streams = std::max<size_t>(options.streams, 1);
+    streams = std::max<size_t>(streams,
+            (size_t)((bulkSize + kMaxStreamSize - 1) / kMaxStreamSize));
+
+    // Module stream indices are 16-bit.
+    if (streams > 0xF000)
+        throw InvalidMsf("too many module streams");
+
+    auto block = std::make_shared<std::vector<uint8_t>>(
+        symbolRecords(random, blockSize ? blockSize : kBlockSize,
+            options.recordSize));
+
+    // Stream indices of the streams that are referenced by other streams.
+    const uint32_t linkInfoIndex = 5;
+    const uint32_t namesIndex = 6;
+    const uint16_t symbolRecordsIndex = 7;
+    const uint16_t publicsIndex = 8;
+    const uint16_t globalsIndex = 9;
+    const uint16_t firstModuleIndex = 10;
+
+    const std::vector<uint8_t> manifest = manifestStream(random);
+
+    std::vector<uint8_t> modulePrefix;
+    put(modulePrefix, (uint32_t)CV_SIGNATURE_C13);
+
+    const size_t moduleLength = (size_t)(bulkSize / streams) & ~(size_t)3;
+
+    // The symbols of a module stream end after the last whole block of
+    // symbol records in it. The linker generated manifest is an additional
+    // module.
+    std::vector<uint32_t> symbolsSizes(1, (uint32_t)manifest.size());
+    for (size_t i = 0; i < streams; ++i) {
+        size_t symbols = 0;
+        if (moduleLength >= modulePrefix.size()) {
+            symbols = modulePrefix.size() + (moduleLength -
+                modulePrefix.size()) / block->size() * block->size();
+        }
+        symbolsSizes.push_back((uint32_t)symbols);
+    }
+
+    // Leave some room for the streams other than the bulk, the free page maps,
+    // and the partially filled last page of each stream.
+    size_t pageSize = options.pageSize;
+    if (pageSize == 0) {
+        const uint64_t needed = options.size + options.size / 64 +
+            (uint64_t)(streams + 16) * kMsfMaxPageSize + 16 * 1024 * 1024;
+
+        pageSize = kMsfDefaultPageSize;
+        while (pageSize < kMsfMaxPageSize &&
+               (uint64_t)pageSize * kMsfMaxPageCount < needed)
+            pageSize *= 2;
+    }
+
+    MsfFile msf;
+    msf.setPageSize(pageSize);
+
+    msf.addStream(nullptr);
+    addStream(msf, headerStream(linkInfoIndex, namesIndex));
+    addStream(msf, std::vector<uint8_t>());
+    addStream(msf, dbiStream(random, symbolsSizes, firstModuleIndex,
+                symbolRecordsIndex, publicsIndex, globalsIndex));
+    addStream(msf, std::vector<uint8_t>());
+    addStream(msf, linkInfoStream(random));
+    addStream(msf, namesStream(random, options.names));
+
+    const std::vector<uint8_t> noPrefix;
+
+    msf.addStream(new PatternStream(noPrefix, block,
+                blockSize ? (size_t)(symbolsSize / blockSize * blockSize) : 0));
+
+    addStream(msf, publicSymbolStream(random));
+
+    std::vector<uint8_t> globals;
+    GsiHashHeader hash = {gsiHashSignature, gsiHashVersion, 0, 0};
+    put(globals, hash);
+    addStream(msf, globals);
+
+    addStream(msf, manifest);
+
+    for (size_t i = 0; i < streams; ++i)
+        msf.addStream(new PatternStream(modulePrefix, block, moduleLength));
+
+    msf.write(f);
+
+    memset(&pdbInfo, 0, sizeof(pdbInfo));
+    pdbInfo.CvSignature = 0x53445352; // "RSDS"
+    memcpy(pdbInfo.Signature, kSignature, sizeof(pdbInfo.Signature));
+    pdbInfo.Age = kAge;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Generates synthetic PDBs for benchmarking.
+ *
+ * The PDBs have all the streams that Ducible patches, with the same kinds of
+ * non-determinism found in real PDBs: garbage in struct and symbol record
+ * padding, GUIDs in file names, an unsorted /names offset array, and garbage at
+ * the end of the /LinkInfo stream. The bulk of the file is made up of module
+ * streams and the symbol records stream, whose contents are generated as they
+ * are written such that PDBs much larger than the available memory can be
+ * created.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h> // For size_t
+
+#include "pe/format.h"
+#include "util/file.h"
+
+/**
+ * Parameters of a generated PDB.
+ */
+struct GeneratorOptions {
+    // Approximate total size of the PDB, in bytes.
+    uint64_t size;
+
+    // Number of module streams the bulk of the PDB is divided into. More are
+    // used if needed to keep each stream below 4 GB.
+    size_t streams;
+
+    // Percentage of the size taken up by the symbol records stream.
+    unsigned symbolPercent;
+
+    // Average size of a symbol record, in bytes. Smaller records mean more of
+    // them need to be patched per byte.
+    size_t recordSize;
+
+    // Number of strings in the /names stream.
+    size_t names;
+
+    // Page size of the PDB. If 0, the smallest page size of at least 4096
+    // bytes that can hold all of the PDB is used.
+    size_t pageSize;
+
+    GeneratorOptions()
+        : size(256 * 1024 * 1024), streams(64), symbolPercent(25),
+          recordSize(32), names(100000), pageSize(0)
+    {}
+};
+
+/**
+ * Writes a synthetic PDB to the given file.
+ *
+ * Params:
+ *   f       = The file to write the PDB to.
+ *   options = Parameters of the PDB.
+ *   pdbInfo = Receives the PDB information that an image linked with this PDB
+ *             would have. This is needed to patch the PDB.
+ */
+void generatePdb(FileRef f, const GeneratorOptions& options,
+        CV_INFO_PDB70& pdbInfo);
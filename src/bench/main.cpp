@@ -0,0 +1,439 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Benchmarks patching of large PDBs.
+ *
+ * A synthetic PDB is generated once and then patched repeatedly. The time
+ * spent in each phase is measured for every run such that the variation
+ * between runs can be reported along with the typical time.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "bench/generator.h"
+
+#include "ducible/patch_pdb.h"
+
+#include "msf/format.h"
+#include "msf/msf.h"
+#include "pdb/pdb.h"
+
+#include "util/arena.h"
+#include "util/file.h"
+#include "util/memmap.h"
+#include "util/stats.h"
+#include "util/thread_pool.h"
+
+namespace {
+
+/**
+ * Thrown when there is an error parsing the command line options.
+ */
+class InvalidCommandLine
+{
+private:
+    std::string _why;
+
+public:
+
+    InvalidCommandLine(const std::string& why) : _why(why) {}
+
+    const std::string& why() const {
+        return _why;
+    }
+};
+
+/**
+ * Thrown when help is requested from the command line.
+ */
+class CommandLineHelp {
+};
+
+/**
+ * Parses a non-negative integer with an optional K, M, or G suffix.
+ */
+uint64_t parseSize(const std::string& arg) {
+    if (arg.empty() || arg.front() < '0' || arg.front() > '9')
+        throw InvalidCommandLine("Expected a non-negative integer");
+
+    size_t pos = 0;
+    uint64_t n;
+
+    try {
+        n = std::stoull(arg, &pos);
+    }
+    catch (const std::logic_error&) {
+        throw InvalidCommandLine("Expected a non-negative integer");
+    }
+
+    const std::string suffix = arg.substr(pos);
+
+    if (suffix == "K" || suffix == "k")
+        n *= 1024;
+    else if (suffix == "M" || suffix == "m")
+        n *= 1024 * 1024;
+    else if (suffix == "G" || suffix == "g")
+        n *= 1024 * 1024 * 1024;
+    else if (!suffix.empty())
+        throw InvalidCommandLine("Unknown size suffix '" + suffix + "'");
+
+    return n;
+}
+
+/**
+ * Command line options.
+ */
+struct CommandOptions
+{
+    GeneratorOptions generator;
+    const char* pdb;
+    size_t iterations;
+    size_t warmup;
+    size_t jobs;
+    bool keep;
+    bool normalizeModules;
+    bool normalizeTypes;
+
+    CommandOptions()
+        : pdb("ducible-bench.pdb"), iterations(5), warmup(1), jobs(0),
+          keep(false), normalizeModules(false), normalizeTypes(false) {}
+
+    /**
+     * Parses the command line arguments.
+     */
+    void parse(int argc, char** argv) {
+
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+
+            if (arg == "--help" || arg == "-h")
+                throw CommandLineHelp();
+
+            if (arg == "--keep") {
+                keep = true;
+                continue;
+            }
+
+            if (arg == "--normalize-modules") {
+                normalizeModules = true;
+                continue;
+            }
+
+            if (arg == "--normalize-types") {
+                normalizeTypes = true;
+                continue;
+            }
+
+            if (arg.empty() || arg.front() != '-')
+                throw InvalidCommandLine("Unexpected argument '" + arg + "'");
+
+            if (i + 1 >= argc)
+                throw InvalidCommandLine("Missing value for " + arg);
+
+            const std::string value = argv[++i];
+
+            if (arg == "--size")
+                generator.size = parseSize(value);
+            else if (arg == "--streams")
+                generator.streams = (size_t)parseSize(value);
+            else if (arg == "--symbols")
+                generator.symbolPercent = (unsigned)std::min<uint64_t>(
+                        parseSize(value), 100);
+            else if (arg == "--record-size")
+                generator.recordSize = (size_t)parseSize(value);
+            else if (arg == "--names")
+                generator.names = (size_t)parseSize(value);
+            else if (arg == "--page-size") {
+                generator.pageSize = (size_t)parseSize(value);
+                if (!isValidPageSize(generator.pageSize))
+                    throw InvalidCommandLine(
+                        "Page size must be a power of 2 from 512 to 65536");
+            }
+            else if (arg == "--iterations" || arg == "-i")
+                iterations = std::max<size_t>((size_t)parseSize(value), 1);
+            else if (arg == "--warmup")
+                warmup = (size_t)parseSize(value);
+            else if (arg == "--jobs" || arg == "-j")
+                jobs = (size_t)parseSize(value);
+            else if (arg == "--pdb")
+                pdb = argv[i];
+            else
+                throw InvalidCommandLine("Unknown option '" + arg + "'");
+        }
+    }
+};
+
+const char* usage =
+    "Usage: bench [--size SIZE] [--streams N] [--symbols PERCENT]\n"
+    "             [--record-size N] [--names N] [--page-size N]\n"
+    "             [--iterations N] [--warmup N] [--jobs N] [--pdb PATH]\n"
+    "             [--keep] [--normalize-modules] [--normalize-types]";
+
+const char* help =
+R"(
+Generates a synthetic PDB and measures how long it takes to patch it.
+
+The PDB is patched repeatedly. For each phase, the fastest, median, and mean
+time over all the runs are printed, along with the standard deviation. The
+first --warmup runs are not counted so that the file is in the page cache.
+
+Optional arguments:
+  --help, -h    Prints this help.
+  --size SIZE   Approximate size of the PDB. K, M, and G suffixes are
+                accepted. Defaults to 256M.
+  --streams N   Number of module streams. Defaults to 64.
+  --symbols PERCENT
+                Percentage of the PDB taken up by symbol records. Defaults
+                to 25.
+  --record-size N
+                Average size of a symbol record in bytes. Defaults to 32.
+  --names N     Number of strings in the /names stream. Defaults to 100000.
+  --page-size N Page size of the PDB. By default, the smallest page size of at
+                least 4K that can hold the whole PDB is used.
+  --iterations, -i N
+                Number of runs that are measured. Defaults to 5.
+  --warmup N    Number of runs before those. Defaults to 1.
+  --jobs, -j N  Maximum number of threads to use. By default, the number of
+                hardware threads is used.
+  --pdb PATH    Where to write the PDB. Defaults to ducible-bench.pdb.
+  --keep        Don't delete the PDB when done.
+  --normalize-modules
+                Also normalize the symbols of every module stream.
+  --normalize-types
+                Also normalize the type and ID info streams. These are empty
+                in the generated PDB.
+)";
+
+/**
+ * Timestamp and signature to patch the PDB with.
+ */
+const uint32_t kTimestamp = 1262304000;
+
+const uint8_t kSignature[16] = {
+    0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88,
+    0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00,
+};
+
+/**
+ * Statistics of the samples of a phase, in milliseconds.
+ */
+struct Summary {
+    double min;
+    double median;
+    double mean;
+    double stddev;
+};
+
+Summary summarize(std::vector<double> samples) {
+    Summary s;
+
+    std::sort(samples.begin(), samples.end());
+
+    const size_t n = samples.size();
+
+    s.min = samples.front();
+    s.median = (n % 2) ? samples[n / 2] :
+        (samples[n / 2 - 1] + samples[n / 2]) / 2;
+
+    double sum = 0;
+    for (auto x: samples)
+        sum += x;
+    s.mean = sum / n;
+
+    double squares = 0;
+    for (auto x: samples)
+        squares += (x - s.mean) * (x - s.mean);
+    s.stddev = n > 1 ? std::sqrt(squares / (n - 1)) : 0;
+
+    return s;
+}
+
+/**
+ * Patches the PDB once, writing the result to `outPath`.
+ */
+void patchOnce(const char* pdbPath, const char* outPath,
+        const CV_INFO_PDB70& pdbInfo, const CommandOptions& opts,
+        ThreadPool& pool) {
+
+    PhaseTimer timer("total");
+
+    Arena arena;
+
+    MsfFile msf(openFile(pdbPath, FileMode<char>::readExisting), &arena);
+
+    if (isPatchedPdb(msf, &pdbInfo, kTimestamp, kSignature))
+        throw InvalidPdb("generated PDB is already patched");
+
+    patchPDB(msf, &pdbInfo, kTimestamp, kSignature, pool,
+            opts.normalizeModules, opts.normalizeTypes);
+
+    msf.write(openFile(outPath, FileMode<char>::readWriteEmpty), &pool);
+}
+
+int bench(const CommandOptions& opts) {
+
+    const std::string outPath = std::string(opts.pdb) + ".out";
+
+    CV_INFO_PDB70 pdbInfo;
+
+    {
+        std::cout << "Generating " << opts.pdb << "..." << std::flush;
+
+        const auto start = std::chrono::steady_clock::now();
+
+        generatePdb(openFile(opts.pdb, FileMode<char>::readWriteEmpty),
+                opts.generator, pdbInfo);
+
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        std::cout << " done in " << std::fixed << std::setprecision(1)
+            << elapsed.count() << " s\n";
+    }
+
+    const uint64_t pdbSize = MemMap(opts.pdb).length();
+    const size_t pageSize =
+        MsfFile(openFile(opts.pdb, FileMode<char>::readExisting)).pageSize();
+
+    std::cout << "PDB size: " << pdbSize / (1024 * 1024) << " MiB, "
+        << "page size: " << pageSize << ", "
+        << "module streams: " << opts.generator.streams << ", "
+        << "symbol records: " << opts.generator.symbolPercent << "%, "
+        << "names: " << opts.generator.names << "\n";
+
+    ThreadPool pool(opts.jobs);
+
+    enableStats();
+
+    // Samples of each phase in milliseconds, in the order the phases were
+    // first seen.
+    std::vector<std::string> names;
+    std::map<std::string, std::vector<double>> samples;
+
+    for (size_t i = 0; i < opts.warmup + opts.iterations; ++i) {
+
+        resetStats();
+
+        patchOnce(opts.pdb, outPath.c_str(), pdbInfo, opts, pool);
+
+        if (i < opts.warmup)
+            continue;
+
+        for (auto&& phase: getPhaseStats()) {
+            auto& s = samples[phase.name];
+            if (s.empty())
+                names.push_back(phase.name);
+            s.push_back(phase.nanoseconds / 1e6);
+        }
+    }
+
+    // The phase column is as wide as the longest phase name.
+    size_t width = std::string("Phase").size();
+    for (auto&& name: names)
+        width = std::max(width, name.size());
+
+    std::cout << "\n" << opts.iterations << " runs with " << pool.threads()
+        << " threads:\n\n"
+        << std::left << std::setw(width) << "Phase" << std::right
+        << "    Min (ms)  Median (ms)    Mean (ms)   Stddev\n";
+
+    for (auto&& name: names) {
+        const auto& s = samples[name];
+
+        // Phases that didn't happen in every run can't be compared.
+        if (s.size() != opts.iterations)
+            continue;
+
+        const Summary summary = summarize(s);
+
+        std::cout << std::left << std::setw(width) << name << std::right
+            << std::fixed << std::setprecision(3)
+            << std::setw(12) << summary.min
+            << std::setw(13) << summary.median
+            << std::setw(13) << summary.mean
+            << std::setw(8) << std::setprecision(1)
+            << (summary.mean > 0 ? 100 * summary.stddev / summary.mean : 0)
+            << "%\n";
+    }
+
+    const auto& total = samples["total"];
+    if (!total.empty()) {
+        const double median = summarize(total).median;
+        std::cout << "\nThroughput: " << std::fixed << std::setprecision(1)
+            << (pdbSize / (1024.0 * 1024.0)) / (median / 1000) << " MiB/s\n";
+    }
+
+    deleteFile(outPath.c_str());
+
+    if (!opts.keep)
+        deleteFile(opts.pdb);
+
+    return 0;
+}
+
+}
+
+int main(int argc, char** argv) {
+
+    CommandOptions opts;
+
+    try {
+        opts.parse(argc, argv);
+    }
+    catch (const InvalidCommandLine& error) {
+        std::cout << "Error parsing arguments: " << error.why() << std::endl;
+        std::cout << usage << std::endl;
+        return 1;
+    }
+    catch (const CommandLineHelp&) {
+        std::cout << usage << std::endl;
+        std::cout << help;
+        return 0;
+    }
+
+    try {
+        return bench(opts);
+    }
+    catch (const InvalidMsf& error) {
+        std::cerr << "Error: Invalid PDB MSF format (" << error.why() << ")\n";
+    }
+    catch (const InvalidPdb& error) {
+        std::cerr << "Error: Invalid PDB format (" << error.why() << ")\n";
+    }
+    catch (const std::system_error& error) {
+        std::cerr << "Error: " << error.what() << "\n";
+    }
+
+    return 1;
+}
@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ducible/batch.h"
+
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <sstream>
+#include <system_error>
+
+#include "pe/pe.h"
+#include "msf/msf.h"
+#include "pdb/pdb.h"
+
+#include "util/thread_pool.h"
+
+namespace {
+
+/**
+ * Streams for the appropriate character type.
+ */
+template<typename CharT>
+struct Console {};
+
+template<>
+struct Console<char> {
+    static std::istream& in() { return std::cin; }
+    static std::ostream& out() { return std::cout; }
+};
+
+template<>
+struct Console<wchar_t> {
+    static std::wistream& in() { return std::wcin; }
+    static std::wostream& out() { return std::wcout; }
+};
+
+/**
+ * Splits a line into whitespace separated words. Double quotes can be used
+ * around words that contain spaces.
+ */
+template<typename CharT>
+std::vector<std::basic_string<CharT>> splitWords(
+        const std::basic_string<CharT>& line) {
+
+    std::vector<std::basic_string<CharT>> words;
+
+    size_t i = 0;
+    while (i < line.length()) {
+        if (line[i] == ' ' || line[i] == '\t' || line[i] == '\r') {
+            ++i;
+            continue;
+        }
+
+        std::basic_string<CharT> word;
+
+        if (line[i] == '"') {
+            const size_t end = line.find('"', i + 1);
+            if (end == std::basic_string<CharT>::npos)
+                throw InvalidBatch("unterminated quote");
+
+            word = line.substr(i + 1, end - i - 1);
+            i = end + 1;
+        }
+        else {
+            while (i < line.length() && line[i] != ' ' && line[i] != '\t' &&
+                    line[i] != '\r') {
+                word.push_back(line[i]);
+                ++i;
+            }
+        }
+
+        words.push_back(word);
+    }
+
+    return words;
+}
+
+template<typename CharT>
+std::vector<BatchItem<CharT>> readBatchImpl(std::basic_istream<CharT>& is) {
+
+    std::vector<BatchItem<CharT>> batch;
+
+    std::basic_string<CharT> line;
+    size_t lineNumber = 0;
+
+    while (std::getline(is, line)) {
+        ++lineNumber;
+
+        const size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::basic_string<CharT>::npos || line[first] == '#')
+            continue;
+
+        try {
+            auto words = splitWords(line);
+            if (words.size() > 2)
+                throw InvalidBatch("expected 'image [pdb]'");
+
+            BatchItem<CharT> item;
+            item.image = words[0];
+            if (words.size() == 2)
+                item.pdb = words[1];
+
+            batch.push_back(item);
+        }
+        catch (const InvalidBatch& error) {
+            std::ostringstream ss;
+            ss << "line " << lineNumber << ": " << error.why();
+            throw InvalidBatch(ss.str());
+        }
+    }
+
+    return batch;
+}
+
+template<typename CharT>
+std::vector<BatchItem<CharT>> readBatchImpl(const CharT* path) {
+
+    if (path[0] == '-' && path[1] == 0)
+        return readBatchImpl(Console<CharT>::in());
+
+    std::basic_ifstream<CharT> f(path);
+    if (!f)
+        throw InvalidBatch("failed to open batch file");
+
+    return readBatchImpl<CharT>(f);
+}
+
+template<typename CharT>
+std::string tryPatchImageImpl(const CharT* imagePath, const CharT* pdbPath,
+        const PatchOptions& options) {
+
+    try {
+        patchImage(imagePath, pdbPath, options);
+    }
+    catch (const InvalidImage& error) {
+        return std::string("Invalid image (") + error.why() + ")";
+    }
+    catch (const InvalidMsf& error) {
+        return std::string("Invalid PDB MSF format (") + error.why() + ")";
+    }
+    catch (const InvalidPdb& error) {
+        return std::string("Invalid PDB format (") + error.why() + ")";
+    }
+    catch (const std::system_error& error) {
+        return error.what();
+    }
+
+    return std::string();
+}
+
+template<typename CharT>
+size_t patchBatchImpl(const std::vector<BatchItem<CharT>>& batch,
+        const PatchOptions& options, size_t jobs) {
+
+    // The images are patched in parallel instead of the streams of each PDB.
+    PatchOptions itemOptions = options;
+    itemOptions.jobs = 1;
+
+    ThreadPool pool(jobs);
+
+    std::vector<std::future<std::string>> results;
+
+    for (auto&& item: batch) {
+        results.push_back(pool.submit([&item, &itemOptions]() {
+            return tryPatchImageImpl(item.image.c_str(),
+                item.pdb.empty() ? NULL : item.pdb.c_str(), itemOptions);
+        }));
+    }
+
+    auto& out = Console<CharT>::out();
+
+    size_t failures = 0;
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+        const std::string error = results[i].get();
+
+        if (error.empty()) {
+            out << "ok: " << batch[i].image << std::endl;
+        }
+        else {
+            out << "error: " << batch[i].image << ": " << error.c_str()
+                << std::endl;
+            ++failures;
+        }
+    }
+
+    return failures;
+}
+
+}
+
+#if defined(_WIN32) && defined(UNICODE)
+
+std::vector<BatchEntry> readBatch(const wchar_t* path) {
+    return readBatchImpl(path);
+}
+
+std::string tryPatchImage(const wchar_t* imagePath, const wchar_t* pdbPath,
+        const PatchOptions& options) {
+    return tryPatchImageImpl(imagePath, pdbPath, options);
+}
+
+#else
+
+std::vector<BatchEntry> readBatch(const char* path) {
+    return readBatchImpl(path);
+}
+
+std::string tryPatchImage(const char* imagePath, const char* pdbPath,
+        const PatchOptions& options) {
+    return tryPatchImageImpl(imagePath, pdbPath, options);
+}
+
+#endif
+
+size_t patchBatch(const std::vector<BatchEntry>& batch,
+        const PatchOptions& options, size_t jobs) {
+    return patchBatchImpl(batch, options, jobs);
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "ducible/patch_image.h"
+
+/**
+ * Thrown when a batch file is invalid.
+ */
+class InvalidBatch
+{
+private:
+    std::string _why;
+
+public:
+
+    InvalidBatch(const std::string& why) : _why(why) {}
+
+    const std::string& why() const {
+        return _why;
+    }
+};
+
+/**
+ * An image and its PDB to patch as part of a batch.
+ */
+template<typename CharT>
+struct BatchItem {
+    std::basic_string<CharT> image;
+
+    // Empty if there is no PDB.
+    std::basic_string<CharT> pdb;
+};
+
+#if defined(_WIN32) && defined(UNICODE)
+
+typedef BatchItem<wchar_t> BatchEntry;
+
+/**
+ * Reads the list of images to patch. Each non-empty line has the form
+ * `image [pdb]`. Paths that contain spaces must be in double quotes. Lines
+ * starting with '#' are ignored. If the path is "-", the list is read from
+ * standard input.
+ */
+std::vector<BatchEntry> readBatch(const wchar_t* path);
+
+/**
+ * Patches an image, like patchImage, but returns a description of the error
+ * instead of throwing. Returns an empty string on success.
+ */
+std::string tryPatchImage(const wchar_t* imagePath, const wchar_t* pdbPath,
+        const PatchOptions& options);
+
+#else
+
+typedef BatchItem<char> BatchEntry;
+
+std::vector<BatchEntry> readBatch(const char* path);
+
+std::string tryPatchImage(const char* imagePath, const char* pdbPath,
+        const PatchOptions& options);
+
+#endif
+
+/**
+ * Patches all images in the batch using up to `jobs` threads (0 means the
+ * number of hardware threads). The result is printed for each image in the
+ * order given. Returns the number of images that failed.
+ */
+size_t patchBatch(const std::vector<BatchEntry>& batch,
+        const PatchOptions& options, size_t jobs);
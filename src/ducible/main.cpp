@@ -20,18 +20,22 @@
  * SOFTWARE.
  */
 
+#include <fstream>
 #include <iostream>
 #include <system_error>
 #include <stdlib.h>
 #include <vector>
 #include <string>
 
+#include "ducible/batch.h"
+#include "ducible/manifest.h"
 #include "ducible/patch_image.h"
+#include "ducible/server.h"
 
-#include "pe/pe.h"
-#include "msf/msf.h"
-#include "pdb/format.h"
-#include "pdb/pdb.h"
+#include "msf/format.h"
+
+#include "util/async_io.h"
+#include "util/stats.h"
 
 #include "version.h"
 
@@ -95,6 +99,25 @@ struct OptionNames<char> {
     const char* versionLong = "--version";
     const char* dryrunLong  = "--dryrun";
     const char* dryrunShort = "-n";
+    const char* jobsLong    = "--jobs";
+    const char* jobsShort   = "-j";
+    const char* hashLong    = "--hash";
+    const char* hashChunkLong = "--hash-chunk-size";
+    const char* batchLong   = "--batch";
+    const char* serveLong   = "--serve";
+    const char* connectLong = "--connect";
+    const char* cacheLong   = "--cache";
+    const char* cacheSizeLong = "--cache-size";
+    const char* pageSizeLong = "--page-size";
+    const char* compactLong = "--compact";
+    const char* normalizeModulesLong = "--normalize-modules";
+    const char* normalizeTypesLong = "--normalize-types";
+    const char* syncIoLong  = "--sync-io";
+    const char* fingerprintLong = "--fingerprint";
+    const char* manifestLong = "--manifest";
+    const char* statsLong   = "--stats";
+    const char* statsJsonLong = "--stats-json";
+    const char* traceLong   = "--trace";
     const char* dashDash    = "--";
 };
 
@@ -105,9 +128,48 @@ struct OptionNames<wchar_t> {
     const wchar_t* versionLong = L"--version";
     const wchar_t* dryrunLong  = L"--dryrun";
     const wchar_t* dryrunShort = L"-n";
+    const wchar_t* jobsLong    = L"--jobs";
+    const wchar_t* jobsShort   = L"-j";
+    const wchar_t* hashLong    = L"--hash";
+    const wchar_t* hashChunkLong = L"--hash-chunk-size";
+    const wchar_t* batchLong   = L"--batch";
+    const wchar_t* serveLong   = L"--serve";
+    const wchar_t* connectLong = L"--connect";
+    const wchar_t* cacheLong   = L"--cache";
+    const wchar_t* cacheSizeLong = L"--cache-size";
+    const wchar_t* pageSizeLong = L"--page-size";
+    const wchar_t* compactLong = L"--compact";
+    const wchar_t* normalizeModulesLong = L"--normalize-modules";
+    const wchar_t* normalizeTypesLong = L"--normalize-types";
+    const wchar_t* syncIoLong  = L"--sync-io";
+    const wchar_t* fingerprintLong = L"--fingerprint";
+    const wchar_t* manifestLong = L"--manifest";
+    const wchar_t* statsLong   = L"--stats";
+    const wchar_t* statsJsonLong = L"--stats-json";
+    const wchar_t* traceLong   = L"--trace";
     const wchar_t* dashDash    = L"--";
 };
 
+/**
+ * Parses a non-negative integer from a command line argument.
+ */
+template<typename CharT>
+size_t parseCount(const std::basic_string<CharT>& arg) {
+    if (arg.empty() || arg.front() < '0' || arg.front() > '9')
+        throw InvalidCommandLine("Expected a non-negative integer");
+
+    try {
+        size_t pos = 0;
+        const unsigned long n = std::stoul(arg, &pos);
+        if (pos != arg.length())
+            throw InvalidCommandLine("Expected a non-negative integer");
+        return (size_t)n;
+    }
+    catch (const std::logic_error&) {
+        throw InvalidCommandLine("Expected a non-negative integer");
+    }
+}
+
 /**
  * Command line options.
  */
@@ -122,9 +184,34 @@ public:
 
     const CharT* image;
     const CharT* pdb;
+    const CharT* batch;
+    const CharT* serve;
+    const CharT* connect;
+    const CharT* cache;
+    uint64_t cacheSize;
+    const CharT* statsJson;
+    const CharT* trace;
+    const CharT* manifest;
+    bool stats;
     bool dryrun;
-
-    CommandOptions() : image(NULL), pdb(NULL), dryrun(false) {}
+    size_t jobs;
+    HashAlgorithm hash;
+    size_t hashChunkSize;
+    size_t pageSize;
+    bool compact;
+    bool normalizeModules;
+    bool normalizeTypes;
+    bool syncIo;
+    bool fingerprint;
+
+    CommandOptions()
+        : image(NULL), pdb(NULL), batch(NULL), serve(NULL), connect(NULL),
+          cache(NULL), cacheSize(kDefaultCacheSize), statsJson(NULL),
+          trace(NULL), manifest(NULL),
+          stats(false), dryrun(false), jobs(0),
+          hash(HashAlgorithm::md5), hashChunkSize(0), pageSize(0),
+          compact(false), normalizeModules(false), normalizeTypes(false),
+          syncIo(false), fingerprint(false) {}
 
     /**
      * Parses the command line arguments.
@@ -171,6 +258,101 @@ public:
             else if (arg == opt.dryrunLong || arg == opt.dryrunShort) {
                 dryrun = true;
             }
+            else if (arg == opt.jobsLong || arg == opt.jobsShort) {
+                if (i + 1 >= argc)
+                    throw InvalidCommandLine("Missing value for --jobs");
+
+                jobs = parseCount(string(argv[++i]));
+            }
+            else if (arg == opt.hashLong) {
+                if (i + 1 >= argc)
+                    throw InvalidCommandLine("Missing value for --hash");
+
+                if (!parseHashAlgorithm(argv[++i], hash))
+                    throw InvalidCommandLine("Unknown hash algorithm");
+            }
+            else if (arg == opt.hashChunkLong) {
+                if (i + 1 >= argc)
+                    throw InvalidCommandLine(
+                            "Missing value for --hash-chunk-size");
+
+                hashChunkSize = parseCount(string(argv[++i]));
+            }
+            else if (arg == opt.batchLong) {
+                if (i + 1 >= argc)
+                    throw InvalidCommandLine("Missing value for --batch");
+
+                batch = argv[++i];
+            }
+            else if (arg == opt.serveLong) {
+                if (i + 1 >= argc)
+                    throw InvalidCommandLine("Missing value for --serve");
+
+                serve = argv[++i];
+            }
+            else if (arg == opt.connectLong) {
+                if (i + 1 >= argc)
+                    throw InvalidCommandLine("Missing value for --connect");
+
+                connect = argv[++i];
+            }
+            else if (arg == opt.statsLong) {
+                stats = true;
+            }
+            else if (arg == opt.statsJsonLong) {
+                if (i + 1 >= argc)
+                    throw InvalidCommandLine("Missing value for --stats-json");
+
+                statsJson = argv[++i];
+            }
+            else if (arg == opt.traceLong) {
+                if (i + 1 >= argc)
+                    throw InvalidCommandLine("Missing value for --trace");
+
+                trace = argv[++i];
+            }
+            else if (arg == opt.cacheLong) {
+                if (i + 1 >= argc)
+                    throw InvalidCommandLine("Missing value for --cache");
+
+                cache = argv[++i];
+            }
+            else if (arg == opt.cacheSizeLong) {
+                if (i + 1 >= argc)
+                    throw InvalidCommandLine("Missing value for --cache-size");
+
+                cacheSize = parseCount(string(argv[++i])) * 1024 * 1024;
+            }
+            else if (arg == opt.pageSizeLong) {
+                if (i + 1 >= argc)
+                    throw InvalidCommandLine("Missing value for --page-size");
+
+                pageSize = parseCount(string(argv[++i]));
+                if (!isValidPageSize(pageSize))
+                    throw InvalidCommandLine(
+                            "Page size must be a power of 2 from 512 to 65536");
+            }
+            else if (arg == opt.compactLong) {
+                compact = true;
+            }
+            else if (arg == opt.normalizeModulesLong) {
+                normalizeModules = true;
+            }
+            else if (arg == opt.normalizeTypesLong) {
+                normalizeTypes = true;
+            }
+            else if (arg == opt.syncIoLong) {
+                syncIo = true;
+            }
+            else if (arg == opt.fingerprintLong) {
+                fingerprint = true;
+            }
+            else if (arg == opt.manifestLong) {
+                if (i + 1 >= argc)
+                    throw InvalidCommandLine("Missing value for --manifest");
+
+                manifest = argv[++i];
+            }
             else if (arg.length() > 0 && arg.front() == '-') {
                 throw UnknownOption<CharT>(argv[i]);
             }
@@ -179,6 +361,29 @@ public:
             }
         }
 
+        // The fingerprints would be printed by the server.
+        if (fingerprint && (serve || connect))
+            throw InvalidCommandLine(
+                    "--fingerprint cannot be used with --serve or --connect");
+
+        // Nothing is written in these cases or the server would be the one
+        // writing.
+        if (manifest && (dryrun || fingerprint || serve || connect))
+            throw InvalidCommandLine(
+                    "--manifest cannot be used with --dryrun, --fingerprint, "
+                    "--serve, or --connect");
+
+        if (batch || serve) {
+            if (!positional.empty())
+                throw InvalidCommandLine(
+                        "Positional arguments cannot be used with --batch or "
+                        "--serve");
+            if (batch && serve)
+                throw InvalidCommandLine(
+                        "--batch and --serve cannot be used together");
+            return;
+        }
+
         switch (positional.size()) {
             case 2:
                 pdb = positional[1];
@@ -200,7 +405,16 @@ template<typename CharT>
 const OptionNames<CharT> CommandOptions<CharT>::opt = OptionNames<CharT>();
 
 const char* usage =
-    "Usage: ducible image [pdb] [--help] [--dryrun]";
+    "Usage: ducible image [pdb] [--help] [--dryrun] [--jobs N]\n"
+    "                     [--hash md5|xxh3] [--hash-chunk-size N]\n"
+    "                     [--cache DIR] [--cache-size MB] [--page-size N]\n"
+    "                     [--compact]\n"
+    "                     [--normalize-modules] [--normalize-types]\n"
+    "                     [--sync-io] [--fingerprint] [--manifest FILE]\n"
+    "                     [--stats] [--stats-json FILE] [--trace FILE]\n"
+    "       ducible --batch FILE [options...]\n"
+    "       ducible --serve ADDRESS [--jobs N] [--cache DIR]\n"
+    "       ducible --connect ADDRESS image [pdb] [options...]";
 
 const char* help =
 R"(
@@ -221,8 +435,141 @@ Optional arguments:
   --help, -h    Prints this help.
   --dryrun, -n  No files are modified, only what would have been patched are
                 printed.
+  --jobs, -j N  Maximum number of threads to use when patching the PDB. By
+                default, the number of hardware threads is used.
+  --hash NAME   Hash used to calculate the new PDB signature. Either 'md5'
+                (the default) or 'xxh3'. xxh3 is much faster for large images,
+                but gives different signatures than md5.
+  --hash-chunk-size N
+                Hash the image in chunks of N bytes in parallel and combine
+                the results. The signature depends on N, but not on the number
+                of threads. 0 (the default) hashes everything in one go.
+  --cache DIR   Keep patched PDBs in the directory DIR. If the same image and
+                PDB are seen again, on this machine or another one sharing
+                the directory, the PDB is copied from the cache instead of
+                being patched again.
+  --cache-size MB
+                Maximum size of the cache in megabytes. The least recently
+                used PDBs are deleted to stay below it. Defaults to 4096.
+  --page-size N Page size of the rewritten PDB, in bytes. Must be a power of 2
+                from 512 to 65536. By default, the page size of the original
+                PDB is kept. An MSF file can have at most 2^20 pages, so PDBs
+                larger than 4 GB need pages bigger than 4096 bytes.
+  --compact     Lay out the PDB compactly: The stream table and the streams a
+                debugger reads first are placed at the start of the file, and
+                the blank page after the free page map is left out.
+  --normalize-modules
+                Also normalize the symbols of every module in the PDB, not just
+                the linker's manifest module. This zeroes the padding of the
+                symbol records and the GUIDs in object file paths. It takes
+                longer, but fewer PDBs differ between otherwise identical
+                builds.
+  --normalize-types
+                Also normalize the padding of the records in the type and ID
+                info streams. Their hashes are updated to match where they can
+                be recalculated.
+  --sync-io     Read and write the PDB with blocking calls only. By default,
+                many reads and writes are kept in flight at once where the
+                platform supports it (io_uring on Linux, I/O completion ports
+                on Windows).
+  --fingerprint Print digests of the image and PDB as they would be after
+                patching instead of patching them. Nothing is written. Two
+                images or PDBs that would be patched to the same contents have
+                the same digest. The digests are not hashes of the files,
+                however. They depend on --hash and on the options that change
+                the output, like --page-size.
+  --manifest FILE
+                Write the sizes and SHA-256 digests of the patched files to
+                FILE as JSON. They are mostly calculated while the files are
+                written, which saves reading them again afterwards. With
+                --batch, all of the images and PDBs are listed.
+  --stats       Print how long each phase took, how much was read and
+                written, and the peak memory usage when done.
+  --stats-json FILE
+                Write the same statistics to FILE as JSON.
+  --trace FILE  Write a trace of what each thread did to FILE in the Chrome
+                trace event format. It can be opened with chrome://tracing or
+                https://ui.perfetto.dev. Each image, stream patcher, hash, and
+                write is a span with the number of bytes it processed. This
+                shows which images or streams hold up a batch.
+  --batch FILE  Patch all of the images listed in FILE instead. Each line has
+                the form 'image [pdb]'. Use quotes around paths with spaces.
+                If FILE is '-', the list is read from standard input. The
+                images are patched in parallel using up to --jobs threads, and
+                the result is printed for each one. The exit code is nonzero if
+                any of them failed.
+  --serve ADDRESS
+                Run as a server that patches images for clients connecting to
+                ADDRESS. On Windows, ADDRESS is a named pipe of the form
+                \\.\pipe\name. Elsewhere, it is the path of a Unix socket.
+                Up to --jobs threads are shared between all requests.
+  --connect ADDRESS
+                Ask the server listening on ADDRESS to patch the image instead
+                of doing it in this process. Errors are reported just the same.
 )";
 
+/**
+ * Does what the command line asked for. Returns the exit code.
+ */
+template<typename CharT>
+int run(const CommandOptions<CharT>& opts, const PatchOptions& options)
+{
+    if (opts.batch) {
+        std::vector<BatchEntry> batch;
+
+        try {
+            batch = readBatch(opts.batch);
+        }
+        catch (const InvalidBatch& error) {
+            std::cerr << "Error: Invalid batch file (" << error.why() << ")\n";
+            return 1;
+        }
+
+        const size_t failures = patchBatch(batch, options, opts.jobs);
+        if (failures > 0) {
+            std::cerr << "Error: " << failures << " of " << batch.size()
+                << " images failed\n";
+            return 1;
+        }
+
+        return 0;
+    }
+
+    if (opts.serve) {
+        try {
+            serve(opts.serve, options);
+        }
+        catch (const std::system_error& error) {
+            std::cerr << "Error: " << error.what() << "\n";
+        }
+
+        return 1;
+    }
+
+    std::string error;
+
+    if (opts.connect) {
+        try {
+            error = tryPatchImageRemote(opts.connect, opts.image, opts.pdb,
+                    options);
+        }
+        catch (const std::system_error& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+    }
+    else {
+        error = tryPatchImage(opts.image, opts.pdb, options);
+    }
+
+    if (!error.empty()) {
+        std::cerr << "Error: " << error << "\n";
+        return 1;
+    }
+
+    return 0;
+}
+
 template<typename CharT = char>
 int ducible(int argc, CharT** argv)
 {
@@ -253,27 +600,74 @@ int ducible(int argc, CharT** argv)
         return 0;
     }
 
-    try {
-        patchImage(opts.image, opts.pdb, opts.dryrun);
+    PatchOptions options;
+    options.dryrun = opts.dryrun;
+    options.jobs = opts.jobs;
+    options.hash = opts.hash;
+    options.hashChunkSize = opts.hashChunkSize;
+    options.cacheDir = opts.cache;
+    options.cacheSize = opts.cacheSize;
+    options.pageSize = opts.pageSize;
+    options.compactLayout = opts.compact;
+    options.normalizeModules = opts.normalizeModules;
+    options.normalizeTypes = opts.normalizeTypes;
+    options.fingerprint = opts.fingerprint;
+
+    if (opts.stats || opts.statsJson)
+        enableStats();
+
+    if (opts.trace)
+        enableTrace();
+
+    if (opts.syncIo)
+        disableAsyncIo();
+
+    Manifest manifest;
+    if (opts.manifest)
+        options.manifest = &manifest;
+
+    int result;
+
+    {
+        PhaseTimer timer("total");
+        result = run(opts, options);
     }
-    catch (const InvalidImage& error) {
-        std::cerr << "Error: Invalid image (" << error.why() << ")\n";
-        return 1;
-    }
-    catch (const InvalidMsf& error) {
-        std::cerr << "Error: Invalid PDB MSF format (" << error.why() << ")\n";
-        return 1;
+
+    if (opts.stats)
+        printStats(std::cout);
+
+    if (opts.statsJson) {
+        std::ofstream f(opts.statsJson);
+        if (!f) {
+            std::cerr << "Error: Failed to open stats file\n";
+            return 1;
+        }
+
+        printStatsJson(f);
     }
-    catch (const InvalidPdb& error) {
-        std::cerr << "Error: Invalid PDB format (" << error.why() << ")\n";
-        return 1;
+
+    if (opts.trace) {
+        std::ofstream f(opts.trace);
+        if (!f) {
+            std::cerr << "Error: Failed to open trace file\n";
+            return 1;
+        }
+
+        printTrace(f);
     }
-    catch (const std::system_error& error) {
-        std::cerr << "Error: " << error.what() << "\n";
-        return 1;
+
+    // The manifest only lists what was patched successfully.
+    if (opts.manifest) {
+        std::ofstream f(opts.manifest);
+        if (!f) {
+            std::cerr << "Error: Failed to open manifest file\n";
+            return 1;
+        }
+
+        manifest.write(f);
     }
 
-    return 0;
+    return result;
 }
 
 #if defined(_WIN32) && defined(UNICODE)
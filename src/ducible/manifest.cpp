@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ducible/manifest.h"
+
+#include <algorithm>
+#include <codecvt>
+#include <cstring>
+#include <locale>
+
+namespace {
+
+/**
+ * Writes a string as a JSON string literal.
+ */
+void writeJsonString(std::ostream& os, const std::string& s) {
+
+    static const char hex[] = "0123456789abcdef";
+
+    os << '"';
+
+    for (char c: s) {
+        if (c == '"' || c == '\\') {
+            os << '\\' << c;
+        }
+        else if ((unsigned char)c < 0x20) {
+            os << "\\u00" << hex[(c >> 4) & 0xF] << hex[c & 0xF];
+        }
+        else {
+            os << c;
+        }
+    }
+
+    os << '"';
+}
+
+}
+
+void Manifest::add(const char* path, uint64_t size,
+        const uint8_t sha256[Sha256::kDigestLength]) {
+
+    Entry entry;
+    entry.path = path;
+    entry.size = size;
+    memcpy(entry.sha256, sha256, sizeof(entry.sha256));
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _entries.push_back(entry);
+}
+
+void Manifest::add(const wchar_t* path, uint64_t size,
+        const uint8_t sha256[Sha256::kDigestLength]) {
+
+    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+    add(converter.to_bytes(path).c_str(), size, sha256);
+}
+
+void Manifest::write(std::ostream& os) const {
+
+    std::vector<Entry> entries;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        entries = _entries;
+    }
+
+    std::sort(entries.begin(), entries.end(),
+            [](const Entry& a, const Entry& b) { return a.path < b.path; });
+
+    os << "{\n  \"files\": [";
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        os << (i ? ",\n" : "\n") << "    {\"path\": ";
+        writeJsonString(os, entries[i].path);
+        os << ", \"size\": " << entries[i].size
+           << ", \"sha256\": \"" << sha256Hex(entries[i].sha256) << "\"}";
+    }
+
+    os << "\n  ]\n}\n";
+}
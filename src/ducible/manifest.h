@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "util/sha256.h"
+
+/**
+ * The digests and sizes of the files that were written. Artifact stores can
+ * take these instead of reading the files again.
+ *
+ * Files can be added from several threads at once.
+ */
+class Manifest {
+private:
+
+    struct Entry {
+        // UTF-8
+        std::string path;
+        uint64_t size;
+        uint8_t sha256[Sha256::kDigestLength];
+    };
+
+    mutable std::mutex _mutex;
+    std::vector<Entry> _entries;
+
+public:
+
+    /**
+     * Adds a file. The path is recorded as it is given.
+     */
+    void add(const char* path, uint64_t size,
+            const uint8_t sha256[Sha256::kDigestLength]);
+    void add(const wchar_t* path, uint64_t size,
+            const uint8_t sha256[Sha256::kDigestLength]);
+
+    /**
+     * Writes the manifest as JSON. The files are sorted by path such that the
+     * output doesn't depend on the order in which they were added.
+     */
+    void write(std::ostream& os) const;
+};
@@ -24,6 +24,7 @@
 
 #include <iostream>
 #include <iomanip>
+#include <sstream>
 #include <tuple>
 #include <cstring>
 
@@ -38,7 +39,11 @@ void Patch::apply(uint8_t* buf, bool dryRun) {
     if (memcmp(buf + offset, data, length) == 0)
         return;
 
-    std::cout << *this << std::endl;
+    // Write the whole line at once so that it doesn't get mixed up with the
+    // output of other images being patched at the same time.
+    std::ostringstream ss;
+    ss << *this << "\n";
+    std::cout << ss.str() << std::flush;
 
     if (!dryRun)
         memcpy(buf + offset, data, length);
@@ -24,11 +24,15 @@
 #include <string.h>
 #include <memory>
 #include <algorithm>
+#include <future>
 #include <iostream>
+#include <vector>
 
 #include "ducible/patch_ilk.h"
 
 #include "util/memmap.h"
+#include "util/stats.h"
+#include "util/thread_pool.h"
 
 namespace {
 
@@ -41,11 +45,86 @@ struct Strings {
 template<> const char    Strings<char>::ilkExtension[]    = ".ilk";
 template<> const wchar_t Strings<wchar_t>::ilkExtension[] = L".ilk";
 
+/**
+ * Size of the regions that are searched for the signature concurrently.
+ */
+const size_t kSearchChunk = 16 * 1024 * 1024;
+
+/**
+ * Finds all occurrences of the 16-byte pattern that start in [begin, end).
+ * Matches may extend up to 15 bytes past the end, but not past bufEnd.
+ *
+ * memchr() is usually vectorized. Thus, it is used to skip ahead to candidates
+ * for the first byte. The last byte then weeds out nearly all false positives
+ * before the full comparison.
+ */
+void findSignature(const uint8_t* buf, size_t begin, size_t end, size_t bufEnd,
+        const uint8_t pattern[16], std::vector<size_t>& matches) {
+
+    if (bufEnd < 16)
+        return;
+
+    end = std::min(end, bufEnd - 15);
+
+    size_t i = begin;
+    while (i < end) {
+        const uint8_t* p = (const uint8_t*)memchr(buf + i, pattern[0], end - i);
+        if (!p)
+            break;
+
+        i = p - buf;
+
+        if (p[15] == pattern[15] && memcmp(p, pattern, 16) == 0) {
+            matches.push_back(i);
+            i += 16;
+        }
+        else {
+            ++i;
+        }
+    }
+}
+
+/**
+ * Returns the offsets of all non-overlapping occurrences of the pattern in
+ * ascending order. Large buffers are searched in parallel.
+ */
+std::vector<size_t> findSignatures(const uint8_t* buf, size_t length,
+        const uint8_t pattern[16], ThreadPool& pool) {
+
+    const size_t chunks = (length + kSearchChunk - 1) / kSearchChunk;
+
+    std::vector<std::vector<size_t>> results(chunks);
+    std::vector<std::future<void>> futures;
+
+    for (size_t i = 0; i < chunks; ++i) {
+        futures.push_back(pool.submit([&, i]() {
+            findSignature(buf, i * kSearchChunk, (i + 1) * kSearchChunk,
+                    length, pattern, results[i]);
+        }));
+    }
+
+    pool.wait(futures);
+
+    // Matches never overlap within a chunk, but they might across a chunk
+    // boundary.
+    std::vector<size_t> matches;
+    for (auto& result : results) {
+        for (size_t offset : result) {
+            if (matches.empty() || offset >= matches.back() + 16)
+                matches.push_back(offset);
+        }
+    }
+
+    return matches;
+}
+
 }
 
 template<typename CharT>
 void patchIlkImpl(const CharT* imagePath, const uint8_t oldSignature[16],
-        const uint8_t newSignature[16], bool dryrun) {
+        const uint8_t newSignature[16], bool dryrun, ThreadPool& pool) {
+
+    PhaseTimer timer("patchIlk");
 
     std::basic_string<CharT> ilkPath(imagePath);
     size_t extpos = ilkPath.find_last_of('.');
@@ -56,23 +135,36 @@ void patchIlkImpl(const CharT* imagePath, const uint8_t oldSignature[16],
 
     ilkPath.append(Strings<CharT>::ilkExtension);
 
-    // Map the ilk file into memory.
     try {
-        MemMap ilk(ilkPath.c_str());
+        std::vector<size_t> matches;
 
-        uint8_t* buf = (uint8_t*)ilk.buf();
-        uint8_t* bufEnd = buf + ilk.length();
+        {
+            // The ilk file is only searched. Most of the time there is either
+            // no ilk file or nothing to replace. Mapping it read-only avoids
+            // the cost of a writable mapping in that case.
+            MemMap ilk(ilkPath.c_str(), 0, true);
+
+            matches = findSignatures((const uint8_t*)ilk.buf(), ilk.length(),
+                    oldSignature, pool);
+        }
+
+        if (matches.empty())
+            return;
 
-        // Find
-        uint8_t* it = std::find_first_of(buf, bufEnd,
-                oldSignature, oldSignature+16);
+        std::cout << "Replacing old PDB signature in ILK file.\n";
 
-        // Replace
-        if (it != bufEnd) {
-            std::cout << "Replacing old PDB signature in ILK file.\n";
+        if (dryrun)
+            return;
+
+        MemMap ilk(ilkPath.c_str());
+
+        uint8_t* buf = (uint8_t*)ilk.buf();
 
-            if (!dryrun)
-                memcpy(it, newSignature, 16);
+        for (size_t offset : matches) {
+            // The file could have been changed in the meantime.
+            if (offset + 16 <= ilk.length() &&
+                memcmp(buf + offset, oldSignature, 16) == 0)
+                memcpy(buf + offset, newSignature, 16);
         }
     }
     catch (const std::system_error&) {
@@ -83,15 +175,15 @@ void patchIlkImpl(const CharT* imagePath, const uint8_t oldSignature[16],
 #if defined(_WIN32) && defined(UNICODE)
 
 void patchIlk(const wchar_t* imagePath, const uint8_t oldSignature[16],
-        const uint8_t newSignature[16], bool dryrun) {
-    patchIlkImpl(imagePath, oldSignature, newSignature, dryrun);
+        const uint8_t newSignature[16], bool dryrun, ThreadPool& pool) {
+    patchIlkImpl(imagePath, oldSignature, newSignature, dryrun, pool);
 }
 
 #else
 
 void patchIlk(const char* imagePath, const uint8_t oldSignature[16],
-        const uint8_t newSignature[16], bool dryrun) {
-    patchIlkImpl(imagePath, oldSignature, newSignature, dryrun);
+        const uint8_t newSignature[16], bool dryrun, ThreadPool& pool) {
+    patchIlkImpl(imagePath, oldSignature, newSignature, dryrun, pool);
 }
 
 #endif
@@ -21,18 +21,21 @@
  */
 #pragma once
 
+class ThreadPool;
+
 /**
  * Patches the PDB signature in the .ilk file so that incremental linking
- * doesn't fail.
+ * doesn't fail. Every occurrence of the old signature is replaced. The search
+ * is split up across the thread pool.
  */
 #if defined(_WIN32) && defined(UNICODE)
 
 void patchIlk(const wchar_t* imagePath, const uint8_t oldSignature[16],
-        const uint8_t newSignature[16], bool dryrun);
+        const uint8_t newSignature[16], bool dryrun, ThreadPool& pool);
 
 #else
 
 void patchIlk(const char* imagePath, const uint8_t oldSignature[16],
-        const uint8_t newSignature[16], bool dryrun);
+        const uint8_t newSignature[16], bool dryrun, ThreadPool& pool);
 
 #endif
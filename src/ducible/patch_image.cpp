@@ -73,16 +73,25 @@
 #include <stdlib.h>
 
 #include <algorithm>
+#include <codecvt>
 #include <cstring>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <locale>
+#include <memory>
+#include <sstream>
+#include <string>
 #include <vector>
 #include <map>
-#include <regex>
 
 #include "ducible/patch_image.h"
 #include "ducible/patch_ilk.h"
+#include "ducible/patch_pdb.h"
 
+#include "ducible/manifest.h"
 #include "ducible/patches.h"
+#include "ducible/pdb_cache.h"
 
 #include "pe/pe.h"
 
@@ -90,14 +99,16 @@
 
 #include "msf/msf.h"
 #include "msf/stream.h"
-#include "msf/memory_stream.h"
 
 #include "pdb/format.h"
 #include "pdb/pdb.h"
-#include "pdb/cvinfo.h"
 
+#include "util/arena.h"
 #include "util/memmap.h"
-#include "util/md5.h"
+#include "util/hash.h"
+#include "util/sha256.h"
+#include "util/stats.h"
+#include "util/thread_pool.h"
 
 namespace {
 
@@ -105,13 +116,10 @@ namespace {
 template<typename CharT>
 struct Strings {
     static const CharT tmpExtension[];
-    static const CharT nullGuid[];
 };
 
 template<> const char    Strings<char>::tmpExtension[]    = ".tmp";
-template<> const char    Strings<char>::nullGuid[]        = "{00000000-0000-0000-0000-000000000000}";
 template<> const wchar_t Strings<wchar_t>::tmpExtension[] = L".tmp";
-template<> const wchar_t Strings<wchar_t>::nullGuid[]     = L"{00000000-0000-0000-0000-000000000000}";
 
 /**
  * There are 0 or more debug data directories. We need to patch the timestamp in
@@ -185,698 +193,814 @@ void patchOptionalHeader(const PEFile& pe, Patches& patches, const T* optional)
     patchDebugDataDirectories(pe, patches, optional);
 }
 
+/**
+ * Size of the windows in which the image is hashed. Each window is taken out of
+ * memory again once it has been hashed. Thus, even huge images only need this
+ * much memory at a time.
+ */
+const size_t kHashWindow = 8 * 1024 * 1024;
+
+/**
+ * Hashes the range [begin, end) of the image. If the image is memory mapped,
+ * the pages are released again as they are hashed.
+ */
+template<typename H>
+void hashRange(H& hasher, const uint8_t* buf, size_t begin, size_t end,
+        MemMap* map) {
+
+    while (begin < end) {
+        const size_t n = std::min(end - begin, kHashWindow);
+
+        hasher.update(buf + begin, n);
+
+        if (map)
+            map->release(begin, n);
+
+        begin += n;
+    }
+}
+
 /**
  * Calculates the checksum for the PE image, skipping over patched areas. This
  * is used to replace the PDB signature with something that is deterministic.
  *
  * The list of patches is assumed to be sorted.
  *
- * Note that this uses the MD5 hashing algorithm, but any 128-bit hashing
- * algorithm could be used instead. It might be a good idea to use a hashing
- * algorithm with better distribution to avoid collisions. MurmurHash3 could be
- * a good choice, but it can't incrementally hash chunks of data.
+ * MD5 is used by default so that signatures stay the same as in previous
+ * versions. Any 128-bit hash will do, however, since the signature only needs
+ * to change when the contents do.
  */
 void calculateChecksum(const uint8_t* buf, const size_t length,
-        const std::vector<Patch>& patches, uint8_t output[16]) {
+        const std::vector<Patch>& patches, HashAlgorithm algorithm,
+        MemMap* map, uint8_t output[16]) {
+
+    PhaseTimer timer("calculateChecksum");
+    timer.addArg("bytes", length);
+
+    addStat(StatCounter::imageBytes, length);
 
     size_t pos = 0;
 
-    md5_context ctx;
-    md5_starts(&ctx);
+    HasherRef hasher = makeHasher(algorithm);
 
     // Take the checksum of the regions between the patches to ensure a
     // deterministic file checksum. Since the patches are sorted, we iterate
     // over the file sequentially.
     for (auto&& patch: patches) {
         // Hash everything up to the patch
-        md5_update(&ctx, buf + pos, patch.offset - pos);
+        hashRange(*hasher, buf, pos, patch.offset, map);
 
         // Skip past the patch
         pos = patch.offset + patch.length;
     }
 
     // Get everything after the last patch
-    md5_update(&ctx, buf + pos, length - pos);
-
-    md5_finish(&ctx, output);
-}
-
-/**
- * Compares the PE and PDB signatures to see if they match.
- */
-bool matchingSignatures(const CV_INFO_PDB70& pdbInfo,
-                        const PdbStream70& pdbHeader) {
-    if (pdbInfo.Age != pdbHeader.age ||
-        memcmp(pdbInfo.Signature, pdbHeader.sig70, sizeof(pdbHeader.sig70)) != 0
-        ) {
-        return false;
-    }
-
-    return true;
-}
-
-/**
- * Returns a temporary PDB path name. The PDB will be written here first and
- * then renamed to the original after everything succeeds.
- */
-template<typename CharT>
-std::basic_string<CharT> getTempPdbPath(const CharT* pdbPath) {
-    std::basic_string<CharT> temp(pdbPath);
-    temp.append(Strings<CharT>::tmpExtension);
-    return temp;
-}
+    hashRange(*hasher, buf, pos, length, map);
 
-/**
- * Helper function for normalizing a GUID in a NULL terminated file name.
- */
-template <typename CharT>
-void normalizeFileNameGuid(CharT* path, size_t length) {
-    static const std::regex guidRegex("\\{"
-            "[0-9a-fA-F]{8}-"
-            "[0-9a-fA-F]{4}-"
-            "[0-9a-fA-F]{4}-"
-            "[0-9a-fA-F]{4}-"
-            "[0-9a-fA-F]{12}"
-        "\\}");
-
-    std::match_results<const CharT*> match;
-
-    if (std::regex_search((const CharT*)path, (const CharT*)path + length,
-                match, guidRegex)) {
-        memcpy(path + match.position(0), Strings<CharT>::nullGuid,
-                sizeof(Strings<CharT>::nullGuid));
-    }
+    hasher->finish(output);
 }
 
 /**
- * Patches the "/LinkInfo" named stream.
+ * Like calculateChecksum, but the hashed regions are split into chunks of
+ * equal size that are hashed in parallel. The signature is then the hash of
+ * the chunk hashes.
+ *
+ * The chunks are formed after the patched areas have been removed. Thus, the
+ * result only depends on the data and the chunk size, not on the number of
+ * threads. It is, however, different from the result of calculateChecksum.
  */
-void patchLinkInfoStream(MsfMemoryStream* stream) {
-    uint8_t* data = stream->data();
-    const size_t length = stream->length();
+void calculateTreeChecksum(const uint8_t* buf, const size_t length,
+        const std::vector<Patch>& patches, HashAlgorithm algorithm,
+        size_t chunkSize, ThreadPool& pool, MemMap* map, uint8_t output[16]) {
 
-    if (length == 0)
-        return;
+    PhaseTimer timer("calculateChecksum");
+    timer.addArg("bytes", length);
 
-    if (length < sizeof(LinkInfo))
-        throw InvalidPdb("got partial LinkInfo stream");
+    addStat(StatCounter::imageBytes, length);
 
-    const LinkInfo* linkInfo = (LinkInfo*)data;
+    // The regions between the patches and the offset of each region in the
+    // hashed data.
+    std::vector<size_t> regionOffsets, regionStarts, regionLengths;
 
-    if (linkInfo->size > length)
-        throw InvalidPdb("LinkInfo size too large for stream");
+    size_t pos = 0, total = 0;
 
-    // The rest of the stream appears to be garbage. Thus, we truncate it.
-    stream->resize(linkInfo->size);
-}
+    for (size_t i = 0; i <= patches.size(); ++i) {
+        const size_t end = (i < patches.size()) ? patches[i].offset : length;
 
-/**
- * Patches the "/names" stream.
- */
-void patchNamesStream(MsfMemoryStream* stream) {
-    uint8_t* data = stream->data();
-    uint8_t* dataEnd = data + stream->length();
+        if (end > pos) {
+            regionOffsets.push_back(total);
+            regionStarts.push_back(pos);
+            regionLengths.push_back(end - pos);
+            total += end - pos;
+        }
 
-    // Parse the header
-    if (size_t(dataEnd - data) < sizeof(StringTableHeader))
-        throw InvalidPdb("missing string table header");
+        if (i < patches.size())
+            pos = patches[i].offset + patches[i].length;
+    }
 
-    StringTableHeader* header = (StringTableHeader*)data;
+    const size_t chunks = (total + chunkSize - 1) / chunkSize;
 
-    data += sizeof(*header);
+    std::vector<uint8_t> digests(chunks * 16);
+    std::vector<std::future<void>> futures;
 
-    if (header->signature != kHashTableSignature)
-        throw InvalidPdb("got invalid string table signature");
+    for (size_t i = 0; i < chunks; ++i) {
+        futures.push_back(pool.submit([&, i]() {
+            size_t offset = i * chunkSize;
+            const size_t end = std::min(offset + chunkSize, total);
 
-    if (header->version != 1 && header->version != 2)
-        throw InvalidPdb("got invalid or unsupported string table version");
+            // Find the region that contains the start of this chunk.
+            size_t r = std::upper_bound(regionOffsets.begin(),
+                    regionOffsets.end(), offset) - regionOffsets.begin() - 1;
 
-    if (size_t(dataEnd - data) < header->stringsSize)
-        throw InvalidPdb("got partial string table data");
+            HasherRef hasher = makeHasher(algorithm);
 
-    data += header->stringsSize;
+            while (offset < end) {
+                const size_t skip = offset - regionOffsets[r];
+                const size_t n = std::min(regionLengths[r] - skip, end - offset);
+                const size_t start = regionStarts[r] + skip;
+                hashRange(*hasher, buf, start, start + n, map);
+                offset += n;
+                ++r;
+            }
 
-    if (size_t(dataEnd - data) < sizeof(uint32_t))
-        throw InvalidPdb("missing string table offset array length");
+            hasher->finish(&digests[i * 16]);
+        }));
+    }
 
-    // Offsets array length
-    uint32_t offsetsLength = *(uint32_t*)data;
+    pool.wait(futures);
 
-    data += sizeof(offsetsLength);
+    HasherRef root = makeHasher(algorithm);
 
-    if (size_t(dataEnd - data) < offsetsLength * sizeof(uint32_t))
-        throw InvalidPdb("got partial string table offsets array");
+    root->update(digests.data(), digests.size());
 
-    uint32_t* offsets = (uint32_t*)data;
+    // Also hash the parameters such that different chunkings cannot collide.
+    uint8_t params[16];
+    for (size_t i = 0; i < 8; ++i) {
+        params[i]     = (uint8_t)((uint64_t)total >> (8 * i));
+        params[8 + i] = (uint8_t)((uint64_t)chunkSize >> (8 * i));
+    }
+    root->update(params, sizeof(params));
 
-    data += offsetsLength * sizeof(uint32_t);
+    root->finish(output);
+}
 
-    // Sort the offsets. There is some non-determinism creeping in here somehow.
-    std::sort(offsets, offsets + offsetsLength);
+/**
+ * Calculates the SHA-256 of the image as it will be once the patches are
+ * applied. The image itself doesn't need to be patched yet. Thus, this can run
+ * while the PDB is being written.
+ *
+ * The list of patches is assumed to be sorted.
+ */
+void sha256PatchedImage(const uint8_t* buf, const size_t length,
+        const std::vector<Patch>& patches, MemMap* map,
+        uint8_t output[Sha256::kDigestLength]) {
 
-    for (size_t i = 0; i < offsetsLength; ++i) {
-        const size_t offset = offsets[i];
+    PhaseTimer timer("hashImage");
+    timer.addArg("bytes", length);
 
-        if (offset == 0)
-            continue;
+    Sha256 sha;
 
-        if (offset >= header->stringsSize)
-            throw InvalidPdb("got invalid offset into string table");
+    size_t pos = 0;
 
-        char* str = &header->strings[offset];
-        size_t len = strlen(str);
+    for (auto&& patch: patches) {
+        hashRange(sha, buf, pos, patch.offset, map);
+        sha.update(patch.data, patch.length);
+        pos = patch.offset + patch.length;
+    }
 
-        if (offset + len + 1 > header->stringsSize)
-            throw InvalidPdb("got invalid offset into string table");
+    hashRange(sha, buf, pos, length, map);
 
-        normalizeFileNameGuid(str, len);
-    }
+    sha.finish(output);
 }
 
 /**
- * Patches the PDB header stream.
+ * Adds a file as it is on disk to the manifest.
  */
-void patchHeaderStream(MsfFile& msf, MsfMemoryStream* stream, const CV_INFO_PDB70* pdbInfo,
-        uint32_t timestamp, const uint8_t signature[16]) {
-
-    uint8_t* data = stream->data();
-    const uint8_t* dataEnd = stream->data() + stream->length();
+template<typename CharT>
+void addFileToManifest(Manifest& manifest, const CharT* path) {
 
-    if (size_t(dataEnd - data) < sizeof(PdbStream70))
-        throw InvalidPdb("missing PDB 7.0 header");
+    PhaseTimer timer("hashFile");
 
-    PdbStream70* header = (PdbStream70*)data;
+    MemMap map(path);
+    map.adviseSequential();
 
-    data += sizeof(*header);
+    timer.addArg("bytes", map.length());
 
-    if (header->version < PdbVersion::vc70)
-        throw InvalidPdb("unsupported PDB implementation version");
+    Sha256 sha;
+    hashRange(sha, (const uint8_t*)map.buf(), 0, map.length(), &map);
 
-    // Check that this PDB matches what the PE file expects
-    if (!pdbInfo || !matchingSignatures(*pdbInfo, *header))
-        throw InvalidPdb("PE and PDB signatures do not match");
+    uint8_t digest[Sha256::kDigestLength];
+    sha.finish(digest);
 
-    // Patch the PDB header stream
-    header->timestamp = timestamp;
-    header->age = 1;
-    memcpy(header->sig70, signature, sizeof(header->sig70));
+    manifest.add(path, map.length(), digest);
+}
 
-    const auto table = readNameMapTable(data, dataEnd);
+/**
+ * Finds everything in the image that needs to be patched. The patches are
+ * sorted afterwards. Returns the PDB information in the image or NULL if there
+ * is none.
+ */
+const CV_INFO_PDB70* addImagePatches(const PEFile& pe, Patches& patches) {
 
-    // Patch the LinkInfo stream.
-    {
-        const auto it = table.find("/LinkInfo");
-        if (it != table.end()) {
-            auto origLinkInfoStream = msf.getStream(it->second);
-            if (!origLinkInfoStream)
-                throw InvalidPdb("missing '/LinkInfo' stream");
+    patches.add(&pe.fileHeader->TimeDateStamp, &pe.timestamp,
+            "IMAGE_FILE_HEADER.TimeDateStamp");
 
-            auto linkInfoStream = std::shared_ptr<MsfMemoryStream>(
-                    new MsfMemoryStream(origLinkInfoStream.get()));
+    const CV_INFO_PDB70* pdbInfo = NULL;
 
-            patchLinkInfoStream(linkInfoStream.get());
+    switch (pe.magic()) {
+        case IMAGE_NT_OPTIONAL_HDR32_MAGIC: {
+            // Patch as a PE32 file
+            auto opt = pe.optionalHeader<IMAGE_OPTIONAL_HEADER32>();
+            pdbInfo = pe.pdbInfo(opt);
+            patchOptionalHeader(pe, patches, opt);
+            break;
+        }
 
-            msf.replaceStream(it->second, linkInfoStream);
+        case IMAGE_NT_OPTIONAL_HDR64_MAGIC: {
+            // Patch as a PE32+ file
+            auto opt = pe.optionalHeader<IMAGE_OPTIONAL_HEADER64>();
+            pdbInfo = pe.pdbInfo(opt);
+            patchOptionalHeader(pe, patches, opt);
+            break;
         }
+
+        default:
+            throw InvalidImage("unsupported IMAGE_NT_HEADERS.OptionalHeader");
     }
 
-    // Rewrite /names hash table
-    {
-        const auto it = table.find("/names");
-        if (it != table.end()) {
-            auto origNamesStream = msf.getStream(it->second);
-            if (!origNamesStream)
-                throw InvalidPdb("missing '/names' stream");
+    patches.sort();
 
-            auto namesStream = std::shared_ptr<MsfMemoryStream>(
-                    new MsfMemoryStream(origNamesStream.get()));
+    return pdbInfo;
+}
 
-            patchNamesStream(namesStream.get());
+/**
+ * Calculates the new PDB signature of the image and stores it in
+ * `pe.pdbSignature`. If the image is memory mapped, the map is given so that
+ * the image can be streamed through memory.
+ */
+void calculateSignature(PEFile& pe, const std::vector<Patch>& patches,
+        const PatchOptions& options, ThreadPool& pool, MemMap* map) {
 
-            msf.replaceStream(it->second, namesStream);
-        }
+    if (options.hashChunkSize > 0) {
+        calculateTreeChecksum(pe.buf, pe.length, patches, options.hash,
+                options.hashChunkSize, pool, map, pe.pdbSignature);
+    }
+    else {
+        calculateChecksum(pe.buf, pe.length, patches, options.hash, map,
+                pe.pdbSignature);
     }
 }
 
 /**
- * Patches a module stream.
+ * The checksum of the image, which is calculated by a task on the thread pool
+ * while the PDB is being read and patched.
  */
-void patchModuleStream(MsfMemoryStream* stream) {
-
-    uint8_t* data = stream->data();
-    const uint8_t* dataEnd = stream->data() + stream->length();
-
-    if (size_t(dataEnd - data) < sizeof(uint16_t))
-        throw InvalidPdb("got partial module info stream");
+class PendingSignature {
+private:
+    ThreadPool& _pool;
+    std::vector<std::future<void>> _tasks;
+    const uint8_t* _signature;
+    bool _done;
+
+    // Tasks that need the checksum. They are submitted once it is there.
+    std::vector<std::function<void()>> _followUps;
+    std::vector<std::future<void>> _followUpTasks;
+
+public:
+    template<typename F>
+    PendingSignature(ThreadPool& pool, const uint8_t signature[16], F f)
+        : _pool(pool), _signature(signature), _done(false) {
+        _tasks.push_back(pool.submit(f));
+    }
 
-    uint32_t type = *(uint32_t*)data;
-    data += sizeof(type);
+    /**
+     * The tasks refer to the image. Thus, they must have finished before the
+     * image goes away, even if patching the PDB failed.
+     */
+    ~PendingSignature() {
+        try {
+            if (!_done)
+                _pool.wait(_tasks);
 
-    if (type != CV_SIGNATURE_C13)
-        return;
+            _pool.wait(_followUpTasks);
+        }
+        catch (...) {
+        }
+    }
 
-    if (size_t(dataEnd - data) < sizeof(SymbolRecord))
-        throw InvalidPdb("missing symbol record in module info stream");
+    /**
+     * Adds a task that is run as soon as the checksum has been calculated. It
+     * must be added before get() is first called.
+     */
+    void then(std::function<void()> f) {
+        _followUps.push_back(f);
+    }
 
-    const SymbolRecord* sym = (const SymbolRecord*)data;
+    /**
+     * Waits for the checksum to be calculated and returns it.
+     */
+    const uint8_t* get() {
+        if (!_done) {
+            _done = true;
+            _pool.wait(_tasks);
 
-    // We're only concerned about objects here
-    if (sym->type != S_OBJNAME)
-        return;
+            for (auto&& f: _followUps)
+                _followUpTasks.push_back(_pool.submit(f));
+        }
 
-    // Recast now that we know the type.
-    OBJNAMESYM* objsym = (OBJNAMESYM*)data;
+        return _signature;
+    }
 
-    // The signature always seems to be 0.
-    if (objsym->signature != 0)
-        throw InvalidPdb("got invalid OBJNAMESYM symbol record signature");
+    /**
+     * Waits for the checksum and for the tasks that needed it.
+     */
+    void wait() {
+        get();
+        _pool.wait(_followUpTasks);
+    }
+};
 
-    if (size_t(dataEnd - data) < objsym->reclen)
-        throw InvalidPdb("got partial OBJNAMESYM symbol record");
+/**
+ * Converts a path to UTF-8 for the trace.
+ */
+#if defined(_WIN32) && defined(UNICODE)
 
-    size_t namelen = strlen((const char*)objsym->name);
+std::string tracePath(const wchar_t* path) {
+    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+    return converter.to_bytes(path);
+}
 
-    if ((uint8_t*)objsym->name + namelen + 1 > dataEnd)
-        throw InvalidPdb("object path in symbol record is not null-terminated");
+#else
 
-    normalizeFileNameGuid((char*)objsym->name, namelen);
+std::string tracePath(const char* path) {
+    return path;
 }
 
-const char* kIncLinkWarning = "\
-Warning: /INCREMENTAL was specified in the linker options. Incremental linking \
-is known to not work with Ducible.";
+#endif
 
 /**
- * Patches the DBI stream.
+ * Returns a temporary PDB path name. The PDB will be written here first and
+ * then renamed to the original after everything succeeds.
  */
-void patchDbiStream(MsfFile& msf, MsfMemoryStream* stream) {
-
-    if (stream->length() < sizeof(DbiHeader))
-        throw InvalidPdb("DBI stream too short");
-
-    uint8_t* data = stream->data();
-    const size_t length = stream->length();
-    size_t offset = 0;
-
-    DbiHeader* dbi = (DbiHeader*)data;
-
-    // Sanity checks
-    if (dbi->signature != dbiHeaderSignature)
-        throw InvalidPdb("invalid DBI header signature");
-
-    if (dbi->version != DbiVersion::v70)
-        throw InvalidPdb("Unsupported DBI stream version");
-
-    // Display a warning about incrementally linking
-    if (dbi->flags.incLink)
-        std::cout << kIncLinkWarning << std::endl;
-
-    // Patch the age. This must match the age in the PDB stream.
-    dbi->age = 1;
-
-    offset += sizeof(*dbi);
-
-    // The module info immediately follows the header.
-
-    // Check bounds
-    if (offset + dbi->gpModInfoSize > length)
-        throw InvalidPdb("DBI module info size exceeds stream length");
-
-    // Number of modules
-    size_t moduleCount = 0;
-
-    // Patch the module info entries
-    for (size_t i = 0; i < dbi->gpModInfoSize; ) {
-        if (dbi->gpModInfoSize - i < sizeof(ModuleInfo))
-            throw InvalidPdb("got partial DBI module info");
-
-        ModuleInfo* info = (ModuleInfo*)(data + offset + i);
-
-        info->sc.padding1 = 0;
-        info->sc.padding2 = 0;
+template<typename CharT>
+std::basic_string<CharT> getTempPdbPath(const CharT* pdbPath) {
+    std::basic_string<CharT> temp(pdbPath);
+    temp.append(Strings<CharT>::tmpExtension);
+    return temp;
+}
 
-        // Patch the offsets "array". This is not used directly by Microsoft's
-        // DBI implementation and may contain non-deterministic data (e.g., the
-        // memory address of the actual allocated array). Thus, we need to zero
-        // it out.
-        info->offsets = 0;
+/**
+ * Writes the patched streams directly into the original PDB file. This is only
+ * done if the result is identical to rewriting the whole PDB. Returns false if
+ * the PDB must be rewritten instead.
+ *
+ * If a manifest is given, the patched PDB is added to it.
+ */
+template<typename CharT>
+bool patchPDBInPlace(const CharT* pdbPath, const MsfFile& msf, bool dryrun,
+        Manifest* manifest) {
 
-        // There is one entry that contains a path with a GUID. We need to patch
-        // this. It is often the first module info entry, but it is safer to
-        // find it by name.
-        if (strcmp(info->moduleName(), "* Linker Generated Manifest RES *") == 0 &&
-            strcmp(info->objectName(), "") == 0) {
+    PhaseTimer timer("writeMsfInPlace");
 
-            auto origModuleStream = msf.getStream(info->stream);
-            if (!origModuleStream)
-                continue;
+    try {
+        // Comparing the pages only needs read access. Thus, a dry run works on
+        // a read-only PDB too.
+        MemMap pdb(pdbPath, 0, true);
 
-            auto moduleStream = std::shared_ptr<MsfMemoryStream>(
-                    new MsfMemoryStream(origModuleStream.get()));
+        const uint8_t* buf = (const uint8_t*)pdb.buf();
 
-            patchModuleStream(moduleStream.get());
+        if (!msf.canWriteInPlace(buf, pdb.length()))
+            return false;
 
-            msf.replaceStream(info->stream, moduleStream);
+        if (!dryrun) {
+            // Both maps are of the same file, so the patched pages are seen
+            // through the read-only one as well.
+            MemMap out(pdbPath);
+            msf.writeInPlace((uint8_t*)out.buf());
         }
 
-        i += info->size();
-        ++moduleCount;
-    }
-
-    offset += dbi->gpModInfoSize;
-
-    // The section contributions follow the module info entries. These contain
-    // garbage due to struct alignment. They needed to be zeroed out.
+        // The pages were just compared with the patched ones and thus are
+        // likely still in memory.
+        if (manifest) {
+            PhaseTimer hashTimer("hashMsf");
+            hashTimer.addArg("bytes", pdb.length());
 
-    if (offset + dbi->sectionContributionSize > length) {
-        throw InvalidPdb(
-                "DBI section contributions size exceeds stream length");
-    }
+            Sha256 sha;
+            hashRange(sha, buf, 0, pdb.length(), &pdb);
 
-    const SectionContribVersion scVersion = *(SectionContribVersion*)(data + offset);
-    offset += sizeof(scVersion);
+            uint8_t digest[Sha256::kDigestLength];
+            sha.finish(digest);
 
-    if (scVersion != SectionContribVersion::v1 &&
-        scVersion != SectionContribVersion::v2) {
-        throw InvalidPdb("got invalid section contribution substream version");
+            manifest->add(pdbPath, pdb.length(), digest);
+        }
     }
-
-    const size_t scCount = (dbi->sectionContributionSize - sizeof(scVersion)) /
-        sizeof(SectionContribution);
-
-    SectionContribution* sectionContribs = (SectionContribution*)(data + offset);
-
-    for (size_t i = 0; i < scCount; ++i) {
-        SectionContribution& sc = sectionContribs[i];
-        sc.padding1 = 0;
-        sc.padding2 = 0;
+    catch (const std::system_error&) {
+        // Couldn't map the file. Fall back to rewriting it.
+        return false;
     }
 
-    offset += dbi->sectionContributionSize - sizeof(scVersion);
-
-    // Skip over the section map
-    offset += dbi->sectionMapSize;
-
-    // In the list of files, there are some temporary files with random GUIDs in
-    // the name.
-    if (dbi->fileInfoSize > 0) {
-
-        if (offset + dbi->fileInfoSize > length)
-            throw InvalidPdb("Missing file info in DBI stream");
-
-        uint8_t* p = data + offset;
-        uint8_t* pEnd = p + dbi->fileInfoSize;
-
-        // Skip over the header as it doesn't always provide correct
-        // information.
-        p += sizeof(FileInfoHeader);
-
-        // Skip over file indices array. We don't need them.
-        p += moduleCount * sizeof(uint16_t);
+    return true;
+}
 
-        // File counts array
-        uint16_t* fileCounts = (uint16_t*)p;
-        p += moduleCount * sizeof(*fileCounts);
+/**
+ * Patches a PDB file.
+ *
+ * If a cache is given, the patched PDB is taken from the cache if possible.
+ * Otherwise, it is added to the cache afterwards.
+ */
+template<typename CharT>
+void patchPDB(const CharT* pdbPath, const CV_INFO_PDB70* pdbInfo,
+        uint32_t timestamp, PendingSignature& signature, bool dryrun,
+        size_t pageSize, bool compactLayout, bool normalizeModules,
+        bool normalizeTypes, ThreadPool& pool,
+        PdbCache<CharT>* cache,
+        const uint8_t imageDigest[16], Manifest* manifest) {
 
-        if (p >= pEnd)
-            throw InvalidPdb("got partial file info in DBI stream");
+    PhaseTimer timer("patchPdb");
+    timer.addArg("pdb", tracePath(pdbPath));
 
-        uint32_t* offsets = (uint32_t*)p;
+    auto tmpPdbPath = getTempPdbPath(pdbPath);
 
-        uint32_t offsetCount = 0;
-        for (size_t i = 0; i < moduleCount; ++i)
-            offsetCount += fileCounts[i];
+    std::string cacheKey;
+    bool cached = false;
+    bool inPlace = false;
 
-        p += offsetCount * sizeof(*offsets);
+    // The digest of the rewritten PDB, if it is added to the manifest.
+    Sha256 sha;
+    uint64_t pdbLength = 0;
 
-        if (p >= pEnd)
-            throw InvalidPdb("got partial file info in DBI stream");
+    {
+        // Everything the PDB needs in memory until it is written out is
+        // allocated from here and released all at once afterwards.
+        Arena arena;
 
-        char* names = (char*)p;
+        auto pdb = openFile(pdbPath, FileMode<CharT>::readExisting);
 
-        for (size_t i = 0; i < offsetCount; ++i) {
-            const uint32_t& off = offsets[i];
+        MsfFile msf(pdb, &arena);
+
+        // Nothing needs to be done if this PDB is already reproducible. Not
+        // rewriting it also keeps its modification time unchanged so that
+        // later build steps aren't triggered again. The signature is only
+        // waited for if nothing else gives away that the PDB needs patching.
+        //
+        // Whether the module or type streams were normalized before, or the
+        // PDB laid out compactly, can't be told that cheaply. If they should
+        // be, the streams are always patched. Writing them in place then still
+        // leaves the file alone if nothing changed.
+        if (!compactLayout && !normalizeModules && !normalizeTypes &&
+            (pageSize == 0 || pageSize == msf.pageSize()) &&
+            mayBePatchedPdb(msf, pdbInfo, timestamp) &&
+            isPatchedPdb(msf, pdbInfo, timestamp, signature.get())) {
+            if (manifest)
+                addFileToManifest(*manifest, pdbPath);
+            return;
+        }
 
-            if ((uint8_t*)names + off + 1 > pEnd)
-                throw InvalidPdb("invalid offset for file info name");
+        if (pageSize != 0)
+            msf.setPageSize(pageSize);
 
-            char* name = names + off;
-            size_t len = strlen(name);
+        if (compactLayout)
+            setCompactPdbLayout(msf);
 
-            if ((uint8_t*)name + len + 1 > pEnd)
-                throw InvalidPdb("file name exceeds file info section size");
+        if (cache) {
+            PhaseTimer cacheTimer("cacheFetch");
+            cacheKey = pdbCacheKey(imageDigest, msf, normalizeModules,
+                    normalizeTypes);
+            cached = cache->fetch(cacheKey, tmpPdbPath.c_str());
+        }
 
-            normalizeFileNameGuid(name, len);
+        if (cached) {
+            std::cout << "Using cached PDB.\n";
+        }
+        else {
+            patchPDBStreams(msf, pdbInfo, pool, normalizeModules,
+                    normalizeTypes);
+            patchPDBSignature(msf, timestamp, signature.get());
+
+            // If the PDB is already laid out exactly as we would write it
+            // (e.g., it was previously rewritten by us), only the patched pages
+            // need to be written. This avoids rewriting what could be a very
+            // large file.
+            inPlace = patchPDBInPlace(pdbPath, msf, dryrun, manifest);
+
+            if (!inPlace) {
+                auto tmpPdb = openFile(tmpPdbPath.c_str(),
+                        FileMode<CharT>::readWriteEmpty);
+
+                // Write out the rewritten PDB to disk.
+                msf.write(tmpPdb, &pool, manifest ? &sha : NULL);
+
+                pdbLength = getFileSize(tmpPdb.get());
+            }
         }
     }
 
-    // Skip past the file info
-    offset += dbi->fileInfoSize;
-
-    // Skip past the TSM substream
-    offset += dbi->typeServerMapSize;
+    if (!inPlace) {
+        if (dryrun) {
+            // Delete the temporary file
+            deleteFile(tmpPdbPath.c_str());
+        } else {
+            // Rename the new PDB file over the old one
+            renameFile(tmpPdbPath.c_str(), pdbPath);
+        }
 
-    // Skip past the EC info
-    offset += dbi->ecInfoSize;
+        if (manifest) {
+            if (cached) {
+                addFileToManifest(*manifest, pdbPath);
+            }
+            else {
+                uint8_t digest[Sha256::kDigestLength];
+                sha.finish(digest);
+                manifest->add(pdbPath, pdbLength, digest);
+            }
+        }
+    }
 
-    // Skip past the debug header. This should be the last substream in the DBI
-    // stream.
-    offset += dbi->debugHeaderSize;
+    if (cache && !cached && !dryrun) {
+        try {
+            PhaseTimer cacheTimer("cacheStore");
+            cache->store(cacheKey, pdbPath);
+        }
+        catch (const std::system_error& error) {
+            // The cache is only an optimization. Don't fail because of it.
+            std::cerr << "Warning: Failed to add PDB to the cache ("
+                << error.what() << ")\n";
+        }
+    }
 }
 
 /**
- * Patches the symbol record stream.
+ * Calculates a digest of the image as it will be once it is patched. The new
+ * signature already covers everything that isn't patched. Thus, only it and the
+ * patches themselves need to be hashed, not the image again.
  *
- * There is up to 3 bytes of padding at the end of each symbol record. Since
- * garbage just lives there, it needs to be zeroed out.
+ * The list of patches is assumed to be sorted and the signature calculated.
  */
-void patchSymbolRecordsStream(MsfMemoryStream* stream) {
-
-    uint8_t* data = stream->data();
-    const size_t length = stream->length();
-
-    for (size_t i = 0; i < length; ) {
-
-        if (length - i < sizeof(SymbolRecord))
-            throw InvalidPdb("got partial symbol record");
-
-        SymbolRecord* rec = (SymbolRecord*)(data + i);
-
-        // The symbol record length must be at least the size of
-        // SymbolRecord::type and the size of the entire record must be a
-        // multiple of 4.
-        if (rec->length < sizeof(rec->type) ||
-            (rec->length + sizeof(rec->length)) % 4 != 0) {
-            throw InvalidPdb("invalid symbol record size");
-        }
-
-        const size_t dataLength = rec->length - sizeof(rec->type);
+void imageFingerprint(const PEFile& pe, const std::vector<Patch>& patches,
+        HashAlgorithm algorithm, uint8_t output[16]) {
 
-        // Bounds check.
-        if (i + sizeof(SymbolRecord) + dataLength > length)
-            throw InvalidPdb("symbol record size too large");
+    HasherRef hasher = makeHasher(algorithm);
 
-        // There is a maximum of 3 bytes of padding at the end of the data.
-        // Note that if the data length is < 3 and this overflows,
-        size_t tail = dataLength - 3;
+    hasher->update(pe.pdbSignature, sizeof(pe.pdbSignature));
 
-        // Find the null terminator at the end. The padding (if any) will be
-        // after this point.
-        while (tail + 1 < dataLength && rec->data[tail] != 0)
-            ++tail;
+    const uint64_t length = pe.length;
+    hasher->update(&length, sizeof(length));
 
-        // Zero out the padding.
-        while (tail < dataLength)
-            rec->data[tail++] = 0;
-
-        // Skip to next symbol record
-        i += sizeof(SymbolRecord) + dataLength;
+    for (auto&& patch: patches) {
+        const uint64_t range[] = { patch.offset, patch.length };
+        hasher->update(range, sizeof(range));
+        hasher->update(patch.data, patch.length);
     }
+
+    hasher->finish(output);
 }
 
 /**
- * Patch the public symbol info stream.
+ * Formats a digest as a string of hex digits.
  */
-void patchPublicSymbolStream(MsfMemoryStream* stream) {
-
-    // The public symbol info stream starts with the public symbol header
-    // followed by the (Global Symbol Info) GSI hash header. We only care about
-    // the public symbol header.
-    if (stream->length() < sizeof(PublicSymbolHeader))
-        throw InvalidPdb("public symbol stream too short");
+std::string hexDigest(const uint8_t digest[16]) {
 
-    PublicSymbolHeader* header = (PublicSymbolHeader*)stream->data();
+    static const char hex[] = "0123456789abcdef";
 
-    // Struct alignment padding
-    header->padding1 = 0;
+    std::string s;
+    for (size_t i = 0; i < 16; ++i) {
+        s.push_back(hex[digest[i] >> 4]);
+        s.push_back(hex[digest[i] & 0xF]);
+    }
 
-    // Microsoft's PDB writer has a bug where this field is not initialized in
-    // the constructor. However, there are other code paths that do initialize
-    // this value, but only sometimes. Thus, since Microsoft's tools are already
-    // broken because of this, we zero this out without worrying about it.
-    //
-    // Since fixing this would be a trivial one-liner for Microsoft, this patch
-    // could become silently obsolete in the future.
-    header->sectionCount = 0;
+    return s;
 }
 
 /**
- * Rewrites a PDB, eliminating non-determinism.
+ * Calculates what the image and its PDB will be like once they are patched,
+ * without modifying or writing any files. The PDB is patched in memory as
+ * usual, but instead of being written out, its streams are hashed where they
+ * are. See MsfFile::fingerprint().
  */
-void patchPDB(MsfFile& msf, const CV_INFO_PDB70* pdbInfo,
-        uint32_t timestamp, const uint8_t signature[16]) {
+template<typename CharT>
+void fingerprintImage(const CharT* imagePath, const CharT* pdbPath,
+        const PatchOptions& options) {
 
-    msf.replaceStream((size_t)PdbStreamType::streamTable, nullptr);
+    PhaseTimer timer("fingerprintImage");
 
-    // Read the PDB header
-    auto origPdbHeaderStream = msf.getStream((size_t)PdbStreamType::header);
-    if (!origPdbHeaderStream)
-        throw InvalidPdb("missing PDB header stream");
+    MemMap image(imagePath, 0, true);
 
-    auto pdbHeaderStream = std::shared_ptr<MsfMemoryStream>(
-            new MsfMemoryStream(origPdbHeaderStream.get()));
+    timer.addArg("image", tracePath(imagePath));
+    timer.addArg("bytes", image.length());
 
-    patchHeaderStream(msf, pdbHeaderStream.get(), pdbInfo, timestamp, signature);
+    PEFile pe = PEFile((uint8_t*)image.buf(), image.length());
 
-    msf.replaceStream((size_t)PdbStreamType::header, pdbHeaderStream);
+    Patches patches((uint8_t*)image.buf());
 
-    // Patch the DBI stream
-    if (auto origDbiStream = msf.getStream((size_t)PdbStreamType::dbi)) {
+    const CV_INFO_PDB70* pdbInfo = addImagePatches(pe, patches);
 
-        auto dbiStream = std::make_shared<MsfMemoryStream>(
-                origDbiStream.get());
+    std::unique_ptr<ThreadPool> ownPool;
+    if (!options.pool)
+        ownPool.reset(new ThreadPool(options.jobs));
 
-        patchDbiStream(msf, dbiStream.get());
+    ThreadPool& pool = options.pool ? *options.pool : *ownPool;
 
-        msf.replaceStream((size_t)PdbStreamType::dbi, dbiStream);
+    image.adviseSequential();
 
-        // We need the DBI header to get the symbol record stream. Note that bounds
-        // checking has already been done at this point.
-        const DbiHeader* dbiHeader = (const DbiHeader*)dbiStream->data();
+    PendingSignature signature(pool, pe.pdbSignature, [&]() {
+        calculateSignature(pe, patches.patches, options, pool, &image);
+    });
 
-        // Patch the symbol records stream
-        if (auto origSymRecStream = msf.getStream(dbiHeader->symbolRecordsStream)) {
-            auto symRecStream = std::make_shared<MsfMemoryStream>(
-                    origSymRecStream.get());
+    std::ostringstream ss;
 
-            patchSymbolRecordsStream(symRecStream.get());
+    if (pdbPath) {
+        Arena arena;
 
-            msf.replaceStream(dbiHeader->symbolRecordsStream, symRecStream);
-        }
+        auto pdb = openFile(pdbPath, FileMode<CharT>::readExisting);
 
-        // Patch the public symbols info stream
-        if (auto origPubSymStream =
-                msf.getStream(dbiHeader->publicSymbolStream)) {
-            auto pubSymStream = std::shared_ptr<MsfMemoryStream>(
-                    new MsfMemoryStream(origPubSymStream.get()));
+        MsfFile msf(pdb, &arena);
 
-            patchPublicSymbolStream(pubSymStream.get());
+        if (options.pageSize != 0)
+            msf.setPageSize(options.pageSize);
 
-            msf.replaceStream(dbiHeader->publicSymbolStream, pubSymStream);
-        }
+        if (options.compactLayout)
+            setCompactPdbLayout(msf);
+
+        patchPDBStreams(msf, pdbInfo, pool, options.normalizeModules,
+                options.normalizeTypes);
+        patchPDBSignature(msf, pe.timestamp, signature.get());
+
+        uint8_t digest[16];
+        msf.fingerprint(options.hash, pool, digest);
+
+        ss << "PDB fingerprint: " << hexDigest(digest) << "\n";
     }
-}
 
-/**
- * Patches a PDB file.
- */
-template<typename CharT>
-void patchPDB(const CharT* pdbPath, const CV_INFO_PDB70* pdbInfo,
-        uint32_t timestamp, const uint8_t signature[16], bool dryrun) {
+    signature.get();
 
-    auto tmpPdbPath = getTempPdbPath(pdbPath);
+    uint8_t digest[16];
+    imageFingerprint(pe, patches.patches, options.hash, digest);
 
-    {
-        auto pdb = openFile(pdbPath, FileMode<CharT>::readExisting);
-        auto tmpPdb = openFile(tmpPdbPath.c_str(), FileMode<CharT>::writeEmpty);
+    // Write both at once so that they stay together when several images are
+    // fingerprinted at the same time.
+    std::cout << "Image fingerprint: " + hexDigest(digest) + "\n" + ss.str()
+        << std::flush;
+}
 
-        MsfFile msf(pdb);
+template<typename CharT>
+void patchImageImpl(const CharT* imagePath, const CharT* pdbPath,
+        const PatchOptions& options) {
 
-        patchPDB(msf, pdbInfo, timestamp, signature);
+    PhaseTimer timer("patchImage");
 
-        // Write out the rewritten PDB to disk.
-        msf.write(tmpPdb);
+    if (options.fingerprint) {
+        fingerprintImage(imagePath, pdbPath, options);
+        return;
     }
 
-    if (dryrun) {
-        // Delete the temporary file
-        deleteFile(tmpPdbPath.c_str());
-    } else {
-        // Rename the new PDB file over the old one
-        renameFile(tmpPdbPath.c_str(), pdbPath);
-    }
-}
+    const bool dryrun = options.dryrun;
 
-template<typename CharT>
-void patchImageImpl(const CharT* imagePath, const CharT* pdbPath, bool dryrun) {
-    MemMap image(imagePath);
+    // Nothing is written to the image in a dry run. Mapping it read-only
+    // guarantees that.
+    MemMap image(imagePath, 0, dryrun);
 
     uint8_t* buf = (uint8_t*)image.buf();
     const size_t length = image.length();
 
+    timer.addArg("image", tracePath(imagePath));
+    timer.addArg("bytes", length);
+
     PEFile pe = PEFile(buf, length);
 
     Patches patches(buf);
 
-    patches.add(&pe.fileHeader->TimeDateStamp, &pe.timestamp,
-            "IMAGE_FILE_HEADER.TimeDateStamp");
-
-    const CV_INFO_PDB70* pdbInfo = NULL;
+    const CV_INFO_PDB70* pdbInfo = addImagePatches(pe, patches);
 
-    switch (pe.magic()) {
-        case IMAGE_NT_OPTIONAL_HDR32_MAGIC: {
-            // Patch as a PE32 file
-            auto opt = pe.optionalHeader<IMAGE_OPTIONAL_HEADER32>();
-            pdbInfo = pe.pdbInfo(opt);
-            patchOptionalHeader(pe, patches, opt);
-            break;
-        }
+    std::unique_ptr<ThreadPool> ownPool;
+    if (!options.pool)
+        ownPool.reset(new ThreadPool(options.jobs));
 
-        case IMAGE_NT_OPTIONAL_HDR64_MAGIC: {
-            // Patch as a PE32+ file
-            auto opt = pe.optionalHeader<IMAGE_OPTIONAL_HEADER64>();
-            pdbInfo = pe.pdbInfo(opt);
-            patchOptionalHeader(pe, patches, opt);
-            break;
-        }
+    ThreadPool& pool = options.pool ? *options.pool : *ownPool;
 
-        default:
-            throw InvalidImage("unsupported IMAGE_NT_HEADERS.OptionalHeader");
+    // The cache key must be calculated from the unpatched image.
+    std::unique_ptr<PdbCache<CharT>> cache;
+    uint8_t imageDigest[16] = {};
+    if (pdbPath && options.cacheDir) {
+        cache.reset(new PdbCache<CharT>(options.cacheDir, options.cacheSize));
+        imageCacheDigest(buf, length, hashAlgorithmName(options.hash),
+                options.hashChunkSize, imageDigest);
     }
 
-    patches.sort();
-
     // Calculate the checksum of the PE file. Note that the checksum is stored
     // in the PDB signature. When the patches are applied, this checksum is what
     // will be set in the file.
-    calculateChecksum(buf, length, patches.patches, pe.pdbSignature);
+    //
+    // Only the headers are needed for anything else. Thus, the rest of the
+    // image is streamed through memory rather than kept there.
+    //
+    // The PDB only needs the checksum for its header stream. Thus, the other
+    // streams are patched while the image is being hashed.
+    image.adviseSequential();
+
+    PendingSignature signature(pool, pe.pdbSignature, [&]() {
+        calculateSignature(pe, patches.patches, options, pool, &image);
+    });
+
+    // Manifest digests are of the files as they end up. The image's is
+    // calculated while the PDB is being written.
+    Manifest* manifest = dryrun ? NULL : options.manifest;
+
+    uint8_t imageSha256[Sha256::kDigestLength];
+    if (manifest) {
+        signature.then([&]() {
+            sha256PatchedImage(buf, length, patches.patches, &image,
+                    imageSha256);
+        });
+    }
 
     // Patch the PDB file.
     if (pdbPath) {
-        patchPDB(pdbPath, pdbInfo, pe.timestamp, pe.pdbSignature, dryrun);
+        patchPDB(pdbPath, pdbInfo, pe.timestamp, signature, dryrun,
+                options.pageSize, options.compactLayout,
+                options.normalizeModules, options.normalizeTypes, pool,
+                cache.get(), imageDigest, manifest);
     }
 
+    signature.wait();
+
     // Patch the ilk file with the new PDB signature. If we don't do this,
     // incremental linking will fail due to a signature mismatch.
-    if (pdbInfo) {
-        patchIlk(imagePath, pdbInfo->Signature, pe.pdbSignature, dryrun);
+    if (pdbInfo && memcmp(pdbInfo->Signature, pe.pdbSignature,
+                sizeof(pe.pdbSignature)) != 0) {
+        patchIlk(imagePath, pdbInfo->Signature, pe.pdbSignature, dryrun,
+                pool);
     }
 
     patches.apply(dryrun);
+
+    if (manifest)
+        manifest->add(imagePath, length, imageSha256);
 }
 
 }
 
 #if defined(_WIN32) && defined(UNICODE)
 
-void patchImage(const wchar_t* imagePath, const wchar_t* pdbPath, bool dryrun) {
-    patchImageImpl(imagePath, pdbPath, dryrun);
+void patchImage(const wchar_t* imagePath, const wchar_t* pdbPath,
+        const PatchOptions& options) {
+    patchImageImpl(imagePath, pdbPath, options);
 }
 
 #else
 
-void patchImage(const char* imagePath, const char* pdbPath, bool dryrun) {
-    patchImageImpl(imagePath, pdbPath, dryrun);
+void patchImage(const char* imagePath, const char* pdbPath,
+        const PatchOptions& options) {
+    patchImageImpl(imagePath, pdbPath, options);
 }
 
 #endif
+
+void patchImage(uint8_t* image, size_t length, MsfFile* pdb, PdbSink* sink,
+        const PatchOptions& options) {
+
+    PhaseTimer timer("patchImage");
+
+    PEFile pe = PEFile(image, length);
+
+    Patches patches(image);
+
+    const CV_INFO_PDB70* pdbInfo = addImagePatches(pe, patches);
+
+    std::unique_ptr<ThreadPool> ownPool;
+    if (!options.pool)
+        ownPool.reset(new ThreadPool(options.jobs));
+
+    ThreadPool& pool = options.pool ? *options.pool : *ownPool;
+
+    // As when patching files, the PDB streams are patched while the image is
+    // being hashed.
+    PendingSignature signature(pool, pe.pdbSignature, [&]() {
+        calculateSignature(pe, patches.patches, options, pool, NULL);
+    });
+
+    if (pdb) {
+        PhaseTimer pdbTimer("patchPdb");
+
+        if (options.pageSize != 0)
+            pdb->setPageSize(options.pageSize);
+
+        if (options.compactLayout)
+            setCompactPdbLayout(*pdb);
+
+        patchPDBStreams(*pdb, pdbInfo, pool, options.normalizeModules,
+                options.normalizeTypes);
+        patchPDBSignature(*pdb, pe.timestamp, signature.get());
+
+        if (sink && !options.dryrun) {
+            const size_t pdbLength = pdb->writtenLength();
+
+            pdb->write(sink->allocate(pdbLength), pdbLength, &pool);
+
+            sink->finish();
+        }
+    }
+
+    signature.get();
+
+    patches.apply(options.dryrun);
+}
@@ -21,16 +21,155 @@
  */
 #pragma once
 
+#include <stdlib.h> // For size_t
+#include <stdint.h>
+
+#include <vector>
+
+#include "util/hash.h"
+
+class Manifest;
+class MsfFile;
+class ThreadPool;
+
+/**
+ * Default maximum size of the PDB cache.
+ */
+const uint64_t kDefaultCacheSize = 4ULL * 1024 * 1024 * 1024;
+
+/**
+ * Options that control how an image and its PDB are patched.
+ */
+struct PatchOptions {
+    // If true, no files are modified.
+    bool dryrun;
+
+    // Maximum number of threads to use. If 0, the number of hardware threads
+    // is used.
+    size_t jobs;
+
+    // Hash used to calculate the new image and PDB signature.
+    HashAlgorithm hash;
+
+    // If not 0, the signature is calculated as a tree hash with chunks of this
+    // many bytes. The chunks are hashed in parallel. This gives a different
+    // signature than hashing everything sequentially.
+    size_t hashChunkSize;
+
+    // If not NULL, this pool is used instead of creating a new one with `jobs`
+    // threads. This lets the threads be reused between images.
+    ThreadPool* pool;
+
+    // If not NULL, patched PDBs are cached in this directory so that the same
+    // PDB doesn't need to be patched again.
+#if defined(_WIN32) && defined(UNICODE)
+    const wchar_t* cacheDir;
+#else
+    const char* cacheDir;
+#endif
+
+    // Maximum size of the cache, in bytes. The least recently used PDBs are
+    // deleted to stay within it.
+    uint64_t cacheSize;
+
+    // Page size of the rewritten PDB. If 0, the page size of the input PDB is
+    // kept. Larger pages allow larger PDBs.
+    size_t pageSize;
+
+    // Write the PDB with the compact MSF layout. See
+    // MsfFile::setCompactLayout().
+    bool compactLayout;
+
+    // Normalize the symbols of every module stream, not just the one that is
+    // known to contain a GUID. Object file paths with GUIDs in them and the
+    // padding of symbol records differ between otherwise identical builds.
+    bool normalizeModules;
+
+    // Normalize the padding of the records in the type and ID info streams.
+    bool normalizeTypes;
+
+    // Instead of patching anything, print digests of the image and PDB as they
+    // would be after patching. No files are modified or written. Ignored when
+    // patching in memory.
+    bool fingerprint;
+
+    // If not NULL, the sizes and SHA-256 digests of the patched image and PDB
+    // are added to this manifest. They are calculated while the files are
+    // written where possible. Ignored in a dry run and when patching in memory.
+    Manifest* manifest;
+
+    PatchOptions()
+        : dryrun(true), jobs(0), hash(HashAlgorithm::md5), hashChunkSize(0),
+          pool(NULL), cacheDir(NULL), cacheSize(kDefaultCacheSize),
+          pageSize(0), compactLayout(false), normalizeModules(false),
+          normalizeTypes(false), fingerprint(false),
+          manifest(NULL)
+    {}
+};
+
 /**
  * Patches the given image and its associated PDB to eliminate the
  * non-deterministic parts of the files.
  */
 #if defined(_WIN32) && defined(UNICODE)
 
-void patchImage(const wchar_t* imagePath, const wchar_t* pdbPath, bool dryrun = true);
+void patchImage(const wchar_t* imagePath, const wchar_t* pdbPath,
+        const PatchOptions& options = PatchOptions());
 
 #else
 
-void patchImage(const char* imagePath, const char* pdbPath, bool dryrun = true);
+void patchImage(const char* imagePath, const char* pdbPath,
+        const PatchOptions& options = PatchOptions());
+
+#endif
+
+/**
+ * Receives the patched PDB when patching in memory.
+ */
+class PdbSink {
+public:
+    virtual ~PdbSink() {}
 
-#endif
\ No newline at end of file
+    /**
+     * Returns a buffer of `length` bytes that the patched PDB is written to. It
+     * must stay valid until finish() has been called.
+     */
+    virtual uint8_t* allocate(size_t length) = 0;
+
+    /**
+     * Called once the whole PDB has been written to the buffer.
+     */
+    virtual void finish() {}
+};
+
+/**
+ * A PdbSink that keeps the patched PDB in a vector.
+ */
+class PdbVectorSink : public PdbSink {
+public:
+    std::vector<uint8_t> data;
+
+    uint8_t* allocate(size_t length) {
+        data.resize(length);
+        return data.data();
+    }
+};
+
+/**
+ * Like the above, but the image and the PDB are already in memory. Nothing is
+ * read from or written to disk. This lets a linker or build system patch its
+ * outputs before they are ever written out. No .ilk file is patched and no
+ * cache is used.
+ *
+ * Params:
+ *   image   = The image. It is patched in place unless this is a dry run.
+ *   length  = Length of the image, in bytes.
+ *   pdb     = The PDB of the image or NULL if there is none. It is patched in
+ *             memory. See the MsfFile constructors for how to read it from a
+ *             buffer or any other stream.
+ *   sink    = Receives the patched PDB. If NULL, or in a dry run, the PDB is
+ *             patched but not written.
+ *   options = As above. The cache directory is ignored.
+ */
+void patchImage(uint8_t* image, size_t length, MsfFile* pdb, PdbSink* sink,
+        const PatchOptions& options = PatchOptions());
@@ -0,0 +1,1905 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * This file contains the logic for patching the streams of a PDB. The PDB is
+ * patched in memory such that it can then be written out in one go.
+ */
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "ducible/patch_pdb.h"
+#include "ducible/symbol_padding.h"
+
+#include "msf/msf.h"
+#include "msf/stream.h"
+#include "msf/file_stream.h"
+#include "msf/memory_stream.h"
+#include "msf/overlay_stream.h"
+
+#include "pdb/format.h"
+#include "pdb/pdb.h"
+#include "pdb/cvinfo.h"
+
+#include "util/guid.h"
+#include "util/stats.h"
+#include "util/thread_pool.h"
+
+namespace {
+
+const char kNullGuid[] = "{00000000-0000-0000-0000-000000000000}";
+
+/**
+ * Compares the PE and PDB signatures to see if they match.
+ */
+bool matchingSignatures(const CV_INFO_PDB70& pdbInfo,
+                        const PdbStream70& pdbHeader) {
+    if (pdbInfo.Age != pdbHeader.age ||
+        memcmp(pdbInfo.Signature, pdbHeader.sig70, sizeof(pdbHeader.sig70)) != 0
+        ) {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Helper function for normalizing a GUID in a NULL terminated file name.
+ */
+void normalizeFileNameGuid(char* path, size_t length) {
+
+    if (char* guid = (char*)findGuid((const char*)path,
+                (const char*)path + length)) {
+        memcpy(guid, kNullGuid, sizeof(kNullGuid));
+    }
+}
+
+/**
+ * Patches the "/LinkInfo" named stream.
+ */
+void patchLinkInfoStream(MsfMemoryStream* stream) {
+    PhaseTimer timer("patchLinkInfoStream");
+    timer.addArg("bytes", stream->length());
+
+    uint8_t* data = stream->data();
+    const size_t length = stream->length();
+
+    if (length == 0)
+        return;
+
+    if (length < sizeof(LinkInfo))
+        throw InvalidPdb("got partial LinkInfo stream");
+
+    const LinkInfo* linkInfo = (LinkInfo*)data;
+
+    if (linkInfo->size > length)
+        throw InvalidPdb("LinkInfo size too large for stream");
+
+    // The rest of the stream appears to be garbage. Thus, we truncate it.
+    stream->resize(linkInfo->size);
+}
+
+/**
+ * Sorts an array of 32-bit offsets. Large arrays are radix sorted a byte at a
+ * time. Passes where every offset has the same byte are skipped.
+ */
+void sortOffsets(uint32_t* offsets, size_t count) {
+
+    // Below this, std::sort is faster than making passes over the array.
+    static const size_t kMinRadixSortCount = 4096;
+
+    if (count < kMinRadixSortCount) {
+        std::sort(offsets, offsets + count);
+        return;
+    }
+
+    // Histograms of each byte, all built in one pass.
+    std::vector<size_t> counts(4 * 256);
+    for (size_t i = 0; i < count; ++i) {
+        const uint32_t x = offsets[i];
+        ++counts[0 * 256 + ((x >>  0) & 0xFF)];
+        ++counts[1 * 256 + ((x >>  8) & 0xFF)];
+        ++counts[2 * 256 + ((x >> 16) & 0xFF)];
+        ++counts[3 * 256 + ((x >> 24) & 0xFF)];
+    }
+
+    std::vector<uint32_t> temp(count);
+    uint32_t* from = offsets;
+    uint32_t* to = temp.data();
+
+    for (size_t pass = 0; pass < 4; ++pass) {
+        size_t* c = &counts[pass * 256];
+        const size_t shift = pass * 8;
+
+        if (c[(from[0] >> shift) & 0xFF] == count)
+            continue;
+
+        // Turn the counts into the starting position of each bucket.
+        size_t total = 0;
+        for (size_t b = 0; b < 256; ++b) {
+            const size_t n = c[b];
+            c[b] = total;
+            total += n;
+        }
+
+        for (size_t i = 0; i < count; ++i)
+            to[c[(from[i] >> shift) & 0xFF]++] = from[i];
+
+        std::swap(from, to);
+    }
+
+    if (from != offsets)
+        memcpy(offsets, from, count * sizeof(uint32_t));
+}
+
+/**
+ * Normalizes the GUIDs in the strings at the given sorted offsets into the
+ * string table. Offsets must be less than the size of the string table.
+ *
+ * Several offsets can point into the same string. Thus, the end of a string is
+ * only searched for once and is reused for the offsets after it that are
+ * within the same string. Like normalizeFileNameGuid(), this truncates a
+ * string right after its GUID.
+ */
+void normalizeNames(char* strings, size_t stringsSize,
+        const uint32_t* first, const uint32_t* last) {
+
+    // The offset of the null terminator of the last string.
+    size_t end = 0;
+    bool haveEnd = false;
+
+    for (; first != last; ++first) {
+        const size_t offset = *first;
+
+        if (offset == 0)
+            continue;
+
+        if (!haveEnd || offset > end) {
+            const char* nul = (const char*)memchr(strings + offset, '\0',
+                    stringsSize - offset);
+
+            // Same as: offset + len + 1 > stringsSize
+            if (!nul)
+                throw InvalidPdb("got invalid offset into string table");
+
+            end = size_t(nul - strings);
+            haveEnd = true;
+        }
+
+        if (char* guid = (char*)findGuid((const char*)strings + offset,
+                    (const char*)strings + end)) {
+            memcpy(guid, kNullGuid, sizeof(kNullGuid));
+
+            // The null terminator is copied too, which cuts the string short.
+            end = size_t(guid - strings) + kGuidLength;
+        }
+    }
+}
+
+/**
+ * Patches the "/names" stream.
+ *
+ * The strings are normalized in chunks of offsets concurrently. Chunks are
+ * split such that no two of them have an offset into the same string. Only the
+ * strings themselves are written to, so the result is the same as normalizing
+ * them one by one.
+ */
+void patchNamesStream(MsfMemoryStream* stream, ThreadPool& pool) {
+    PhaseTimer timer("patchNamesStream");
+    timer.addArg("bytes", stream->length());
+
+    // Chunks with fewer offsets than this aren't worth the overhead of a task.
+    static const size_t kMinChunkOffsets = 64 * 1024;
+
+    uint8_t* data = stream->data();
+    uint8_t* dataEnd = data + stream->length();
+
+    // Parse the header
+    if (size_t(dataEnd - data) < sizeof(StringTableHeader))
+        throw InvalidPdb("missing string table header");
+
+    StringTableHeader* header = (StringTableHeader*)data;
+
+    data += sizeof(*header);
+
+    if (header->signature != kHashTableSignature)
+        throw InvalidPdb("got invalid string table signature");
+
+    if (header->version != 1 && header->version != 2)
+        throw InvalidPdb("got invalid or unsupported string table version");
+
+    if (size_t(dataEnd - data) < header->stringsSize)
+        throw InvalidPdb("got partial string table data");
+
+    data += header->stringsSize;
+
+    if (size_t(dataEnd - data) < sizeof(uint32_t))
+        throw InvalidPdb("missing string table offset array length");
+
+    // Offsets array length
+    uint32_t offsetsLength = *(uint32_t*)data;
+
+    data += sizeof(offsetsLength);
+
+    if (size_t(dataEnd - data) / sizeof(uint32_t) < offsetsLength)
+        throw InvalidPdb("got partial string table offsets array");
+
+    uint32_t* offsets = (uint32_t*)data;
+
+    data += offsetsLength * sizeof(uint32_t);
+
+    // Sort the offsets. There is some non-determinism creeping in here somehow.
+    sortOffsets(offsets, offsetsLength);
+
+    if (offsetsLength == 0)
+        return;
+
+    // Now that they're sorted, only the last offset needs to be checked.
+    if (offsets[offsetsLength-1] >= header->stringsSize)
+        throw InvalidPdb("got invalid offset into string table");
+
+    char* strings = header->strings;
+    const size_t stringsSize = header->stringsSize;
+
+    const size_t chunkSize = std::max(kMinChunkOffsets,
+            (size_t)offsetsLength / (pool.threads() * 4));
+
+    if (pool.threads() == 1 || offsetsLength <= chunkSize) {
+        normalizeNames(strings, stringsSize, offsets, offsets + offsetsLength);
+        return;
+    }
+
+    // Split the offsets into chunks. The end of a chunk is moved past the
+    // offsets that are within the same string as its last offset.
+    std::vector<size_t> ranges(1, 0);
+
+    for (size_t i = chunkSize; i < offsetsLength; ) {
+        const size_t offset = offsets[i-1];
+
+        const char* nul = (const char*)memchr(strings + offset, '\0',
+                stringsSize - offset);
+        if (!nul)
+            throw InvalidPdb("got invalid offset into string table");
+
+        const size_t end = size_t(nul - strings);
+        while (i < offsetsLength && offsets[i] <= end)
+            ++i;
+
+        if (i == offsetsLength)
+            break;
+
+        ranges.push_back(i);
+        i += chunkSize;
+    }
+
+    ranges.push_back(offsetsLength);
+
+    std::vector<std::future<void>> tasks;
+
+    for (size_t i = 0; i + 1 < ranges.size(); ++i) {
+        const uint32_t* first = offsets + ranges[i];
+        const uint32_t* last = offsets + ranges[i+1];
+
+        tasks.push_back(pool.submit([strings, stringsSize, first, last]() {
+            PhaseTimer timer("normalizeNames");
+            timer.addArg("offsets", uint64_t(last - first));
+            normalizeNames(strings, stringsSize, first, last);
+        }));
+    }
+
+    pool.wait(tasks);
+}
+
+/**
+ * Checks the PDB header stream. Returns the table of named streams, which
+ * refers to the stream's data.
+ */
+NameMapTable readHeaderStream(MsfMemoryStream* stream,
+        const CV_INFO_PDB70* pdbInfo) {
+
+    uint8_t* data = stream->data();
+    const uint8_t* dataEnd = stream->data() + stream->length();
+
+    if (size_t(dataEnd - data) < sizeof(PdbStream70))
+        throw InvalidPdb("missing PDB 7.0 header");
+
+    PdbStream70* header = (PdbStream70*)data;
+
+    data += sizeof(*header);
+
+    if (header->version < PdbVersion::vc70)
+        throw InvalidPdb("unsupported PDB implementation version");
+
+    // Check that this PDB matches what the PE file expects
+    if (!pdbInfo || !matchingSignatures(*pdbInfo, *header))
+        throw InvalidPdb("PE and PDB signatures do not match");
+
+    return NameMapTable(data, dataEnd);
+}
+
+/**
+ * Patches the PDB header stream. It must have been checked by
+ * readHeaderStream() already.
+ */
+void patchHeaderStream(MsfMemoryStream* stream, uint32_t timestamp,
+        const uint8_t signature[16]) {
+
+    PhaseTimer timer("patchHeaderStream");
+    timer.addArg("bytes", stream->length());
+
+    PdbStream70* header = (PdbStream70*)stream->data();
+
+    header->timestamp = timestamp;
+    header->age = 1;
+    memcpy(header->sig70, signature, sizeof(header->sig70));
+}
+
+/**
+ * Patches a module stream.
+ */
+void patchModuleStream(MsfMemoryStream* stream) {
+
+    PhaseTimer timer("patchModuleStream");
+    timer.addArg("bytes", stream->length());
+
+    uint8_t* data = stream->data();
+    const uint8_t* dataEnd = stream->data() + stream->length();
+
+    if (size_t(dataEnd - data) < sizeof(uint16_t))
+        throw InvalidPdb("got partial module info stream");
+
+    uint32_t type = *(uint32_t*)data;
+    data += sizeof(type);
+
+    if (type != CV_SIGNATURE_C13)
+        return;
+
+    if (size_t(dataEnd - data) < sizeof(SymbolRecord))
+        throw InvalidPdb("missing symbol record in module info stream");
+
+    const SymbolRecord* sym = (const SymbolRecord*)data;
+
+    // We're only concerned about objects here
+    if (sym->type != S_OBJNAME)
+        return;
+
+    // Recast now that we know the type.
+    OBJNAMESYM* objsym = (OBJNAMESYM*)data;
+
+    // The signature always seems to be 0.
+    if (objsym->signature != 0)
+        throw InvalidPdb("got invalid OBJNAMESYM symbol record signature");
+
+    if (size_t(dataEnd - data) < objsym->reclen)
+        throw InvalidPdb("got partial OBJNAMESYM symbol record");
+
+    size_t namelen = strlen((const char*)objsym->name);
+
+    if ((uint8_t*)objsym->name + namelen + 1 > dataEnd)
+        throw InvalidPdb("object path in symbol record is not null-terminated");
+
+    normalizeFileNameGuid((char*)objsym->name, namelen);
+}
+
+/**
+ * Returns the offset of the name in symbol records of the given type, or 0 if
+ * the record doesn't end with a null-terminated name. Only in those records can
+ * the padding be told apart from the data without knowing anything else about
+ * the record.
+ */
+size_t symbolNameOffset(uint16_t type) {
+    switch (type) {
+        case S_OBJNAME:     return offsetof(OBJNAMESYM, name);
+        case S_BLOCK32:     return offsetof(BLOCKSYM32, name);
+        case S_LABEL32:     return offsetof(LABELSYM32, name);
+        case S_REGISTER:    return offsetof(REGSYM, name);
+        case S_UDT:         return offsetof(UDTSYM, name);
+        case S_BPREL32:     return offsetof(BPRELSYM32, name);
+        case S_LDATA32:
+        case S_GDATA32:     return offsetof(DATASYM32, name);
+        case S_PUB32:       return offsetof(PUBSYM32, name);
+        case S_LPROC32:
+        case S_GPROC32:
+        case S_LPROC32_ID:
+        case S_GPROC32_ID:  return offsetof(PROCSYM32, name);
+        case S_REGREL32:    return offsetof(REGREL32, name);
+        case S_LTHREAD32:
+        case S_GTHREAD32:   return offsetof(THREADSYM32, name);
+        case S_SECTION:     return offsetof(SECTIONSYM, name);
+        case S_COFFGROUP:   return offsetof(COFFGROUPSYM, name);
+        case S_EXPORT:      return offsetof(EXPORTSYM, name);
+        case S_COMPILE3:    return offsetof(COMPILESYM3, verSz);
+        case S_LOCAL:       return offsetof(LOCALSYM, name);
+        default:            return 0;
+    }
+}
+
+/**
+ * A module stream that needs to be patched and the length of the symbols at
+ * its start.
+ */
+struct ModuleStream {
+    size_t stream;
+    size_t symbolsSize;
+};
+
+const char* kIncLinkWarning = "\
+Warning: /INCREMENTAL was specified in the linker options. Incremental linking \
+is known to not work with Ducible.";
+
+/**
+ * Patches a copy of the DBI stream.
+ *
+ * The module streams that need to be patched are added to `moduleStreams`.
+ * That is only the one with a GUID in it, unless all of them are to be
+ * normalized.
+ */
+void patchDbiStream(uint8_t* data, const size_t length, bool allModules,
+        std::vector<ModuleStream>& moduleStreams) {
+
+    if (length < sizeof(DbiHeader))
+        throw InvalidPdb("DBI stream too short");
+
+    size_t offset = 0;
+
+    DbiHeader* dbi = (DbiHeader*)data;
+
+    // Sanity checks
+    if (dbi->signature != dbiHeaderSignature)
+        throw InvalidPdb("invalid DBI header signature");
+
+    if (dbi->version != DbiVersion::v70)
+        throw InvalidPdb("Unsupported DBI stream version");
+
+    // Display a warning about incrementally linking
+    if (dbi->flags.incLink)
+        std::cout << kIncLinkWarning << std::endl;
+
+    // Patch the age. This must match the age in the PDB stream.
+    dbi->age = 1;
+
+    offset += sizeof(*dbi);
+
+    // The module info immediately follows the header.
+
+    // Check bounds
+    if (offset + dbi->gpModInfoSize > length)
+        throw InvalidPdb("DBI module info size exceeds stream length");
+
+    // Number of modules
+    size_t moduleCount = 0;
+
+    // Patch the module info entries
+    for (size_t i = 0; i < dbi->gpModInfoSize; ) {
+        if (dbi->gpModInfoSize - i < sizeof(ModuleInfo))
+            throw InvalidPdb("got partial DBI module info");
+
+        ModuleInfo* info = (ModuleInfo*)(data + offset + i);
+
+        info->sc.padding1 = 0;
+        info->sc.padding2 = 0;
+
+        // Patch the offsets "array". This is not used directly by Microsoft's
+        // DBI implementation and may contain non-deterministic data (e.g., the
+        // memory address of the actual allocated array). Thus, we need to zero
+        // it out.
+        info->offsets = 0;
+
+        // There is one entry that contains a path with a GUID. We need to patch
+        // this. It is often the first module info entry, but it is safer to
+        // find it by name.
+        if (allModules) {
+            if (info->stream != invalidStream) {
+                ModuleStream module = {info->stream, info->symbolsSize};
+                moduleStreams.push_back(module);
+            }
+        }
+        else if (strcmp(info->moduleName(), "* Linker Generated Manifest RES *") == 0 &&
+            strcmp(info->objectName(), "") == 0) {
+            ModuleStream module = {info->stream, info->symbolsSize};
+            moduleStreams.push_back(module);
+        }
+
+        i += info->size();
+        ++moduleCount;
+    }
+
+    offset += dbi->gpModInfoSize;
+
+    // The section contributions follow the module info entries. These contain
+    // garbage due to struct alignment. They needed to be zeroed out.
+
+    if (offset + dbi->sectionContributionSize > length) {
+        throw InvalidPdb(
+                "DBI section contributions size exceeds stream length");
+    }
+
+    const SectionContribVersion scVersion = *(SectionContribVersion*)(data + offset);
+    offset += sizeof(scVersion);
+
+    if (scVersion != SectionContribVersion::v1 &&
+        scVersion != SectionContribVersion::v2) {
+        throw InvalidPdb("got invalid section contribution substream version");
+    }
+
+    const size_t scCount = (dbi->sectionContributionSize - sizeof(scVersion)) /
+        sizeof(SectionContribution);
+
+    SectionContribution* sectionContribs = (SectionContribution*)(data + offset);
+
+    for (size_t i = 0; i < scCount; ++i) {
+        SectionContribution& sc = sectionContribs[i];
+        sc.padding1 = 0;
+        sc.padding2 = 0;
+    }
+
+    offset += dbi->sectionContributionSize - sizeof(scVersion);
+
+    // Skip over the section map
+    offset += dbi->sectionMapSize;
+
+    // In the list of files, there are some temporary files with random GUIDs in
+    // the name.
+    if (dbi->fileInfoSize > 0) {
+
+        if (offset + dbi->fileInfoSize > length)
+            throw InvalidPdb("Missing file info in DBI stream");
+
+        uint8_t* p = data + offset;
+        uint8_t* pEnd = p + dbi->fileInfoSize;
+
+        // Skip over the header as it doesn't always provide correct
+        // information.
+        p += sizeof(FileInfoHeader);
+
+        // Skip over file indices array. We don't need them.
+        p += moduleCount * sizeof(uint16_t);
+
+        // File counts array
+        uint16_t* fileCounts = (uint16_t*)p;
+        p += moduleCount * sizeof(*fileCounts);
+
+        if (p >= pEnd)
+            throw InvalidPdb("got partial file info in DBI stream");
+
+        uint32_t* offsets = (uint32_t*)p;
+
+        uint32_t offsetCount = 0;
+        for (size_t i = 0; i < moduleCount; ++i)
+            offsetCount += fileCounts[i];
+
+        p += offsetCount * sizeof(*offsets);
+
+        if (p >= pEnd)
+            throw InvalidPdb("got partial file info in DBI stream");
+
+        char* names = (char*)p;
+
+        for (size_t i = 0; i < offsetCount; ++i) {
+            const uint32_t& off = offsets[i];
+
+            if ((uint8_t*)names + off + 1 > pEnd)
+                throw InvalidPdb("invalid offset for file info name");
+
+            char* name = names + off;
+            size_t len = strlen(name);
+
+            if ((uint8_t*)name + len + 1 > pEnd)
+                throw InvalidPdb("file name exceeds file info section size");
+
+            normalizeFileNameGuid(name, len);
+        }
+    }
+
+    // Skip past the file info
+    offset += dbi->fileInfoSize;
+
+    // Skip past the TSM substream
+    offset += dbi->typeServerMapSize;
+
+    // Skip past the EC info
+    offset += dbi->ecInfoSize;
+
+    // Skip past the debug header. This should be the last substream in the DBI
+    // stream.
+    offset += dbi->debugHeaderSize;
+}
+
+/**
+ * Patches the DBI stream.
+ *
+ * The DBI stream is parsed from a temporary copy. Writing the copy back only
+ * modifies the pages of the stream that actually changed.
+ */
+void patchDbiStream(MsfStream* stream, bool allModules,
+        std::vector<ModuleStream>& moduleStreams) {
+
+    PhaseTimer timer("patchDbiStream");
+    timer.addArg("bytes", stream->length());
+
+    std::vector<uint8_t> data(stream->length());
+
+    stream->setPos(0);
+    if (stream->read(data.size(), data.data()) != data.size())
+        throw InvalidPdb("failed to read DBI stream");
+
+    patchDbiStream(data.data(), data.size(), allModules, moduleStreams);
+
+    stream->setPos(0);
+    stream->write(data.size(), data.data());
+}
+
+/**
+ * Checks the header of the symbol record at offset `i` in a stream of the given
+ * length. Returns the length of the record's data.
+ */
+size_t symbolRecordDataLength(const SymbolRecord* rec, size_t i, size_t length) {
+
+    // The symbol record length must be at least the size of
+    // SymbolRecord::type and the size of the entire record must be a
+    // multiple of 4.
+    if (rec->length < sizeof(rec->type) ||
+        (rec->length + sizeof(rec->length)) % 4 != 0) {
+        throw InvalidPdb("invalid symbol record size");
+    }
+
+    const size_t dataLength = rec->length - sizeof(rec->type);
+
+    // Bounds check.
+    if (i + sizeof(SymbolRecord) + dataLength > length)
+        throw InvalidPdb("symbol record size too large");
+
+    return dataLength;
+}
+
+/**
+ * Normalizes the symbols of a module stream. The padding after the name of the
+ * records that end with one is zeroed out, and GUIDs in object file paths are
+ * replaced.
+ *
+ * The symbols are patched in a temporary copy. Writing the copy back through
+ * the overlay only keeps the pages that actually changed.
+ */
+void normalizeModuleStream(MsfStream* stream, size_t symbolsSize) {
+
+    PhaseTimer timer("normalizeModuleStream");
+    timer.addArg("bytes", stream->length());
+
+    if (symbolsSize > stream->length())
+        throw InvalidPdb("module symbols exceed the module stream");
+
+    if (symbolsSize < sizeof(uint32_t))
+        return;
+
+    std::vector<uint8_t> data(symbolsSize);
+
+    stream->setPos(0);
+    if (stream->read(data.size(), data.data()) != data.size())
+        throw InvalidPdb("failed to read module stream");
+
+    uint32_t type;
+    memcpy(&type, data.data(), sizeof(type));
+
+    if (type != CV_SIGNATURE_C13)
+        return;
+
+    for (size_t i = sizeof(type); i < symbolsSize; ) {
+
+        if (symbolsSize - i < sizeof(SymbolRecord))
+            throw InvalidPdb("got partial symbol record in module stream");
+
+        SymbolRecord* rec = (SymbolRecord*)(data.data() + i);
+
+        const size_t dataLength = symbolRecordDataLength(rec, i, symbolsSize);
+
+        const size_t recordLength = sizeof(SymbolRecord) + dataLength;
+        const size_t nameOffset = symbolNameOffset(rec->type);
+
+        if (nameOffset > 0 && nameOffset < recordLength) {
+            char* name = (char*)rec + nameOffset;
+            const size_t maxLength = recordLength - nameOffset;
+            const size_t namelen = strnlen(name, maxLength);
+
+            if (namelen < maxLength) {
+                if (rec->type == S_OBJNAME)
+                    normalizeFileNameGuid(name, namelen);
+
+                // Everything after the null terminator is padding.
+                memset(name + namelen + 1, 0, maxLength - namelen - 1);
+            }
+        }
+
+        i += sizeof(SymbolRecord) + dataLength;
+    }
+
+    stream->setPos(0);
+    stream->write(data.size(), data.data());
+}
+
+/**
+ * Zeroes out the padding of the symbol records in the range [begin, end) of a
+ * stream. `begin` must be the start of a symbol record.
+ *
+ * Params:
+ *   length = Length of the stream.
+ *   read   = Function that reads `count` bytes at `offset` into `buf`.
+ *            Returns the number of bytes read.
+ *   write  = Function that is called with the offset and length of padding
+ *            that was changed to zeros.
+ */
+template<typename Read, typename Write>
+void patchSymbolRecords(size_t begin, size_t end, size_t length,
+        Read read, Write write) {
+
+    PhaseTimer timer("patchSymbolRecords");
+    timer.addArg("bytes", end - begin);
+
+    // Must be large enough to hold the largest possible symbol record.
+    static const size_t kWindowSize = 1024 * 1024;
+
+    std::vector<uint8_t> window(kWindowSize);
+
+    // Offset in the stream of the start of the window and the number of bytes
+    // in the window.
+    size_t windowStart = 0;
+    size_t windowLength = 0;
+
+    // The last 4 bytes of the data of each symbol record are gathered into a
+    // batch such that their padding can be zeroed all at once.
+    static const size_t kBatchSize = 256;
+
+    uint32_t words[kBatchSize];
+    size_t offsets[kBatchSize];
+    size_t batched = 0;
+
+    auto flush = [&]() {
+        uint32_t patched[kBatchSize];
+        memcpy(patched, words, batched * sizeof(uint32_t));
+
+        zeroSymbolPadding(patched, batched);
+
+        // Report the padding that changed, starting from the first byte that
+        // changed. Any padding before that byte is already zero.
+        for (size_t j = 0; j < batched; ++j) {
+            const uint32_t diff = patched[j] ^ words[j];
+            if (diff == 0)
+                continue;
+
+            size_t first = 1;
+            while (!(diff & (0xFFu << (first * 8))))
+                ++first;
+
+            write(offsets[j] + first, sizeof(uint32_t) - first);
+        }
+
+        batched = 0;
+    };
+
+    // Ensures that the given range of the stream is in the window.
+    auto ensure = [&](size_t offset, size_t count) {
+        if (offset >= windowStart &&
+            offset + count <= windowStart + windowLength)
+            return;
+
+        windowStart = offset;
+        windowLength = std::min(kWindowSize, length - offset);
+
+        if (read(windowStart, windowLength, window.data()) != windowLength)
+            throw InvalidPdb("failed to read symbol records");
+    };
+
+    for (size_t i = begin; i < end; ) {
+
+        if (length - i < sizeof(SymbolRecord))
+            throw InvalidPdb("got partial symbol record");
+
+        ensure(i, sizeof(SymbolRecord));
+
+        SymbolRecord* rec = (SymbolRecord*)(window.data() + (i - windowStart));
+
+        const size_t dataLength = symbolRecordDataLength(rec, i, length);
+
+        ensure(i, sizeof(SymbolRecord) + dataLength);
+
+        // There is a maximum of 3 bytes of padding at the end of the data.
+        // Since the length of the data is a multiple of 4, all of the padding
+        // is in the last 4 bytes.
+        if (dataLength >= sizeof(uint32_t)) {
+            const size_t offset = i + sizeof(SymbolRecord) + dataLength -
+                sizeof(uint32_t);
+
+            memcpy(&words[batched], window.data() + (offset - windowStart),
+                    sizeof(uint32_t));
+            offsets[batched] = offset;
+
+            if (++batched == kBatchSize)
+                flush();
+        }
+
+        // Skip to next symbol record
+        i += sizeof(SymbolRecord) + dataLength;
+    }
+
+    flush();
+}
+
+/**
+ * Patches the symbol record stream.
+ *
+ * There is up to 3 bytes of padding at the end of each symbol record. Since
+ * garbage just lives there, it needs to be zeroed out.
+ *
+ * The stream is read through a window so that it never needs to be in memory
+ * all at once. Only the padding that actually changes is written back to the
+ * stream.
+ *
+ * If the stream is memory mapped, it is patched in parallel: A first pass
+ * finds the record boundaries at roughly evenly spaced checkpoints. The chunks
+ * between the checkpoints are then scanned concurrently. The padding that
+ * changed is written back in order afterwards, so the result is identical to
+ * scanning the whole stream in one go.
+ */
+void patchSymbolRecordsStream(MsfOverlayStream* stream, ThreadPool& pool) {
+
+    PhaseTimer timer("patchSymbolRecordsStream");
+    timer.addArg("bytes", stream->length());
+
+    // Chunks smaller than this aren't worth the overhead of a task.
+    static const size_t kMinChunkSize = 64 * 1024;
+
+    static const uint8_t zeros[3] = {0, 0, 0};
+
+    const size_t length = stream->length();
+
+    auto writeZeros = [stream](size_t offset, size_t count) {
+        stream->setPos(offset);
+        stream->write(count, zeros);
+    };
+
+    // The chunks are read concurrently from the original stream. This is only
+    // worth it if reads are just copies from a memory map.
+    const auto base = dynamic_cast<const MsfFileStream*>(stream->base());
+
+    const size_t chunkSize = std::max(kMinChunkSize,
+            length / (pool.threads() * 4));
+
+    if (pool.threads() == 1 || length <= chunkSize || !base || !base->map() ||
+        base->length() != length || stream->dirtyPages() > 0) {
+
+        patchSymbolRecords(0, length, length,
+            [stream](size_t offset, size_t count, void* buf) {
+                stream->setPos(offset);
+                return stream->read(count, buf);
+            },
+            writeZeros);
+        return;
+    }
+
+    // Find the first record boundary after each checkpoint. Only the record
+    // headers are read and checked here.
+    std::vector<size_t> boundaries(1, 0);
+
+    for (size_t i = 0, next = chunkSize; i < length; ) {
+
+        if (i >= next) {
+            boundaries.push_back(i);
+            next = i + chunkSize;
+        }
+
+        if (length - i < sizeof(SymbolRecord))
+            throw InvalidPdb("got partial symbol record");
+
+        SymbolRecord rec;
+        if (base->readAt(i, sizeof(rec), &rec) != sizeof(rec))
+            throw InvalidPdb("failed to read symbol records");
+
+        i += sizeof(SymbolRecord) + symbolRecordDataLength(&rec, i, length);
+    }
+
+    boundaries.push_back(length);
+
+    // Scan the chunks. The padding that needs to be zeroed is recorded as
+    // (offset, length) pairs for each chunk.
+    typedef std::vector<std::pair<size_t, size_t>> Padding;
+
+    const size_t chunks = boundaries.size() - 1;
+
+    std::vector<Padding> padding(chunks);
+    std::vector<std::future<void>> tasks;
+
+    for (size_t i = 0; i < chunks; ++i) {
+        const size_t begin = boundaries[i], end = boundaries[i+1];
+        Padding& p = padding[i];
+
+        tasks.push_back(pool.submit([base, begin, end, length, &p]() {
+            patchSymbolRecords(begin, end, length,
+                [base](size_t offset, size_t count, void* buf) {
+                    return base->readAt(offset, count, buf);
+                },
+                [&p](size_t offset, size_t count) {
+                    p.push_back(std::make_pair(offset, count));
+                });
+        }));
+    }
+
+    pool.wait(tasks);
+
+    for (auto& p: padding) {
+        for (auto& pad: p)
+            writeZeros(pad.first, pad.second);
+    }
+}
+
+/**
+ * Returns the length of the numeric leaf at the start of `data`, or 0 if it
+ * isn't one we know the length of.
+ */
+size_t numericLeafLength(const uint8_t* data, size_t length) {
+
+    if (length < sizeof(uint16_t))
+        return 0;
+
+    uint16_t leaf;
+    memcpy(&leaf, data, sizeof(leaf));
+
+    // Small values are stored in the leaf itself.
+    if (leaf < LF_NUMERIC)
+        return sizeof(leaf);
+
+    size_t size;
+
+    switch (leaf) {
+        case LF_CHAR:       size = 1; break;
+        case LF_SHORT:
+        case LF_USHORT:
+        case LF_REAL16:     size = 2; break;
+        case LF_LONG:
+        case LF_ULONG:
+        case LF_REAL32:     size = 4; break;
+        case LF_REAL48:     size = 6; break;
+        case LF_REAL64:
+        case LF_QUADWORD:
+        case LF_UQUADWORD:
+        case LF_COMPLEX32:
+        case LF_DATE:       size = 8; break;
+        case LF_REAL80:     size = 10; break;
+        case LF_REAL128:
+        case LF_OCTWORD:
+        case LF_UOCTWORD:
+        case LF_COMPLEX64:
+        case LF_DECIMAL:    size = 16; break;
+        case LF_COMPLEX80:  size = 20; break;
+        case LF_COMPLEX128: size = 32; break;
+        case LF_VARSTRING: {
+            uint16_t n;
+            if (length < sizeof(leaf) + sizeof(n))
+                return 0;
+            memcpy(&n, data + sizeof(leaf), sizeof(n));
+            size = sizeof(n) + n;
+            break;
+        }
+        default:            return 0;
+    }
+
+    size += sizeof(leaf);
+
+    return size <= length ? size : 0;
+}
+
+/**
+ * Returns the length of the data in a type record that comes before the
+ * padding, or 0 if it can't be told. `data` starts at the leaf type.
+ *
+ * Like for symbol records, this is only known for some types of records: Those
+ * with a fixed size, those with a count of elements, and those that end with
+ * names. Field lists are not among them, but the padding between their members
+ * must already be well-formed for them to be read at all.
+ */
+size_t typeRecordDataEnd(const uint8_t* data, size_t length) {
+
+    uint16_t leaf;
+    memcpy(&leaf, data, sizeof(leaf));
+
+    // Records with a fixed size or a count of elements
+    switch (leaf) {
+        case LF_MODIFIER:         return sizeof(lfModifier);
+        case LF_PROCEDURE:        return sizeof(lfProc);
+        case LF_MFUNCTION:
+            return offsetof(lfMFunc, thisadjust) + sizeof(int32_t);
+        case LF_UDT_SRC_LINE:     return sizeof(lfUdtSrcLine);
+        case LF_UDT_MOD_SRC_LINE: return sizeof(lfUdtModSrcLine);
+        case LF_ARGLIST:
+        case LF_SUBSTR_LIST: {
+            uint32_t count;
+            if (length < offsetof(lfArgList, arg))
+                return 0;
+            memcpy(&count, data + offsetof(lfArgList, count), sizeof(count));
+            if (count > (length - offsetof(lfArgList, arg)) / sizeof(CV_typ_t))
+                return 0;
+            return offsetof(lfArgList, arg) + count * sizeof(CV_typ_t);
+        }
+        case LF_BUILDINFO: {
+            uint16_t count;
+            if (length < offsetof(lfBuildInfo, arg))
+                return 0;
+            memcpy(&count, data + offsetof(lfBuildInfo, count), sizeof(count));
+            if (count > (length - offsetof(lfBuildInfo, arg)) / sizeof(CV_ItemId))
+                return 0;
+            return offsetof(lfBuildInfo, arg) + count * sizeof(CV_ItemId);
+        }
+    }
+
+    // Records that end with names
+    size_t offset = 0;
+
+    // Offset of the properties, if they can say there is a unique name after
+    // the regular name.
+    size_t propertyOffset = 0;
+
+    // True if the name is preceded by a numeric leaf.
+    bool numeric = false;
+
+    switch (leaf) {
+        case LF_CLASS:
+        case LF_STRUCTURE:
+        case LF_INTERFACE:
+            offset = offsetof(lfClass, data);
+            propertyOffset = offsetof(lfClass, property);
+            numeric = true;
+            break;
+        case LF_UNION:
+            offset = offsetof(lfUnion, data);
+            propertyOffset = offsetof(lfUnion, property);
+            numeric = true;
+            break;
+        case LF_ENUM:
+            offset = offsetof(lfEnum, Name);
+            propertyOffset = offsetof(lfEnum, property);
+            break;
+        case LF_ARRAY:
+            offset = offsetof(lfArray, data);
+            numeric = true;
+            break;
+        case LF_ALIAS:       offset = offsetof(lfAlias, Name); break;
+        case LF_STRING_ID:   offset = offsetof(lfStringId, name); break;
+        case LF_FUNC_ID:     offset = offsetof(lfFuncId, name); break;
+        case LF_MFUNC_ID:    offset = offsetof(lfMFuncId, name); break;
+        case LF_TYPESERVER2: offset = offsetof(lfTypeServer2, name); break;
+        default:             return 0;
+    }
+
+    if (offset > length)
+        return 0;
+
+    size_t names = 1;
+
+    if (propertyOffset > 0) {
+        CV_prop_t property;
+        memcpy(&property, data + propertyOffset, sizeof(property));
+        if (property.hasuniquename)
+            names = 2;
+    }
+
+    if (numeric) {
+        const size_t n = numericLeafLength(data + offset, length - offset);
+        if (n == 0)
+            return 0;
+        offset += n;
+    }
+
+    for (size_t i = 0; i < names; ++i) {
+        const void* nul = memchr(data + offset, 0, length - offset);
+        if (!nul)
+            return 0;
+        offset = (const uint8_t*)nul - data + 1;
+    }
+
+    return offset;
+}
+
+/**
+ * Calculates the hash that the Microsoft tools use for type records that are
+ * hashed over all of their bytes. This is a CRC-32 that starts at 0 instead of
+ * 0xFFFFFFFF and has no final complement (hashBufferV8() in LLVM).
+ */
+uint32_t typeRecordHash(const uint8_t* data, size_t length) {
+
+    static const auto table = []() {
+        std::vector<uint32_t> t(256);
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (size_t j = 0; j < 8; ++j)
+                c = (c & 1) ? (c >> 1) ^ 0xEDB88320 : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    uint32_t crc = 0;
+    for (size_t i = 0; i < length; ++i)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+    return crc;
+}
+
+/**
+ * Returns true if the name of a user defined type is one the compiler made up
+ * for an anonymous type.
+ */
+bool isAnonymousTypeName(const char* name, size_t length) {
+
+    static const char* const names[] = {"<unnamed-tag>", "__unnamed"};
+
+    for (const char* anon: names) {
+        const size_t n = strlen(anon);
+
+        if (length == n && memcmp(name, anon, n) == 0)
+            return true;
+
+        // Nested in another scope
+        if (length >= n + 2 && memcmp(name + length - n - 2, "::", 2) == 0 &&
+            memcmp(name + length - n, anon, n) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * Returns true if the hash of a type record is calculated over all of its
+ * bytes, which includes the padding. `data` is the record after its length and
+ * `length` the size of that, whose names have already been found to be valid
+ * by typeRecordDataEnd().
+ *
+ * User defined types are usually hashed by their name or unique name instead.
+ * That isn't the case for forward references, anonymous types or scoped types
+ * without a unique name, which are hashed over all of their bytes too (see
+ * getHashForUdt() in LLVM). The source line records of user defined types are
+ * hashed by the index of the type.
+ */
+bool typeRecordHashesData(const uint8_t* data, size_t length) {
+
+    uint16_t leaf;
+    memcpy(&leaf, data, sizeof(leaf));
+
+    size_t nameOffset, propertyOffset;
+
+    switch (leaf) {
+        case LF_CLASS:
+        case LF_STRUCTURE:
+        case LF_INTERFACE:
+            nameOffset = offsetof(lfClass, data);
+            propertyOffset = offsetof(lfClass, property);
+            break;
+        case LF_UNION:
+            nameOffset = offsetof(lfUnion, data);
+            propertyOffset = offsetof(lfUnion, property);
+            break;
+        case LF_ENUM:
+            nameOffset = offsetof(lfEnum, Name);
+            propertyOffset = offsetof(lfEnum, property);
+            break;
+        case LF_UDT_SRC_LINE:
+        case LF_UDT_MOD_SRC_LINE:
+            return false;
+        default:
+            return true;
+    }
+
+    if (leaf != LF_ENUM)
+        nameOffset += numericLeafLength(data + nameOffset, length - nameOffset);
+
+    CV_prop_t property;
+    memcpy(&property, data + propertyOffset, sizeof(property));
+
+    const char* name = (const char*)data + nameOffset;
+    const bool anonymous = property.hasuniquename &&
+        isAnonymousTypeName(name, strlen(name));
+
+    if (property.fwdref || anonymous)
+        return true;
+
+    return property.scoped && !property.hasuniquename;
+}
+
+/**
+ * The hash of a type record before and after its padding was normalized.
+ */
+struct TypeHash {
+    uint32_t index;
+    uint32_t before;
+    uint32_t after;
+};
+
+/**
+ * Padding of a type record that needs to be rewritten.
+ */
+struct TypePadding {
+    size_t offset;
+    size_t length;
+};
+
+/**
+ * Normalizes the padding of the type records [first, last). `offsets` holds
+ * the offset of every record in the stream, followed by the offset of the end
+ * of the records.
+ */
+template<typename Read>
+void normalizeTypeRecords(const std::vector<uint32_t>& offsets,
+        size_t first, size_t last, Read read,
+        std::vector<TypePadding>& padding, std::vector<TypeHash>& hashes) {
+
+    const size_t begin = offsets[first];
+
+    PhaseTimer timer("normalizeTypeRecords");
+    timer.addArg("bytes", offsets[last] - begin);
+
+    std::vector<uint8_t> buf(offsets[last] - begin);
+
+    if (read(begin, buf.size(), buf.data()) != buf.size())
+        throw InvalidPdb("failed to read type records");
+
+    for (size_t i = first; i < last; ++i) {
+        uint8_t* rec = buf.data() + (offsets[i] - begin);
+        const size_t size = offsets[i+1] - offsets[i];
+
+        const size_t dataLength = size - sizeof(uint16_t);
+        uint8_t* data = rec + sizeof(uint16_t);
+
+        const size_t end = typeRecordDataEnd(data, dataLength);
+        if (end == 0 || end > dataLength)
+            continue;
+
+        // Records are padded to a multiple of 4 bytes. If there is more after
+        // the data than that, the record is something we don't understand.
+        const size_t n = dataLength - end;
+        if (n == 0 || n > 3)
+            continue;
+
+        // Each padding byte says how many bytes are left in the record.
+        bool wellFormed = true;
+        for (size_t j = 0; j < n; ++j) {
+            if (data[end + j] != LF_PAD0 + n - j) {
+                wellFormed = false;
+                break;
+            }
+        }
+
+        if (wellFormed)
+            continue;
+
+        const bool hashed = typeRecordHashesData(data, dataLength);
+        const uint32_t before = hashed ? typeRecordHash(rec, size) : 0;
+
+        for (size_t j = 0; j < n; ++j)
+            data[end + j] = (uint8_t)(LF_PAD0 + n - j);
+
+        padding.push_back({offsets[i] + sizeof(uint16_t) + end, n});
+
+        if (hashed)
+            hashes.push_back({(uint32_t)i, before, typeRecordHash(rec, size)});
+    }
+}
+
+/**
+ * Patches a type info (TPI) or ID info (IPI) stream.
+ *
+ * The padding at the end of a type record is a sequence of LF_PAD leaves
+ * instead of zeros, but it can have garbage in it all the same. Readers skip
+ * over these leaves, so the padding is rewritten with them instead of being
+ * zeroed.
+ *
+ * A first pass reads just the record headers to find the offset of every
+ * record. The records are then normalized in evenly sized ranges concurrently.
+ * The padding that changed is written back in order afterwards.
+ *
+ * The hashes of the records that changed are returned in `hashes` such that
+ * the hash stream can be fixed up too.
+ */
+void normalizeTypeStream(MsfOverlayStream* stream, ThreadPool& pool,
+        TypeStreamHeader& header, std::vector<TypeHash>& hashes) {
+
+    PhaseTimer timer("normalizeTypeStream");
+    timer.addArg("bytes", stream->length());
+
+    // Chunks smaller than this aren't worth the overhead of a task. Chunks are
+    // read into memory all at once, so they can't be too large either.
+    static const size_t kMinChunkSize = 64 * 1024;
+    static const size_t kMaxChunkSize = 4 * 1024 * 1024;
+
+    // An empty stream has no header and nothing to normalize.
+    if (stream->length() == 0)
+        return;
+
+    stream->setPos(0);
+    if (stream->read(sizeof(header), &header) != sizeof(header))
+        throw InvalidPdb("missing type stream header");
+
+    const size_t length = stream->length();
+
+    if (header.headerSize < sizeof(header) || header.headerSize > length ||
+        header.typeRecordBytes > length - header.headerSize)
+        throw InvalidPdb("invalid type stream header");
+
+    const size_t begin = header.headerSize;
+    const size_t end = begin + header.typeRecordBytes;
+
+    // The records are read concurrently from the original stream. This is
+    // only worth it if reads are just copies from a memory map.
+    const auto base = dynamic_cast<const MsfFileStream*>(stream->base());
+
+    const bool parallel = pool.threads() > 1 && base && base->map() &&
+        base->length() == length && stream->dirtyPages() == 0;
+
+    std::function<size_t(size_t, size_t, void*)> read;
+    if (parallel) {
+        read = [base](size_t offset, size_t count, void* buf) {
+            return base->readAt(offset, count, buf);
+        };
+    }
+    else {
+        read = [stream](size_t offset, size_t count, void* buf) {
+            stream->setPos(offset);
+            return stream->read(count, buf);
+        };
+    }
+
+    // Find the offset of every record. The headers are read through a window
+    // so that the records are never in memory all at once.
+    static const size_t kWindowSize = 1024 * 1024;
+
+    std::vector<uint8_t> window(kWindowSize);
+    size_t windowStart = 0, windowLength = 0;
+
+    std::vector<uint32_t> offsets;
+    offsets.reserve(header.typeIndexEnd > header.typeIndexBegin ?
+            header.typeIndexEnd - header.typeIndexBegin + 1 : 1);
+
+    for (size_t i = begin; i < end; ) {
+
+        if (end - i < sizeof(TypeRecord))
+            throw InvalidPdb("got partial type record");
+
+        if (i + sizeof(uint16_t) > windowStart + windowLength) {
+            windowStart = i;
+            windowLength = std::min(kWindowSize, end - i);
+            if (read(windowStart, windowLength, window.data()) != windowLength)
+                throw InvalidPdb("failed to read type records");
+        }
+
+        uint16_t recordLength;
+        memcpy(&recordLength, window.data() + (i - windowStart),
+                sizeof(recordLength));
+
+        if (recordLength < sizeof(uint16_t) ||
+            recordLength > end - i - sizeof(uint16_t))
+            throw InvalidPdb("invalid type record length");
+
+        offsets.push_back((uint32_t)i);
+        i += sizeof(uint16_t) + recordLength;
+    }
+
+    const size_t count = offsets.size();
+    offsets.push_back((uint32_t)end);
+
+    // Split the records into ranges of roughly equal size.
+    const size_t chunkSize = std::min(kMaxChunkSize, std::max(kMinChunkSize,
+            header.typeRecordBytes / (pool.threads() * 4)));
+
+    std::vector<size_t> ranges(1, 0);
+    for (size_t i = 0; i < count; ++i) {
+        if (offsets[i] - offsets[ranges.back()] >= chunkSize)
+            ranges.push_back(i);
+    }
+    ranges.push_back(count);
+
+    const size_t chunks = ranges.size() - 1;
+
+    std::vector<std::vector<TypePadding>> padding(chunks);
+    std::vector<std::vector<TypeHash>> chunkHashes(chunks);
+
+    if (parallel && chunks > 1) {
+        std::vector<std::future<void>> tasks;
+
+        for (size_t i = 0; i < chunks; ++i) {
+            const size_t first = ranges[i], last = ranges[i+1];
+            auto& p = padding[i];
+            auto& h = chunkHashes[i];
+
+            tasks.push_back(pool.submit([&offsets, first, last, &read, &p, &h]() {
+                normalizeTypeRecords(offsets, first, last, read, p, h);
+            }));
+        }
+
+        pool.wait(tasks);
+    }
+    else {
+        for (size_t i = 0; i < chunks; ++i) {
+            normalizeTypeRecords(offsets, ranges[i], ranges[i+1], read,
+                    padding[i], chunkHashes[i]);
+        }
+    }
+
+    static const uint8_t pads[3] = {LF_PAD3, LF_PAD2, LF_PAD1};
+
+    for (size_t i = 0; i < chunks; ++i) {
+        for (auto& pad: padding[i]) {
+            stream->setPos(pad.offset);
+            stream->write(pad.length, pads + 3 - pad.length);
+        }
+
+        hashes.insert(hashes.end(), chunkHashes[i].begin(),
+                chunkHashes[i].end());
+    }
+}
+
+/**
+ * Updates the hash values of the type records whose padding was normalized.
+ *
+ * The hash of most type records is calculated over all of its bytes, including
+ * the padding. The hashes are only updated if all of them are the ones the
+ * Microsoft tools would have calculated for the original records. Other
+ * linkers may use different hashes. Those can't be recalculated, so they are
+ * left alone. A single record could match by chance, but all of them can't.
+ */
+void patchTypeHashStream(MsfStream* stream, const TypeStreamHeader& header,
+        const std::vector<TypeHash>& hashes) {
+
+    PhaseTimer timer("patchTypeHashStream");
+    timer.addArg("bytes", stream->length());
+
+    if (header.hashKeySize != sizeof(uint32_t) || header.numHashBuckets == 0 ||
+        header.hashValueBufferOffset < 0)
+        return;
+
+    const size_t buckets = header.numHashBuckets;
+    const size_t count = header.hashValueBufferLength / sizeof(uint32_t);
+
+    auto hashOffset = [&header](const TypeHash& hash) {
+        return (size_t)header.hashValueBufferOffset +
+            hash.index * sizeof(uint32_t);
+    };
+
+    for (auto& hash: hashes) {
+        if (hash.index >= count)
+            return;
+
+        uint32_t value;
+        stream->setPos(hashOffset(hash));
+        if (stream->read(sizeof(value), &value) != sizeof(value))
+            throw InvalidPdb("failed to read type record hash");
+
+        if (value != hash.before % buckets)
+            return;
+    }
+
+    for (auto& hash: hashes) {
+        const uint32_t value = hash.after % buckets;
+        stream->setPos(hashOffset(hash));
+        stream->write(sizeof(value), &value);
+    }
+}
+
+/**
+ * Patch the public symbol info stream.
+ */
+void patchPublicSymbolStream(MsfStream* stream) {
+
+    PhaseTimer timer("patchPublicSymbolStream");
+    timer.addArg("bytes", stream->length());
+
+    // The public symbol info stream starts with the public symbol header
+    // followed by the (Global Symbol Info) GSI hash header. We only care about
+    // the public symbol header.
+    PublicSymbolHeader header;
+
+    stream->setPos(0);
+    if (stream->read(sizeof(header), &header) != sizeof(header))
+        throw InvalidPdb("public symbol stream too short");
+
+    // Struct alignment padding
+    header.padding1 = 0;
+
+    // Microsoft's PDB writer has a bug where this field is not initialized in
+    // the constructor. However, there are other code paths that do initialize
+    // this value, but only sometimes. Thus, since Microsoft's tools are already
+    // broken because of this, we zero this out without worrying about it.
+    //
+    // Since fixing this would be a trivial one-liner for Microsoft, this patch
+    // could become silently obsolete in the future.
+    header.sectionCount = 0;
+
+    stream->setPos(0);
+    stream->write(sizeof(header), &header);
+}
+
+/**
+ * A set of patches to PDB streams.
+ *
+ * Each patch creates a replacement for its stream and patches that. Since the
+ * original streams are not modified, patches to different streams can run
+ * concurrently. The original streams are only replaced after all the patches
+ * have finished.
+ */
+class StreamPatches {
+public:
+
+    /**
+     * Creates the patched replacement of the given stream.
+     */
+    typedef std::function<MsfStreamRef(MsfStreamRef)> Patch;
+
+private:
+
+    std::vector<std::pair<size_t, Patch>> _patches;
+
+    // True if more than one patch is applied to the same stream.
+    bool _overlapping;
+
+public:
+
+    StreamPatches() : _overlapping(false) {}
+
+    void add(size_t index, Patch patch) {
+        for (auto& p: _patches) {
+            if (p.first == index)
+                _overlapping = true;
+        }
+
+        _patches.push_back(std::make_pair(index, patch));
+    }
+
+    /**
+     * Applies the patches. Streams that don't exist are skipped.
+     */
+    void apply(MsfFile& msf, ThreadPool& pool) {
+
+        // If a stream is patched more than once, the patches must be applied
+        // on top of each other in the order they were added.
+        if (_overlapping || pool.threads() == 1) {
+            for (auto& p: _patches) {
+                if (auto stream = msf.getStream(p.first))
+                    msf.replaceStream(p.first, p.second(stream));
+            }
+
+            return;
+        }
+
+        std::vector<MsfStreamRef> streams(_patches.size());
+        std::vector<std::future<void>> tasks;
+
+        for (size_t i = 0; i < _patches.size(); ++i) {
+            auto orig = msf.getStream(_patches[i].first);
+            if (!orig)
+                continue;
+
+            const Patch& patch = _patches[i].second;
+            MsfStreamRef& result = streams[i];
+
+            tasks.push_back(pool.submit([&patch, &result, orig]() {
+                result = patch(orig);
+            }));
+        }
+
+        pool.wait(tasks);
+
+        for (size_t i = 0; i < _patches.size(); ++i) {
+            if (streams[i])
+                msf.replaceStream(_patches[i].first, streams[i]);
+        }
+    }
+};
+
+}
+
+/**
+ * Returns true if the PDB has already been patched for this image. That is,
+ * both the image and the PDB header already have the signature, age, and
+ * timestamp that we would give them.
+ *
+ * Since the signature is a hash of the image contents, it can only match if the
+ * PDB was previously patched by us for this very image.
+ */
+bool isPatchedPdb(MsfFile& msf, const CV_INFO_PDB70* pdbInfo,
+        uint32_t timestamp, const uint8_t signature[16]) {
+
+    if (!pdbInfo ||
+        memcmp(pdbInfo->Signature, signature, sizeof(pdbInfo->Signature)) != 0)
+        return false;
+
+    return mayBePatchedPdb(msf, pdbInfo, timestamp);
+}
+
+bool mayBePatchedPdb(MsfFile& msf, const CV_INFO_PDB70* pdbInfo,
+        uint32_t timestamp) {
+
+    if (!pdbInfo || pdbInfo->Age != 1)
+        return false;
+
+    auto stream = msf.getStream((size_t)PdbStreamType::header);
+    if (!stream)
+        return false;
+
+    PdbStream70 header;
+
+    stream->setPos(0);
+    if (stream->read(sizeof(header), &header) != sizeof(header))
+        return false;
+
+    return header.version >= PdbVersion::vc70 &&
+           header.timestamp == timestamp &&
+           matchingSignatures(*pdbInfo, header);
+}
+
+/**
+ * Rewrites a PDB, eliminating non-determinism.
+ */
+void patchPDB(MsfFile& msf, const CV_INFO_PDB70* pdbInfo,
+        uint32_t timestamp, const uint8_t signature[16], ThreadPool& pool,
+        bool normalizeModules, bool normalizeTypes) {
+
+    patchPDBStreams(msf, pdbInfo, pool, normalizeModules, normalizeTypes);
+    patchPDBSignature(msf, timestamp, signature);
+}
+
+void patchPDBSignature(MsfFile& msf, uint32_t timestamp,
+        const uint8_t signature[16]) {
+
+    auto stream = std::dynamic_pointer_cast<MsfMemoryStream>(
+            msf.getStream((size_t)PdbStreamType::header));
+
+    if (!stream)
+        throw InvalidPdb("PDB streams must be patched before the signature");
+
+    patchHeaderStream(stream.get(), timestamp, signature);
+}
+
+/**
+ * The header stream is read first as it tells us where the other streams are.
+ * The remaining streams are then patched concurrently.
+ */
+void patchPDBStreams(MsfFile& msf, const CV_INFO_PDB70* pdbInfo,
+        ThreadPool& pool, bool normalizeModules, bool normalizeTypes) {
+
+    PhaseTimer timer("patchStreams");
+
+    msf.replaceStream((size_t)PdbStreamType::streamTable, nullptr);
+
+    // Read the PDB header
+    auto origPdbHeaderStream = msf.getStream((size_t)PdbStreamType::header);
+    if (!origPdbHeaderStream)
+        throw InvalidPdb("missing PDB header stream");
+
+    auto pdbHeaderStream = std::shared_ptr<MsfMemoryStream>(
+            new MsfMemoryStream(origPdbHeaderStream.get(), msf.arena()));
+
+    const auto table = readHeaderStream(pdbHeaderStream.get(), pdbInfo);
+
+    msf.replaceStream((size_t)PdbStreamType::header, pdbHeaderStream);
+
+    // Streams that are copied into memory live until the MSF is written out.
+    Arena* arena = msf.arena();
+
+    StreamPatches patches;
+
+    // Patch the LinkInfo stream.
+    {
+        uint32_t index;
+        if (table.find("/LinkInfo", index)) {
+            if (!msf.getStream(index))
+                throw InvalidPdb("missing '/LinkInfo' stream");
+
+            patches.add(index, [arena](MsfStreamRef orig) {
+                auto stream = std::make_shared<MsfMemoryStream>(orig.get(),
+                        arena);
+                patchLinkInfoStream(stream.get());
+                return stream;
+            });
+        }
+    }
+
+    // Rewrite /names hash table
+    {
+        uint32_t index;
+        if (table.find("/names", index)) {
+            if (!msf.getStream(index))
+                throw InvalidPdb("missing '/names' stream");
+
+            patches.add(index, [arena, &pool](MsfStreamRef orig) {
+                auto stream = std::make_shared<MsfMemoryStream>(orig.get(),
+                        arena);
+                patchNamesStream(stream.get(), pool);
+                return stream;
+            });
+        }
+    }
+
+    // Module streams found while patching the DBI stream.
+    std::vector<ModuleStream> moduleStreams;
+
+    // Patch the DBI stream. This and the streams below can be large, but only
+    // a few bytes in them are patched. Thus, they are patched through overlays
+    // so that only the modified pages need to be kept in memory.
+    if (auto dbiStream = msf.getStream((size_t)PdbStreamType::dbi)) {
+
+        patches.add((size_t)PdbStreamType::dbi,
+            [&moduleStreams, normalizeModules](MsfStreamRef orig) {
+                auto stream = std::make_shared<MsfOverlayStream>(orig);
+                patchDbiStream(stream.get(), normalizeModules, moduleStreams);
+                return stream;
+            });
+
+        // We need the DBI header to get the symbol record stream. If the DBI
+        // stream is too short, patching it throws an error.
+        DbiHeader dbiHeader;
+        dbiStream->setPos(0);
+        if (dbiStream->read(sizeof(dbiHeader), &dbiHeader) == sizeof(dbiHeader)) {
+
+            // Patch the symbol records stream
+            patches.add(dbiHeader.symbolRecordsStream, [&pool](MsfStreamRef orig) {
+                auto stream = std::make_shared<MsfOverlayStream>(orig);
+                patchSymbolRecordsStream(stream.get(), pool);
+                return stream;
+            });
+
+            // Patch the public symbols info stream
+            patches.add(dbiHeader.publicSymbolStream, [](MsfStreamRef orig) {
+                auto stream = std::make_shared<MsfOverlayStream>(orig);
+                patchPublicSymbolStream(stream.get());
+                return stream;
+            });
+        }
+    }
+
+    // Type streams and the hashes of the type records changed in them.
+    const PdbStreamType typeStreams[] = {PdbStreamType::tbi, PdbStreamType::ipi};
+    TypeStreamHeader typeHeaders[2];
+    std::vector<TypeHash> typeHashes[2];
+
+    if (normalizeTypes) {
+        for (size_t i = 0; i < 2; ++i) {
+            // Older toolsets write an empty ID info stream.
+            auto typeStream = msf.getStream((size_t)typeStreams[i]);
+            if (!typeStream || typeStream->length() == 0)
+                continue;
+
+            auto& header = typeHeaders[i];
+            auto& hashes = typeHashes[i];
+
+            patches.add((size_t)typeStreams[i],
+                [&pool, &header, &hashes](MsfStreamRef orig) {
+                    auto stream = std::make_shared<MsfOverlayStream>(orig);
+                    normalizeTypeStream(stream.get(), pool, header, hashes);
+                    return stream;
+                });
+        }
+    }
+
+    patches.apply(msf, pool);
+
+    // The hashes of the type records that changed are fixed up once the type
+    // streams are done.
+    StreamPatches hashPatches;
+
+    for (size_t i = 0; i < 2; ++i) {
+        if (typeHashes[i].empty())
+            continue;
+
+        const auto& header = typeHeaders[i];
+        const auto& hashes = typeHashes[i];
+
+        if (!msf.getStream(header.hashStreamIndex))
+            continue;
+
+        hashPatches.add(header.hashStreamIndex,
+            [&header, &hashes](MsfStreamRef orig) {
+                auto stream = std::make_shared<MsfOverlayStream>(orig);
+                patchTypeHashStream(stream.get(), header, hashes);
+                return stream;
+            });
+    }
+
+    hashPatches.apply(msf, pool);
+
+    // Patch the module streams referenced by the DBI stream. When all of them
+    // are normalized, there can be tens of thousands. Each one gets its own
+    // overlay and they are patched concurrently.
+    StreamPatches modulePatches;
+
+    if (normalizeModules) {
+        // Modules sharing a stream would make the patches overlap, which
+        // would apply all of them one after another.
+        std::sort(moduleStreams.begin(), moduleStreams.end(),
+            [](const ModuleStream& a, const ModuleStream& b) {
+                return a.stream < b.stream;
+            });
+
+        moduleStreams.erase(std::unique(moduleStreams.begin(),
+                moduleStreams.end(),
+            [](const ModuleStream& a, const ModuleStream& b) {
+                return a.stream == b.stream;
+            }), moduleStreams.end());
+    }
+
+    for (auto& module: moduleStreams) {
+        if (normalizeModules) {
+            const size_t symbolsSize = module.symbolsSize;
+
+            modulePatches.add(module.stream, [symbolsSize](MsfStreamRef orig) {
+                auto stream = std::make_shared<MsfOverlayStream>(orig);
+                normalizeModuleStream(stream.get(), symbolsSize);
+                return stream;
+            });
+        }
+        else {
+            modulePatches.add(module.stream, [arena](MsfStreamRef orig) {
+                auto stream = std::make_shared<MsfMemoryStream>(orig.get(),
+                        arena);
+                patchModuleStream(stream.get());
+                return stream;
+            });
+        }
+    }
+
+    modulePatches.apply(msf, pool);
+}
+
+void setCompactPdbLayout(MsfFile& msf) {
+
+    std::vector<size_t> first = {
+        (size_t)PdbStreamType::header,
+        (size_t)PdbStreamType::dbi,
+        (size_t)PdbStreamType::tbi,
+        (size_t)PdbStreamType::ipi,
+    };
+
+    if (auto dbiStream = msf.getStream((size_t)PdbStreamType::dbi)) {
+        DbiHeader dbiHeader;
+        dbiStream->setPos(0);
+        if (dbiStream->read(sizeof(dbiHeader), &dbiHeader) == sizeof(dbiHeader)) {
+            first.push_back(dbiHeader.publicSymbolStream);
+            first.push_back(dbiHeader.globalSymbolStream);
+            first.push_back(dbiHeader.symbolRecordsStream);
+        }
+    }
+
+    // The hashes of the type records are needed to look up types by name.
+    for (auto type: {PdbStreamType::tbi, PdbStreamType::ipi}) {
+        if (auto stream = msf.getStream((size_t)type)) {
+            TypeStreamHeader header;
+            stream->setPos(0);
+            if (stream->read(sizeof(header), &header) == sizeof(header))
+                first.push_back(header.hashStreamIndex);
+        }
+    }
+
+    msf.setCompactLayout(first);
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "pe/format.h"
+
+class MsfFile;
+class ThreadPool;
+
+/**
+ * Returns true if the PDB has already been patched for this image. That is,
+ * both the image and the PDB header already have the signature, age, and
+ * timestamp that we would give them.
+ */
+bool isPatchedPdb(MsfFile& msf, const CV_INFO_PDB70* pdbInfo,
+        uint32_t timestamp, const uint8_t signature[16]);
+
+/**
+ * Like isPatchedPdb(), but without comparing the signature. If this returns
+ * false, the PDB certainly still needs to be patched. This can be checked
+ * before the signature has been calculated.
+ */
+bool mayBePatchedPdb(MsfFile& msf, const CV_INFO_PDB70* pdbInfo,
+        uint32_t timestamp);
+
+/**
+ * Patches the streams of a PDB in memory, eliminating non-determinism. Nothing
+ * is written to disk; the patched streams replace the originals in `msf`.
+ *
+ * Params:
+ *   msf       = The PDB to patch.
+ *   pdbInfo   = The PDB information in the image. Its signature and age must
+ *               match the PDB.
+ *   timestamp = The new timestamp of the PDB.
+ *   signature = The new signature of the PDB.
+ *   pool      = Threads used to patch independent streams concurrently.
+ *   normalizeModules = If true, the symbols of every module stream are
+ *               normalized. Otherwise, only the one module stream known to
+ *               contain a GUID is patched.
+ *   normalizeTypes = If true, the padding of the records in the type and ID
+ *               info streams is normalized as well.
+ */
+void patchPDB(MsfFile& msf, const CV_INFO_PDB70* pdbInfo,
+        uint32_t timestamp, const uint8_t signature[16], ThreadPool& pool,
+        bool normalizeModules = false, bool normalizeTypes = false);
+
+/**
+ * The two halves of patchPDB(). The first one patches everything but the
+ * header stream and doesn't need the signature. Thus, it can run while the
+ * signature is still being calculated. The second one then fills in the
+ * timestamp, age, and signature in the header stream.
+ */
+void patchPDBStreams(MsfFile& msf, const CV_INFO_PDB70* pdbInfo,
+        ThreadPool& pool, bool normalizeModules = false,
+        bool normalizeTypes = false);
+
+void patchPDBSignature(MsfFile& msf, uint32_t timestamp,
+        const uint8_t signature[16]);
+
+/**
+ * Makes the PDB be written with the compact MSF layout. The streams a debugger
+ * reads first when loading the PDB are laid out first: the header, DBI, type
+ * and ID info streams, and the symbol streams referenced by the DBI header.
+ */
+void setCompactPdbLayout(MsfFile& msf);
@@ -0,0 +1,362 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ducible/pdb_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <sstream>
+#include <system_error>
+#include <vector>
+
+#include "msf/msf.h"
+#include "msf/stream.h"
+#include "msf/file_stream.h"
+
+#include "util/file.h"
+#include "util/hash.h"
+
+#ifdef _WIN32
+#   include <windows.h>
+#   include <codecvt>
+#   include <locale>
+#else
+#   include <sys/types.h>
+#   include <sys/stat.h>
+#   include <sys/time.h>
+#   include <dirent.h>
+#   include <errno.h>
+#   include <unistd.h>
+#endif
+
+namespace {
+
+/**
+ * Bump this whenever the output of ducible changes such that old entries are
+ * no longer used.
+ */
+const char* kCacheVersion = "ducible-pdb-cache-1";
+
+const char* kEntryExtension = ".pdb";
+
+void hashInteger(Hasher& hasher, uint64_t n) {
+    uint8_t buf[8];
+    for (size_t i = 0; i < sizeof(buf); ++i)
+        buf[i] = (uint8_t)(n >> (8 * i));
+    hasher.update(buf, sizeof(buf));
+}
+
+template<typename CharT>
+std::basic_string<CharT> widen(const std::string& s) {
+    return std::basic_string<CharT>(s.begin(), s.end());
+}
+
+struct Entry {
+    std::string name;
+    uint64_t size;
+    int64_t lastUsed;
+
+    bool operator<(const Entry& other) const {
+        return lastUsed < other.lastUsed;
+    }
+};
+
+bool isEntry(const std::string& name) {
+    const size_t n = strlen(kEntryExtension);
+    return name.length() > n &&
+        name.compare(name.length() - n, n, kEntryExtension) == 0;
+}
+
+#ifdef _WIN32
+
+std::wstring toWide(const std::string& s) {
+    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+    return converter.from_bytes(s);
+}
+
+std::wstring toWide(const std::wstring& s) {
+    return s;
+}
+
+template<typename CharT>
+void makeDirectory(const std::basic_string<CharT>& dir) {
+    if (!CreateDirectoryW(toWide(dir).c_str(), NULL) &&
+        GetLastError() != ERROR_ALREADY_EXISTS) {
+        throw std::system_error(GetLastError(), std::system_category(),
+                "failed to create cache directory");
+    }
+}
+
+template<typename CharT>
+std::vector<Entry> listEntries(const std::basic_string<CharT>& dir) {
+    std::vector<Entry> entries;
+
+    WIN32_FIND_DATAW data;
+    HANDLE h = FindFirstFileW((toWide(dir) + L"\\*").c_str(), &data);
+    if (h == INVALID_HANDLE_VALUE)
+        return entries;
+
+    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+
+    do {
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            continue;
+
+        Entry entry;
+        entry.name = converter.to_bytes(data.cFileName);
+        if (!isEntry(entry.name))
+            continue;
+
+        entry.size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+        entry.lastUsed = ((int64_t)data.ftLastWriteTime.dwHighDateTime << 32) |
+            data.ftLastWriteTime.dwLowDateTime;
+        entries.push_back(entry);
+    } while (FindNextFileW(h, &data));
+
+    FindClose(h);
+
+    return entries;
+}
+
+template<typename CharT>
+void touchFile(const std::basic_string<CharT>& path) {
+    HANDLE h = CreateFileW(toWide(path).c_str(), FILE_WRITE_ATTRIBUTES,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE)
+        return;
+
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    SetFileTime(h, NULL, NULL, &now);
+    CloseHandle(h);
+}
+
+uint64_t processId() {
+    return GetCurrentProcessId();
+}
+
+#else
+
+void makeDirectory(const std::string& dir) {
+    if (mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST) {
+        throw std::system_error(errno, std::system_category(),
+                "failed to create cache directory");
+    }
+}
+
+std::vector<Entry> listEntries(const std::string& dir) {
+    std::vector<Entry> entries;
+
+    DIR* d = opendir(dir.c_str());
+    if (!d)
+        return entries;
+
+    while (dirent* ent = readdir(d)) {
+        Entry entry;
+        entry.name = ent->d_name;
+        if (!isEntry(entry.name))
+            continue;
+
+        struct stat st;
+        if (stat((dir + "/" + entry.name).c_str(), &st) != 0 ||
+            !S_ISREG(st.st_mode))
+            continue;
+
+        entry.size = (uint64_t)st.st_size;
+        entry.lastUsed = (int64_t)st.st_mtime;
+        entries.push_back(entry);
+    }
+
+    closedir(d);
+
+    return entries;
+}
+
+void touchFile(const std::string& path) {
+    utimes(path.c_str(), NULL);
+}
+
+uint64_t processId() {
+    return (uint64_t)getpid();
+}
+
+#endif
+
+}
+
+void imageCacheDigest(const uint8_t* image, size_t length,
+        const char* hashName, size_t hashChunkSize, uint8_t output[16]) {
+
+    HasherRef hasher = makeHasher(HashAlgorithm::xxh3);
+
+    // The options that change the output are part of the key as well.
+    hasher->update(kCacheVersion, strlen(kCacheVersion) + 1);
+    hasher->update(hashName, strlen(hashName) + 1);
+    hashInteger(*hasher, hashChunkSize);
+
+    hashInteger(*hasher, length);
+    hasher->update(image, length);
+
+    hasher->finish(output);
+}
+
+std::string pdbCacheKey(const uint8_t imageDigest[16], MsfFile& msf,
+        bool normalizeModules, bool normalizeTypes) {
+
+    HasherRef hasher = makeHasher(HashAlgorithm::xxh3);
+
+    hasher->update(imageDigest, 16);
+
+    // The page size of the output changes the whole layout of the file.
+    hashInteger(*hasher, msf.pageSize());
+    hashInteger(*hasher, msf.compactLayout() ? 1 : 0);
+
+    // So does normalizing the module and type streams.
+    hashInteger(*hasher, normalizeModules ? 1 : 0);
+    hashInteger(*hasher, normalizeTypes ? 1 : 0);
+
+    // Since the PDB GUID is embedded in the image, the stream table is enough
+    // to tell apart different PDBs for the same image.
+    hashInteger(*hasher, msf.streamCount());
+
+    for (size_t i = 0; i < msf.streamCount(); ++i) {
+        auto stream = msf.getStream(i);
+        if (!stream) {
+            hashInteger(*hasher, (uint64_t)-1);
+            continue;
+        }
+
+        hashInteger(*hasher, stream->length());
+
+        if (auto fileStream = dynamic_cast<MsfFileStream*>(stream.get())) {
+            const auto& pages = fileStream->pages();
+            hashInteger(*hasher, fileStream->pageSize());
+            hashInteger(*hasher, pages.size());
+            if (!pages.empty())
+                hasher->update(pages.data(), pages.size() * sizeof(pages[0]));
+        }
+    }
+
+    uint8_t digest[16];
+    hasher->finish(digest);
+
+    static const char hex[] = "0123456789abcdef";
+
+    std::string key;
+    for (size_t i = 0; i < sizeof(digest); ++i) {
+        key.push_back(hex[digest[i] >> 4]);
+        key.push_back(hex[digest[i] & 0xF]);
+    }
+
+    return key;
+}
+
+template<typename CharT>
+PdbCache<CharT>::PdbCache(const CharT* dir, uint64_t maxSize)
+    : _dir(dir), _maxSize(maxSize) {
+    makeDirectory(_dir);
+}
+
+template<typename CharT>
+std::basic_string<CharT> PdbCache<CharT>::path(const std::string& name) const {
+    return _dir + (CharT)'/' + widen<CharT>(name);
+}
+
+template<typename CharT>
+bool PdbCache<CharT>::fetch(const std::string& key, const CharT* dest) {
+
+    const auto entry = path(key + kEntryExtension);
+
+    try {
+        copyFile(entry.c_str(), dest);
+    }
+    catch (const std::system_error&) {
+        return false;
+    }
+
+    // Mark it as recently used.
+    touchFile(entry);
+
+    return true;
+}
+
+template<typename CharT>
+void PdbCache<CharT>::store(const std::string& key, const CharT* src) {
+
+    static std::atomic<unsigned> counter(0);
+
+    // Copy to a unique temporary name first so that other processes never see
+    // a partially written entry.
+    std::ostringstream tmpName;
+    tmpName << key << "." << processId() << "." << counter++ << ".tmp";
+
+    const auto tmp = path(tmpName.str());
+
+    try {
+        copyFile(src, tmp.c_str());
+        renameFile(tmp.c_str(), path(key + kEntryExtension).c_str());
+    }
+    catch (const std::system_error&) {
+        try {
+            deleteFile(tmp.c_str());
+        }
+        catch (const std::system_error&) {
+        }
+
+        throw;
+    }
+
+    evict();
+}
+
+template<typename CharT>
+void PdbCache<CharT>::evict() {
+
+    auto entries = listEntries(_dir);
+
+    uint64_t total = 0;
+    for (auto&& entry: entries)
+        total += entry.size;
+
+    std::sort(entries.begin(), entries.end());
+
+    for (auto&& entry: entries) {
+        if (total <= _maxSize)
+            break;
+
+        try {
+            deleteFile(path(entry.name).c_str());
+            total -= entry.size;
+        }
+        catch (const std::system_error&) {
+            // It may be in use by another process. Try the next one.
+        }
+    }
+}
+
+template class PdbCache<char>;
+
+#ifdef _WIN32
+template class PdbCache<wchar_t>;
+#endif
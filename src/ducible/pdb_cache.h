@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * An on-disk cache of patched PDBs. Byte-identical images linked on different
+ * machines (or at different times) produce PDBs that only need to be patched
+ * once. The patched result is stored under a key derived from the unpatched
+ * image and the layout of the unpatched PDB.
+ *
+ * Entries are evicted in least-recently-used order once the cache grows beyond
+ * its maximum size.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+class MsfFile;
+
+/**
+ * Calculates the part of the cache key that depends on the image. This must be
+ * given the image before it is patched.
+ */
+void imageCacheDigest(const uint8_t* image, size_t length,
+        const char* hashName, size_t hashChunkSize, uint8_t output[16]);
+
+/**
+ * Calculates the cache key for a PDB. The MSF must not have been modified yet,
+ * except for its page size. The key is a string of hex digits.
+ */
+std::string pdbCacheKey(const uint8_t imageDigest[16], MsfFile& msf,
+        bool normalizeModules, bool normalizeTypes);
+
+template<typename CharT>
+class PdbCache
+{
+private:
+    std::basic_string<CharT> _dir;
+    uint64_t _maxSize;
+
+    std::basic_string<CharT> path(const std::string& name) const;
+
+    /**
+     * Deletes the least recently used entries until the cache is within its
+     * maximum size.
+     */
+    void evict();
+
+public:
+
+    /**
+     * Params:
+     *   dir     = Directory to keep the cache in. It is created if it doesn't
+     *             exist.
+     *   maxSize = Maximum total size of the cache entries, in bytes.
+     */
+    PdbCache(const CharT* dir, uint64_t maxSize);
+
+    /**
+     * Copies the cached PDB to the given path. Returns false if there is no
+     * such entry.
+     */
+    bool fetch(const std::string& key, const CharT* dest);
+
+    /**
+     * Adds a patched PDB to the cache.
+     */
+    void store(const std::string& key, const CharT* src);
+};
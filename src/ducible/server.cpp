@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ducible/server.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#include "ducible/batch.h"
+
+#include "msf/format.h"
+
+#include "util/file.h"
+#include "util/local_socket.h"
+#include "util/thread_pool.h"
+
+namespace {
+
+/**
+ * Converts an ASCII string literal to the appropriate character type.
+ */
+template<typename CharT>
+std::basic_string<CharT> literal(const char* s) {
+    return std::basic_string<CharT>(s, s + strlen(s));
+}
+
+template<typename CharT>
+void writeString(LocalSocket& socket, const std::basic_string<CharT>& s) {
+    socket.write(s.c_str(), (s.length() + 1) * sizeof(CharT));
+}
+
+template<typename CharT>
+void writeField(LocalSocket& socket, const char* key,
+        const std::basic_string<CharT>& value) {
+    writeString(socket, literal<CharT>(key));
+    writeString(socket, value);
+}
+
+/**
+ * Reads NUL-terminated strings from a socket.
+ */
+class MessageReader
+{
+private:
+    LocalSocket& _socket;
+    uint8_t _buf[4096];
+    size_t _pos, _length;
+
+public:
+    MessageReader(LocalSocket& socket) : _socket(socket), _pos(0), _length(0) {}
+
+    /**
+     * Reads exactly `length` bytes. Returns false if the connection was closed
+     * first.
+     */
+    bool read(void* out, size_t length) {
+        uint8_t* p = (uint8_t*)out;
+
+        while (length > 0) {
+            if (_pos == _length) {
+                _length = _socket.read(_buf, sizeof(_buf));
+                _pos = 0;
+
+                if (_length == 0)
+                    return false;
+            }
+
+            const size_t n = std::min(length, _length - _pos);
+            memcpy(p, _buf + _pos, n);
+            _pos += n;
+            p += n;
+            length -= n;
+        }
+
+        return true;
+    }
+
+    template<typename CharT>
+    bool readString(std::basic_string<CharT>& s) {
+        s.clear();
+
+        CharT c;
+        while (read(&c, sizeof(c))) {
+            if (c == 0)
+                return true;
+
+            s.push_back(c);
+        }
+
+        return false;
+    }
+};
+
+void reply(LocalSocket& socket, const std::string& error) {
+    writeString(socket, std::string(error.empty() ? "0" : "1") + error);
+}
+
+/**
+ * Reads a request from a client, patches the image, and sends back the result.
+ */
+template<typename CharT>
+void handleClient(LocalSocket& socket, const PatchOptions& defaults,
+        ThreadPool& pool) {
+
+    typedef std::basic_string<CharT> string;
+
+    MessageReader reader(socket);
+
+    string image, pdb;
+
+    PatchOptions options = defaults;
+    options.dryrun = false;
+    options.pool = &pool;
+
+    string key, value;
+
+    while (true) {
+        if (!reader.readString(key))
+            return;
+
+        if (key.empty())
+            break;
+
+        if (!reader.readString(value))
+            return;
+
+        if (key == literal<CharT>("image")) {
+            image = value;
+        }
+        else if (key == literal<CharT>("pdb")) {
+            pdb = value;
+        }
+        else if (key == literal<CharT>("dryrun")) {
+            options.dryrun = (value == literal<CharT>("1"));
+        }
+        else if (key == literal<CharT>("hash")) {
+            if (!parseHashAlgorithm(value.c_str(), options.hash)) {
+                reply(socket, "Unknown hash algorithm");
+                return;
+            }
+        }
+        else if (key == literal<CharT>("hashChunkSize")) {
+            try {
+                options.hashChunkSize = (size_t)std::stoull(value);
+            }
+            catch (const std::logic_error&) {
+                reply(socket, "Invalid hash chunk size");
+                return;
+            }
+        }
+        else if (key == literal<CharT>("pageSize")) {
+            try {
+                options.pageSize = (size_t)std::stoull(value);
+            }
+            catch (const std::logic_error&) {
+                reply(socket, "Invalid page size");
+                return;
+            }
+
+            if (options.pageSize != 0 && !isValidPageSize(options.pageSize)) {
+                reply(socket, "Invalid page size");
+                return;
+            }
+        }
+        else if (key == literal<CharT>("compactLayout")) {
+            options.compactLayout = (value == literal<CharT>("1"));
+        }
+        else if (key == literal<CharT>("normalizeModules")) {
+            options.normalizeModules = (value == literal<CharT>("1"));
+        }
+        else if (key == literal<CharT>("normalizeTypes")) {
+            options.normalizeTypes = (value == literal<CharT>("1"));
+        }
+        else {
+            reply(socket, "Unknown request field");
+            return;
+        }
+    }
+
+    if (image.empty()) {
+        reply(socket, "Missing image path");
+        return;
+    }
+
+    reply(socket, tryPatchImage(image.c_str(),
+                pdb.empty() ? NULL : pdb.c_str(), options));
+}
+
+template<typename CharT>
+void serveImpl(const CharT* address, const PatchOptions& options) {
+
+    LocalServer server(address);
+
+    // Clients are handled on the same pool that is used for patching. Since
+    // waiting for tasks on the pool helps run them, this cannot deadlock.
+    ThreadPool pool(options.jobs);
+
+    while (true) {
+        LocalSocketRef socket = server.accept();
+
+        pool.submit([socket, &options, &pool]() {
+            try {
+                handleClient<CharT>(*socket, options, pool);
+            }
+            catch (const std::system_error& error) {
+                std::cerr << "Error: " << error.what() << "\n";
+            }
+        });
+    }
+}
+
+template<typename CharT>
+std::string tryPatchImageRemoteImpl(const CharT* address,
+        const CharT* imagePath, const CharT* pdbPath,
+        const PatchOptions& options) {
+
+    typedef std::basic_string<CharT> string;
+
+    LocalSocketRef socket = LocalSocket::connect(address);
+
+    // The server has a different working directory.
+    writeField<CharT>(*socket, "image", absolutePath(imagePath));
+
+    if (pdbPath)
+        writeField<CharT>(*socket, "pdb", absolutePath(pdbPath));
+
+    writeField(*socket, "dryrun",
+            literal<CharT>(options.dryrun ? "1" : "0"));
+    writeField(*socket, "hash",
+            literal<CharT>(hashAlgorithmName(options.hash)));
+    writeField(*socket, "hashChunkSize",
+            literal<CharT>(std::to_string(options.hashChunkSize).c_str()));
+    writeField(*socket, "pageSize",
+            literal<CharT>(std::to_string(options.pageSize).c_str()));
+    writeField(*socket, "compactLayout",
+            literal<CharT>(options.compactLayout ? "1" : "0"));
+    writeField(*socket, "normalizeModules",
+            literal<CharT>(options.normalizeModules ? "1" : "0"));
+    writeField(*socket, "normalizeTypes",
+            literal<CharT>(options.normalizeTypes ? "1" : "0"));
+
+    writeString(*socket, string());
+
+    MessageReader reader(*socket);
+
+    std::string status;
+    if (!reader.readString(status) || status.empty())
+        return "Server closed the connection";
+
+    if (status[0] == '0')
+        return std::string();
+
+    return (status.length() > 1) ? status.substr(1) : "Unknown error";
+}
+
+}
+
+#if defined(_WIN32) && defined(UNICODE)
+
+void serve(const wchar_t* address, const PatchOptions& options) {
+    serveImpl(address, options);
+}
+
+std::string tryPatchImageRemote(const wchar_t* address,
+        const wchar_t* imagePath, const wchar_t* pdbPath,
+        const PatchOptions& options) {
+    return tryPatchImageRemoteImpl(address, imagePath, pdbPath, options);
+}
+
+#else
+
+void serve(const char* address, const PatchOptions& options) {
+    serveImpl(address, options);
+}
+
+std::string tryPatchImageRemote(const char* address,
+        const char* imagePath, const char* pdbPath,
+        const PatchOptions& options) {
+    return tryPatchImageRemoteImpl(address, imagePath, pdbPath, options);
+}
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * A long-running server that patches images on behalf of clients. This avoids
+ * the start up costs of a new process for every image and keeps the worker
+ * threads around between requests.
+ *
+ * The client and server communicate over a local socket (a named pipe on
+ * Windows). A request is a list of key/value pairs, each a NUL-terminated
+ * string, ending with an empty key. Paths are always absolute. The reply is a
+ * status character ('0' for success) followed by a NUL-terminated error
+ * message.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "ducible/patch_image.h"
+
+#if defined(_WIN32) && defined(UNICODE)
+
+/**
+ * Listens for requests on the given address and handles them using up to
+ * `options.jobs` threads. The other options are the defaults for each request
+ * (e.g., the cache directory). This only returns if there is an error.
+ *
+ * Throws std::system_error if the server could not be started.
+ */
+void serve(const wchar_t* address, const PatchOptions& options);
+
+/**
+ * Asks the server listening on the given address to patch an image. Returns a
+ * description of the error, or an empty string on success. The `jobs`,
+ * `pool`, and cache options are ignored; those are up to the server.
+ *
+ * Throws std::system_error if the server could not be reached.
+ */
+std::string tryPatchImageRemote(const wchar_t* address,
+        const wchar_t* imagePath, const wchar_t* pdbPath,
+        const PatchOptions& options);
+
+#else
+
+void serve(const char* address, const PatchOptions& options);
+
+std::string tryPatchImageRemote(const char* address,
+        const char* imagePath, const char* pdbPath,
+        const PatchOptions& options);
+
+#endif
@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ducible/symbol_padding.h"
+
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#   define DUCIBLE_X86 1
+#   include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#   define DUCIBLE_NEON 1
+#   include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#   define TARGET(t) __attribute__((target(t)))
+#else
+#   define TARGET(t)
+#endif
+
+namespace {
+
+void zeroSymbolPaddingScalar(uint32_t* words, size_t count) {
+    for (size_t i = 0; i < count; ++i)
+        words[i] = zeroSymbolPadding(words[i]);
+}
+
+#if defined(DUCIBLE_X86)
+
+/**
+ * The SIMD kernels all work the same way, just on different vector widths:
+ *
+ *  1. Find the bytes that are not zero.
+ *  2. Shift that left by one byte in each word such that the second and third
+ *     bytes can be combined.
+ *  3. Keep the first byte, the second byte if it isn't zero, and the third byte
+ *     if neither it nor the second byte is zero.
+ */
+TARGET("sse2")
+void zeroSymbolPaddingSSE2(uint32_t* words, size_t count) {
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi32(-1);
+    const __m128i keep0 = _mm_set1_epi32(0x000000FF);
+    const __m128i keep1 = _mm_set1_epi32(0x0000FF00);
+    const __m128i keep2 = _mm_set1_epi32(0x00FF0000);
+
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(words + i));
+
+        __m128i nonzero = _mm_xor_si128(_mm_cmpeq_epi8(v, zero), ones);
+        __m128i both = _mm_and_si128(nonzero, _mm_slli_epi32(nonzero, 8));
+
+        __m128i mask = _mm_or_si128(keep0, _mm_or_si128(
+                    _mm_and_si128(nonzero, keep1),
+                    _mm_and_si128(both, keep2)));
+
+        _mm_storeu_si128((__m128i*)(words + i), _mm_and_si128(v, mask));
+    }
+
+    zeroSymbolPaddingScalar(words + i, count - i);
+}
+
+TARGET("avx2")
+void zeroSymbolPaddingAVX2(uint32_t* words, size_t count) {
+
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi32(-1);
+    const __m256i keep0 = _mm256_set1_epi32(0x000000FF);
+    const __m256i keep1 = _mm256_set1_epi32(0x0000FF00);
+    const __m256i keep2 = _mm256_set1_epi32(0x00FF0000);
+
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(words + i));
+
+        __m256i nonzero = _mm256_xor_si256(_mm256_cmpeq_epi8(v, zero), ones);
+        __m256i both = _mm256_and_si256(nonzero, _mm256_slli_epi32(nonzero, 8));
+
+        __m256i mask = _mm256_or_si256(keep0, _mm256_or_si256(
+                    _mm256_and_si256(nonzero, keep1),
+                    _mm256_and_si256(both, keep2)));
+
+        _mm256_storeu_si256((__m256i*)(words + i), _mm256_and_si256(v, mask));
+    }
+
+    zeroSymbolPaddingSSE2(words + i, count - i);
+}
+
+/**
+ * Returns true if the CPU and OS support AVX2.
+ */
+bool hasAVX2() {
+#if defined(_MSC_VER)
+    int info[4];
+
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+
+    // The OS must save the YMM registers on context switches.
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+        return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+/**
+ * Returns true if the CPU supports SSE2. This is always the case on x86-64.
+ */
+bool hasSSE2() {
+#if defined(__x86_64__) || defined(_M_X64)
+    return true;
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[3] & (1 << 26)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+#elif defined(DUCIBLE_NEON)
+
+void zeroSymbolPaddingNEON(uint32_t* words, size_t count) {
+
+    const uint32x4_t keep0 = vdupq_n_u32(0x000000FF);
+    const uint32x4_t keep1 = vdupq_n_u32(0x0000FF00);
+    const uint32x4_t keep2 = vdupq_n_u32(0x00FF0000);
+
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        uint32x4_t v = vld1q_u32(words + i);
+
+        // All ones for each byte that is not zero.
+        uint32x4_t nonzero = vreinterpretq_u32_u8(
+                vtstq_u8(vreinterpretq_u8_u32(v), vreinterpretq_u8_u32(v)));
+        uint32x4_t both = vandq_u32(nonzero, vshlq_n_u32(nonzero, 8));
+
+        uint32x4_t mask = vorrq_u32(keep0, vorrq_u32(
+                    vandq_u32(nonzero, keep1),
+                    vandq_u32(both, keep2)));
+
+        vst1q_u32(words + i, vandq_u32(v, mask));
+    }
+
+    zeroSymbolPaddingScalar(words + i, count - i);
+}
+
+#endif
+
+struct Kernel {
+    void (*fn)(uint32_t*, size_t);
+    const char* name;
+};
+
+Kernel selectKernel() {
+#if defined(DUCIBLE_X86)
+    if (hasAVX2())
+        return {zeroSymbolPaddingAVX2, "avx2"};
+    if (hasSSE2())
+        return {zeroSymbolPaddingSSE2, "sse2"};
+#elif defined(DUCIBLE_NEON)
+    return {zeroSymbolPaddingNEON, "neon"};
+#endif
+    return {zeroSymbolPaddingScalar, "scalar"};
+}
+
+const Kernel& kernel() {
+    static const Kernel k = selectKernel();
+    return k;
+}
+
+}
+
+void zeroSymbolPadding(uint32_t* words, size_t count) {
+    kernel().fn(words, count);
+}
+
+const char* symbolPaddingKernel() {
+    return kernel().name;
+}
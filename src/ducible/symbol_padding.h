@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Kernels for zeroing the padding at the end of symbol records.
+ *
+ * Symbol records are always a multiple of 4 bytes long and the data of each
+ * record ends with a null-terminated name followed by up to 3 bytes of
+ * padding. Thus, only the last 4 bytes of a record's data need to be looked
+ * at. These are gathered into an array of words such that the padding of many
+ * symbol records can be zeroed at once using SIMD instructions.
+ */
+
+#pragma once
+
+#include <stdlib.h> // For size_t
+#include <stdint.h>
+
+/**
+ * Zeroes the padding in the last 4 bytes of the data of a symbol record. The
+ * word is read in little-endian byte order. The first byte is never padding.
+ * The last byte is always padding. The two bytes in between are padding if
+ * they come after the null terminator.
+ */
+inline uint32_t zeroSymbolPadding(uint32_t word) {
+
+    // Set the high bit of each byte that is not zero.
+    const uint32_t nonzero =
+        (((word & 0x7F7F7F7F) + 0x7F7F7F7F) | word) & 0x80808080;
+
+    const uint32_t b1 = (nonzero >> 15) & 1;
+    const uint32_t b2 = (nonzero >> 23) & 1;
+
+    const uint32_t mask = 0x000000FF |
+        ((0 - b1) & 0x0000FF00) |
+        ((0 - (b1 & b2)) & 0x00FF0000);
+
+    return word & mask;
+}
+
+/**
+ * Zeroes the padding in an array of words. Each word is the last 4 bytes of
+ * the data of a symbol record. This uses the fastest kernel supported by the
+ * CPU.
+ */
+void zeroSymbolPadding(uint32_t* words, size_t count);
+
+/**
+ * Returns the name of the kernel used by zeroSymbolPadding(). Useful for
+ * diagnostics.
+ */
+const char* symbolPaddingKernel();
@@ -23,14 +23,48 @@
 #include "msf/file_stream.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
 #include <system_error>
 
 #include <iostream>
 
-MsfFileStream::MsfFileStream(FileRef f, size_t pageSize, size_t length, const uint32_t* pages)
-    : _f(f), _pageSize(pageSize), _pos(0), _length(length)
+#include "util/async_io.h"
+#include "util/file.h"
+#include "util/stats.h"
+
+namespace {
+
+/**
+ * Reads that are split up into fewer runs of pages than this are done with
+ * blocking calls. Setting up the queue costs more than it saves.
+ */
+const size_t kMinAsyncRuns = 4;
+
+/**
+ * Set once asynchronous I/O has turned out to be unavailable so that it isn't
+ * tried again for every read.
+ */
+std::atomic<bool> asyncUnavailable(false);
+
+}
+
+MsfFileStream::MsfFileStream(FileRef f, size_t pageSize, size_t length,
+        const uint32_t* pages, MemMapRef map, std::shared_ptr<const void> owner)
+    : _f(f), _map(map), _pageSize(pageSize), _pos(0), _length(length),
+      _owner(owner)
 {
-    _pages.assign(pages, pages + ::pageCount(pageSize, length));
+    const size_t count = ::pageCount(pageSize, length);
+
+    if (!_owner) {
+        auto copy = std::make_shared<std::vector<uint32_t>>(pages,
+                pages + count);
+        pages = copy->data();
+        _owner = copy;
+    }
+
+    _pages = MsfPageList(pages, count);
 }
 
 size_t MsfFileStream::length() const {
@@ -45,34 +79,157 @@ void MsfFileStream::setPos(size_t pos) {
     _pos = pos;
 }
 
+const uint8_t* MsfFileStream::data(size_t offset, size_t length) const {
+
+    if (!_map || length == 0 || offset + length > _length)
+        return NULL;
+
+    const size_t first = offset / _pageSize;
+    const size_t last = (offset + length - 1) / _pageSize;
+
+    for (size_t i = first; i < last; ++i) {
+        if (_pages[i + 1] != _pages[i] + 1)
+            return NULL;
+    }
+
+    const size_t start = (size_t)_pages[first] * _pageSize + offset % _pageSize;
+    if (start + length > _map->length())
+        return NULL;
+
+    return (const uint8_t*)_map->buf() + start;
+}
+
 size_t MsfFileStream::readFromPage(size_t page, size_t length, void* buf,
-        size_t offset) {
+        size_t offset) const {
+
+    if (_map) {
+        const size_t start = _pageSize * page + offset;
+        if (start >= _map->length())
+            return 0;
+
+        length = std::min(length, _map->length() - start);
+        memcpy(buf, (const uint8_t*)_map->buf() + start, length);
+        addStat(StatCounter::bytesRead, length);
+        return length;
+    }
+
+    // Streams may be read from different threads. Since they all share the
+    // same FILE, seeking and reading must not be interleaved.
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
 
     // Seek to the desired offset in the file.
-    if (fseek(_f.get(), (long)(_pageSize * page + offset), SEEK_SET) != 0) {
-        throw std::system_error(errno, std::system_category(),
-                "Failed to seek to MSF page");
+    seekFile(_f.get(), (int64_t)_pageSize * page + offset);
+
+    const size_t bytesRead = fread(buf, 1, length, _f.get());
+    addStat(StatCounter::bytesRead, bytesRead);
+    return bytesRead;
+}
+
+bool MsfFileStream::readAtAsync(size_t pos, size_t length, void* buf,
+        size_t& bytesRead) const {
+
+    if (asyncUnavailable)
+        return false;
+
+    const size_t first = pos / _pageSize;
+    const size_t last = (pos + length - 1) / _pageSize;
+
+    // Let the blocking path deal with streams that are missing pages.
+    if (last >= _pages.size())
+        return false;
+
+    size_t runs = 1;
+    for (size_t i = first; i < last; ++i) {
+        if (_pages[i + 1] != _pages[i] + 1)
+            ++runs;
+    }
+
+    if (runs < kMinAsyncRuns)
+        return false;
+
+    std::unique_ptr<AsyncIo> io;
+    try {
+        io.reset(new AsyncIo(_f.get()));
+    }
+    catch (const std::system_error&) {
+        asyncUnavailable = true;
+        return false;
+    }
+
+    size_t done = 0;
+    uint8_t* p = (uint8_t*)buf;
+    size_t offset = pos % _pageSize;
+
+    for (size_t i = first; length > 0; ++i) {
+        const size_t start = i;
+
+        size_t chunkSize = std::min(length, _pageSize - offset);
+
+        while (chunkSize < length && _pages[i + 1] == _pages[i] + 1) {
+            chunkSize = std::min(length, chunkSize + _pageSize);
+            ++i;
+        }
+
+        io->read((int64_t)_pageSize * _pages[start] + offset, p, chunkSize,
+                &done);
+
+        p += chunkSize;
+        length -= chunkSize;
+        offset = 0;
+    }
+
+    // If anything went wrong, read it again the slow way to find out how far
+    // it gets.
+    try {
+        io->wait();
+    }
+    catch (const std::system_error&) {
+        return false;
     }
 
-    return fread(buf, 1, length, _f.get());
+    addStat(StatCounter::bytesRead, done);
+    bytesRead = done;
+    return true;
 }
 
-size_t MsfFileStream::read(size_t length, void* buf) {
+size_t MsfFileStream::readAt(size_t pos, size_t length, void* buf) const {
 
     size_t bytesRead = 0;
 
+    // The last page may extend past the end of the stream. Don't read into
+    // that.
+    if (pos >= _length || length == 0)
+        return 0;
+
+    length = std::min(length, _length - pos);
+
+    if (!_map && readAtAsync(pos, length, buf, bytesRead))
+        return bytesRead;
+
     while (length > 0) {
-        size_t i = _pos / _pageSize;
-        size_t offset = _pos % _pageSize;
+        size_t i = pos / _pageSize;
+        size_t offset = pos % _pageSize;
         size_t chunkSize = std::min(length, _pageSize - offset);
 
         if (i >= _pages.size())
             break;
 
+        // Read runs of consecutive pages in one go if they are mapped.
+        if (_map) {
+            while (i + 1 < _pages.size() && chunkSize < length &&
+                   _pages[i + 1] == _pages[i] + 1) {
+                chunkSize = std::min(length, chunkSize + _pageSize);
+                ++i;
+            }
+
+            i = pos / _pageSize;
+        }
+
         size_t chunkRead = readFromPage(_pages[i], chunkSize, buf, offset);
         bytesRead += chunkRead;
 
-        _pos += chunkRead;
+        pos += chunkRead;
 
         if (chunkRead != chunkSize)
             break;
@@ -84,6 +241,12 @@ size_t MsfFileStream::read(size_t length, void* buf) {
     return bytesRead;
 }
 
+size_t MsfFileStream::read(size_t length, void* buf) {
+    const size_t bytesRead = readAt(_pos, length, buf);
+    _pos += bytesRead;
+    return bytesRead;
+}
+
 size_t MsfFileStream::read(void* buf) {
     return read(_length - _pos, buf);
 }
@@ -22,10 +22,37 @@
 #pragma once
 
 #include <stdint.h>
+#include <memory>
 #include <vector>
 
 #include "msf/stream.h"
 #include "util/file.h"
+#include "util/memmap.h"
+
+/**
+ * A view of the list of pages of a stream. The pages themselves are owned by
+ * the stream, which usually shares them with the stream table they were read
+ * from.
+ */
+class MsfPageList {
+private:
+    const uint32_t* _pages;
+    size_t _count;
+
+public:
+    MsfPageList(const uint32_t* pages = NULL, size_t count = 0)
+        : _pages(pages), _count(count) {}
+
+    size_t size() const { return _count; }
+    bool empty() const { return _count == 0; }
+
+    const uint32_t* data() const { return _pages; }
+    const uint32_t* begin() const { return _pages; }
+    const uint32_t* end() const { return _pages + _count; }
+
+    const uint32_t& operator[](size_t i) const { return _pages[i]; }
+    const uint32_t& back() const { return _pages[_count - 1]; }
+};
 
 /**
  * Represents an MSF file stream.
@@ -34,10 +61,14 @@ class MsfFileStream : public MsfStream {
 private:
 
     FileRef _f;
+    MemMapRef _map;
     size_t _pageSize;
     size_t _pos;
     size_t _length;
-    std::vector<uint32_t> _pages;
+    MsfPageList _pages;
+
+    // Keeps the memory that _pages points into alive.
+    std::shared_ptr<const void> _owner;
 
 public:
     /**
@@ -47,8 +78,15 @@ public:
      *   length   = Length of the stream, in bytes.
      *   pages    = List of pages. The length of this array is calculated using
      *              the page size and stream length.
+     *   map      = Optional memory map of the file. If given, pages are read
+     *              directly from the memory map instead of through the FILE
+     *              pointer.
+     *   owner    = Optional owner of the list of pages. If given, the list is
+     *              referred to instead of copied and the owner is kept alive for
+     *              as long as the stream.
      */
-    MsfFileStream(FileRef f, size_t pageSize, size_t length, const uint32_t* pages);
+    MsfFileStream(FileRef f, size_t pageSize, size_t length, const uint32_t* pages,
+            MemMapRef map = nullptr, std::shared_ptr<const void> owner = nullptr);
 
     /**
      * Returns the length of the stream, in bytes.
@@ -87,6 +125,15 @@ public:
      */
     size_t read(void* buf);
 
+    /**
+     * Reads a length of the stream starting at the given position. The current
+     * position is neither used nor changed. Thus, unlike read(), this can be
+     * called from multiple threads at once.
+     *
+     * Returns: The number of bytes read.
+     */
+    size_t readAt(size_t pos, size_t length, void* buf) const;
+
     /**
      * Writes a buffer to the stream from the current position. If an attempt is
      * made to write past the end of the last page, it will only partially
@@ -97,10 +144,38 @@ public:
     /**
      * Returns the pages in the stream. This is useful for diagnostic purposes.
      */
-    const std::vector<uint32_t>& pages() const {
+    const MsfPageList& pages() const {
         return _pages;
     }
 
+    /**
+     * Returns the file this stream is read from.
+     */
+    FileRef file() const {
+        return _f;
+    }
+
+    /**
+     * Returns the length of one page, in bytes.
+     */
+    size_t pageSize() const {
+        return _pageSize;
+    }
+
+    /**
+     * Returns the memory map the stream is read from, if any.
+     */
+    MemMapRef map() const {
+        return _map;
+    }
+
+    /**
+     * Returns a pointer to the given range of the stream in the memory map.
+     * Returns NULL if the stream isn't memory mapped or if the range doesn't
+     * lie in consecutive pages of the file.
+     */
+    const uint8_t* data(size_t offset, size_t length) const;
+
 private:
 
     /**
@@ -115,5 +190,15 @@ private:
      *
      * Returns: The number of bytes read.
      */
-    size_t readFromPage(size_t page, size_t length, void* buf, size_t offset = 0);
+    size_t readFromPage(size_t page, size_t length, void* buf, size_t offset = 0) const;
+
+    /**
+     * Reads a length of the stream starting at the given position with all of
+     * its runs of pages in flight at once. This is only worth it if the range
+     * is scattered across the file and it isn't memory mapped.
+     *
+     * Returns: False if the blocking path should be used instead.
+     */
+    bool readAtAsync(size_t pos, size_t length, void* buf,
+            size_t& bytesRead) const;
 };
@@ -50,6 +50,34 @@
  */
 
 #include <stdint.h>
+#include <stdlib.h> // For size_t
+
+/**
+ * Page size used for new MSF files.
+ */
+const size_t kMsfDefaultPageSize = 4096;
+
+/**
+ * Smallest and largest supported page sizes. Linkers use pages larger than
+ * 4096 bytes (via /PDBPAGESIZE) for PDBs that would not fit otherwise.
+ */
+const size_t kMsfMinPageSize = 512;
+const size_t kMsfMaxPageSize = 65536;
+
+/**
+ * Maximum number of pages that Microsoft's tools can handle in an MSF. Thus,
+ * the maximum size of an MSF is this many times the page size (e.g., 4 GB with
+ * 4096 byte pages).
+ */
+const uint64_t kMsfMaxPageCount = 1 << 20;
+
+/**
+ * Returns true if the given page size is supported. It must be a power of 2.
+ */
+inline bool isValidPageSize(size_t pageSize) {
+    return pageSize >= kMsfMinPageSize && pageSize <= kMsfMaxPageSize &&
+           (pageSize & (pageSize - 1)) == 0;
+}
 
 struct STREAM_INFO {
     // Size of the stream, in bytes
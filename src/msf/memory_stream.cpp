@@ -25,15 +25,16 @@
 
 #include "msf/memory_stream.h"
 
-MsfMemoryStream::MsfMemoryStream(size_t length, const void* buf)
-    : _pos(0)
+MsfMemoryStream::MsfMemoryStream(size_t length, const void* buf,
+        Arena* arena)
+    : _pos(0), _data(arena)
 {
     _data.resize(length);
     memcpy(_data.data(), buf, length);
 }
 
-MsfMemoryStream::MsfMemoryStream(MsfStream* stream)
-    : _pos(0)
+MsfMemoryStream::MsfMemoryStream(MsfStream* stream, Arena* arena)
+    : _pos(0), _data(arena)
 {
     const size_t length = stream->length();
 
@@ -25,6 +25,7 @@
 #include <vector>
 
 #include "msf/stream.h"
+#include "util/arena.h"
 
 /**
  * Represents an MSF file stream.
@@ -33,7 +34,7 @@ class MsfMemoryStream : public MsfStream {
 private:
 
     size_t _pos;
-    std::vector<uint8_t> _data;
+    ArenaVector<uint8_t> _data;
 
 public:
     /**
@@ -42,13 +43,15 @@ public:
      * Params:
      *   length = Length of the buffer, in bytes.
      *   buf    = The buffer.
+     *   arena  = Optional arena to allocate the copy from. It must outlive the
+     *            stream.
      */
-    MsfMemoryStream(size_t length, const void* buf);
+    MsfMemoryStream(size_t length, const void* buf, Arena* arena = NULL);
 
     /**
      * Initialize the stream with another stream.
      */
-    MsfMemoryStream(MsfStream* stream);
+    MsfMemoryStream(MsfStream* stream, Arena* arena = NULL);
 
     /**
      * Returns the length of the stream, in bytes.
@@ -26,53 +26,27 @@
 #include <cstring>
 #include <iostream>
 #include <cassert>
+#include <algorithm>
 
+#include "util/arena.h"
 #include "util/file.h"
+#include "util/hash.h"
+#include "util/memmap.h"
+#include "util/sha256.h"
+#include "util/stats.h"
+#include "util/thread_pool.h"
 
 #include "msf/file_stream.h"
 #include "msf/readonly_stream.h"
+#include "msf/overlay_stream.h"
+#include "msf/page_writer.h"
+#include "msf/read_planner.h"
 
 namespace {
 
-// A good page size to use when writing out the MSF.
-const size_t kPageSize = 4096;
-
-// A blank page. Used to write uninitialized pages to the MSF file.
-const uint8_t kBlankPage[kPageSize] = {0};
-
-/**
- * Helper function for finding the size of the given file.
- */
-int64_t getFileSize(FILE* f) {
-
-    // Save our spot...
-    int64_t pos = ftell(f);
-    if (pos == -1) {
-        throw std::system_error(errno, std::system_category(),
-            "ftell() failed");
-    }
-
-    // Go to the end
-    if (fseek(f, 0, SEEK_END) == -1) {
-        throw std::system_error(errno, std::system_category(),
-            "fseek() failed");
-    }
-
-    // Current position is the size of the file.
-    int64_t size = ftell(f);
-    if (size == -1) {
-        throw std::system_error(errno, std::system_category(),
-            "ftell() failed");
-    }
-
-    // Go back to our old spot
-    if (fseek(f, (long)pos, SEEK_SET) == -1) {
-        throw std::system_error(errno, std::system_category(),
-            "fseek() failed");
-    }
-
-    return size;
-}
+// A blank page. Used to write uninitialized pages to the MSF file. This is
+// large enough for any page size.
+const uint8_t kBlankPage[kMsfMaxPageSize] = {0};
 
 /**
  * Returns true if the given page number should be a free page map page.
@@ -86,7 +60,7 @@ int64_t getFileSize(FILE* f) {
  * out there or add an unreasonable complexity to the file format, so we're
  * stuck with it for the foreseeable future.
  */
-bool isFpmPage(size_t page, size_t pageSize = kPageSize) noexcept {
+bool isFpmPage(size_t page, size_t pageSize) noexcept {
     switch (page & (pageSize - 1)) {
         case 1: case 2:
             return true;
@@ -98,47 +72,211 @@ bool isFpmPage(size_t page, size_t pageSize = kPageSize) noexcept {
 /**
  * Writes a page to the given file handle.
  */
-void writePage(FileRef f, const uint8_t* data, size_t pageSize,
-        std::vector<uint32_t>& pagesWritten, uint32_t& pageCount) {
+void writePage(MsfPageWriter& w, const uint8_t* data, size_t pageSize,
+        ArenaVector<uint32_t>& pagesWritten, uint32_t& pageCount) {
 
-    if (fwrite(data, 1, pageSize, f.get()) != pageSize) {
-        throw std::system_error(errno, std::system_category(),
-            "failed writing page");
-    }
+    w.write(data, pageSize);
+
+    addStat(StatCounter::bytesWritten, pageSize);
+    addStat(StatCounter::pagesWritten, 1);
 
     pagesWritten.push_back(pageCount++);
 }
 
+/**
+ * If the next page is the start of an FPM pair, writes the pair as blank pages.
+ * The FPM is filled in at the end. These pages are not part of any stream and
+ * so aren't added to its list of pages.
+ */
+void skipFpmPages(MsfPageWriter& w, size_t pageSize, uint32_t& pageCount) {
+
+    if (!isFpmPage(pageCount, pageSize))
+        return;
+
+    w.writeZeros(2 * pageSize);
+
+    addStat(StatCounter::bytesWritten, 2 * pageSize);
+    addStat(StatCounter::pagesWritten, 2);
+
+    pageCount += 2;
+}
+
+/**
+ * Copies a run of pages from a file stream directly to the given file handle.
+ */
+void copyPages(MsfPageWriter& w, const MsfFileStream* stream, uint32_t first,
+        uint32_t count, ArenaVector<uint32_t>& pagesWritten,
+        uint32_t& pageCount) {
+
+    if (count == 0)
+        return;
+
+    const size_t pageSize = stream->pageSize();
+
+    // Streams that were read from memory have no file to copy from.
+    if (!stream->file()) {
+        const MemMap& map = *stream->map();
+        if (((uint64_t)first + count) * pageSize > map.length())
+            throw InvalidMsf("failed to read page of stream");
+
+        w.write((const uint8_t*)map.buf() + (size_t)first * pageSize,
+                count * pageSize);
+    }
+    else {
+        w.copy(stream->file(), (int64_t)first * pageSize, count * pageSize);
+    }
+
+    addStat(StatCounter::bytesWritten, count * stream->pageSize());
+    addStat(StatCounter::pagesWritten, count);
+    addStat(StatCounter::pagesCopied, count);
+
+    for (uint32_t i = 0; i < count; ++i)
+        pagesWritten.push_back(pageCount++);
+}
+
+/**
+ * Writes a file stream to the given file handle. Rather than reading each page
+ * into a buffer and writing it back out again, runs of consecutive pages are
+ * copied straight from the source file.
+ *
+ * If an overlay is given, the stream is the overlay's underlying stream and
+ * pages that have been modified in the overlay are written from memory instead.
+ * The last page, which may be partially filled, always goes through a buffer so
+ * that the remainder can be padded with zeros.
+ */
+void writeFileStream(MsfPageWriter& w, const MsfFileStream* stream,
+        MsfOverlayStream* overlay, ArenaVector<uint32_t>& pagesWritten,
+        uint32_t& pageCount) {
+
+    const size_t pageSize = stream->pageSize();
+    const auto& pages = stream->pages();
+    const size_t length = overlay ? overlay->length() : stream->length();
+    const size_t fullPages = length / pageSize;
+
+    // Pages past this point don't exist in the source file.
+    const size_t sourcePages = stream->length() / pageSize;
+
+    // Start of the current run of pages and its length.
+    uint32_t runStart = 0;
+    uint32_t runLength = 0;
+
+    std::vector<uint8_t> buf(pageSize);
+
+    for (size_t i = 0; i < fullPages; ++i) {
+
+        const bool fromMemory = i >= sourcePages ||
+            (overlay && overlay->isDirty(i));
+
+        // A run must be consecutive in both the source and the destination.
+        if (fromMemory || isFpmPage(pageCount + runLength, pageSize) ||
+            (runLength > 0 && pages[i] != runStart + runLength)) {
+            copyPages(w, stream, runStart, runLength, pagesWritten, pageCount);
+            runLength = 0;
+        }
+
+        skipFpmPages(w, pageSize, pageCount);
+
+        if (fromMemory) {
+            overlay->setPos(i * pageSize);
+            if (overlay->read(pageSize, buf.data()) != pageSize)
+                throw InvalidMsf("failed to read page of stream");
+
+            writePage(w, buf.data(), pageSize, pagesWritten, pageCount);
+            continue;
+        }
+
+        if (runLength == 0)
+            runStart = pages[i];
+
+        ++runLength;
+    }
+
+    copyPages(w, stream, runStart, runLength, pagesWritten, pageCount);
+
+    const size_t leftOver = length % pageSize;
+    if (leftOver == 0)
+        return;
+
+    if (overlay) {
+        overlay->setPos(fullPages * pageSize);
+        if (overlay->read(leftOver, buf.data()) != leftOver)
+            throw InvalidMsf("failed to read last page of stream");
+    }
+    else {
+        MsfFileStream tail(stream->file(), pageSize, leftOver, &pages[fullPages],
+                stream->map());
+        if (tail.read(leftOver, buf.data()) != leftOver)
+            throw InvalidMsf("failed to read last page of stream");
+    }
+
+    memset(buf.data() + leftOver, 0, pageSize - leftOver);
+
+    skipFpmPages(w, pageSize, pageCount);
+
+    writePage(w, buf.data(), pageSize, pagesWritten, pageCount);
+}
+
+/**
+ * Returns the file stream that the given stream's pages can be copied from
+ * directly, or NULL if there is none. This is only possible if its pages have
+ * the given size. If the stream is an overlay, the overlay is returned as well.
+ */
+const MsfFileStream* passthroughSource(MsfStream* stream, size_t pageSize,
+        MsfOverlayStream*& overlay) {
+
+    overlay = dynamic_cast<MsfOverlayStream*>(stream);
+    if (overlay) {
+        if (overlay->pageSize() != pageSize)
+            return NULL;
+
+        stream = const_cast<MsfStream*>(overlay->base());
+    }
+
+    auto fileStream = dynamic_cast<const MsfFileStream*>(stream);
+    if (!fileStream || fileStream->pageSize() != pageSize)
+        return NULL;
+
+    return fileStream;
+}
+
 /**
  * Writes a stream to the given file handle.
  *
  * The pages that are written are appended to the given vector and the page
  * count is incremented appropriately.
  */
-void writeStream(FileRef f, MsfStreamRef stream,
-        std::vector<uint32_t>& pagesWritten, uint32_t& pageCount) {
+void writeStream(MsfPageWriter& w, MsfStreamRef stream, size_t pageSize,
+        ArenaVector<uint32_t>& pagesWritten, uint32_t& pageCount) {
 
     if (!stream || stream->length() == 0)
         return;
 
-    uint8_t buf[kPageSize];
+    // Pages that haven't been modified can be passed through without copying
+    // them into a buffer first.
+    MsfOverlayStream* overlay;
+    if (auto fileStream = passthroughSource(stream.get(), pageSize, overlay)) {
+        addStat(StatCounter::streamsPassedThrough, 1);
+        writeFileStream(w, fileStream, overlay, pagesWritten, pageCount);
+        return;
+    }
+
+    addStat(StatCounter::streamsRewritten, 1);
+
+    std::vector<uint8_t> buf(pageSize);
 
     stream->setPos(0);
 
-    while (size_t bytesRead = stream->read(kPageSize, buf)) {
-        assert(bytesRead <= kPageSize);
+    while (size_t bytesRead = stream->read(pageSize, buf.data())) {
+        assert(bytesRead <= pageSize);
 
-        size_t leftOver = kPageSize - bytesRead;
+        size_t leftOver = pageSize - bytesRead;
 
         // Pad the rest of the buffer with zeros
-        memset(buf + bytesRead, 0, leftOver);
+        memset(buf.data() + bytesRead, 0, leftOver);
 
-        if (isFpmPage(pageCount)) {
-            writePage(f, kBlankPage, sizeof(kBlankPage), pagesWritten, pageCount);
-            writePage(f, kBlankPage, sizeof(kBlankPage), pagesWritten, pageCount);
-        }
+        skipFpmPages(w, pageSize, pageCount);
 
-        writePage(f, buf, sizeof(buf), pagesWritten, pageCount);
+        writePage(w, buf.data(), pageSize, pagesWritten, pageCount);
     }
 }
 
@@ -181,9 +319,34 @@ public:
     /**
      * Writes the FPM to the MSF.
      */
-    void write(FILE* f, size_t pageSize = kPageSize) const;
+    void write(FILE* f, size_t pageSize) const;
+
+    /**
+     * Gets the contents of the given FPM page exactly as write() leaves it in
+     * the MSF.
+     */
+    void getPage(size_t page, uint8_t* buf, size_t pageSize) const;
 };
 
+void FreePageMap::getPage(size_t page, uint8_t* buf, size_t pageSize) const {
+
+    memset(buf, 0, pageSize);
+
+    // Only the first page of each FPM pair is ever written to.
+    if (page % pageSize != 1)
+        return;
+
+    const size_t offset = (page / pageSize) * pageSize;
+    if (offset >= _data.size())
+        return;
+
+    const size_t n = std::min(pageSize, _data.size() - offset);
+    memcpy(buf, &_data[offset], n);
+
+    // The remainder of the final FPM page is filled with 1s.
+    memset(buf + n, 0xFF, pageSize - n);
+}
+
 void FreePageMap::write(FILE* f, size_t pageSize) const {
     // The FPM is spread out across the MSF at regular intervals. There are two
     // FPM pages every 4096 pages (or whatever the page size is), starting at
@@ -209,10 +372,7 @@ void FreePageMap::write(FILE* f, size_t pageSize) const {
     for (size_t i = 0; i < chunks; ++i) {
 
         // Seek to the FPM page
-        if (fseek(f, (long)(page * pageSize), SEEK_SET) != 0) {
-            throw std::system_error(errno, std::system_category(),
-                    "Failed to seek to MSF page");
-        }
+        seekFile(f, (int64_t)page * pageSize);
 
         // Write a page of the FPM
         if (fwrite(data, 1, pageSize, f) != pageSize) {;
@@ -227,10 +387,7 @@ void FreePageMap::write(FILE* f, size_t pageSize) const {
     // Write the remainder of the FPM and fill with 0xFF.
     if (const size_t leftOver = _data.size() % pageSize) {
         // Seek to the FPM page
-        if (fseek(f, (long)(page * pageSize), SEEK_SET) != 0) {
-            throw std::system_error(errno, std::system_category(),
-                    "Failed to seek to final MSF page");
-        }
+        seekFile(f, (int64_t)page * pageSize);
 
         // Write a partial page of the FPM
         if (fwrite(data, 1, leftOver, f) != leftOver) {;
@@ -247,22 +404,471 @@ void FreePageMap::write(FILE* f, size_t pageSize) const {
     }
 }
 
+/**
+ * Allocates pages for a stream of the given length in the same way that
+ * writeStream() does, skipping over FPM pages.
+ */
+void allocatePages(size_t length, size_t pageSize, uint32_t* pages,
+        uint32_t& pageCount) {
+
+    for (size_t n = ::pageCount(pageSize, length); n > 0; --n) {
+        if (isFpmPage(pageCount, pageSize))
+            pageCount += 2;
+
+        *pages++ = pageCount++;
+    }
+}
+
+void allocatePages(size_t length, size_t pageSize,
+        ArenaVector<uint32_t>& pages, uint32_t& pageCount) {
+
+    const size_t first = pages.size();
+    pages.resize(first + ::pageCount(pageSize, length));
+    allocatePages(length, pageSize, pages.data() + first, pageCount);
+}
+
+/**
+ * Roughly how much of a file stream is copied by one task when writing through
+ * a memory map.
+ */
+const size_t kPagesPerTaskBytes = 8 * 1024 * 1024;
+
+/**
+ * Reads the pages [first, last) of a stream straight into their place in the
+ * output. The remainder of the last page is left alone.
+ *
+ * File streams are read without moving their position and thus may be read
+ * by several threads at once. Any other stream must only be read by one.
+ */
+void fillPages(uint8_t* buf, size_t pageSize, MsfStream* stream,
+        const uint32_t* pages, size_t first, size_t last) {
+
+    auto fileStream = dynamic_cast<const MsfFileStream*>(stream);
+
+    if (!fileStream)
+        stream->setPos(first * pageSize);
+
+    for (size_t i = first; i < last; ++i) {
+        const size_t chunk = std::min(pageSize,
+                stream->length() - i * pageSize);
+
+        uint8_t* page = buf + (size_t)pages[i] * pageSize;
+
+        const size_t bytesRead = fileStream ?
+            fileStream->readAt(i * pageSize, chunk, page) :
+            stream->read(chunk, page);
+
+        if (bytesRead != chunk)
+            throw InvalidMsf("failed to read page of stream");
+    }
+}
+
+/**
+ * Adds the pages of a stream that can be copied straight from the original file
+ * to the planner. These are all pages of a file stream, or the pages of an
+ * overlay that haven't been modified. The indices of the remaining pages are
+ * added to `rest`.
+ *
+ * Returns: False if the stream can't be planned for at all. It must then be
+ * filled in with fillPages() instead.
+ */
+bool planPages(MsfReadPlanner& planner, MsfStream* stream, size_t pageSize,
+        const uint32_t* pages, std::vector<size_t>& rest) {
+
+    auto overlay = dynamic_cast<MsfOverlayStream*>(stream);
+    auto fileStream = dynamic_cast<const MsfFileStream*>(
+            overlay ? overlay->base() : stream);
+
+    if (!fileStream || !fileStream->map())
+        return false;
+
+    // The modified pages of an overlay are only known by its own page size.
+    if (overlay && overlay->pageSize() != pageSize)
+        return false;
+
+    const size_t length = stream->length();
+    const size_t count = ::pageCount(pageSize, length);
+
+    for (size_t i = 0; i < count; ++i) {
+        const size_t offset = i * pageSize;
+        const size_t chunk = std::min(pageSize, length - offset);
+
+        if (overlay && (overlay->isDirty(i) ||
+                    offset + chunk > fileStream->length())) {
+            rest.push_back(i);
+            continue;
+        }
+
+        if (!planner.add(fileStream, offset, chunk,
+                    (uint64_t)pages[i] * pageSize)) {
+            // This can only fail for the first page that is added, since every
+            // page of the stream is read from the same map.
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Fills in the given pages of an overlay that weren't planned for. Modified
+ * pages are copied from memory and the rest is read through the overlay.
+ */
+void fillOverlayPages(uint8_t* buf, size_t pageSize, MsfOverlayStream* overlay,
+        const uint32_t* pages, const std::vector<size_t>& indices) {
+
+    for (size_t i: indices) {
+        const size_t chunk = std::min(pageSize,
+                overlay->length() - i * pageSize);
+
+        uint8_t* page = buf + (size_t)pages[i] * pageSize;
+
+        if (overlay->isDirty(i)) {
+            memcpy(page, overlay->pageData(i), chunk);
+            continue;
+        }
+
+        overlay->setPos(i * pageSize);
+        if (overlay->read(chunk, page) != chunk)
+            throw InvalidMsf("failed to read page of stream");
+    }
 }
 
-MsfFile::MsfFile(FileRef f) {
+/**
+ * Streams are fingerprinted in chunks of this many bytes. Each chunk is hashed
+ * by its own task.
+ */
+const size_t kFingerprintChunk = 8 * 1024 * 1024;
+
+/**
+ * Hashes the bytes [begin, end) of a stream. Modified pages of an overlay and
+ * pages of a memory map are hashed where they are. Everything else is read
+ * into `scratch` first.
+ *
+ * File streams, and overlays over them, are read without moving their position
+ * and may thus be hashed by several threads at once. Any other stream must only
+ * be hashed by one.
+ */
+void hashStreamRange(Hasher& hasher, MsfStream* stream, size_t begin,
+        size_t end, std::vector<uint8_t>& scratch) {
+
+    auto overlay = dynamic_cast<MsfOverlayStream*>(stream);
+    auto fileStream = dynamic_cast<const MsfFileStream*>(
+            overlay ? overlay->base() : stream);
+
+    // Each piece that is hashed lies within one page.
+    const size_t pageSize = overlay ? overlay->pageSize() :
+        fileStream ? fileStream->pageSize() : kMsfDefaultPageSize;
+
+    if (scratch.size() < pageSize)
+        scratch.resize(pageSize);
+
+    while (begin < end) {
+        const size_t n = std::min(end - begin, pageSize - begin % pageSize);
+
+        if (overlay && overlay->isDirty(begin / pageSize)) {
+            hasher.update(overlay->pageData(begin / pageSize) +
+                    begin % pageSize, n);
+        }
+        else if (fileStream && begin + n <= fileStream->length()) {
+            if (const uint8_t* data = fileStream->data(begin, n)) {
+                hasher.update(data, n);
+            }
+            else {
+                if (fileStream->readAt(begin, n, scratch.data()) != n)
+                    throw InvalidMsf("failed to read page of stream");
+
+                hasher.update(scratch.data(), n);
+            }
+        }
+        else {
+            stream->setPos(begin);
+            if (stream->read(n, scratch.data()) != n)
+                throw InvalidMsf("failed to read page of stream");
+
+            hasher.update(scratch.data(), n);
+        }
+
+        begin += n;
+    }
+}
+
+/**
+ * Hashes a file from the beginning. Afterwards, the position of the FILE is at
+ * its end.
+ */
+void hashFile(FILE* f, Sha256& digest) {
+
+    PhaseTimer timer("hashMsf");
+
+    if (fflush(f) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                "failed to flush file");
+    }
+
+    seekFile(f, 0);
+
+    std::vector<uint8_t> buf(1024 * 1024);
+
+    uint64_t total = 0;
+
+    while (true) {
+        const size_t n = fread(buf.data(), 1, buf.size(), f);
+        if (n == 0)
+            break;
+
+        addStat(StatCounter::bytesRead, n);
+        digest.update(buf.data(), n);
+        total += n;
+    }
+
+    timer.addArg("bytes", total);
+
+    if (ferror(f)) {
+        throw std::system_error(errno, std::system_category(),
+                "failed to read back MSF file");
+    }
+}
+
+/**
+ * Returns true if the given pages contain exactly the given data followed by
+ * zero padding.
+ */
+bool pagesMatch(const uint8_t* buf, size_t pageSize, const uint32_t* pages,
+        const void* data, size_t length) {
+
+    const uint8_t* p = (const uint8_t*)data;
+
+    for (size_t i = 0; length > 0; ++i) {
+        const uint8_t* page = buf + (size_t)pages[i] * pageSize;
+        const size_t chunk = std::min(length, pageSize);
+
+        if (memcmp(page, p, chunk) != 0 ||
+            memcmp(page + chunk, kBlankPage, pageSize - chunk) != 0)
+            return false;
+
+        p += chunk;
+        length -= chunk;
+    }
+
+    return true;
+}
+
+}
+
+/**
+ * The page layout that MsfFile::write() produces.
+ */
+struct MsfFile::Layout {
+    // The stream table as it will be written out. This includes the page
+    // numbers of each stream.
+    ArenaVector<uint32_t> streamTable;
+
+    // Index into the stream table of the first page of each stream.
+    ArenaVector<size_t> streamPages;
+
+    // The pages of the stream table and the pages of its page list.
+    ArenaVector<uint32_t> streamTablePages;
+    ArenaVector<uint32_t> streamTablePgPg;
+
+    // The order in which the streams are laid out in the file.
+    ArenaVector<size_t> order;
+
+    // True if the stream table and its page list come before the streams.
+    bool streamTableFirst;
+
+    // The pages that are marked as free in the FPM.
+    ArenaVector<uint32_t> freePages;
+
+    // Number of pages before the first page of the first stream. These are
+    // blank, except for the header and the FPM.
+    uint32_t reservedPages;
+
+    // Total number of pages in the MSF.
+    uint32_t pageCount;
+
+    explicit Layout(Arena* arena)
+        : streamTable(arena), streamPages(arena), streamTablePages(arena),
+          streamTablePgPg(arena), order(arena), streamTableFirst(false),
+          freePages(arena), reservedPages(0), pageCount(0) {}
+
+    /**
+     * Returns the first page of the given stream.
+     */
+    const uint32_t* pages(size_t stream) const {
+        return streamTable.data() + streamPages[stream];
+    }
+};
+
+void MsfFile::computeLayout(Layout& layout) const {
+
+    const size_t count = streamCount();
+
+    // The header and the FPM pair. Unless the layout is compact, there is also
+    // the superfluous blank page.
+    layout.reservedPages = _compact ? 3 : 4;
+    layout.pageCount = layout.reservedPages;
+
+    // The page lists in the stream table are in the order of the streams, no
+    // matter where the streams end up in the file. Thus, the size of the
+    // stream table and where each page list goes in it are known up front.
+    layout.streamTable.clear();
+    layout.streamTable.push_back((uint32_t)count);
+
+    for (size_t i = 0; i < count; ++i)
+        layout.streamTable.push_back((uint32_t)streamLength(i));
+
+    layout.streamPages.clear();
+
+    size_t tableLength = layout.streamTable.size();
+    for (size_t i = 0; i < count; ++i) {
+        layout.streamPages.push_back(tableLength);
+        tableLength += ::pageCount(_pageSize, streamLength(i));
+    }
+
+    layout.streamTable.resize(tableLength);
+
+    layout.order.clear();
+
+    if (_compact) {
+        std::vector<bool> placed(count);
+
+        for (size_t i: _firstStreams) {
+            if (i < count && !placed[i]) {
+                layout.order.push_back(i);
+                placed[i] = true;
+            }
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            if (!placed[i])
+                layout.order.push_back(i);
+        }
+    }
+    else {
+        for (size_t i = 0; i < count; ++i)
+            layout.order.push_back(i);
+    }
+
+    layout.streamTableFirst = _compact;
+
+    auto allocateStreamTable = [&]() {
+        layout.streamTablePages.clear();
+        allocatePages(tableLength * sizeof(uint32_t), _pageSize,
+                layout.streamTablePages, layout.pageCount);
+
+        layout.streamTablePgPg.clear();
+        allocatePages(layout.streamTablePages.size() * sizeof(uint32_t),
+                _pageSize, layout.streamTablePgPg, layout.pageCount);
+    };
+
+    if (layout.streamTableFirst)
+        allocateStreamTable();
+
+    for (size_t i: layout.order) {
+        allocatePages(streamLength(i), _pageSize,
+                layout.streamTable.data() + layout.streamPages[i],
+                layout.pageCount);
+    }
+
+    if (!layout.streamTableFirst)
+        allocateStreamTable();
+
+    // The superfluous page and the pages of stream 0 are free. Stream 0 is
+    // the stream table of the previous commit and isn't used by anyone.
+    layout.freePages.clear();
+
+    if (!_compact)
+        layout.freePages.push_back(3);
+
+    if (count > 0) {
+        const uint32_t* pages = layout.pages(0);
+        layout.freePages.insert(layout.freePages.end(), pages,
+                pages + ::pageCount(_pageSize, streamLength(0)));
+    }
+}
+
+const uint32_t MsfFile::StreamEntry::kLoaded;
+
+MsfFile::MsfFile(Arena* arena)
+    : _filePageSize(0), _arena(arena), _pageSize(kMsfDefaultPageSize),
+      _compact(false) {
+}
+
+MsfFile::MsfFile(FileRef f, Arena* arena)
+    : _f(f), _arena(arena), _compact(false) {
+
+    // Map the file into memory such that streams can be read without seeking
+    // around the file for every page. If the file can't be mapped (e.g.,
+    // because it is empty or not a regular file), fall back to reading it
+    // through the FILE pointer.
+    MemMapRef map;
+    try {
+        map = std::make_shared<MemMap>(f.get(), 0, true);
+    }
+    catch (const std::system_error&) {
+        map = nullptr;
+    }
+
+    read(map);
+}
+
+MsfFile::MsfFile(MemMapRef map, Arena* arena)
+    : _arena(arena), _compact(false) {
+
+    if (!map)
+        throw InvalidMsf("Missing MSF header");
+
+    read(map);
+}
+
+MsfFile::MsfFile(MsfStream& source, Arena* arena)
+    : _arena(arena), _compact(false) {
+
+    // The streams refer to the memory map and may outlive this MsfFile. Thus,
+    // the copy of the source belongs to the map.
+    auto data = std::make_shared<std::vector<uint8_t>>(source.length());
+
+    source.setPos(0);
+    if (source.read(data->size(), data->data()) != data->size())
+        throw InvalidMsf("failed to read MSF");
+
+    MemMapRef map(new MemMap(data->data(), data->size()),
+            [data](MemMap* m) { delete m; });
+
+    read(map);
+}
+
+void MsfFile::read(MemMapRef map) {
+
+    PhaseTimer timer("readMsf");
+
+    FileRef f = _f;
 
     MSF_HEADER header;
 
     // Read the header
-    if (fread(&header, sizeof(header), 1, f.get()) != 1)
+    if (map) {
+        if (map->length() < sizeof(header))
+            throw InvalidMsf("Missing MSF header");
+
+        memcpy(&header, map->buf(), sizeof(header));
+    }
+    else if (fread(&header, sizeof(header), 1, f.get()) != 1)
         throw InvalidMsf("Missing MSF header");
 
     // Check that this is indeed an MSF header
     if (memcmp(header.magic, kMsfHeaderMagic, sizeof(kMsfHeaderMagic)) != 0)
         throw InvalidMsf("Invalid MSF header");
 
+    if (!isValidPageSize(header.pageSize))
+        throw InvalidMsf("Unsupported MSF page size");
+
+    _pageSize = _filePageSize = header.pageSize;
+
     // Check that the file size makes sense
-    if (header.pageSize * header.pageCount != getFileSize(f.get()))
+    const uint64_t fileSize = map ? map->length() : getFileSize(f.get());
+    if ((uint64_t)header.pageSize * header.pageCount != fileSize)
         throw InvalidMsf("Invalid MSF file length");
 
     // The number of pages required to store the pages of the stream table
@@ -271,51 +877,62 @@ MsfFile::MsfFile(FileRef f) {
         ::pageCount(header.pageSize, header.streamTableInfo.size);
 
     // Read the stream table page directory
-    std::unique_ptr<uint32_t> streamTablePagesPages(
-        new uint32_t[stPagesPagesCount]);
+    ArenaVector<uint32_t> streamTablePagesPages(stPagesPagesCount, 0, _arena);
+
+    if (map) {
+        // The root page list immediately follows the header.
+        const size_t rootLength = stPagesPagesCount * sizeof(uint32_t);
+        if (rootLength > map->length() - sizeof(header))
+            throw InvalidMsf("Missing root MSF stream table page list");
 
-    if (fread(streamTablePagesPages.get(), sizeof(uint32_t), stPagesPagesCount, f.get()) !=
+        memcpy(streamTablePagesPages.data(),
+                (const uint8_t*)map->buf() + sizeof(header), rootLength);
+    }
+    else if (fread(streamTablePagesPages.data(), sizeof(uint32_t), stPagesPagesCount, f.get()) !=
             stPagesPagesCount) {
         throw InvalidMsf("Missing root MSF stream table page list");
     }
 
     MsfFileStream streamTablePagesStream(f, header.pageSize, stPagesPagesCount * sizeof(uint32_t),
-            streamTablePagesPages.get());
+            streamTablePagesPages.data(), map);
 
     // Read the list of stream table pages.
-    std::vector<uint32_t> streamTablePages(stPagesPagesCount);
+    ArenaVector<uint32_t> streamTablePages(stPagesPagesCount, 0, _arena);
     if (streamTablePagesStream.read(&streamTablePages[0])
             != stPagesPagesCount * sizeof(uint32_t)) {
         throw InvalidMsf("failed to read stream table page list");
     }
 
-    // Finally, read the stream table itself
+    // Finally, read the stream table itself. It is kept around since the page
+    // lists of the streams point into it.
     MsfFileStream streamTableStream(f, header.pageSize, header.streamTableInfo.size,
-            &streamTablePages[0]);
-    std::vector<uint32_t> streamTable(header.streamTableInfo.size / sizeof(uint32_t));
-    if (streamTableStream.read(&streamTable[0]) != header.streamTableInfo.size)
+            &streamTablePages[0], map);
+    _streamTable = std::make_shared<ArenaVector<uint32_t>>(
+            header.streamTableInfo.size / sizeof(uint32_t), 0, _arena);
+    const ArenaVector<uint32_t>& streamTable = *_streamTable;
+    if (streamTable.empty() ||
+        streamTableStream.read(_streamTable->data()) != header.streamTableInfo.size)
         throw InvalidMsf("failed to read stream table");
 
     // The first element in the stream table is the total number of streams.
-    const uint32_t& streamCount = streamTable[0];
+    const uint32_t streamCount = streamTable[0];
 
-    // The sizes of each stream then follow.
-    const uint32_t* streamSizes = &streamTable[1];
+    // The sizes of each stream then follow. After all the sizes, there are the
+    // lists of pages for each stream. We calculate the number of pages required
+    // for the stream using the stream size.
+    //
+    // If we were given a bogus stream count, we could potentially overflow the
+    // stream table vector. Detect that here.
+    if (streamCount >= streamTable.size())
+        throw InvalidMsf("invalid stream count in stream table");
 
-    // After all the sizes, there are the lists of pages for each stream. We
-    // calculate the number of pages required for the stream using the stream
-    // size.
-    const uint32_t* streamPages = streamSizes + streamCount;
+    size_t pagesIndex = 1 + (size_t)streamCount;
 
-    uint32_t pagesIndex = 0;
-    for (uint32_t i = 0; i < streamCount; ++i) {
+    _entries.resize(streamCount);
 
-        // If we were given a bogus stream count, we could potentially overflow
-        // the stream table vector. Detect that here.
-        if (pagesIndex >= streamTable.size())
-            throw InvalidMsf("invalid stream count in stream table");
+    for (uint32_t i = 0; i < streamCount; ++i) {
 
-        uint32_t size = streamSizes[i];
+        uint32_t size = streamTable[1 + i];
 
         // Microsoft's PDB implementation sometimes sets the size of a stream to
         // -1. We can't ignore this stream as it will invalidate the stream
@@ -323,11 +940,43 @@ MsfFile::MsfFile(FileRef f) {
         if (size == (uint32_t)-1)
             size = 0;
 
-        addStream(new MsfFileStream(f, header.pageSize, size,
-                streamPages + pagesIndex));
+        const size_t count = ::pageCount(header.pageSize, size);
+        if (count > streamTable.size() - pagesIndex)
+            throw InvalidMsf("invalid stream count in stream table");
+
+        _entries[i].length = size;
+        _entries[i].pages = (uint32_t)pagesIndex;
+
+        pagesIndex += count;
+    }
+
+    // The streams themselves are only created when they are asked for.
+    _streams.resize(streamCount);
+    _map = map;
+}
+
+size_t MsfFile::streamLength(size_t index) const {
+    if (isPending(index))
+        return _entries[index].length;
 
-        pagesIndex += ::pageCount(header.pageSize, size);
+    const auto& stream = _streams[index];
+    return stream ? stream->length() : 0;
+}
+
+MsfStreamRef MsfFile::loadStream(size_t index) const {
+    std::lock_guard<std::mutex> lock(_streamsMutex);
+
+    if (isPending(index)) {
+        StreamEntry& entry = _entries[index];
+
+        _streams[index] = std::make_shared<MsfFileStream>(_f, _filePageSize,
+                entry.length, _streamTable->data() + entry.pages, _map,
+                _streamTable);
+
+        entry.pages = StreamEntry::kLoaded;
     }
+
+    return _streams[index];
 }
 
 MsfFile::~MsfFile() {
@@ -340,103 +989,116 @@ size_t MsfFile::addStream(MsfStream* stream) {
 
 MsfStreamRef MsfFile::getStream(size_t index) {
     if (index < _streams.size()) {
-        return _streams[index];
+        return loadStream(index);
     }
 
     return nullptr;
 }
 
 void MsfFile::replaceStream(size_t index, MsfStreamRef stream) {
+    std::lock_guard<std::mutex> lock(_streamsMutex);
+
     _streams[index] = stream;
+
+    if (index < _entries.size())
+        _entries[index].pages = StreamEntry::kLoaded;
 }
 
 size_t MsfFile::streamCount() const {
     return _streams.size();
 }
 
-void MsfFile::write(FileRef f) const {
+void MsfFile::setPageSize(size_t pageSize) {
+    if (!isValidPageSize(pageSize))
+        throw InvalidMsf("Unsupported MSF page size");
 
-    uint32_t pageCount = 0;
+    _pageSize = pageSize;
+}
 
-    // Write out 4 blank pages: one for the header, two for the FPM, and one
-    // superfluous blank page. We'll come back at the end and write in the
-    // header and free page map. We can't do it now, because we don't have that
-    // information yet.
-    for (; pageCount < 4; ++pageCount) {
-        if (fwrite(kBlankPage, 1, kPageSize, f.get()) != kPageSize) {
-            throw std::system_error(errno, std::system_category(),
-                    "failed writing MSF preamble");
-        }
-    }
+void MsfFile::setCompactLayout(const std::vector<size_t>& firstStreams) {
+    _compact = true;
+    _firstStreams = firstStreams;
+}
 
-    // Initialize the stream table.
-    std::vector<uint32_t> streamTable;
-    streamTable.push_back((uint32_t)streamCount());
+void MsfFile::write(FileRef f, ThreadPool* pool, Sha256* digest) const {
 
-    for (auto&& stream: _streams) {
-        if (stream)
-            streamTable.push_back((uint32_t)stream->length());
-        else
-            streamTable.push_back(0);
-    }
+    PhaseTimer timer("writeMsf");
 
-    // Write out each stream and add the stream's page numbers to the stream
-    // table. Note that stream 0 is special, we need to keep track of which
-    // pages it was written to so we can mark them as free later.
-    size_t streamZeroStart = streamTable.size();
-    if (_streams.size() > 0) {
-        writeStream(f, _streams[0], streamTable, pageCount);
-    }
-    size_t streamZeroEnd = streamTable.size();
+    const size_t pageSize = _pageSize;
 
-    for (size_t i = 1; i < _streams.size(); ++i) {
+    Layout layout(_arena);
+    computeLayout(layout);
 
-        //std::cout << "Stream #" << i << ": pages ";
+    timer.addArg("bytes", (uint64_t)layout.pageCount * pageSize);
 
-        //uint32_t j = pageCount;
+    // Fail before writing anything if the result would be invalid.
+    if (layout.pageCount > kMsfMaxPageCount)
+        throw InvalidMsf("MSF is too large for its page size");
 
-        writeStream(f, _streams[i], streamTable, pageCount);
+    // Without a pool, everything is done on this thread.
+    ThreadPool serial(1);
 
-        //for (; j < pageCount; ++j) {
-            //std::cout << j << ", ";
-        //}
+    if (writeMapped(f, layout, pool ? *pool : serial, digest))
+        return;
 
-        //std::cout << std::endl;
-    }
+    MsfPageWriter w(f);
+
+    // Write out the blank pages that come before the streams: one for the
+    // header, two for the FPM, and maybe one superfluous blank page. We'll
+    // come back at the end and write in the header and free page map. We
+    // can't do it now, because we don't have that information yet.
+    w.writeZeros(layout.reservedPages * pageSize);
+    uint32_t pageCount = layout.reservedPages;
+
+    // The pages are written in the same order that they were allocated in, so
+    // they end up exactly where the layout says.
+    ArenaVector<uint32_t> pagesWritten(_arena);
+
+    const ArenaVector<uint32_t>& streamTable = layout.streamTable;
+    const ArenaVector<uint32_t>& streamTablePgPg = layout.streamTablePgPg;
+
+    auto writeStreamTable = [&]() {
+        // The stream table stream, followed by the list of its pages. That
+        // list in turn is referenced from the MSF header.
+        MsfStreamRef streamTableStream(new MsfReadOnlyStream(
+                streamTable.size() * sizeof(streamTable[0]),
+                streamTable.data()
+                ));
+
+        writeStream(w, streamTableStream, pageSize, pagesWritten, pageCount);
 
-    // Write the stream table stream at the end of the file, keeping track of
-    // which pages were written.
-    std::vector<uint32_t> streamTablePages;
-    MsfStreamRef streamTableStream(new MsfReadOnlyStream(
-            streamTable.size() * sizeof(streamTable[0]),
-            streamTable.data())
-            );
+        MsfStreamRef streamTableStreamPages(new MsfReadOnlyStream(
+                layout.streamTablePages.size() * sizeof(uint32_t),
+                layout.streamTablePages.data()
+                ));
 
-    writeStream(f, streamTableStream, streamTablePages, pageCount);
+        writeStream(w, streamTableStreamPages, pageSize, pagesWritten,
+                pageCount);
+    };
 
-    // Write the stream table pages, keeping track of which pages were written.
-    // These pages in turn will be written after the MSF header.
-    std::vector<uint32_t> streamTablePgPg;
-    MsfStreamRef streamTableStreamPages(new MsfReadOnlyStream(
-            streamTablePages.size() * sizeof(uint32_t),
-            streamTablePages.data()
-            ));
+    if (layout.streamTableFirst)
+        writeStreamTable();
 
-    writeStream(f, streamTableStreamPages, streamTablePgPg, pageCount);
+    for (size_t i: layout.order)
+        writeStream(w, loadStream(i), pageSize, pagesWritten, pageCount);
+
+    if (!layout.streamTableFirst)
+        writeStreamTable();
+
+    assert(pageCount == layout.pageCount);
+
+    w.flush();
 
     // Write the header
     MSF_HEADER header = {};
     memcpy(header.magic, kMsfHeaderMagic, sizeof(kMsfHeaderMagic));
-    header.pageSize = kPageSize;
+    header.pageSize = (uint32_t)pageSize;
     header.freePageMap = 1;
     header.pageCount = pageCount;
     header.streamTableInfo.size = (uint32_t)streamTable.size() * sizeof(streamTable[0]);
     header.streamTableInfo.index = 0;
 
-    if (fseek(f.get(), 0, SEEK_SET) != 0) {
-        throw std::system_error(errno, std::system_category(),
-                "fseek() failed");
-    }
+    seekFile(f.get(), 0);
 
     if (fwrite(&header, sizeof(header), 1, f.get()) != 1) {
         throw std::system_error(errno, std::system_category(),
@@ -448,7 +1110,7 @@ void MsfFile::write(FileRef f) const {
     const size_t streamTablePgPgLength =
         streamTablePgPg.size() * sizeof(streamTablePgPg[0]);
 
-    if (streamTablePgPgLength > kPageSize - sizeof(header)) {
+    if (streamTablePgPgLength > pageSize - sizeof(header)) {
         throw InvalidMsf(
                 "root stream table pages are too large to fit in one page");
     }
@@ -462,13 +1124,486 @@ void MsfFile::write(FileRef f) const {
 
     // Construct the free page map.
     FreePageMap fpm(pageCount);
-    fpm.setFree(3); // The omnipresent superfluous page
 
-    // Mark stream 0 pages as free
-    for (size_t i = streamZeroStart; i < streamZeroEnd; ++i) {
-        fpm.setFree(streamTable[i]);
-    }
+    for (uint32_t page: layout.freePages)
+        fpm.setFree(page);
 
     // Write the free page map.
-    fpm.write(f.get());
+    fpm.write(f.get(), pageSize);
+
+    // The header and the FPM were filled in last. Thus, the file has to be
+    // read back to be hashed in order.
+    if (digest)
+        hashFile(f.get(), *digest);
+}
+
+size_t MsfFile::writtenLength() const {
+
+    Layout layout(_arena);
+    computeLayout(layout);
+
+    const uint64_t length = (uint64_t)layout.pageCount * _pageSize;
+    if (layout.pageCount > kMsfMaxPageCount || length > SIZE_MAX)
+        throw InvalidMsf("MSF is too large for its page size");
+
+    return (size_t)length;
+}
+
+void MsfFile::write(uint8_t* buf, size_t length, ThreadPool* pool) const {
+
+    PhaseTimer timer("writeMsf");
+
+    Layout layout(_arena);
+    computeLayout(layout);
+
+    timer.addArg("bytes", length);
+
+    if (layout.pageCount > kMsfMaxPageCount)
+        throw InvalidMsf("MSF is too large for its page size");
+
+    if ((uint64_t)layout.pageCount * _pageSize != length)
+        throw InvalidMsf("buffer doesn't have the length of the MSF");
+
+    checkStreamTableRoot(layout);
+
+    // Only the pages are filled in. Everything in between must be zero.
+    memset(buf, 0, length);
+
+    ThreadPool serial(1);
+
+    writeBuffer(buf, layout, pool ? *pool : serial);
+}
+
+void MsfFile::checkStreamTableRoot(const Layout& layout) const {
+
+    const size_t streamTablePgPgLength =
+        layout.streamTablePgPg.size() * sizeof(uint32_t);
+
+    if (streamTablePgPgLength > _pageSize - sizeof(MSF_HEADER)) {
+        throw InvalidMsf(
+                "root stream table pages are too large to fit in one page");
+    }
+}
+
+bool MsfFile::writeMapped(FileRef f, const Layout& layout,
+        ThreadPool& pool, Sha256* digest) const {
+
+    const uint64_t length = (uint64_t)layout.pageCount * _pageSize;
+    if (length > SIZE_MAX)
+        return false;
+
+    checkStreamTableRoot(layout);
+
+    // The pages are only filled in. Everything else must already be zero,
+    // which is only known to be the case if the file starts out empty.
+    MemMapRef map;
+    try {
+        if (getFileSize(f.get()) != 0)
+            return false;
+
+        map = std::make_shared<MemMap>(f.get(), (size_t)length, false);
+    }
+    catch (const std::system_error&) {
+        return false;
+    }
+
+    writeBuffer((uint8_t*)map->buf(), layout, pool);
+
+    // The pages are still in memory. Hashing them now saves reading the whole
+    // file again later.
+    if (digest) {
+        PhaseTimer timer("hashMsf");
+        timer.addArg("bytes", length);
+        digest->update(map->buf(), (size_t)length);
+    }
+
+    return true;
+}
+
+void MsfFile::writeBuffer(uint8_t* buf, const Layout& layout,
+        ThreadPool& pool) const {
+
+    const size_t pageSize = _pageSize;
+
+    const size_t length = (size_t)layout.pageCount * pageSize;
+
+    const size_t streamTablePgPgLength =
+        layout.streamTablePgPg.size() * sizeof(uint32_t);
+
+    // The header page
+    MSF_HEADER header = {};
+    memcpy(header.magic, kMsfHeaderMagic, sizeof(kMsfHeaderMagic));
+    header.pageSize = (uint32_t)pageSize;
+    header.freePageMap = 1;
+    header.pageCount = layout.pageCount;
+    header.streamTableInfo.size =
+        (uint32_t)layout.streamTable.size() * sizeof(uint32_t);
+    header.streamTableInfo.index = 0;
+
+    memcpy(buf, &header, sizeof(header));
+    memcpy(buf + sizeof(header), layout.streamTablePgPg.data(),
+            streamTablePgPgLength);
+
+    // The streams. Since every page already has its place, the streams are
+    // independent of each other and are filled in in parallel.
+    //
+    // Pages that are copied from the original file are planned for first and
+    // then read in the order they appear in it instead of stream by stream.
+    // Otherwise, a fragmented PDB would be read in random order. Any other
+    // file streams can be read from any position at once, so large ones are
+    // split up further.
+    const size_t pagesPerTask = std::max<size_t>(kPagesPerTaskBytes / pageSize,
+            1);
+
+    MsfReadPlanner planner;
+
+    // The pages of overlays that aren't copied from the original file.
+    std::vector<std::vector<size_t>> rest(_streams.size());
+
+    std::vector<std::future<void>> tasks;
+
+    for (size_t i = 0; i < _streams.size(); ++i) {
+        if (streamLength(i) == 0)
+            continue;
+
+        // The stream is kept alive by _streams.
+        MsfStream* stream = loadStream(i).get();
+
+        const uint32_t* pages = layout.pages(i);
+        const size_t count = ::pageCount(pageSize, stream->length());
+
+        if (planPages(planner, stream, pageSize, pages, rest[i])) {
+            addStat(StatCounter::streamsPassedThrough, 1);
+            addStat(StatCounter::pagesCopied, count - rest[i].size());
+
+            if (!rest[i].empty()) {
+                auto overlay = static_cast<MsfOverlayStream*>(stream);
+                const std::vector<size_t>* indices = &rest[i];
+                tasks.push_back(pool.submit([=]() {
+                    fillOverlayPages(buf, pageSize, overlay, pages, *indices);
+                }));
+            }
+        }
+        else if (dynamic_cast<const MsfFileStream*>(stream)) {
+            addStat(StatCounter::streamsPassedThrough, 1);
+            addStat(StatCounter::pagesCopied, count);
+
+            for (size_t first = 0; first < count; first += pagesPerTask) {
+                const size_t last = std::min(first + pagesPerTask, count);
+                tasks.push_back(pool.submit([=]() {
+                    fillPages(buf, pageSize, stream, pages, first, last);
+                }));
+            }
+        }
+        else {
+            addStat(StatCounter::streamsRewritten, 1);
+
+            tasks.push_back(pool.submit([=]() {
+                fillPages(buf, pageSize, stream, pages, 0, count);
+            }));
+        }
+    }
+
+    planner.plan();
+    planner.submit(buf, (size_t)length, pool, tasks);
+
+    pool.wait(tasks);
+
+    // The stream table and its page list
+    const uint8_t* streamTable = (const uint8_t*)layout.streamTable.data();
+    for (size_t i = 0; i < layout.streamTablePages.size(); ++i) {
+        const size_t offset = i * pageSize;
+        memcpy(buf + (size_t)layout.streamTablePages[i] * pageSize,
+                streamTable + offset,
+                std::min(pageSize,
+                    layout.streamTable.size() * sizeof(uint32_t) - offset));
+    }
+
+    const uint8_t* streamTablePages =
+        (const uint8_t*)layout.streamTablePages.data();
+    for (size_t i = 0; i < layout.streamTablePgPg.size(); ++i) {
+        const size_t offset = i * pageSize;
+        memcpy(buf + (size_t)layout.streamTablePgPg[i] * pageSize,
+                streamTablePages + offset,
+                std::min(pageSize,
+                    layout.streamTablePages.size() * sizeof(uint32_t) - offset));
+    }
+
+    // The free page map
+    FreePageMap fpm(layout.pageCount);
+
+    for (uint32_t page: layout.freePages)
+        fpm.setFree(page);
+
+    for (size_t page = 1; page < layout.pageCount; page += pageSize)
+        fpm.getPage(page, buf + page * pageSize, pageSize);
+
+    addStat(StatCounter::bytesWritten, length);
+    addStat(StatCounter::pagesWritten, layout.pageCount);
+}
+
+void MsfFile::fingerprint(HashAlgorithm algorithm, ThreadPool& pool,
+        uint8_t output[16]) const {
+
+    PhaseTimer timer("fingerprintMsf");
+
+    Layout layout(_arena);
+    computeLayout(layout);
+
+    // The first chunk of each stream and the digest of each chunk.
+    std::vector<size_t> firstChunks(_streams.size() + 1);
+
+    for (size_t i = 0; i < _streams.size(); ++i) {
+        firstChunks[i + 1] = firstChunks[i] +
+            (streamLength(i) + kFingerprintChunk - 1) / kFingerprintChunk;
+    }
+
+    std::vector<uint8_t> digests(firstChunks.back() * 16);
+
+    std::vector<std::future<void>> tasks;
+
+    for (size_t i = 0; i < _streams.size(); ++i) {
+        const size_t length = streamLength(i);
+        if (length == 0)
+            continue;
+
+        // The stream is kept alive by _streams.
+        MsfStream* stream = loadStream(i).get();
+
+        auto overlay = dynamic_cast<MsfOverlayStream*>(stream);
+        const bool parallel = dynamic_cast<const MsfFileStream*>(
+                overlay ? overlay->base() : stream) != NULL;
+
+        uint8_t* digest = &digests[firstChunks[i] * 16];
+
+        auto hashChunks = [=](size_t first, size_t last) {
+            std::vector<uint8_t> scratch;
+
+            for (size_t c = first; c < last; ++c) {
+                HasherRef hasher = makeHasher(algorithm);
+
+                const size_t begin = c * kFingerprintChunk;
+                hashStreamRange(*hasher, stream, begin,
+                        std::min(begin + kFingerprintChunk, length), scratch);
+
+                hasher->finish(digest + c * 16);
+            }
+        };
+
+        const size_t chunks = firstChunks[i + 1] - firstChunks[i];
+
+        if (parallel) {
+            for (size_t c = 0; c < chunks; ++c)
+                tasks.push_back(pool.submit([=]() { hashChunks(c, c + 1); }));
+        }
+        else {
+            tasks.push_back(pool.submit([=]() { hashChunks(0, chunks); }));
+        }
+    }
+
+    pool.wait(tasks);
+
+    // The stream table determines where every page goes. Together with the
+    // page size and the order of the streams, it gives the whole layout.
+    const uint32_t params[] = {
+        (uint32_t)_pageSize,
+        (uint32_t)_compact,
+        (uint32_t)layout.order.size(),
+    };
+
+    HasherRef root = makeHasher(algorithm);
+
+    root->update(params, sizeof(params));
+    root->update(layout.streamTable.data(),
+            layout.streamTable.size() * sizeof(uint32_t));
+
+    for (size_t i: layout.order) {
+        const uint32_t index = (uint32_t)i;
+        root->update(&index, sizeof(index));
+    }
+
+    root->update(digests.data(), digests.size());
+
+    root->finish(output);
+}
+
+bool MsfFile::canWriteInPlace(const uint8_t* buf, size_t length) const {
+
+    const size_t pageSize = _pageSize;
+
+    Layout layout(_arena);
+    computeLayout(layout);
+
+    if (length != (size_t)layout.pageCount * pageSize)
+        return false;
+
+    // The header page
+    MSF_HEADER header = {};
+    memcpy(header.magic, kMsfHeaderMagic, sizeof(kMsfHeaderMagic));
+    header.pageSize = (uint32_t)pageSize;
+    header.freePageMap = 1;
+    header.pageCount = layout.pageCount;
+    header.streamTableInfo.size =
+        (uint32_t)layout.streamTable.size() * sizeof(uint32_t);
+    header.streamTableInfo.index = 0;
+
+    const size_t streamTablePgPgLength =
+        layout.streamTablePgPg.size() * sizeof(uint32_t);
+
+    if (streamTablePgPgLength > pageSize - sizeof(header))
+        return false;
+
+    if (memcmp(buf, &header, sizeof(header)) != 0 ||
+        memcmp(buf + sizeof(header), layout.streamTablePgPg.data(),
+            streamTablePgPgLength) != 0 ||
+        memcmp(buf + sizeof(header) + streamTablePgPgLength, kBlankPage,
+            pageSize - sizeof(header) - streamTablePgPgLength) != 0) {
+        return false;
+    }
+
+    // The free page map
+    FreePageMap fpm(layout.pageCount);
+
+    for (uint32_t page: layout.freePages)
+        fpm.setFree(page);
+
+    std::vector<uint8_t> expected(pageSize);
+
+    for (size_t page = 1; page < layout.pageCount; page += pageSize) {
+        for (size_t i = page; i < page + 2 && i < layout.pageCount; ++i) {
+            fpm.getPage(i, expected.data(), pageSize);
+            if (memcmp(buf + i * pageSize, expected.data(), pageSize) != 0)
+                return false;
+        }
+    }
+
+    // The superfluous page
+    if (layout.reservedPages > 3 &&
+        memcmp(buf + 3 * pageSize, kBlankPage, pageSize) != 0)
+        return false;
+
+    // The stream table and its page list
+    if (!pagesMatch(buf, pageSize, layout.streamTablePages.data(),
+                layout.streamTable.data(),
+                layout.streamTable.size() * sizeof(uint32_t)) ||
+        !pagesMatch(buf, pageSize, layout.streamTablePgPg.data(),
+                layout.streamTablePages.data(),
+                layout.streamTablePages.size() * sizeof(uint32_t))) {
+        return false;
+    }
+
+    // Streams that haven't been modified must already be where they would be
+    // written and must already be padded with zeros. The same goes for the
+    // pages of overlays that haven't been modified.
+    for (size_t i = 0; i < _streams.size(); ++i) {
+        MsfOverlayStream* overlay = NULL;
+        size_t length;
+        MsfPageList pages;
+
+        if (isPending(i)) {
+            // Still exactly as it was read.
+            if (_filePageSize != pageSize)
+                return false;
+
+            length = _entries[i].length;
+            pages = MsfPageList(_streamTable->data() + _entries[i].pages,
+                    ::pageCount(pageSize, length));
+        }
+        else {
+            auto fileStream = passthroughSource(_streams[i].get(), pageSize,
+                    overlay);
+
+            if (!fileStream) {
+                if (dynamic_cast<const MsfFileStream*>(_streams[i].get()))
+                    return false;
+
+                continue;
+            }
+
+            length = fileStream->length();
+            pages = fileStream->pages();
+        }
+
+        // Overlays that have changed size are written out in full.
+        if (overlay && overlay->length() != length)
+            continue;
+
+        if (!std::equal(pages.begin(), pages.end(), layout.pages(i)))
+            return false;
+
+        const size_t leftOver = length % pageSize;
+        if (leftOver && !(overlay && overlay->isDirty(pages.size() - 1))) {
+            const uint8_t* page = buf + (size_t)pages.back() * pageSize;
+            if (memcmp(page + leftOver, kBlankPage, pageSize - leftOver) != 0)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+void MsfFile::writeInPlace(uint8_t* buf) const {
+
+    const size_t pageSize = _pageSize;
+
+    Layout layout(_arena);
+    computeLayout(layout);
+
+    std::vector<uint8_t> page(pageSize);
+
+    for (size_t i = 0; i < _streams.size(); ++i) {
+        if (isPending(i)) {
+            addStat(StatCounter::streamsPassedThrough, 1);
+            continue;
+        }
+
+        const auto& stream = _streams[i];
+
+        if (!stream)
+            continue;
+
+        if (dynamic_cast<const MsfFileStream*>(stream.get())) {
+            addStat(StatCounter::streamsPassedThrough, 1);
+            continue;
+        }
+
+        const uint32_t* pages = layout.pages(i);
+
+        // Only the modified pages of an overlay need to be written.
+        MsfOverlayStream* overlay;
+        if (auto fileStream = passthroughSource(stream.get(), pageSize,
+                    overlay)) {
+            if (overlay->length() == fileStream->length()) {
+                addStat(StatCounter::streamsPassedThrough, 1);
+
+                for (size_t j = 0; j < fileStream->pages().size(); ++j) {
+                    if (overlay->isDirty(j)) {
+                        memcpy(buf + (size_t)pages[j] * pageSize,
+                                overlay->pageData(j), pageSize);
+                        addStat(StatCounter::bytesWritten, pageSize);
+                        addStat(StatCounter::pagesWritten, 1);
+                    }
+                }
+
+                continue;
+            }
+        }
+
+        addStat(StatCounter::streamsRewritten, 1);
+
+        stream->setPos(0);
+
+        while (size_t bytesRead = stream->read(pageSize, page.data())) {
+            memset(page.data() + bytesRead, 0, pageSize - bytesRead);
+
+            uint8_t* dest = buf + (size_t)*pages++ * pageSize;
+
+            // Only touch the pages that actually changed.
+            if (memcmp(dest, page.data(), pageSize) != 0) {
+                memcpy(dest, page.data(), pageSize);
+                addStat(StatCounter::bytesWritten, pageSize);
+                addStat(StatCounter::pagesWritten, 1);
+            }
+        }
+    }
 }
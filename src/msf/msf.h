@@ -25,9 +25,13 @@
 #include <stdio.h> // For FILE*
 #include <vector>
 #include <memory>
+#include <mutex>
 
 #include "msf/format.h"
+#include "util/arena.h"
 #include "util/file.h"
+#include "util/hash.h"
+#include "util/memmap.h"
 
 /**
  * Thrown when an MSF is found to be invalid or unsupported.
@@ -47,17 +51,132 @@ public:
 };
 
 class MsfStream;
+class Sha256;
+class ThreadPool;
 
 typedef std::shared_ptr<MsfStream> MsfStreamRef;
 
 class MsfFile {
 private:
 
-    std::vector<MsfStreamRef> _streams;
+    // The file this MSF was read from and its stream table. Streams are only
+    // created from the stream table once they are asked for.
+    FileRef _f;
+    MemMapRef _map;
+    std::shared_ptr<ArenaVector<uint32_t>> _streamTable;
+    size_t _filePageSize;
+
+    // Where buffers that live as long as this MsfFile are allocated from. May
+    // be NULL to use the heap.
+    Arena* _arena;
+
+    /**
+     * A stream in the stream table that hasn't been created yet.
+     */
+    struct StreamEntry {
+        uint32_t length;
+
+        // Index of the stream's page list in the stream table, or kLoaded once
+        // the stream exists in _streams.
+        uint32_t pages;
+
+        static const uint32_t kLoaded = (uint32_t)-1;
+    };
+
+    // Streams that have been created, added, or replaced. Streams that are
+    // still pending in _entries are null here.
+    mutable std::vector<MsfStreamRef> _streams;
+    mutable std::vector<StreamEntry> _entries;
+    mutable std::mutex _streamsMutex;
+
+    // Page size used when writing the MSF.
+    size_t _pageSize;
+
+    // True if the MSF is written with the compact layout. The streams in
+    // _firstStreams are then laid out first.
+    bool _compact;
+    std::vector<size_t> _firstStreams;
+
+    struct Layout;
+
+    /**
+     * Returns true if the stream with the given index hasn't been created from
+     * the stream table yet. It is thus unmodified.
+     */
+    bool isPending(size_t index) const {
+        return index < _entries.size() &&
+            _entries[index].pages != StreamEntry::kLoaded;
+    }
+
+    /**
+     * Returns the length of a stream without creating it.
+     */
+    size_t streamLength(size_t index) const;
+
+    /**
+     * Returns the stream with the given index, creating it from the stream
+     * table if necessary.
+     */
+    MsfStreamRef loadStream(size_t index) const;
+
+    /**
+     * Computes the page layout that write() produces.
+     */
+    void computeLayout(Layout& layout) const;
+
+    /**
+     * Writes the MSF with the given layout by sizing the file up front and
+     * filling in its pages through a memory map. Returns false without having
+     * written anything if the file can't be mapped.
+     */
+    bool writeMapped(FileRef f, const Layout& layout, ThreadPool& pool,
+            Sha256* digest) const;
+
+    /**
+     * Fills in the pages of the MSF with the given layout. Everything that
+     * isn't a page of the header, the FPM, or a stream is left alone and must
+     * already be zero.
+     */
+    void writeBuffer(uint8_t* buf, const Layout& layout, ThreadPool& pool) const;
+
+    /**
+     * Throws InvalidMsf if the page list of the stream table doesn't fit in the
+     * header page.
+     */
+    void checkStreamTableRoot(const Layout& layout) const;
+
+    /**
+     * Reads the MSF from the given memory map or, if it is NULL, from _f.
+     */
+    void read(MemMapRef map);
 
 public:
 
-    MsfFile(FileRef f);
+    /**
+     * Creates an empty MSF file. Streams can then be added with addStream().
+     *
+     * If an arena is given, the buffers of the MSF and of the streams that are
+     * patched in it are allocated from it. The arena must outlive the MsfFile
+     * and all of its streams.
+     */
+    explicit MsfFile(Arena* arena = NULL);
+
+    MsfFile(FileRef f, Arena* arena = NULL);
+
+    /**
+     * Reads an MSF from memory instead of a file. The memory can be that of a
+     * buffer wrapped in a MemMap. It is not copied and must outlive all of the
+     * streams of this MsfFile, which keep the map alive.
+     */
+    MsfFile(MemMapRef map, Arena* arena = NULL);
+
+    /**
+     * Reads an MSF from the contents of a stream, which can be anything the
+     * caller implements. The stream is read into memory in its entirety.
+     *
+     * Throws: InvalidMsf if the stream can't be read or isn't a valid MSF.
+     */
+    MsfFile(MsfStream& source, Arena* arena = NULL);
 
     virtual ~MsfFile();
 
@@ -69,7 +188,8 @@ public:
 
     /**
      * Returns the stream with the given index. Returns nullptr if it doesn't
-     * exist.
+     * exist. Streams read from a file are only created the first time they are
+     * asked for. This may be called from multiple threads at once.
      */
     MsfStreamRef getStream(size_t index);
 
@@ -83,11 +203,118 @@ public:
      */
     size_t streamCount() const;
 
+    /**
+     * Returns the arena that buffers for this MSF should be allocated from.
+     * This is NULL if they should come from the heap.
+     */
+    Arena* arena() const {
+        return _arena;
+    }
+
+    /**
+     * Returns the page size that the MSF is written with. By default, this is
+     * the page size of the MSF that was read or kMsfDefaultPageSize for a new
+     * one.
+     */
+    size_t pageSize() const {
+        return _pageSize;
+    }
+
+    /**
+     * Sets the page size that the MSF is written with. Larger pages are needed
+     * for larger MSFs and reduce the size of the stream table.
+     *
+     * Throws: InvalidMsf if the page size is not supported.
+     */
+    void setPageSize(size_t pageSize);
+
+    /**
+     * Makes write() lay out the MSF compactly: The stream table follows right
+     * after the header and the FPM, without the superfluous page that
+     * otherwise comes after the FPM. The given streams are written next, in
+     * that order, and then the rest of them by index. Readers can then find
+     * everything they need first near the start of the file.
+     *
+     * Indices of streams that don't exist are ignored.
+     */
+    void setCompactLayout(const std::vector<size_t>& firstStreams);
+
+    /**
+     * Returns true if the MSF is written with the compact layout.
+     */
+    bool compactLayout() const {
+        return _compact;
+    }
+
     /**
      * Writes this MsfFile out to a new file. A new header, FPM, and stream
      * table will be created.
      *
-     * Throws: MsfWriteError if the write fails.
+     * If a thread pool is given, streams are written in parallel where
+     * possible. The result is the same either way.
+     *
+     * If a digest is given, the written file is hashed as well. When the file
+     * is written through a memory map, the pages are hashed from memory right
+     * after they have been filled in. Otherwise, the file is read back.
+     *
+     * Throws: std::system_error if the write fails or InvalidMsf if the MSF
+     * would have more pages than its page size allows for.
+     */
+    void write(FileRef f, ThreadPool* pool = NULL, Sha256* digest = NULL) const;
+
+    /**
+     * Returns the length, in bytes, of the MSF as write() writes it.
+     *
+     * Throws: InvalidMsf if the MSF would have more pages than its page size
+     * allows for.
+     */
+    size_t writtenLength() const;
+
+    /**
+     * Writes this MsfFile into a buffer instead of a file. The result is the
+     * same as that of write(). This lets the MSF be passed on without going
+     * through the disk.
+     *
+     * Params:
+     *   buf    = Where the MSF is written to.
+     *   length = Length of the buffer, in bytes. This must be writtenLength().
+     *   pool   = If given, streams are written in parallel where possible.
+     *
+     * Throws: InvalidMsf if the length is wrong or the MSF would have more
+     * pages than its page size allows for.
+     */
+    void write(uint8_t* buf, size_t length, ThreadPool* pool = NULL) const;
+
+    /**
+     * Calculates a digest of the MSF as write() would write it, without
+     * writing anything. Two MsfFiles have the same fingerprint if, and only if,
+     * they would be written out identically, barring collisions. It is not the
+     * hash of the written file, however.
+     *
+     * The streams are hashed in chunks in parallel. Pages that are in memory
+     * already, modified pages or those of a memory map, are hashed where they
+     * are. The result doesn't depend on the number of threads.
+     */
+    void fingerprint(HashAlgorithm algorithm, ThreadPool& pool,
+            uint8_t output[16]) const;
+
+    /**
+     * Returns true if the given MSF, which must be the file this MsfFile was
+     * read from, is already laid out exactly as write() would write it. In that
+     * case, writeInPlace() gives the same result as write() without having to
+     * rewrite the entire file.
+     *
+     * Params:
+     *   buf    = The contents of the original MSF file (e.g., a memory map).
+     *   length = Length of the MSF file, in bytes.
+     */
+    bool canWriteInPlace(const uint8_t* buf, size_t length) const;
+
+    /**
+     * Writes the streams that have been replaced over the pages they occupy in
+     * the original MSF. Only pages whose contents change are written to.
+     *
+     * This must only be used if canWriteInPlace() returned true.
      */
-    void write(FileRef f) const;
+    void writeInPlace(uint8_t* buf) const;
 };
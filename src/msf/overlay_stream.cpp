@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "msf/overlay_stream.h"
+#include "msf/file_stream.h"
+
+namespace {
+
+// Page size to use if it can't be determined from the underlying stream.
+const size_t kDefaultPageSize = 4096;
+
+}
+
+MsfOverlayStream::MsfOverlayStream(std::shared_ptr<MsfStream> base,
+        size_t pageSize)
+    : _base(base), _pageSize(pageSize), _pos(0), _length(base->length())
+{
+    if (_pageSize == 0) {
+        auto fileStream = dynamic_cast<const MsfFileStream*>(base.get());
+        _pageSize = fileStream ? fileStream->pageSize() : kDefaultPageSize;
+    }
+
+    _pages.resize(::pageCount(_pageSize, _length));
+}
+
+size_t MsfOverlayStream::length() const {
+    return _length;
+}
+
+void MsfOverlayStream::resize(size_t length) {
+    if (length >= _length)
+        return;
+
+    _length = length;
+    _pages.resize(::pageCount(_pageSize, _length));
+
+    // Keep the padding of the last page zeroed.
+    const size_t leftOver = _length % _pageSize;
+    if (leftOver && _pages.back())
+        memset(_pages.back().get() + leftOver, 0, _pageSize - leftOver);
+
+    _pos = std::min(_pos, _length);
+}
+
+size_t MsfOverlayStream::getPos() const {
+    return _pos;
+}
+
+void MsfOverlayStream::setPos(size_t pos) {
+    // Don't allow setting the position past the end of the stream.
+    _pos = std::min(_length, pos);
+}
+
+void MsfOverlayStream::readBasePage(size_t page, uint8_t* buf) {
+    const size_t offset = page * _pageSize;
+
+    size_t bytesRead = 0;
+
+    if (offset < _base->length()) {
+        _base->setPos(offset);
+        bytesRead = _base->read(std::min(_pageSize, _length - offset), buf);
+    }
+
+    memset(buf + bytesRead, 0, _pageSize - bytesRead);
+}
+
+size_t MsfOverlayStream::read(size_t length, void* buf) {
+
+    size_t bytesRead = 0;
+
+    length = std::min(length, _length - _pos);
+
+    while (length > 0) {
+        const size_t i = _pos / _pageSize;
+        const size_t offset = _pos % _pageSize;
+        const size_t chunkSize = std::min(length, _pageSize - offset);
+
+        size_t chunkRead = chunkSize;
+
+        if (_pages[i]) {
+            memcpy(buf, _pages[i].get() + offset, chunkSize);
+        }
+        else {
+            _base->setPos(_pos);
+            chunkRead = _pos < _base->length() ? _base->read(chunkSize, buf) : 0;
+
+            // Anything past the end of the underlying stream was grown into
+            // with zeros.
+            if (chunkRead < chunkSize && _pos + chunkRead >= _base->length()) {
+                memset((uint8_t*)buf + chunkRead, 0, chunkSize - chunkRead);
+                chunkRead = chunkSize;
+            }
+        }
+
+        bytesRead += chunkRead;
+        _pos += chunkRead;
+
+        if (chunkRead != chunkSize)
+            break;
+
+        length -= chunkSize;
+        buf = (uint8_t*)buf + chunkSize;
+    }
+
+    return bytesRead;
+}
+
+size_t MsfOverlayStream::read(void* buf) {
+    return read(_length - _pos, buf);
+}
+
+size_t MsfOverlayStream::write(size_t length, const void* buf) {
+
+    // Grow the stream if necessary.
+    if (_pos + length > _length) {
+        _length = _pos + length;
+        _pages.resize(::pageCount(_pageSize, _length));
+    }
+
+    std::unique_ptr<uint8_t[]> page;
+
+    const uint8_t* data = (const uint8_t*)buf;
+
+    for (size_t remaining = length; remaining > 0; ) {
+        const size_t i = _pos / _pageSize;
+        const size_t offset = _pos % _pageSize;
+        const size_t chunkSize = std::min(remaining, _pageSize - offset);
+
+        if (!_pages[i]) {
+            if (!page)
+                page.reset(new uint8_t[_pageSize]);
+
+            readBasePage(i, page.get());
+
+            // Only keep the page if it actually changes.
+            if (memcmp(page.get() + offset, data, chunkSize) != 0)
+                _pages[i] = std::move(page);
+        }
+
+        if (_pages[i])
+            memcpy(_pages[i].get() + offset, data, chunkSize);
+
+        _pos += chunkSize;
+        data += chunkSize;
+        remaining -= chunkSize;
+    }
+
+    return length;
+}
+
+size_t MsfOverlayStream::dirtyPages() const {
+    size_t count = 0;
+
+    for (auto&& page: _pages) {
+        if (page) ++count;
+    }
+
+    return count;
+}
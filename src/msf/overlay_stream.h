@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+#include "msf/stream.h"
+
+/**
+ * A copy-on-write stream layered over another stream.
+ *
+ * Reads are passed through to the underlying stream until a page is written
+ * to. Only then is that page copied into memory. This is much cheaper than
+ * copying an entire stream into an MsfMemoryStream when only a few bytes of it
+ * need to be patched. When the MSF is written back out, the pages that were
+ * never modified can be copied straight from the original file.
+ */
+class MsfOverlayStream : public MsfStream {
+private:
+
+    std::shared_ptr<MsfStream> _base;
+    size_t _pageSize;
+    size_t _pos;
+    size_t _length;
+
+    // Pages that have been written to. A page that was never written to is
+    // NULL and must be read from the underlying stream.
+    std::vector<std::unique_ptr<uint8_t[]>> _pages;
+
+public:
+    /**
+     * Params:
+     *   base     = The underlying stream. This is never written to.
+     *   pageSize = Length of one page, in bytes. If 0, the page size of the
+     *              underlying stream is used if it is an MsfFileStream.
+     */
+    MsfOverlayStream(std::shared_ptr<MsfStream> base, size_t pageSize = 0);
+
+    /**
+     * Returns the length of the stream, in bytes.
+     */
+    size_t length() const;
+
+    /**
+     * Truncates the stream to the given length. The stream cannot be grown
+     * this way.
+     */
+    void resize(size_t length);
+
+    /**
+     * Gets the current position, in bytes, in the stream.
+     */
+    size_t getPos() const;
+
+    /**
+     * Sets the current position, in bytes, in the stream.
+     */
+    void setPos(size_t p);
+
+    /**
+     * Reads a length of the stream. Pages that have been modified are read from
+     * memory. All other pages are read from the underlying stream.
+     *
+     * Params:
+     *   length = The number of bytes to read from the stream.
+     *   buf    = The buffer to read the stream into.
+     *
+     * Returns: The number of bytes read.
+     */
+    size_t read(size_t length, void* buf);
+
+    /**
+     * Reads the entire stream.
+     *
+     * Params:
+     *   buf = The buffer to read the stream into. This must be large enough to
+     *         hold the entire stream.
+     *
+     * Returns: The number of bytes read.
+     */
+    size_t read(void* buf);
+
+    /**
+     * Writes a buffer to the stream from the current position. Only the pages
+     * whose contents actually change are copied into memory. If attempting to
+     * write past the end of the stream, the length of the stream will grow.
+     */
+    size_t write(size_t length, const void* buf);
+
+    /**
+     * Returns the underlying stream.
+     */
+    const MsfStream* base() const {
+        return _base.get();
+    }
+
+    /**
+     * Returns the length of one page, in bytes.
+     */
+    size_t pageSize() const {
+        return _pageSize;
+    }
+
+    /**
+     * Returns true if the given page has been modified.
+     */
+    bool isDirty(size_t page) const {
+        return page < _pages.size() && _pages[page];
+    }
+
+    /**
+     * Returns the contents of a modified page. The parts of the page past the
+     * end of the stream are zero.
+     */
+    const uint8_t* pageData(size_t page) const {
+        return _pages[page].get();
+    }
+
+    /**
+     * Returns the number of modified pages.
+     */
+    size_t dirtyPages() const;
+
+private:
+
+    /**
+     * Reads a page of the underlying stream into memory with the remainder of
+     * the page padded with zeros.
+     */
+    void readBasePage(size_t page, uint8_t* buf);
+};
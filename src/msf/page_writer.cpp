@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "msf/page_writer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <system_error>
+
+#ifdef _WIN32
+#   include <stdio.h>
+#else
+#   include <errno.h>
+#   include <sys/uio.h>
+#   include <unistd.h>
+#endif
+
+#include "util/stats.h"
+
+namespace {
+
+/**
+ * Runs of zeros refer to this when the writes are gathered.
+ */
+const size_t kZerosSize = 64 * 1024;
+const uint8_t kZeros[kZerosSize] = {0};
+
+/**
+ * Maximum number of pieces gathered into one write. POSIX guarantees at least
+ * 16 for writev(), but every platform we care about allows 1024.
+ */
+const size_t kMaxSegments = 1024;
+
+struct Chunk {
+    const uint8_t* data;
+    size_t length;
+};
+
+/**
+ * Writes all of the given chunks at the current position of the file.
+ */
+void writeChunks(FILE* f, Chunk* chunks, size_t count) {
+
+#ifdef _WIN32
+
+    // WriteFileGather() only works with unbuffered handles and page aligned
+    // buffers. Since consecutive pages of data are already contiguous in the
+    // buffer, the number of writes is small anyway.
+    for (size_t i = 0; i < count; ++i) {
+        if (fwrite(chunks[i].data, 1, chunks[i].length, f) != chunks[i].length) {
+            throw std::system_error(errno, std::system_category(),
+                    "failed writing pages");
+        }
+
+        addStat(StatCounter::writeCalls, 1);
+    }
+
+#else
+
+    const int fd = fileno(f);
+
+    struct iovec iov[kMaxSegments];
+
+    while (count > 0) {
+        const size_t n = std::min(count, kMaxSegments);
+
+        for (size_t i = 0; i < n; ++i) {
+            iov[i].iov_base = (void*)chunks[i].data;
+            iov[i].iov_len = chunks[i].length;
+        }
+
+        const ssize_t written = writev(fd, iov, (int)n);
+
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+
+            throw std::system_error(errno, std::system_category(),
+                    "failed writing pages");
+        }
+
+        addStat(StatCounter::writeCalls, 1);
+
+        // Skip over what was written. A short write leaves the rest of a chunk
+        // to be written next time around.
+        size_t left = (size_t)written;
+        while (count > 0 && left >= chunks->length) {
+            left -= chunks->length;
+            ++chunks;
+            --count;
+        }
+
+        if (count > 0) {
+            chunks->data += left;
+            chunks->length -= left;
+        }
+    }
+
+#endif
+}
+
+}
+
+MsfPageWriter::MsfPageWriter(FileRef f, size_t bufferSize)
+    : _f(f), _buf(bufferSize), _used(0), _pending(0)
+{
+    // Anything buffered by stdio must come first.
+    if (fflush(_f.get()) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                "failed to flush file");
+    }
+
+    _offset = tellFile(_f.get());
+
+    // Fall back to blocking writes if asynchronous I/O isn't available.
+    try {
+        _io.reset(new AsyncIo(_f.get()));
+        _spare.resize(bufferSize);
+    }
+    catch (const std::system_error&) {
+        _io.reset();
+    }
+}
+
+void MsfPageWriter::append(bool zeros, size_t offset, size_t length) {
+
+    // Extend the last segment if it is of the same kind and contiguous.
+    if (!_segments.empty()) {
+        Segment& last = _segments.back();
+        if (last.zeros == zeros &&
+            (zeros || last.offset + last.length == offset)) {
+            last.length += length;
+            _pending += length;
+            return;
+        }
+    }
+
+    Segment s = {zeros, offset, length};
+    _segments.push_back(s);
+    _pending += length;
+}
+
+void MsfPageWriter::write(const void* data, size_t length) {
+
+    const uint8_t* p = (const uint8_t*)data;
+
+    while (length > 0) {
+        if (_used == _buf.size() || _segments.size() == kMaxSegments)
+            submit();
+
+        const size_t n = std::min(length, _buf.size() - _used);
+
+        memcpy(_buf.data() + _used, p, n);
+        append(false, _used, n);
+
+        _used += n;
+        p += n;
+        length -= n;
+    }
+}
+
+void MsfPageWriter::writeZeros(size_t length) {
+    if (_segments.size() == kMaxSegments)
+        submit();
+
+    append(true, 0, length);
+
+    // Don't let the writes get too far behind even if they are just zeros.
+    if (_pending >= _buf.size())
+        submit();
+}
+
+void MsfPageWriter::copy(FileRef src, int64_t offset, size_t length) {
+    flush();
+
+    copyFileRange(src, offset, _f, length);
+
+    _offset += (int64_t)length;
+}
+
+void MsfPageWriter::submit() {
+
+    if (_segments.empty())
+        return;
+
+    if (_io) {
+        // The spare buffer is reused once the writes from it have finished.
+        _io->wait();
+
+        int64_t offset = _offset;
+
+        for (auto&& s: _segments) {
+            if (s.zeros) {
+                for (size_t left = s.length; left > 0; ) {
+                    const size_t n = std::min(left, kZerosSize);
+                    _io->write(offset, kZeros, n);
+                    offset += (int64_t)n;
+                    left -= n;
+                }
+            }
+            else {
+                _io->write(offset, _buf.data() + s.offset, s.length);
+                offset += (int64_t)s.length;
+            }
+        }
+
+        _buf.swap(_spare);
+
+        _offset += (int64_t)_pending;
+
+        _segments.clear();
+        _used = 0;
+        _pending = 0;
+        return;
+    }
+
+    std::vector<Chunk> chunks;
+
+    for (auto&& s: _segments) {
+        if (s.zeros) {
+            for (size_t left = s.length; left > 0; ) {
+                const size_t n = std::min(left, kZerosSize);
+                Chunk c = {kZeros, n};
+                chunks.push_back(c);
+                left -= n;
+            }
+        }
+        else {
+            Chunk c = {_buf.data() + s.offset, s.length};
+            chunks.push_back(c);
+        }
+    }
+
+    // Writing around stdio. Make sure the file is where we think it is.
+    seekFile(_f.get(), _offset);
+
+    writeChunks(_f.get(), chunks.data(), chunks.size());
+
+    _offset += (int64_t)_pending;
+
+    // Keep the stdio position in sync with what was written.
+    seekFile(_f.get(), _offset);
+
+    _segments.clear();
+    _used = 0;
+    _pending = 0;
+}
+
+void MsfPageWriter::flush() {
+
+    submit();
+
+    if (_io) {
+        _io->wait();
+
+        // Asynchronous writes don't move the stdio position.
+        seekFile(_f.get(), _offset);
+    }
+}
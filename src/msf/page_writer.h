@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h> // For size_t
+#include <memory>
+#include <vector>
+
+#include "util/async_io.h"
+#include "util/file.h"
+
+/**
+ * Writes pages of an MSF sequentially, coalescing them into large writes.
+ *
+ * Writing a multi-gigabyte PDB one page at a time means hundreds of thousands
+ * of small writes. Instead, pages are gathered here and written out in one go
+ * once several megabytes have accumulated. Runs of zeros (e.g., the blank FPM
+ * pages) aren't even copied into the buffer, they just refer to a shared block
+ * of zeros when the writes are gathered.
+ *
+ * Where asynchronous I/O is available, the gathered pages are handed off to the
+ * operating system in many pieces at once and the next pages are gathered into
+ * a second buffer while they are being written.
+ *
+ * The writer takes over the FILE until flush() is called. Nothing else may
+ * write to it or move its position in the meantime.
+ */
+class MsfPageWriter {
+private:
+
+    // A piece of the data that is waiting to be written. If it is zeros, the
+    // offset is meaningless.
+    struct Segment {
+        bool zeros;
+        size_t offset;
+        size_t length;
+    };
+
+    FileRef _f;
+
+    // File offset of the first byte that is waiting to be written.
+    int64_t _offset;
+
+    std::vector<uint8_t> _buf;
+    size_t _used;
+
+    // The buffer that is being written asynchronously, if any.
+    std::vector<uint8_t> _spare;
+
+    std::vector<Segment> _segments;
+
+    // Number of bytes waiting to be written, including zeros.
+    size_t _pending;
+
+    // If NULL, pages are written with blocking calls. This must come after the
+    // buffers such that it is destroyed first, which waits for the writes
+    // that still refer to them.
+    std::unique_ptr<AsyncIo> _io;
+
+    void append(bool zeros, size_t offset, size_t length);
+
+    // Starts writing out everything that is pending.
+    void submit();
+
+public:
+
+    /**
+     * Default number of bytes gathered before they are written out.
+     */
+    static const size_t kDefaultBufferSize = 8 * 1024 * 1024;
+
+    /**
+     * Params:
+     *   f          = The file to write to. Writing starts at its current
+     *                position.
+     *   bufferSize = Number of bytes gathered before they are written out.
+     */
+    MsfPageWriter(FileRef f, size_t bufferSize = kDefaultBufferSize);
+
+    /**
+     * Appends data to the file.
+     */
+    void write(const void* data, size_t length);
+
+    /**
+     * Appends the given number of zero bytes to the file.
+     */
+    void writeZeros(size_t length);
+
+    /**
+     * Appends a range of bytes of another file. This is copied without going
+     * through the buffer if the platform supports it.
+     */
+    void copy(FileRef src, int64_t offset, size_t length);
+
+    /**
+     * Writes out everything that is pending. Afterwards, the position of the
+     * FILE is just past the last byte written and it may be used directly
+     * again.
+     *
+     * Throws: std::system_error if the write fails.
+     */
+    void flush();
+
+    /**
+     * Returns the offset in the file that the next byte is written to.
+     */
+    int64_t offset() const {
+        return _offset + (int64_t)_pending;
+    }
+};
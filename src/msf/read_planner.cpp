@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "msf/read_planner.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "msf/file_stream.h"
+#include "msf/msf.h"
+
+#include "util/stats.h"
+#include "util/thread_pool.h"
+
+const size_t MsfReadPlanner::kMaxGap;
+const size_t MsfReadPlanner::kMaxSweepLength;
+
+void MsfReadPlanner::add(uint64_t source, uint64_t dest, size_t length) {
+
+    // Runs of pages that are consecutive in both files become one piece, as
+    // long as it still fits in a sweep.
+    if (!_pieces.empty()) {
+        Piece& last = _pieces.back();
+        if (last.source + last.length == source &&
+            last.dest + last.length == dest &&
+            last.length + length <= kMaxSweepLength) {
+            last.length += length;
+            return;
+        }
+    }
+
+    Piece p = {source, dest, length};
+    _pieces.push_back(p);
+}
+
+bool MsfReadPlanner::add(const MsfFileStream* stream, size_t offset,
+        size_t length, uint64_t dest) {
+
+    if (!stream->map() || (_source && stream->map() != _source))
+        return false;
+
+    _source = stream->map();
+
+    const size_t pageSize = stream->pageSize();
+    const auto& pages = stream->pages();
+
+    if (length == 0)
+        return true;
+
+    if ((offset + length - 1) / pageSize >= pages.size())
+        return false;
+
+    // The page sizes of the two files needn't be the same. Split the range up
+    // where it crosses a page boundary in the original file.
+    while (length > 0) {
+        const size_t i = offset / pageSize;
+        const size_t n = std::min(length, pageSize - offset % pageSize);
+
+        add((uint64_t)pages[i] * pageSize + offset % pageSize, dest, n);
+
+        offset += n;
+        dest += n;
+        length -= n;
+    }
+
+    return true;
+}
+
+void MsfReadPlanner::plan() {
+
+    // Streams that aren't fragmented are already in order.
+    if (!std::is_sorted(_pieces.begin(), _pieces.end(),
+                [](const Piece& a, const Piece& b) {
+                    return a.source < b.source;
+                })) {
+        std::sort(_pieces.begin(), _pieces.end(),
+                [](const Piece& a, const Piece& b) {
+                    return a.source < b.source;
+                });
+    }
+
+    for (size_t i = 0; i < _pieces.size(); ++i) {
+        const Piece& p = _pieces[i];
+
+        if (!_sweeps.empty()) {
+            Sweep& last = _sweeps.back();
+            const uint64_t end = last.offset + last.length;
+            const uint64_t newEnd = std::max(end, p.source + p.length);
+
+            if (p.source <= end + kMaxGap &&
+                newEnd - last.offset <= kMaxSweepLength) {
+                last.length = newEnd - last.offset;
+                ++last.count;
+                continue;
+            }
+        }
+
+        Sweep s = {p.source, p.length, i, 1};
+        _sweeps.push_back(s);
+    }
+
+    addStat(StatCounter::readSweeps, _sweeps.size());
+}
+
+void MsfReadPlanner::copy(uint8_t* dest, size_t destLength,
+        const Sweep& sweep) const {
+
+    if (sweep.offset + sweep.length > _source->length())
+        throw InvalidMsf("failed to read page of stream");
+
+    const uint8_t* source = (const uint8_t*)_source->buf();
+
+    // Get the whole sweep coming from the disk at once instead of faulting it
+    // in one page at a time.
+    _source->prefetch((size_t)sweep.offset, (size_t)sweep.length);
+
+    for (size_t i = sweep.first; i < sweep.first + sweep.count; ++i) {
+        const Piece& p = _pieces[i];
+
+        if (p.dest + p.length > destLength)
+            throw InvalidMsf("page of stream lies outside of the MSF");
+
+        memcpy(dest + p.dest, source + p.source, p.length);
+
+        addStat(StatCounter::bytesRead, p.length);
+    }
+}
+
+void MsfReadPlanner::submit(uint8_t* dest, size_t destLength, ThreadPool& pool,
+        std::vector<std::future<void>>& tasks) const {
+
+    for (auto&& sweep: _sweeps) {
+        const Sweep* s = &sweep;
+        tasks.push_back(pool.submit([=]() {
+            copy(dest, destLength, *s);
+        }));
+    }
+}
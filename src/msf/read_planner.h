@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h> // For size_t
+#include <future>
+#include <vector>
+
+#include "util/memmap.h"
+
+class MsfFileStream;
+class ThreadPool;
+
+/**
+ * Plans copying the pages of file streams into a new MSF such that the original
+ * file is read in physical order.
+ *
+ * A PDB that the linker has updated many times has the pages of its streams
+ * scattered all over the file. Copying one stream after another then reads the
+ * file in random order, which is slow on spinning disks and network shares.
+ * Instead, every range of the original file that ends up in the new one is
+ * added here first. They are then sorted by their offset and read in a few
+ * large, sequential sweeps, each range going straight to its place in the new
+ * file. Where things end up isn't affected by this, only the order in which
+ * they are read.
+ */
+class MsfReadPlanner {
+private:
+
+    // A range of the original file and where it goes in the new one.
+    struct Piece {
+        uint64_t source;
+        uint64_t dest;
+        size_t length;
+    };
+
+    // Consecutive pieces that are read in one go, including any small gaps
+    // between them.
+    struct Sweep {
+        uint64_t offset;
+        uint64_t length;
+        size_t first;
+        size_t count;
+    };
+
+    MemMapRef _source;
+
+    std::vector<Piece> _pieces;
+    std::vector<Sweep> _sweeps;
+
+    void add(uint64_t source, uint64_t dest, size_t length);
+
+    void copy(uint8_t* dest, size_t destLength, const Sweep& sweep) const;
+
+public:
+
+    /**
+     * Gaps between pieces up to this length are read over instead of seeking
+     * past them.
+     */
+    static const size_t kMaxGap = 64 * 1024;
+
+    /**
+     * Maximum length of a sweep, in bytes. Sweeps are copied in parallel.
+     */
+    static const size_t kMaxSweepLength = 8 * 1024 * 1024;
+
+    /**
+     * Adds a range of a file stream that goes to the given offset in the new
+     * file.
+     *
+     * Returns: False if the range can't be planned for, because it isn't read
+     * from the same memory map as the ranges added before or because the stream
+     * is missing pages. Nothing is added then and the range must be copied some
+     * other way.
+     */
+    bool add(const MsfFileStream* stream, size_t offset, size_t length,
+            uint64_t dest);
+
+    /**
+     * Sorts the pieces and groups them into sweeps. Nothing may be added
+     * afterwards.
+     */
+    void plan();
+
+    /**
+     * Returns the number of sweeps.
+     */
+    size_t sweeps() const {
+        return _sweeps.size();
+    }
+
+    /**
+     * Submits tasks to the thread pool that copy the planned ranges into the
+     * new file, which is mapped into memory at `dest`. The sweeps are submitted
+     * in the order they appear in the original file.
+     *
+     * Throws: InvalidMsf from the tasks if a range lies outside of the
+     * original file.
+     */
+    void submit(uint8_t* dest, size_t destLength, ThreadPool& pool,
+            std::vector<std::future<void>>& tasks) const;
+};
@@ -315,6 +315,56 @@ struct SymbolRecord {
 
 static_assert(sizeof(SymbolRecord) == 4, "invalid struct size");
 
+/**
+ * Header of the type info (TPI) and ID info (IPI) streams. It is followed by
+ * the type records.
+ */
+struct TypeStreamHeader {
+    uint32_t version;
+
+    // Size of this header. The type records start right after it.
+    uint32_t headerSize;
+
+    // Type index of the first type record and one past the last one.
+    uint32_t typeIndexBegin;
+    uint32_t typeIndexEnd;
+
+    // Total size of the type records
+    uint32_t typeRecordBytes;
+
+    // Stream holding the hash values of the type records
+    uint16_t hashStreamIndex;
+    uint16_t hashAuxStreamIndex;
+
+    // Size of each hash value and the number of hash buckets
+    uint32_t hashKeySize;
+    uint32_t numHashBuckets;
+
+    // Locations of the buffers in the hash stream
+    int32_t hashValueBufferOffset;
+    uint32_t hashValueBufferLength;
+
+    int32_t indexOffsetBufferOffset;
+    uint32_t indexOffsetBufferLength;
+
+    int32_t hashAdjBufferOffset;
+    uint32_t hashAdjBufferLength;
+};
+
+static_assert(sizeof(TypeStreamHeader) == 56, "invalid struct size");
+
+/**
+ * A type record. The first 2 bytes of the data are the leaf type.
+ */
+struct TypeRecord {
+    // Length of the record, not including this field
+    uint16_t length;
+    uint16_t leaf;
+    uint8_t data[];
+};
+
+static_assert(sizeof(TypeRecord) == 4, "invalid struct size");
+
 /**
  * Global stream info hash signature
  */
@@ -20,6 +20,8 @@
  * SOFTWARE.
  */
 
+#include <string.h>
+
 #include "pdb/pdb.h"
 
 /**
@@ -53,72 +55,216 @@
  *  2. PDB/include/map.h - Map::reload() - for loading a Map from disk.
  *  3. PDB/include/iset.h - ISet::reload() - for loading a bitset from disk,
  *     which is just an Array of longs.
+ *
+ * Nothing is copied out of the data. The strings are only checked to be
+ * null-terminated within the string buffer.
  */
-NameMapTable readNameMapTable(const uint8_t* data, const uint8_t* dataEnd) {
-    NameMapTable table;
+NameMapTable::NameMapTable(const uint8_t* data, const uint8_t* dataEnd) {
 
     // Parse the name map
     if (size_t(dataEnd - data) < sizeof(uint32_t))
         throw InvalidPdb("missing PDB name table strings length");
 
-    const uint32_t stringsLength = *(const uint32_t*)data;
-    data += sizeof(stringsLength);
+    _stringsLength = *(const uint32_t*)data;
+    data += sizeof(_stringsLength);
 
-    if (size_t(dataEnd - data) < stringsLength)
+    if (size_t(dataEnd - data) < _stringsLength)
         throw InvalidPdb("missing PDB name table strings data");
 
     // The names of the streams. We'll index into this later.
-    const char* strings = (const char*)data;
-    data += stringsLength;
+    _strings = (const char*)data;
+    data += _stringsLength;
 
     if (size_t(dataEnd - data) < 2 * sizeof(uint32_t))
         throw InvalidPdb("missing PDB stream name map sizes");
 
     // The number of elements in the hash table.
-    const uint32_t elemCount = *(const uint32_t*)data;
-    data += sizeof(elemCount);
+    _count = *(const uint32_t*)data;
+    data += sizeof(_count);
 
     // The maximum number of elements in the hash table.
-    const uint32_t elemCountMax = *(const uint32_t*)data;
-    data += sizeof(elemCountMax);
+    _capacity = *(const uint32_t*)data;
+    data += sizeof(_capacity);
 
     if (size_t(dataEnd - data) < sizeof(uint32_t))
         throw InvalidPdb("missing PDB name table 'present' bitset size");
 
     // Skip over the "present" bitset.
-    const uint32_t presentSize = *(const uint32_t*)data;
-    data += sizeof(presentSize);
-    data += presentSize * sizeof(uint32_t);
+    _presentWords = *(const uint32_t*)data;
+    data += sizeof(_presentWords);
 
-    if (data > dataEnd)
+    if (size_t(dataEnd - data) / sizeof(uint32_t) < _presentWords)
         throw InvalidPdb("missing PDB name table 'present' bitset data");
 
+    _present = (const uint32_t*)data;
+    data += _presentWords * sizeof(uint32_t);
+
     if (size_t(dataEnd - data) < sizeof(uint32_t))
         throw InvalidPdb("missing PDB name table 'deleted' bitset size");
 
     // Skip over the "deleted" bitset.
-    const uint32_t deletedSize = *(const uint32_t*)data;
-    data += sizeof(deletedSize);
-    data += deletedSize * sizeof(uint32_t);
+    _deletedWords = *(const uint32_t*)data;
+    data += sizeof(_deletedWords);
 
-    if (data > dataEnd)
+    if (size_t(dataEnd - data) / sizeof(uint32_t) < _deletedWords)
         throw InvalidPdb("missing PDB name table 'deleted' bitset data");
 
-    if (size_t(dataEnd - data) < elemCount * sizeof(uint32_t) * 2)
+    _deleted = (const uint32_t*)data;
+    data += _deletedWords * sizeof(uint32_t);
+
+    if (size_t(dataEnd - data) / (sizeof(uint32_t) * 2) < _count)
         throw InvalidPdb("missing PDB name table pairs");
 
-    // Finally, read the pairs of string offsets and stream indices
-    const uint32_t* pairs = (const uint32_t*)data;
-    for (size_t i = 0; i < elemCount; ++i) {
-        const uint32_t offset = pairs[i*2];
+    // Finally, the pairs of string offsets and stream indices
+    _pairs = (const uint32_t*)data;
+    for (size_t i = 0; i < _count; ++i) {
+        const uint32_t offset = _pairs[i*2];
 
-        if (offset >= stringsLength)
+        if (offset >= _stringsLength)
             throw InvalidPdb("invalid PDB name table offset into strings buffer");
 
-        const char* name = &strings[offset];
-        const uint32_t stream = pairs[i*2+1];
-        table[std::string(name)] = stream;
+        if (!memchr(_strings + offset, '\0', _stringsLength - offset))
+            throw InvalidPdb("unterminated PDB name table string");
     }
 
-    return table;
+    _hashed = checkHashes();
+}
+
+bool NameMapTable::isPresent(uint32_t bucket) const {
+    return bucket / 32 < _presentWords &&
+        (_present[bucket / 32] & (1u << (bucket % 32)));
+}
+
+bool NameMapTable::isDeleted(uint32_t bucket) const {
+    return bucket / 32 < _deletedWords &&
+        (_deleted[bucket / 32] & (1u << (bucket % 32)));
+}
+
+namespace {
+
+size_t countBits(uint32_t x) {
+    x = x - ((x >> 1) & 0x55555555);
+    x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+    x = (x + (x >> 4)) & 0x0F0F0F0F;
+    return (x * 0x01010101) >> 24;
+}
+
+}
+
+size_t NameMapTable::pairIndex(uint32_t bucket) const {
+    size_t index = 0;
+
+    for (uint32_t i = 0; i < bucket / 32; ++i)
+        index += countBits(_present[i]);
+
+    if (bucket % 32)
+        index += countBits(_present[bucket / 32] & ((1u << (bucket % 32)) - 1));
+
+    return index;
+}
+
+/**
+ * The pairs are stored in the order of the buckets they occupy. For lookups to
+ * find a name, there must be a bucket in use for each pair and the name must be
+ * reachable by probing from the bucket of its hash without passing an empty
+ * bucket.
+ */
+bool NameMapTable::checkHashes() const {
+    if (_capacity == 0 || _presentWords > (_capacity + 31) / 32)
+        return false;
+
+    size_t index = 0;
+
+    for (uint32_t bucket = 0; bucket < _capacity; ++bucket) {
+        if (!isPresent(bucket))
+            continue;
+
+        if (index == _count)
+            return false;
+
+        const Entry entry = (*this)[index++];
+
+        uint32_t i = nameMapHash(entry.name, entry.length) % _capacity;
+        for (; i != bucket; i = (i + 1) % _capacity) {
+            if (!isPresent(i) && !isDeleted(i))
+                return false;
+        }
+    }
+
+    return index == _count;
+}
+
+NameMapTable::Entry NameMapTable::operator[](size_t i) const {
+    Entry entry;
+    entry.name = _strings + _pairs[i*2];
+    entry.length = strlen(entry.name);
+    entry.stream = _pairs[i*2+1];
+    return entry;
+}
+
+bool NameMapTable::find(const char* name, uint32_t& stream) const {
+    const size_t length = strlen(name);
+
+    if (!_hashed) {
+        for (size_t i = 0; i < _count; ++i) {
+            const Entry entry = (*this)[i];
+            if (entry.length == length &&
+                memcmp(entry.name, name, length) == 0) {
+                stream = entry.stream;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Probe from the bucket of the hash until an empty bucket is reached.
+    // Deleted buckets don't end the search.
+    uint32_t bucket = nameMapHash(name, length) % _capacity;
+    for (uint32_t n = 0; n < _capacity; ++n) {
+        if (isPresent(bucket)) {
+            const Entry entry = (*this)[pairIndex(bucket)];
+            if (entry.length == length &&
+                memcmp(entry.name, name, length) == 0) {
+                stream = entry.stream;
+                return true;
+            }
+        }
+        else if (!isDeleted(bucket)) {
+            break;
+        }
+
+        bucket = (bucket + 1) % _capacity;
+    }
+
+    return false;
+}
+
+/**
+ * This is the hash Microsoft's PDB implementation uses for the name table (see
+ * hashSz() in PDB/include/misc.h), truncated to 16 bits.
+ */
+uint16_t nameMapHash(const char* name, size_t length) {
+    uint32_t result = 0;
+
+    const uint8_t* p = (const uint8_t*)name;
+
+    for (; length >= 4; length -= 4, p += 4)
+        result ^= uint32_t(p[0]) | uint32_t(p[1]) << 8 |
+                  uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+
+    if (length >= 2) {
+        result ^= uint32_t(p[0]) | uint32_t(p[1]) << 8;
+        length -= 2;
+        p += 2;
+    }
+
+    if (length == 1)
+        result ^= p[0];
+
+    result |= 0x20202020;
+    result ^= (result >> 11);
+    result ^= (result >> 16);
+
+    return (uint16_t)result;
 }
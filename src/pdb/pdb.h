@@ -21,8 +21,8 @@
  */
 #pragma once
 
-#include <map>
-#include <string>
+#include <stdlib.h> // For size_t
+#include <stdint.h>
 
 /**
  * Thrown when a PDB is found to be invalid or unsupported.
@@ -41,6 +41,93 @@ public:
     }
 };
 
-using NameMapTable = std::map<std::string, uint32_t>;
+/**
+ * The table of named streams in the PDB header stream, like "/names" or
+ * "/LinkInfo". This is a view of the table as it is stored. Nothing is copied
+ * and the data must outlive the table.
+ *
+ * The stored table is a hash table. Names are looked up by probing it the way
+ * Microsoft's implementation does. That only works if the table was built with
+ * the same hash function. It is checked for when the table is read. If not,
+ * lookups fall back to a linear search.
+ */
+class NameMapTable
+{
+public:
+
+    /**
+     * A named stream. The name is null-terminated.
+     */
+    struct Entry {
+        const char* name;
+        size_t length;
+        uint32_t stream;
+    };
+
+private:
+
+    const char* _strings;
+    uint32_t _stringsLength;
+
+    // Bitset of the buckets that are in use and of those that were deleted.
+    const uint32_t* _present;
+    uint32_t _presentWords;
+    const uint32_t* _deleted;
+    uint32_t _deletedWords;
+
+    // The (string offset, stream index) pairs of the buckets in use.
+    const uint32_t* _pairs;
+    uint32_t _count;
+
+    // Number of buckets.
+    uint32_t _capacity;
+
+    // True if names can be found by their hash.
+    bool _hashed;
 
-NameMapTable readNameMapTable(const uint8_t* data, const uint8_t* dataEnd);
+    bool isPresent(uint32_t bucket) const;
+    bool isDeleted(uint32_t bucket) const;
+
+    /**
+     * Returns the index of the pair of a bucket that is in use.
+     */
+    size_t pairIndex(uint32_t bucket) const;
+
+    /**
+     * Returns true if every name can be found by probing from its hash.
+     */
+    bool checkHashes() const;
+
+public:
+
+    /**
+     * Reads the table from the part of the header stream after the header.
+     *
+     * Throws: InvalidPdb if the table is truncated or invalid.
+     */
+    NameMapTable(const uint8_t* data, const uint8_t* dataEnd);
+
+    /**
+     * Returns the number of named streams.
+     */
+    size_t size() const {
+        return _count;
+    }
+
+    /**
+     * Returns the named stream at the given index, in the order the table
+     * stores them.
+     */
+    Entry operator[](size_t i) const;
+
+    /**
+     * Looks up the stream with the given name. Returns false if there is no
+     * such stream.
+     */
+    bool find(const char* name, uint32_t& stream) const;
+};
+
+/**
+ * The hash of a name in the table of named streams.
+ */
+uint16_t nameMapHash(const char* name, size_t length);
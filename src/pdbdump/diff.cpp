@@ -0,0 +1,642 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "pdbdump/diff.h"
+
+#include "util/file.h"
+#include "util/hash.h"
+#include "util/thread_pool.h"
+#include "msf/msf.h"
+#include "msf/stream.h"
+#include "msf/file_stream.h"
+
+#include "pdb/format.h"
+#include "pdb/pdb.h"
+
+namespace {
+
+/**
+ * Streams are hashed in chunks of this size. Large streams are thus hashed in
+ * parallel and only the chunks whose hashes differ need to be compared byte by
+ * byte.
+ */
+const size_t kChunkSize = 16 * 1024 * 1024;
+
+typedef std::array<uint8_t, 16> Digest;
+
+/**
+ * What a stream is used for. This determines how a difference in it is
+ * narrowed down.
+ */
+enum class StreamKind {
+    unknown,
+    header,
+    dbi,
+    types,
+    symbolRecords,
+    module,
+};
+
+struct StreamRole {
+    StreamKind kind;
+
+    // Human readable name of the stream, if it has one.
+    std::string name;
+
+    // For module streams, the sizes of the parts of the stream.
+    uint32_t symbolsSize;
+    uint32_t linesSize;
+    uint32_t c13LinesSize;
+
+    StreamRole() : kind(StreamKind::unknown), symbolsSize(0), linesSize(0),
+        c13LinesSize(0) {}
+};
+
+/**
+ * A field of a header that differences can be attributed to.
+ */
+struct Field {
+    const char* name;
+    size_t offset;
+    size_t size;
+};
+
+// PdbStream70 derives from PdbStream, so its own field comes after it.
+const Field kPdbHeaderFields[] = {
+    {"version",   offsetof(PdbStream, version),   sizeof(uint32_t)},
+    {"timestamp", offsetof(PdbStream, timestamp), sizeof(uint32_t)},
+    {"age",       offsetof(PdbStream, age),       sizeof(uint32_t)},
+    {"signature", sizeof(PdbStream),              16},
+};
+
+const Field kDbiHeaderFields[] = {
+    {"signature",               offsetof(DbiHeader, signature),               4},
+    {"version",                 offsetof(DbiHeader, version),                 4},
+    {"age",                     offsetof(DbiHeader, age),                     4},
+    {"global symbol stream",    offsetof(DbiHeader, globalSymbolStream),      2},
+    {"PDB DLL version",         offsetof(DbiHeader, pdbDllVersion),           2},
+    {"public symbol stream",    offsetof(DbiHeader, publicSymbolStream),      2},
+    {"PDB DLL build major",     offsetof(DbiHeader, pdbDllBuildVersionMajor), 2},
+    {"symbol records stream",   offsetof(DbiHeader, symbolRecordsStream),     2},
+    {"PDB DLL build minor",     offsetof(DbiHeader, pdbDllBuildVersionMinor), 2},
+    {"module info size",        offsetof(DbiHeader, gpModInfoSize),           4},
+    {"section contribution size", offsetof(DbiHeader, sectionContributionSize), 4},
+    {"section map size",        offsetof(DbiHeader, sectionMapSize),          4},
+    {"file info size",          offsetof(DbiHeader, fileInfoSize),            4},
+    {"type server map size",    offsetof(DbiHeader, typeServerMapSize),       4},
+    {"MFC type server index",   offsetof(DbiHeader, mfcIndex),                4},
+    {"debug header size",       offsetof(DbiHeader, debugHeaderSize),         4},
+    {"EC info size",            offsetof(DbiHeader, ecInfoSize),              4},
+    {"flags",                   offsetof(DbiHeader, flags),                   2},
+    {"machine",                 offsetof(DbiHeader, machine),                 2},
+    {"reserved",                offsetof(DbiHeader, reserved),                4},
+};
+
+/**
+ * Returns the name of the field that the given offset is in, or NULL if it
+ * isn't in any of them.
+ */
+template<size_t N>
+const char* fieldAt(const Field (&fields)[N], size_t offset) {
+    for (auto& field: fields) {
+        if (offset >= field.offset && offset < field.offset + field.size)
+            return field.name;
+    }
+
+    return NULL;
+}
+
+/**
+ * Reads a range of a stream. Returns fewer bytes if the stream is shorter.
+ */
+std::vector<uint8_t> readRange(const MsfFileStream* stream, size_t offset,
+        size_t length) {
+
+    if (offset >= stream->length())
+        return std::vector<uint8_t>();
+
+    std::vector<uint8_t> buf(std::min(length, stream->length() - offset));
+
+    if (stream->readAt(offset, buf.size(), buf.data()) != buf.size())
+        throw InvalidMsf("failed to read stream");
+
+    return buf;
+}
+
+/**
+ * Hashes a chunk of a stream. Pages are hashed straight out of the memory map
+ * if there is one.
+ */
+Digest hashChunk(const MsfFileStream* stream, size_t offset, size_t length) {
+
+    HasherRef hasher = makeHasher(HashAlgorithm::xxh3);
+
+    const size_t pageSize = stream->pageSize();
+
+    std::vector<uint8_t> buf;
+
+    for (size_t end = offset + length; offset < end; ) {
+        const size_t n = std::min(pageSize - offset % pageSize, end - offset);
+
+        if (const uint8_t* p = stream->data(offset, n)) {
+            hasher->update(p, n);
+        }
+        else {
+            buf.resize(n);
+            if (stream->readAt(offset, n, buf.data()) != n)
+                throw InvalidMsf("failed to read stream");
+            hasher->update(buf.data(), n);
+        }
+
+        offset += n;
+    }
+
+    Digest digest;
+    hasher->finish(digest.data());
+    return digest;
+}
+
+/**
+ * An opened PDB and the hashes of the chunks of each of its streams.
+ */
+struct Pdb {
+    FileRef file;
+    MsfFile msf;
+
+    std::vector<std::shared_ptr<MsfFileStream>> streams;
+    std::vector<std::vector<Digest>> digests;
+
+    explicit Pdb(FileRef f) : file(f), msf(f) {
+        for (size_t i = 0; i < msf.streamCount(); ++i) {
+            streams.push_back(
+                    std::dynamic_pointer_cast<MsfFileStream>(msf.getStream(i)));
+        }
+
+        digests.resize(streams.size());
+    }
+
+    size_t length(size_t i) const {
+        return streams[i] ? streams[i]->length() : 0;
+    }
+};
+
+/**
+ * Hashes the chunks of every stream of the given PDBs in parallel.
+ */
+void hashStreams(Pdb& a, Pdb& b, ThreadPool& pool) {
+
+    std::vector<std::future<void>> tasks;
+
+    for (Pdb* pdb: {&a, &b}) {
+        for (size_t i = 0; i < pdb->streams.size(); ++i) {
+            const MsfFileStream* stream = pdb->streams[i].get();
+            if (!stream)
+                continue;
+
+            const size_t length = stream->length();
+            auto& digests = pdb->digests[i];
+            digests.resize((length + kChunkSize - 1) / kChunkSize);
+
+            for (size_t j = 0; j < digests.size(); ++j) {
+                Digest* digest = &digests[j];
+                const size_t offset = j * kChunkSize;
+                const size_t n = std::min(kChunkSize, length - offset);
+
+                tasks.push_back(pool.submit([stream, digest, offset, n]() {
+                    *digest = hashChunk(stream, offset, n);
+                }));
+            }
+        }
+    }
+
+    pool.wait(tasks);
+}
+
+/**
+ * Returns the offset of the first byte that differs between the two streams,
+ * or SIZE_MAX if they are identical. If one stream is a prefix of the other,
+ * the length of the shorter one is returned.
+ */
+size_t firstDifference(const Pdb& a, const Pdb& b, size_t i) {
+
+    const size_t lengthA = a.length(i), lengthB = b.length(i);
+    const size_t common = std::min(lengthA, lengthB);
+
+    const auto& digestsA = a.digests[i];
+    const auto& digestsB = b.digests[i];
+
+    for (size_t j = 0; j * kChunkSize < common; ++j) {
+        if (digestsA[j] == digestsB[j])
+            continue;
+
+        const size_t offset = j * kChunkSize;
+
+        const auto bufA = readRange(a.streams[i].get(), offset, kChunkSize);
+        const auto bufB = readRange(b.streams[i].get(), offset, kChunkSize);
+
+        const size_t n = std::min(bufA.size(), bufB.size());
+        const auto it = std::mismatch(bufA.begin(), bufA.begin() + n,
+                bufB.begin());
+
+        if (it.first != bufA.begin() + n)
+            return offset + (it.first - bufA.begin());
+    }
+
+    return lengthA == lengthB ? SIZE_MAX : common;
+}
+
+/**
+ * Finds out what each stream is used for from the PDB header and DBI streams.
+ * If they can't be parsed, the remaining streams are just left unknown.
+ */
+std::vector<StreamRole> streamRoles(Pdb& pdb) {
+
+    std::vector<StreamRole> roles(pdb.streams.size());
+
+    auto setRole = [&roles](size_t i, StreamKind kind, const std::string& name) {
+        if (i < roles.size() && roles[i].kind == StreamKind::unknown &&
+            roles[i].name.empty()) {
+            roles[i].kind = kind;
+            roles[i].name = name;
+        }
+    };
+
+    setRole((size_t)PdbStreamType::header, StreamKind::header, "PDB header");
+    setRole((size_t)PdbStreamType::dbi, StreamKind::dbi, "DBI");
+    setRole((size_t)PdbStreamType::tbi, StreamKind::types, "TPI");
+    setRole((size_t)PdbStreamType::ipi, StreamKind::types, "IPI");
+
+    try {
+        const size_t header = (size_t)PdbStreamType::header;
+        if (header < pdb.streams.size() && pdb.streams[header] &&
+            pdb.length(header) > sizeof(PdbStream70)) {
+
+            const auto data = readRange(pdb.streams[header].get(), 0,
+                    pdb.length(header));
+
+            const NameMapTable table(data.data() + sizeof(PdbStream70),
+                    data.data() + data.size());
+
+            for (size_t i = 0; i < table.size(); ++i) {
+                const auto entry = table[i];
+                setRole(entry.stream, StreamKind::unknown, entry.name);
+            }
+        }
+
+        const size_t dbi = (size_t)PdbStreamType::dbi;
+        if (dbi < pdb.streams.size() && pdb.streams[dbi] &&
+            pdb.length(dbi) >= sizeof(DbiHeader)) {
+
+            const auto data = readRange(pdb.streams[dbi].get(), 0,
+                    pdb.length(dbi));
+
+            DbiHeader dbiHeader;
+            memcpy(&dbiHeader, data.data(), sizeof(dbiHeader));
+
+            setRole(dbiHeader.symbolRecordsStream, StreamKind::symbolRecords,
+                    "symbol records");
+            setRole(dbiHeader.publicSymbolStream, StreamKind::unknown,
+                    "public symbols");
+            setRole(dbiHeader.globalSymbolStream, StreamKind::unknown,
+                    "global symbols");
+
+            const size_t end = std::min(data.size(),
+                    sizeof(DbiHeader) + (size_t)dbiHeader.gpModInfoSize);
+
+            size_t module = 0;
+            for (size_t i = sizeof(DbiHeader); end - i >= sizeof(ModuleInfo);
+                    ++module) {
+
+                const ModuleInfo* info = (const ModuleInfo*)(data.data() + i);
+
+                // The names must be terminated within the substream.
+                const size_t namesLength = end - i - sizeof(ModuleInfo);
+                const char* names = info->names;
+                const char* nul = (const char*)memchr(names, 0, namesLength);
+                if (!nul || !memchr(nul + 1, 0, namesLength - (nul + 1 - names)))
+                    break;
+
+                if (info->stream < roles.size() &&
+                    roles[info->stream].kind == StreamKind::unknown &&
+                    roles[info->stream].name.empty()) {
+                    StreamRole& role = roles[info->stream];
+                    role.kind = StreamKind::module;
+                    role.name = "module " + std::to_string(module) + " '" +
+                        info->moduleName() + "'";
+                    role.symbolsSize = info->symbolsSize;
+                    role.linesSize = info->linesSize;
+                    role.c13LinesSize = info->c13LinesSize;
+                }
+
+                i += info->size();
+                if (i > end)
+                    break;
+            }
+        }
+    }
+    catch (const InvalidPdb&) {
+    }
+    catch (const InvalidMsf&) {
+    }
+
+    return roles;
+}
+
+/**
+ * Prints the record that contains the given offset. The records are in the
+ * range [begin, end) of the stream and each of them starts with a 16-bit
+ * length, which doesn't include itself, and a 16-bit type.
+ *
+ * Records are numbered from `firstIndex`. Type indices are printed in hex.
+ */
+void printRecordAt(const MsfFileStream* stream, size_t begin, size_t end,
+        size_t offset, const char* what, size_t firstIndex, bool hexIndex,
+        std::ostream& os) {
+
+    end = std::min(end, stream->length());
+
+    size_t index = firstIndex;
+
+    for (size_t i = begin; i < end; ++index) {
+        uint16_t header[2];
+        if (end - i < sizeof(header) ||
+            stream->readAt(i, sizeof(header), header) != sizeof(header)) {
+            os << "    in a partial " << what << " at offset 0x" << std::hex
+               << i << std::dec << "\n";
+            return;
+        }
+
+        const size_t next = i + sizeof(uint16_t) + header[0];
+
+        if (offset < next) {
+            os << "    in " << what << " ";
+            if (hexIndex)
+                os << "0x" << std::hex << index;
+            else
+                os << index << std::hex;
+            os << " at offset 0x" << i << " (type 0x" << header[1] << ")"
+               << std::dec << ", " << header[0] + sizeof(uint16_t)
+               << " bytes\n";
+            return;
+        }
+
+        i = next;
+    }
+
+    os << "    after the last " << what << "\n";
+}
+
+/**
+ * Prints in which part of the DBI stream the given offset is in.
+ */
+void printDbiDifference(const MsfFileStream* stream, size_t offset,
+        std::ostream& os) {
+
+    if (offset < sizeof(DbiHeader)) {
+        os << "    in the header field '"
+           << fieldAt(kDbiHeaderFields, offset) << "'\n";
+        return;
+    }
+
+    const auto data = readRange(stream, 0, sizeof(DbiHeader));
+    if (data.size() < sizeof(DbiHeader))
+        return;
+
+    DbiHeader dbi;
+    memcpy(&dbi, data.data(), sizeof(dbi));
+
+    const std::pair<const char*, uint32_t> substreams[] = {
+        {"module info", dbi.gpModInfoSize},
+        {"section contribution", dbi.sectionContributionSize},
+        {"section map", dbi.sectionMapSize},
+        {"file info", dbi.fileInfoSize},
+        {"type server map", dbi.typeServerMapSize},
+        {"EC info", dbi.ecInfoSize},
+        {"debug header", dbi.debugHeaderSize},
+    };
+
+    size_t begin = sizeof(DbiHeader);
+
+    for (size_t j = 0; j < sizeof(substreams) / sizeof(substreams[0]); ++j) {
+        const auto& substream = substreams[j];
+        const size_t end = begin + substream.second;
+
+        if (offset < end) {
+            os << "    in the " << substream.first
+               << " substream at offset 0x" << std::hex << offset - begin
+               << std::dec << "\n";
+
+            // Differences in the module info are narrowed down to the module.
+            if (j == 0) {
+                // Find the module
+                const auto modules = readRange(stream, begin, substream.second);
+
+                size_t module = 0;
+                for (size_t i = 0; modules.size() - i >= sizeof(ModuleInfo);
+                        ++module) {
+                    const ModuleInfo* info =
+                        (const ModuleInfo*)(modules.data() + i);
+
+                    if (!memchr(info->names, 0,
+                                modules.size() - i - sizeof(ModuleInfo)))
+                        break;
+
+                    const size_t next = i + info->size();
+
+                    if (offset - begin < next) {
+                        os << "    in module " << module << " '"
+                           << info->moduleName() << "'\n";
+                        break;
+                    }
+
+                    i = next;
+                    if (i > modules.size())
+                        break;
+                }
+            }
+
+            return;
+        }
+
+        begin = end;
+    }
+
+    os << "    after the substreams\n";
+}
+
+/**
+ * Prints the part of the stream that the first difference is in.
+ */
+void printDifference(const MsfFileStream* stream, const StreamRole& role,
+        size_t offset, std::ostream& os) {
+
+    switch (role.kind) {
+        case StreamKind::header:
+            if (const char* field = fieldAt(kPdbHeaderFields, offset))
+                os << "    in the header field '" << field << "'\n";
+            else
+                os << "    in the name map table\n";
+            break;
+
+        case StreamKind::dbi:
+            printDbiDifference(stream, offset, os);
+            break;
+
+        case StreamKind::types: {
+            TypeStreamHeader header;
+            if (offset < sizeof(header) ||
+                stream->readAt(0, sizeof(header), &header) != sizeof(header)) {
+                os << "    in the header\n";
+                break;
+            }
+
+            printRecordAt(stream, header.headerSize,
+                    (size_t)header.headerSize + header.typeRecordBytes, offset,
+                    "type record", header.typeIndexBegin, true, os);
+            break;
+        }
+
+        case StreamKind::symbolRecords:
+            printRecordAt(stream, 0, stream->length(), offset, "symbol record",
+                    0, false, os);
+            break;
+
+        case StreamKind::module: {
+            // The symbols start with a 4-byte signature.
+            const size_t symbols = role.symbolsSize;
+            const size_t lines = symbols + role.linesSize;
+            const size_t c13Lines = lines + role.c13LinesSize;
+
+            if (offset < sizeof(uint32_t))
+                os << "    in the signature\n";
+            else if (offset < symbols)
+                printRecordAt(stream, sizeof(uint32_t), symbols, offset,
+                        "symbol record", 0, false, os);
+            else if (offset < lines)
+                os << "    in the lines\n";
+            else if (offset < c13Lines)
+                os << "    in the C13 lines\n";
+            else
+                os << "    in the global references\n";
+            break;
+        }
+
+        case StreamKind::unknown:
+            break;
+    }
+}
+
+template<typename CharT>
+bool diffPdbImpl(const CharT* pathA, const CharT* pathB) {
+
+    Pdb a(openFile(pathA, FileMode<CharT>::readExisting));
+    Pdb b(openFile(pathB, FileMode<CharT>::readExisting));
+
+    ThreadPool pool;
+    hashStreams(a, b, pool);
+
+    const auto roles = streamRoles(a);
+
+    std::ostream& os = std::cout;
+
+    const size_t countA = a.streams.size(), countB = b.streams.size();
+
+    size_t differing = 0;
+
+    if (countA != countB) {
+        os << "Stream count: " << countA << " vs. " << countB << "\n";
+    }
+
+    if (a.msf.pageSize() != b.msf.pageSize()) {
+        os << "Page size: " << a.msf.pageSize() << " vs. " << b.msf.pageSize()
+           << "\n";
+    }
+
+    for (size_t i = 0; i < std::max(countA, countB); ++i) {
+
+        if (i >= countA || i >= countB) {
+            os << "Stream " << i << ": only in "
+               << (i < countA ? "the first" : "the second") << " PDB\n";
+            ++differing;
+            continue;
+        }
+
+        const size_t offset = firstDifference(a, b, i);
+        if (offset == SIZE_MAX)
+            continue;
+
+        ++differing;
+
+        os << "Stream " << i;
+        if (!roles[i].name.empty())
+            os << " (" << roles[i].name << ")";
+        os << ": ";
+
+        if (a.length(i) != b.length(i))
+            os << a.length(i) << " vs. " << b.length(i) << " bytes, ";
+
+        os << "first difference at offset 0x" << std::hex << offset
+           << std::dec << "\n";
+
+        if (a.streams[i] && offset < a.length(i))
+            printDifference(a.streams[i].get(), roles[i], offset, os);
+    }
+
+    if (differing == 0) {
+        os << "The streams of the PDBs are identical.\n";
+        return true;
+    }
+
+    os << differing << " of " << std::max(countA, countB)
+       << " streams differ.\n";
+
+    return false;
+}
+
+}
+
+#if defined(_WIN32) && defined(UNICODE)
+
+bool diffPdb(const wchar_t* pathA, const wchar_t* pathB) {
+    return diffPdbImpl(pathA, pathB);
+}
+
+#else
+
+bool diffPdb(const char* pathA, const char* pathB) {
+    return diffPdbImpl(pathA, pathB);
+}
+
+#endif
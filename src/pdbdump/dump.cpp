@@ -20,6 +20,7 @@
  * SOFTWARE.
  */
 
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
 #include <memory>
@@ -53,7 +54,8 @@ void printLinkInfoStream(MsfMemoryStream* stream, std::ostream& os);
  *
  *    [0-4, 6-9, 20]
  */
-void printPageSequences(const std::vector<uint32_t>& pages, std::ostream& os) {
+void printPageSequences(const MsfPageList& pages, size_t pageSize,
+        std::ostream& os) {
     os << "[";
 
     for (size_t i = 0; i < pages.size(); ) {
@@ -73,15 +75,15 @@ void printPageSequences(const std::vector<uint32_t>& pages, std::ostream& os) {
         if (count == 0) {
             os << start
                << " (0x" << std::hex
-               << (uint64_t)start * 4096 << "-0x"
-               << ((uint64_t)start+1) * 4096 - 1
+               << (uint64_t)start * pageSize << "-0x"
+               << ((uint64_t)start+1) * pageSize - 1
                << ")" << std::dec;
         }
         else {
             os << start << "-" << start+count
                << " (0x" << std::hex
-               << ((uint64_t)start) * 4096 << "-0x"
-               << ((uint64_t)start+count+1) * 4096 - 1
+               << ((uint64_t)start) * pageSize << "-0x"
+               << ((uint64_t)start+count+1) * pageSize - 1
                << ")" << std::dec;
         }
     }
@@ -108,12 +110,12 @@ void printStreamTable(MsfFile& msf, std::ostream& os) {
            << std::setw(8) << stream->length() << " bytes, "
            << std::setw(4) << pages.size() << " pages ";
 
-        printPageSequences(pages, os);
+        printPageSequences(pages, stream->pageSize(), os);
 
-        std::cout << std::endl;
+        os << '\n';
     }
 
-    os << std::endl;
+    os << '\n';
 }
 
 /**
@@ -153,9 +155,9 @@ void printPdbStream(MsfFile& msf, std::ostream& os) {
     os << "PDB Stream Info\n"
        << "===============\n";
 
-    os << "Stream ID:   " << streamid << std::endl;
-    os << "Stream Size: " << stream->length() << " bytes" << std::endl;
-    os << std::endl;
+    os << "Stream ID:   " << streamid << '\n';
+    os << "Stream Size: " << stream->length() << " bytes" << '\n';
+    os << '\n';
 
     PdbStream70 header;
 
@@ -165,11 +167,11 @@ void printPdbStream(MsfFile& msf, std::ostream& os) {
     os << "Header\n"
        << "------\n";
 
-    os << "Version:   " << (uint32_t)header.version << std::endl;
-    os << "Timestamp: " << header.timestamp << std::endl;
-    os << "Age:       " << header.age << std::endl;
-    os << "Signature: "; printGUID(header.sig70, os); os << std::endl;
-    os << std::endl;
+    os << "Version:   " << (uint32_t)header.version << '\n';
+    os << "Timestamp: " << header.timestamp << '\n';
+    os << "Age:       " << header.age << '\n';
+    os << "Signature: "; printGUID(header.sig70, os); os << '\n';
+    os << '\n';
 
     os << "Name Map Table\n"
        << "--------------\n";
@@ -180,17 +182,27 @@ void printPdbStream(MsfFile& msf, std::ostream& os) {
     if (stream->read(remaining, buf.get()) != remaining)
         throw InvalidPdb("failed to read name map table");
 
-    auto nameMap = readNameMapTable(buf.get(), buf.get()+remaining);
+    const NameMapTable nameMap(buf.get(), buf.get()+remaining);
 
-    for (auto const& kv: nameMap)
-        os << kv.first << " => " << kv.second << std::endl;
+    // Print the names in sorted order, not in the order of the hash table.
+    std::vector<NameMapTable::Entry> entries;
+    for (size_t i = 0; i < nameMap.size(); ++i)
+        entries.push_back(nameMap[i]);
 
-    os << std::endl;
+    std::sort(entries.begin(), entries.end(),
+        [](const NameMapTable::Entry& a, const NameMapTable::Entry& b) {
+            return strcmp(a.name, b.name) < 0;
+        });
+
+    for (auto const& entry: entries)
+        os << entry.name << " => " << entry.stream << '\n';
+
+    os << '\n';
 
     // Dump the /LinkInfo stream if it exists.
-    const auto it = nameMap.find("/LinkInfo");
-    if (it != nameMap.end()) {
-        auto linkInfoStream = msf.getStream(it->second);
+    uint32_t linkInfo;
+    if (nameMap.find("/LinkInfo", linkInfo)) {
+        auto linkInfoStream = msf.getStream(linkInfo);
         if (!linkInfoStream)
             throw InvalidPdb("missing '/LinkInfo' stream");
 
@@ -222,11 +234,11 @@ void printLinkInfoStream(MsfMemoryStream* stream, std::ostream& os) {
     if (linkInfo->size > length)
         throw InvalidPdb("LinkInfo size too large for stream");
 
-    os << "CWD:         '" << linkInfo->cwd<char>()        << "'" << std::endl
-       << "Command:     '" << linkInfo->command<char>()    << "'" << std::endl
-       << "Libs:        '" << linkInfo->libs<char>()       << "'" << std::endl
-       << "Output File: '" << linkInfo->outputFile<char>() << "'" << std::endl
-       << std::endl;
+    os << "CWD:         '" << linkInfo->cwd<char>()        << "'" << '\n'
+       << "Command:     '" << linkInfo->command<char>()    << "'" << '\n'
+       << "Libs:        '" << linkInfo->libs<char>()       << "'" << '\n'
+       << "Output File: '" << linkInfo->outputFile<char>() << "'" << '\n'
+       << '\n';
 }
 
 /**
@@ -242,9 +254,9 @@ void printDbiStream(MsfFile& msf, std::ostream& os, bool verbose) {
     os << "DBI Stream Info\n"
        << "===============\n";
 
-    os << "Stream ID:   " << streamid << std::endl;
-    os << "Stream Size: " << stream->length() << " bytes" << std::endl;
-    os << std::endl;
+    os << "Stream ID:   " << streamid << '\n';
+    os << "Stream Size: " << stream->length() << " bytes" << '\n';
+    os << '\n';
 
     DbiHeader dbi;
 
@@ -254,33 +266,32 @@ void printDbiStream(MsfFile& msf, std::ostream& os, bool verbose) {
     os << "Header\n"
        << "------\n";
 
-    os << "Signature:                          0x" << std::hex << dbi.signature << std::dec <<
-        std::endl
-       << "Version:                            " << (uint32_t)dbi.version << std::endl
-       << "Age:                                " << dbi.age << std::endl
-       << "Global Symbol Info (GSI) Stream ID: " << dbi.globalSymbolStream << std::endl
+    os << "Signature:                          0x" << std::hex << dbi.signature << std::dec << '\n'
+       << "Version:                            " << (uint32_t)dbi.version << '\n'
+       << "Age:                                " << dbi.age << '\n'
+       << "Global Symbol Info (GSI) Stream ID: " << dbi.globalSymbolStream << '\n'
        << "PDB DLL Version:                    "
            << dbi.pdbDllVersion.major << "."
            << dbi.pdbDllVersion.minor << "."
-           << dbi.pdbDllVersion.format << std::endl
-       << "Public Symbol Info (PSI) Stream ID: " << dbi.publicSymbolStream << std::endl
-       << "PDB DLL Build Major Version:        " << dbi.pdbDllBuildVersionMajor << std::endl
-       << "Symbol Records Stream ID:           " << dbi.symbolRecordsStream << std::endl
-       << "PDB DLL Build Minor Version:        " << dbi.pdbDllBuildVersionMinor << std::endl
-       << "Module Info Size:                   " << dbi.gpModInfoSize << " bytes" << std::endl
-       << "Section Contribution Size:          " << dbi.sectionContributionSize << " bytes" << std::endl
-       << "Section Map Size:                   " << dbi.sectionMapSize << " bytes" << std::endl
-       << "File Info Size:                     " << dbi.fileInfoSize << " bytes" << std::endl
-       << "Type Server Map Size:               " << dbi.typeServerMapSize << " bytes" << std::endl
-       << "MFC Type Server Index:              " << dbi.mfcIndex << std::endl
-       << "Debug Header Size:                  " << dbi.debugHeaderSize << " bytes" << std::endl
-       << "EC Info Size:                       " << dbi.ecInfoSize << " bytes" << std::endl
-       << "Flags:" << std::endl
-       << "    Incrementally Linked:           " << (dbi.flags.incLink ? "yes" : "no") << std::endl
-       << "    Stripped:                       " << (dbi.flags.stripped ? "yes" : "no") << std::endl
-       << "    CTypes:                         " << (dbi.flags.ctypes ? "yes" : "no") << std::endl
-       << "Machine Type:                       " << dbi.machine << std::endl
-       << std::endl;
+           << dbi.pdbDllVersion.format << '\n'
+       << "Public Symbol Info (PSI) Stream ID: " << dbi.publicSymbolStream << '\n'
+       << "PDB DLL Build Major Version:        " << dbi.pdbDllBuildVersionMajor << '\n'
+       << "Symbol Records Stream ID:           " << dbi.symbolRecordsStream << '\n'
+       << "PDB DLL Build Minor Version:        " << dbi.pdbDllBuildVersionMinor << '\n'
+       << "Module Info Size:                   " << dbi.gpModInfoSize << " bytes" << '\n'
+       << "Section Contribution Size:          " << dbi.sectionContributionSize << " bytes" << '\n'
+       << "Section Map Size:                   " << dbi.sectionMapSize << " bytes" << '\n'
+       << "File Info Size:                     " << dbi.fileInfoSize << " bytes" << '\n'
+       << "Type Server Map Size:               " << dbi.typeServerMapSize << " bytes" << '\n'
+       << "MFC Type Server Index:              " << dbi.mfcIndex << '\n'
+       << "Debug Header Size:                  " << dbi.debugHeaderSize << " bytes" << '\n'
+       << "EC Info Size:                       " << dbi.ecInfoSize << " bytes" << '\n'
+       << "Flags:" << '\n'
+       << "    Incrementally Linked:           " << (dbi.flags.incLink ? "yes" : "no") << '\n'
+       << "    Stripped:                       " << (dbi.flags.stripped ? "yes" : "no") << '\n'
+       << "    CTypes:                         " << (dbi.flags.ctypes ? "yes" : "no") << '\n'
+       << "Machine Type:                       " << dbi.machine << '\n'
+       << '\n';
 
     size_t moduleCount = 0;
 
@@ -299,11 +310,11 @@ void printDbiStream(MsfFile& msf, std::ostream& os, bool verbose) {
 
             ModuleInfo* info = (ModuleInfo*)(modInfo.get() + i);
 
-            os  << "Module ID:   " << moduleCount << std::endl
-                << "Module Name: '" << info->moduleName() << "'" << std::endl
-                << "Object Name: '" << info->objectName() << "'" << std::endl
-                << "Stream ID:   " << info->stream << std::endl
-                << std::endl;
+            os  << "Module ID:   " << moduleCount << '\n'
+                << "Module Name: '" << info->moduleName() << "'" << '\n'
+                << "Object Name: '" << info->objectName() << "'" << '\n'
+                << "Stream ID:   " << info->stream << '\n'
+                << '\n';
 
             i += info->size();
             ++moduleCount;
@@ -326,7 +337,7 @@ void printDbiStream(MsfFile& msf, std::ostream& os, bool verbose) {
         const size_t count = (dbi.sectionContributionSize - sizeof(scVersion)) /
             sizeof(SectionContribution);
 
-        os << "Section Contribution Count: " << count << std::endl;
+        os << "Section Contribution Count: " << count << '\n';
 
         for (size_t i = 0; i < count; ++i) {
             SectionContribution sc;
@@ -334,20 +345,20 @@ void printDbiStream(MsfFile& msf, std::ostream& os, bool verbose) {
             if (stream->read(sizeof(sc), &sc) != sizeof(sc))
                 throw InvalidPdb("failed to read SectionContribution");
 
-            os  << "id              = " << i                  << std::endl
-                << "section         = " << sc.section         << std::endl
-                << "padding1        = " << sc.padding1        << std::endl
-                << "offset          = " << std::hex << "0x" << sc.offset << std::dec << std::endl
-                << "size            = " << sc.size            << std::endl
-                << "characteristics = " << sc.characteristics << std::endl
-                << "imod            = " << sc.imod            << std::endl
-                << "padding2        = " << sc.padding2        << std::endl
-                << "dataCrc         = " << std::hex << "0x" << sc.dataCrc << std::dec << std::endl
-                << "relocCrc        = " << sc.relocCrc        << std::endl
-               << std::endl;
+            os  << "id              = " << i                  << '\n'
+                << "section         = " << sc.section         << '\n'
+                << "padding1        = " << sc.padding1        << '\n'
+                << "offset          = " << std::hex << "0x" << sc.offset << std::dec << '\n'
+                << "size            = " << sc.size            << '\n'
+                << "characteristics = " << sc.characteristics << '\n'
+                << "imod            = " << sc.imod            << '\n'
+                << "padding2        = " << sc.padding2        << '\n'
+                << "dataCrc         = " << std::hex << "0x" << sc.dataCrc << std::dec << '\n'
+                << "relocCrc        = " << sc.relocCrc        << '\n'
+               << '\n';
         }
 
-        os << std::endl;
+        os << '\n';
     }
     else {
         // Skip over the section contribution
@@ -360,7 +371,7 @@ void printDbiStream(MsfFile& msf, std::ostream& os, bool verbose) {
 
         os << "No information available.\n";
 
-        os << std::endl;
+        os << '\n';
 
         // Skip over the section map
         stream->skip(dbi.sectionMapSize);
@@ -412,14 +423,14 @@ void printDbiStream(MsfFile& msf, std::ostream& os, bool verbose) {
 
         for (size_t i = 0; i < moduleCount; ++i) {
 
-            os << "Module " << i << std::endl;
+            os << "Module " << i << '\n';
 
             for (size_t j = 1; j < fileCounts[i]; ++j) {
-                os << "    " << names + offsets[offset] << std::endl;
+                os << "    " << names + offsets[offset] << '\n';
                 ++offset;
             }
 
-            os << std::endl;
+            os << '\n';
         }
     }
     else {
@@ -427,7 +438,7 @@ void printDbiStream(MsfFile& msf, std::ostream& os, bool verbose) {
         stream->skip(dbi.fileInfoSize);
     }
 
-    os << std::endl;
+    os << '\n';
 
     {
         os << "Type Server Map (TSM)\n"
@@ -435,7 +446,7 @@ void printDbiStream(MsfFile& msf, std::ostream& os, bool verbose) {
 
         os << "No information available.\n";
 
-        os << std::endl;
+        os << '\n';
 
         // Skip over the TSM substream
         stream->skip(dbi.typeServerMapSize);
@@ -447,7 +458,7 @@ void printDbiStream(MsfFile& msf, std::ostream& os, bool verbose) {
 
         os << "No information available.\n";
 
-        os << std::endl;
+        os << '\n';
 
         // Skip over the EC info substream
         stream->skip(dbi.ecInfoSize);
@@ -466,48 +477,55 @@ void printDbiStream(MsfFile& msf, std::ostream& os, bool verbose) {
 
         const int16_t* streams = (const int16_t*)debugHeader.get();
 
-        os << "fpo            = " << streams[DebugTypes::fpo]            << std::endl
-           << "exception      = " << streams[DebugTypes::exception]      << std::endl
-           << "fixup          = " << streams[DebugTypes::fixup]          << std::endl
-           << "omapToSrc      = " << streams[DebugTypes::omapToSrc]      << std::endl
-           << "omapFromSrc    = " << streams[DebugTypes::omapFromSrc]    << std::endl
-           << "sectionHdr     = " << streams[DebugTypes::sectionHdr]     << std::endl
-           << "tokenRidMap    = " << streams[DebugTypes::tokenRidMap]    << std::endl
-           << "xdata          = " << streams[DebugTypes::xdata]          << std::endl
-           << "pdata          = " << streams[DebugTypes::pdata]          << std::endl
-           << "newFPO         = " << streams[DebugTypes::newFPO]         << std::endl
-           << "sectionHdrOrig = " << streams[DebugTypes::sectionHdrOrig] << std::endl
-           << std::endl;
+        os << "fpo            = " << streams[DebugTypes::fpo]            << '\n'
+           << "exception      = " << streams[DebugTypes::exception]      << '\n'
+           << "fixup          = " << streams[DebugTypes::fixup]          << '\n'
+           << "omapToSrc      = " << streams[DebugTypes::omapToSrc]      << '\n'
+           << "omapFromSrc    = " << streams[DebugTypes::omapFromSrc]    << '\n'
+           << "sectionHdr     = " << streams[DebugTypes::sectionHdr]     << '\n'
+           << "tokenRidMap    = " << streams[DebugTypes::tokenRidMap]    << '\n'
+           << "xdata          = " << streams[DebugTypes::xdata]          << '\n'
+           << "pdata          = " << streams[DebugTypes::pdata]          << '\n'
+           << "newFPO         = " << streams[DebugTypes::newFPO]         << '\n'
+           << "sectionHdrOrig = " << streams[DebugTypes::sectionHdrOrig] << '\n'
+           << '\n';
     }
 }
 
-void dumpPdb(MsfFile& msf, bool verbose) {
-    printStreamTable(msf, std::cout);
-    printPdbStream(msf, std::cout);
-    printDbiStream(msf, std::cout, verbose);
+void dumpPdb(MsfFile& msf, bool verbose, unsigned sections) {
+    if (sections & DumpSection::streamTable)
+        printStreamTable(msf, std::cout);
+
+    if (sections & DumpSection::pdb)
+        printPdbStream(msf, std::cout);
+
+    if (sections & DumpSection::dbi)
+        printDbiStream(msf, std::cout, verbose);
 }
 
 template<typename CharT>
-void dumpPdbImpl(const CharT* path, bool verbose) {
+void dumpPdbImpl(const CharT* path, bool verbose, unsigned sections) {
     auto pdb = openFile(path, FileMode<CharT>::readExisting);
 
+    // Streams are only read from the file when they are asked for, so only the
+    // parts of the file that the selected sections need are touched.
     MsfFile msf(pdb);
 
-    dumpPdb(msf, verbose);
+    dumpPdb(msf, verbose, sections);
 }
 
 }
 
 #if defined(_WIN32) && defined(UNICODE)
 
-void dumpPdb(const wchar_t* path, bool verbose) {
-    dumpPdbImpl(path, verbose);
+void dumpPdb(const wchar_t* path, bool verbose, unsigned sections) {
+    dumpPdbImpl(path, verbose, sections);
 }
 
 #else
 
-void dumpPdb(const char* path, bool verbose) {
-    dumpPdbImpl(path, verbose);
+void dumpPdb(const char* path, bool verbose, unsigned sections) {
+    dumpPdbImpl(path, verbose, sections);
 }
 
 #endif
@@ -21,16 +21,30 @@
  */
 #pragma once
 
+/**
+ * Sections of the dump. These can be combined to only dump some of them.
+ */
+namespace DumpSection {
+    enum {
+        streamTable = 1 << 0,
+        pdb         = 1 << 1,
+        dbi         = 1 << 2,
+
+        all = streamTable | pdb | dbi,
+    };
+}
 
 /**
- * Prints information about a PDB.
+ * Prints information about a PDB. Only the given sections are printed.
  */
 #if defined(_WIN32) && defined(UNICODE)
 
-void dumpPdb(const wchar_t* path, bool verbose);
+void dumpPdb(const wchar_t* path, bool verbose,
+        unsigned sections = DumpSection::all);
 
 #else
 
-void dumpPdb(const char* path, bool verbose);
+void dumpPdb(const char* path, bool verbose,
+        unsigned sections = DumpSection::all);
 
 #endif
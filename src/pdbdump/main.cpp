@@ -27,6 +27,7 @@
 #include "msf/msf.h"
 #include "pdb/format.h"
 #include "pdb/pdb.h"
+#include "pdbdump/diff.h"
 #include "pdbdump/dump.h"
 
 #include "version.h"
@@ -91,6 +92,12 @@ struct OptionNames<char> {
     const char* versionLong  = "--version";
     const char* verboseLong  = "--verbose";
     const char* verboseShort = "-v";
+    const char* diffLong     = "--diff";
+    const char* sectionLong  = "--section";
+    const char* sectionShort = "-s";
+    const char* streamTableSection = "streams";
+    const char* pdbSection   = "pdb";
+    const char* dbiSection   = "dbi";
     const char* dashDash     = "--";
 };
 
@@ -101,6 +108,12 @@ struct OptionNames<wchar_t> {
     const wchar_t* versionLong  = L"--version";
     const wchar_t* verboseLong  = L"--verbose";
     const wchar_t* verboseShort = L"-v";
+    const wchar_t* diffLong     = L"--diff";
+    const wchar_t* sectionLong  = L"--section";
+    const wchar_t* sectionShort = L"-s";
+    const wchar_t* streamTableSection = L"streams";
+    const wchar_t* pdbSection   = L"pdb";
+    const wchar_t* dbiSection   = L"dbi";
     const wchar_t* dashDash     = L"--";
 };
 
@@ -118,9 +131,15 @@ public:
 
     const CharT* pdb;
 
+    // The PDB to compare against, if --diff was given.
+    const CharT* diff;
+
     bool verbose;
 
-    CommandOptions() : pdb(NULL), verbose(false) {}
+    // The sections to dump. If none are given, everything is dumped.
+    unsigned sections;
+
+    CommandOptions() : pdb(NULL), diff(NULL), verbose(false), sections(0) {}
 
     /**
      * Parses the command line arguments.
@@ -149,6 +168,9 @@ public:
             }
         }
 
+        // Set to true if two PDBs should be compared.
+        bool isDiff = false;
+
         // Set to true if only positional arguments can occur.
         bool onlyPositional = false;
 
@@ -167,6 +189,24 @@ public:
             else if (arg == opt.verboseLong || arg == opt.verboseShort) {
                 verbose = true;
             }
+            else if (arg == opt.diffLong) {
+                isDiff = true;
+            }
+            else if (arg == opt.sectionLong || arg == opt.sectionShort) {
+                if (i + 1 >= argc)
+                    throw InvalidCommandLine("Missing value for --section");
+
+                const string name = argv[++i];
+                if (name == opt.streamTableSection)
+                    sections |= DumpSection::streamTable;
+                else if (name == opt.pdbSection)
+                    sections |= DumpSection::pdb;
+                else if (name == opt.dbiSection)
+                    sections |= DumpSection::dbi;
+                else
+                    throw InvalidCommandLine(
+                            "Section must be one of 'streams', 'pdb', or 'dbi'");
+            }
             else if (arg.length() > 0 && arg.front() == '-') {
                 throw UnknownOption<CharT>(argv[i]);
             }
@@ -175,6 +215,18 @@ public:
             }
         }
 
+        if (sections == 0)
+            sections = DumpSection::all;
+
+        if (isDiff) {
+            if (positional.size() != 2)
+                throw InvalidCommandLine("--diff needs two PDBs");
+
+            pdb = positional[0];
+            diff = positional[1];
+            return;
+        }
+
         switch (positional.size()) {
             case 1:
                 pdb = positional[0];
@@ -193,7 +245,8 @@ template<typename CharT>
 const OptionNames<CharT> CommandOptions<CharT>::opt = OptionNames<CharT>();
 
 const char* usage =
-    "Usage: pdbdump pdb [--help] [--verbose]";
+    "Usage: pdbdump pdb [--help] [--verbose] [--section NAME]...\n"
+    "       pdbdump --diff pdb1 pdb2";
 
 const char* help =
 R"(
@@ -202,10 +255,27 @@ Dumps information about a PDB. This is useful for diffing two PDBs.
 Positional arguments:
   pdb            The PDB file.
 
+Comparing PDBs:
+  --diff pdb1 pdb2
+                 Instead of dumping a PDB, compares two of them. Streams are
+                 compared by their hashes. For each stream that differs, the
+                 part of it that the first difference is in is printed, such
+                 as a DBI substream, a module, or a symbol or type record. The
+                 exit code is 0 if the streams are identical, 1 if they
+                 differ, and 2 if there was an error.
+
 Optional arguments:
   --help, -h     Prints this help.
   --version      Prints version information.
   --verbose, -v  Prints extra information about the PDB.
+  --section, -s NAME
+                 Only prints the given section. This can be given more than
+                 once. NAME is one of:
+                   streams  The stream table.
+                   pdb      The PDB header stream and the /LinkInfo stream.
+                   dbi      The DBI stream.
+                 Only the streams needed for the sections are read. By
+                 default, all sections are printed.
 )";
 
 template<typename CharT = char>
@@ -238,20 +308,30 @@ int pdbdump(int argc, CharT** argv)
         return 0;
     }
 
+    // Nothing is printed with stdio. Not synchronizing with it lets the output
+    // be buffered. It is flushed before anything is printed to stderr.
+    std::ios::sync_with_stdio(false);
+
+    // Like diff(1), --diff tells differences apart from errors.
+    const int errorCode = opts.diff ? 2 : 1;
+
     try {
-        dumpPdb(opts.pdb, opts.verbose);
+        if (opts.diff)
+            return diffPdb(opts.pdb, opts.diff) ? 0 : 1;
+
+        dumpPdb(opts.pdb, opts.verbose, opts.sections);
     }
     catch (const InvalidMsf& error) {
         std::cerr << "Error: Invalid PDB MSF format (" << error.why() << ")\n";
-        return 1;
+        return errorCode;
     }
     catch (const InvalidPdb& error) {
         std::cerr << "Error: Invalid PDB format (" << error.why() << ")\n";
-        return 1;
+        return errorCode;
     }
     catch (const std::system_error& error) {
         std::cerr << "Error: " << error.what() << "\n";
-        return 1;
+        return errorCode;
     }
 
     return 0;
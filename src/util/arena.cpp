@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "util/arena.h"
+
+#if defined(_WIN32)
+#   include <windows.h>
+#else
+#   include <sys/mman.h>
+#endif
+
+namespace {
+
+/**
+ * Maps a block of memory directly from the OS. Returns NULL on failure.
+ */
+uint8_t* mapBlock(size_t size) {
+#if defined(_WIN32)
+    return (uint8_t*)VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT,
+            PAGE_READWRITE);
+#else
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+
+#   if defined(MADV_HUGEPAGE)
+    // Only a hint. Fewer TLB misses when the buffers are walked.
+    madvise(p, size, MADV_HUGEPAGE);
+#   endif
+
+    return (uint8_t*)p;
+#endif
+}
+
+void unmapBlock(uint8_t* p, size_t size) {
+#if defined(_WIN32)
+    (void)size;
+    VirtualFree(p, 0, MEM_RELEASE);
+#else
+    munmap(p, size);
+#endif
+}
+
+}
+
+const size_t Arena::kMappedBlockSize;
+
+Arena::Arena(size_t blockSize)
+    : _next(NULL), _end(NULL), _blockSize(blockSize), _allocated(0) {
+}
+
+Arena::~Arena() {
+    reset();
+}
+
+uint8_t* Arena::allocateBlock(size_t size) {
+
+    Block block;
+    block.mapped = size >= kMappedBlockSize;
+
+    if (block.mapped) {
+        // Round up to whole huge pages.
+        size = (size + kMappedBlockSize - 1) & ~(kMappedBlockSize - 1);
+        block.data = mapBlock(size);
+    }
+    else {
+        block.data = (uint8_t*)malloc(size);
+    }
+
+    if (!block.data)
+        throw std::bad_alloc();
+
+    block.size = size;
+
+    try {
+        _blocks.push_back(block);
+    }
+    catch (...) {
+        if (block.mapped)
+            unmapBlock(block.data, block.size);
+        else
+            free(block.data);
+        throw;
+    }
+
+    return block.data;
+}
+
+void* Arena::allocate(size_t size, size_t alignment) {
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _allocated += size;
+
+    // Large allocations get a block of their own. This leaves the current
+    // block for the small ones.
+    if (size > _blockSize / 4)
+        return allocateBlock(size);
+
+    uintptr_t p = ((uintptr_t)_next + alignment - 1) & ~(uintptr_t)(alignment - 1);
+
+    if (!_next || p + size > (uintptr_t)_end) {
+        _next = allocateBlock(_blockSize);
+        _end = _next + _blockSize;
+        p = ((uintptr_t)_next + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    }
+
+    _next = (uint8_t*)(p + size);
+
+    return (void*)p;
+}
+
+void Arena::reset() {
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    for (auto& block: _blocks) {
+        if (block.mapped)
+            unmapBlock(block.data, block.size);
+        else
+            free(block.data);
+    }
+
+    _blocks.clear();
+    _next = _end = NULL;
+    _allocated = 0;
+}
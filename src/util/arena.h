@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * A monotonic arena for buffers that live until the end of a run. Allocating
+ * from it is a pointer bump and nothing is freed individually. Instead, all of
+ * it is released at once when the arena is reset or destroyed. This keeps the
+ * many large, short-lived buffers of patching a PDB from fragmenting the heap
+ * of a long-running process.
+ */
+
+#pragma once
+
+#include <stdlib.h> // For size_t
+#include <stdint.h>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+class Arena
+{
+private:
+    struct Block {
+        uint8_t* data;
+        size_t size;
+        bool mapped;
+    };
+
+    std::vector<Block> _blocks;
+
+    // The free space left in the current block.
+    uint8_t* _next;
+    uint8_t* _end;
+
+    size_t _blockSize;
+    size_t _allocated;
+
+    std::mutex _mutex;
+
+    uint8_t* allocateBlock(size_t size);
+
+public:
+    // Blocks this large or larger are mapped directly from the OS. Where
+    // available, they are backed by huge pages.
+    static const size_t kMappedBlockSize = 2 * 1024 * 1024;
+
+    /**
+     * Params:
+     *   blockSize = Size of the blocks that small allocations are carved out
+     *               of. Allocations larger than a quarter of this get a block
+     *               of their own.
+     */
+    explicit Arena(size_t blockSize = 1024 * 1024);
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    /**
+     * Allocates memory that stays valid until the arena is reset. This may be
+     * called from multiple threads at once.
+     *
+     * Throws: std::bad_alloc if out of memory.
+     */
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+    /**
+     * Releases everything that was allocated.
+     */
+    void reset();
+
+    /**
+     * Returns the number of bytes that were allocated since the last reset.
+     */
+    size_t allocated() const {
+        return _allocated;
+    }
+};
+
+/**
+ * Allocator for standard containers that allocates from an arena. Without an
+ * arena, it falls back to the heap. Thus, containers using this can be used
+ * with or without an arena.
+ */
+template<typename T>
+class ArenaAllocator
+{
+private:
+    Arena* _arena;
+
+public:
+    typedef T value_type;
+
+    ArenaAllocator(Arena* arena = NULL) noexcept : _arena(arena) {}
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) noexcept
+        : _arena(other.arena()) {}
+
+    T* allocate(size_t n) {
+        if (n > SIZE_MAX / sizeof(T))
+            throw std::bad_alloc();
+
+        if (_arena)
+            return (T*)_arena->allocate(n * sizeof(T), alignof(T));
+
+        return (T*)::operator new(n * sizeof(T));
+    }
+
+    void deallocate(T* p, size_t) noexcept {
+        if (!_arena)
+            ::operator delete(p);
+    }
+
+    Arena* arena() const {
+        return _arena;
+    }
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+    return a.arena() == b.arena();
+}
+
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+    return a.arena() != b.arena();
+}
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
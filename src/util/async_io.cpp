@@ -0,0 +1,475 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "util/async_io.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+#if defined(_WIN32)
+#   include <Windows.h>
+#   include <io.h>
+#elif defined(__linux__)
+#   include <linux/io_uring.h>
+#   include <sys/mman.h>
+#   include <sys/syscall.h>
+#   include <sys/uio.h>
+#   include <unistd.h>
+#endif
+
+#include "util/stats.h"
+
+namespace {
+
+std::atomic<bool> disabled(false);
+
+}
+
+void disableAsyncIo() {
+    disabled = true;
+}
+
+bool asyncIoEnabled() {
+    return !disabled;
+}
+
+const size_t AsyncIo::kDefaultQueueDepth;
+const size_t AsyncIo::kMaxRequestSize;
+
+struct AsyncIo::Request {
+#if defined(_WIN32)
+    // Must come first such that the request can be found from the OVERLAPPED
+    // that completed.
+    OVERLAPPED overlapped;
+#elif defined(__linux__)
+    // Must stay valid until the kernel has picked up the request.
+    struct iovec iov;
+#endif
+
+    bool write;
+    int64_t offset;
+    uint8_t* buf;
+    size_t length;
+    size_t* done;
+};
+
+void AsyncIo::read(int64_t offset, void* buf, size_t length, size_t* done) {
+    queue(false, offset, buf, length, done);
+}
+
+void AsyncIo::write(int64_t offset, const void* buf, size_t length) {
+    queue(true, offset, const_cast<void*>(buf), length, NULL);
+}
+
+void AsyncIo::queue(bool write, int64_t offset, void* buf, size_t length,
+        size_t* done) {
+
+    uint8_t* p = (uint8_t*)buf;
+
+    // Once something has failed, wait() is going to throw anyway.
+    while (length > 0 && !_error) {
+        if (_free.empty())
+            reap();
+
+        const size_t n = std::min(length, kMaxRequestSize);
+
+        const size_t i = _free.back();
+        _free.pop_back();
+
+        Request& r = _requests[i];
+        r.write = write;
+        r.offset = offset;
+        r.buf = p;
+        r.length = n;
+        r.done = done;
+
+        addStat(StatCounter::asyncRequests, 1);
+
+        start(i);
+
+        offset += (int64_t)n;
+        p += n;
+        length -= n;
+    }
+
+#if defined(__linux__)
+    // Get the kernel going on what was just queued up.
+    if (_unsubmitted > 0)
+        submit(0);
+#endif
+}
+
+void AsyncIo::complete(size_t i, int64_t result, int error) {
+
+    Request& r = _requests[i];
+
+#if defined(__linux__)
+    if (error == EINTR || error == EAGAIN) {
+        start(i);
+        return;
+    }
+#endif
+
+    if (error != 0) {
+        if (!_error)
+            _error = std::error_code(error, std::system_category());
+    }
+    else if (result == 0) {
+        // Only a read with somewhere to report the short count may run into
+        // the end of the file.
+        if ((r.write || !r.done) && !_error)
+            _error = std::make_error_code(std::errc::io_error);
+    }
+    else {
+        if (r.done)
+            *r.done += (size_t)result;
+
+        // Keep going with the rest of a partial transfer.
+        if ((size_t)result < r.length) {
+            r.offset += result;
+            r.buf += result;
+            r.length -= (size_t)result;
+            start(i);
+            return;
+        }
+    }
+
+    _free.push_back(i);
+}
+
+void AsyncIo::wait() {
+
+    while (_free.size() < _depth)
+        reap();
+
+    if (_error) {
+        const std::error_code error = _error;
+        _error.clear();
+        throw std::system_error(error, "asynchronous I/O failed");
+    }
+}
+
+#if defined(_WIN32)
+
+AsyncIo::AsyncIo(FILE* f, size_t queueDepth)
+    : _requests(new Request[queueDepth]), _depth(queueDepth),
+      _file(INVALID_HANDLE_VALUE), _port(NULL) {
+
+    if (!asyncIoEnabled()) {
+        throw std::system_error(
+                std::make_error_code(std::errc::operation_not_supported),
+                "asynchronous I/O is turned off");
+    }
+
+    HANDLE hFile = (HANDLE)_get_osfhandle(_fileno(f));
+    if (hFile == INVALID_HANDLE_VALUE) {
+        throw std::system_error(EBADF, std::system_category(),
+            "Failed to get file handle");
+    }
+
+    // The handle of the FILE isn't opened for overlapped I/O. Open another one
+    // to the same file that is. The FILE may have been opened read-only.
+    const DWORD share = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+
+    _file = ReOpenFile(hFile, GENERIC_READ | GENERIC_WRITE, share,
+            FILE_FLAG_OVERLAPPED);
+
+    if (_file == INVALID_HANDLE_VALUE)
+        _file = ReOpenFile(hFile, GENERIC_READ, share, FILE_FLAG_OVERLAPPED);
+
+    if (_file == INVALID_HANDLE_VALUE) {
+        throw std::system_error(GetLastError(), std::system_category(),
+            "Failed to reopen file for overlapped I/O");
+    }
+
+    _port = CreateIoCompletionPort(_file, NULL, 0, 1);
+    if (!_port) {
+        auto err = GetLastError();
+        CloseHandle(_file);
+        throw std::system_error(err, std::system_category(),
+            "Failed to create I/O completion port");
+    }
+
+    for (size_t i = queueDepth; i-- > 0; )
+        _free.push_back(i);
+}
+
+AsyncIo::~AsyncIo() {
+
+    // The buffers may not go away while the requests are still in flight.
+    try {
+        while (_free.size() < _depth)
+            reap();
+    }
+    catch (const std::system_error&) {
+        CancelIo(_file);
+    }
+
+    CloseHandle(_port);
+    CloseHandle(_file);
+}
+
+void AsyncIo::start(size_t i) {
+
+    Request& r = _requests[i];
+
+    memset(&r.overlapped, 0, sizeof(r.overlapped));
+    r.overlapped.Offset = (DWORD)r.offset;
+    r.overlapped.OffsetHigh = (DWORD)((uint64_t)r.offset >> 32);
+
+    const BOOL ok = r.write
+        ? WriteFile(_file, r.buf, (DWORD)r.length, NULL, &r.overlapped)
+        : ReadFile(_file, r.buf, (DWORD)r.length, NULL, &r.overlapped);
+
+    // Even if it finished right away, the completion is still posted to the
+    // port. If it failed, it isn't.
+    if (!ok) {
+        const DWORD err = GetLastError();
+        if (err == ERROR_HANDLE_EOF)
+            complete(i, 0, 0);
+        else if (err != ERROR_IO_PENDING)
+            complete(i, 0, (int)err);
+    }
+}
+
+void AsyncIo::reap() {
+
+    DWORD transferred = 0;
+    ULONG_PTR key = 0;
+    OVERLAPPED* overlapped = NULL;
+
+    const BOOL ok = GetQueuedCompletionStatus(_port, &transferred, &key,
+            &overlapped, INFINITE);
+
+    if (!overlapped) {
+        throw std::system_error(GetLastError(), std::system_category(),
+            "Failed to wait for I/O completion");
+    }
+
+    const size_t i = (Request*)overlapped - _requests.get();
+
+    DWORD err = ok ? 0 : GetLastError();
+    if (err == ERROR_HANDLE_EOF)
+        err = 0;
+
+    complete(i, transferred, (int)err);
+}
+
+#elif defined(__linux__)
+
+AsyncIo::AsyncIo(FILE* f, size_t queueDepth)
+    : _requests(new Request[queueDepth]), _depth(queueDepth),
+      _fd(fileno(f)), _ring(-1), _sqRing(NULL), _sqRingSize(0), _cqRing(NULL),
+      _cqRingSize(0), _sqes(NULL), _sqesSize(0), _unsubmitted(0) {
+
+    if (!asyncIoEnabled()) {
+        throw std::system_error(
+                std::make_error_code(std::errc::operation_not_supported),
+                "asynchronous I/O is turned off");
+    }
+
+    // This fails if the kernel is too old or io_uring has been disallowed
+    // (e.g., in containers).
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    _ring = (int)syscall(__NR_io_uring_setup, (unsigned)queueDepth, &params);
+    if (_ring < 0) {
+        throw std::system_error(errno, std::system_category(),
+                "failed to set up io_uring");
+    }
+
+    _sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    _cqRingSize = params.cq_off.cqes +
+        params.cq_entries * sizeof(struct io_uring_cqe);
+    _sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    // Newer kernels share one mapping between both rings.
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        _sqRingSize = _cqRingSize = std::max(_sqRingSize, _cqRingSize);
+
+    _sqRing = mmap(NULL, _sqRingSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQ_RING);
+
+    if (_sqRing != MAP_FAILED) {
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            _cqRing = _sqRing;
+        }
+        else {
+            _cqRing = mmap(NULL, _cqRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_CQ_RING);
+        }
+    }
+
+    if (_sqRing != MAP_FAILED && _cqRing != MAP_FAILED) {
+        _sqes = mmap(NULL, _sqesSize, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQES);
+    }
+
+    if (_sqRing == MAP_FAILED || _cqRing == MAP_FAILED || _sqes == MAP_FAILED) {
+        const int err = errno;
+        close();
+        throw std::system_error(err, std::system_category(),
+                "failed to map io_uring");
+    }
+
+    uint8_t* sq = (uint8_t*)_sqRing;
+    _sqTail = (uint32_t*)(sq + params.sq_off.tail);
+    _sqMask = *(uint32_t*)(sq + params.sq_off.ring_mask);
+    _sqArray = (uint32_t*)(sq + params.sq_off.array);
+
+    uint8_t* cq = (uint8_t*)_cqRing;
+    _cqHead = (uint32_t*)(cq + params.cq_off.head);
+    _cqTail = (uint32_t*)(cq + params.cq_off.tail);
+    _cqMask = *(uint32_t*)(cq + params.cq_off.ring_mask);
+    _cqes = cq + params.cq_off.cqes;
+
+    for (size_t i = queueDepth; i-- > 0; )
+        _free.push_back(i);
+}
+
+AsyncIo::~AsyncIo() {
+
+    // The buffers may not go away while the requests are still in flight.
+    try {
+        while (_free.size() < _depth)
+            reap();
+    }
+    catch (const std::system_error&) {
+    }
+
+    close();
+}
+
+void AsyncIo::close() {
+    if (_sqes && _sqes != MAP_FAILED)
+        munmap(_sqes, _sqesSize);
+
+    if (_cqRing && _cqRing != MAP_FAILED && _cqRing != _sqRing)
+        munmap(_cqRing, _cqRingSize);
+
+    if (_sqRing && _sqRing != MAP_FAILED)
+        munmap(_sqRing, _sqRingSize);
+
+    if (_ring >= 0)
+        ::close(_ring);
+}
+
+void AsyncIo::start(size_t i) {
+
+    Request& r = _requests[i];
+
+    r.iov.iov_base = r.buf;
+    r.iov.iov_len = r.length;
+
+    // Nobody else adds to the submission queue. Since no more than the queue
+    // depth is ever in flight, there is always room.
+    const uint32_t tail = *_sqTail;
+    const uint32_t index = tail & _sqMask;
+
+    struct io_uring_sqe& sqe = ((struct io_uring_sqe*)_sqes)[index];
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = r.write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe.fd = _fd;
+    sqe.off = (uint64_t)r.offset;
+    sqe.addr = (uint64_t)(uintptr_t)&r.iov;
+    sqe.len = 1;
+    sqe.user_data = i;
+
+    _sqArray[index] = index;
+
+    __atomic_store_n(_sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    ++_unsubmitted;
+}
+
+void AsyncIo::submit(uint32_t minComplete) {
+
+    const unsigned flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+    while (_unsubmitted > 0 || minComplete > 0) {
+        const int n = (int)syscall(__NR_io_uring_enter, _ring, _unsubmitted,
+                minComplete, flags, NULL, 0);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+
+            throw std::system_error(errno, std::system_category(),
+                    "failed to submit I/O");
+        }
+
+        _unsubmitted -= std::min((uint32_t)n, _unsubmitted);
+
+        // Waiting was done along with the submission.
+        minComplete = 0;
+    }
+}
+
+void AsyncIo::reap() {
+
+    submit(1);
+
+    uint32_t head = *_cqHead;
+    const uint32_t tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; ++head) {
+        const struct io_uring_cqe& cqe =
+            ((const struct io_uring_cqe*)_cqes)[head & _cqMask];
+
+        const size_t i = (size_t)cqe.user_data;
+        const int result = cqe.res;
+
+        // Hand the entry back before anything is restarted.
+        __atomic_store_n(_cqHead, head + 1, __ATOMIC_RELEASE);
+
+        if (result < 0)
+            complete(i, 0, -result);
+        else
+            complete(i, result, 0);
+    }
+}
+
+#else
+
+AsyncIo::AsyncIo(FILE* f, size_t queueDepth)
+    : _requests(new Request[queueDepth]), _depth(queueDepth) {
+    (void)f;
+
+    throw std::system_error(
+            std::make_error_code(std::errc::operation_not_supported),
+            "asynchronous I/O isn't supported on this platform");
+}
+
+AsyncIo::~AsyncIo() {
+}
+
+void AsyncIo::start(size_t i) {
+    (void)i;
+}
+
+void AsyncIo::reap() {
+}
+
+#endif
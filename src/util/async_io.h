@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Keeps many reads and writes of a file in flight at once.
+ *
+ * Reading and writing a file one piece at a time through stdio leaves either
+ * the disk or the CPU idle at any given moment. On fast drives and network
+ * shares, a queue depth of one also uses only a fraction of the available
+ * bandwidth. Here, requests are queued up with the operating system (io_uring
+ * on Linux, I/O completion ports on Windows) and only waited for when the
+ * results are needed.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h> // For size_t
+#include <stdio.h>  // For FILE*
+#include <memory>
+#include <system_error>
+#include <vector>
+
+#ifdef _WIN32
+typedef void* HANDLE;
+#endif
+
+/**
+ * Turns off asynchronous I/O for the rest of the process. Every AsyncIo
+ * constructed afterwards fails such that the blocking fallback is used.
+ */
+void disableAsyncIo();
+
+/**
+ * Returns true if asynchronous I/O hasn't been turned off.
+ */
+bool asyncIoEnabled();
+
+/**
+ * Queue of requests to read and write one file. Requests may complete in any
+ * order. Nothing may be assumed about a buffer or the range of the file it
+ * refers to until wait() has returned.
+ *
+ * This is not thread-safe. Since each request has its own offset, the position
+ * of the FILE is neither used nor changed.
+ */
+class AsyncIo
+{
+private:
+
+    // A request that is in flight. Large requests are split up so that they
+    // proceed in parallel and so that each fits in 32 bits. This is defined
+    // with the platform specific parts in the implementation.
+    struct Request;
+
+    std::unique_ptr<Request[]> _requests;
+    size_t _depth;
+
+    // Indices of requests that aren't in flight.
+    std::vector<size_t> _free;
+
+    // The first error that occurred, if any.
+    std::error_code _error;
+
+#if defined(_WIN32)
+    HANDLE _file;
+    HANDLE _port;
+#elif defined(__linux__)
+    int _fd;
+    int _ring;
+
+    // The rings shared with the kernel.
+    void* _sqRing;
+    size_t _sqRingSize;
+    void* _cqRing;
+    size_t _cqRingSize;
+    void* _sqes;
+    size_t _sqesSize;
+
+    uint32_t* _sqTail;
+    uint32_t _sqMask;
+    uint32_t* _sqArray;
+    uint32_t* _cqHead;
+    uint32_t* _cqTail;
+    uint32_t _cqMask;
+    void* _cqes;
+
+    // Number of requests that were queued up but not passed to the kernel yet.
+    uint32_t _unsubmitted;
+
+    void submit(uint32_t minComplete);
+    void close();
+#endif
+
+    void queue(bool write, int64_t offset, void* buf, size_t length,
+            size_t* done);
+    void start(size_t i);
+    void complete(size_t i, int64_t result, int error);
+    void reap();
+
+public:
+
+    /**
+     * Default number of requests that are in flight at once.
+     */
+    static const size_t kDefaultQueueDepth = 32;
+
+    /**
+     * Requests larger than this are split up.
+     */
+    static const size_t kMaxRequestSize = 1024 * 1024;
+
+    /**
+     * Params:
+     *   f          = The file to read from or write to. It must stay open for
+     *                the lifetime of this object.
+     *   queueDepth = Maximum number of requests in flight.
+     *
+     * Throws: std::system_error if asynchronous I/O isn't available for this
+     * file. The caller should then fall back to blocking I/O.
+     */
+    AsyncIo(FILE* f, size_t queueDepth = kDefaultQueueDepth);
+
+    /**
+     * Waits for the remaining requests. Errors are ignored. Call wait() first
+     * to find out about them.
+     */
+    ~AsyncIo();
+
+    AsyncIo(const AsyncIo&) = delete;
+    AsyncIo& operator=(const AsyncIo&) = delete;
+
+    /**
+     * Starts reading `length` bytes at `offset` into `buf`. If `done` is given,
+     * the number of bytes read is added to it, which is less than `length` if
+     * the end of the file is reached. Otherwise, reaching the end of the file
+     * is an error.
+     *
+     * If the queue is full, this blocks until a request has completed.
+     */
+    void read(int64_t offset, void* buf, size_t length, size_t* done = NULL);
+
+    /**
+     * Starts writing `length` bytes from `buf` at `offset`.
+     *
+     * If the queue is full, this blocks until a request has completed.
+     */
+    void write(int64_t offset, const void* buf, size_t length);
+
+    /**
+     * Waits for all requests to complete.
+     *
+     * Throws: std::system_error if any of them failed.
+     */
+    void wait();
+};
@@ -26,16 +26,34 @@
 #include <codecvt>
 #include <string>
 #include <sstream>
+#include <system_error>
+#include <vector>
+#include <algorithm>
 
 #ifdef _WIN32
 #   include <Windows.h>
+#   include <io.h>
+#else
+#   include <sys/types.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#   include <errno.h>
+#endif
+
+#ifdef __linux__
+#   include <fcntl.h>
+#   include <sys/sendfile.h>
+#   include <sys/ioctl.h>
+#   include <linux/fs.h>
 #endif
 
 template<> const FileMode<char> FileMode<char>::readExisting("rb");
 template<> const FileMode<char> FileMode<char>::writeEmpty("wb");
+template<> const FileMode<char> FileMode<char>::readWriteEmpty("w+b");
 
 template<> const FileMode<wchar_t> FileMode<wchar_t>::readExisting(L"rb");
 template<> const FileMode<wchar_t> FileMode<wchar_t>::writeEmpty(L"wb");
+template<> const FileMode<wchar_t> FileMode<wchar_t>::readWriteEmpty(L"w+b");
 
 /**
  * Deletion object to be used with shared_ptr.
@@ -47,6 +65,29 @@ public:
     }
 };
 
+namespace {
+
+/**
+ * 64-bit versions of ftell() and fseek().
+ */
+int64_t tell64(FILE* f) {
+#ifdef _WIN32
+    return _ftelli64(f);
+#else
+    return ftello(f);
+#endif
+}
+
+int seek64(FILE* f, int64_t offset, int origin) {
+#ifdef _WIN32
+    return _fseeki64(f, offset, origin);
+#else
+    return fseeko(f, (off_t)offset, origin);
+#endif
+}
+
+}
+
 #ifdef _WIN32
 
 FileRef openFile(const char* path, FileMode<char> mode) {
@@ -136,6 +177,103 @@ void deleteFile(const wchar_t* path) {
     }
 }
 
+void copyFile(const char* src, const char* dest) {
+    // Newer versions of Windows clone blocks on file systems that support it.
+    if (!CopyFileA(src, dest, FALSE)) {
+        throw std::system_error(GetLastError(), std::system_category(),
+            "failed to copy file");
+    }
+}
+
+void copyFile(const wchar_t* src, const wchar_t* dest) {
+    if (!CopyFileW(src, dest, FALSE)) {
+        throw std::system_error(GetLastError(), std::system_category(),
+            "failed to copy file");
+    }
+}
+
+std::string absolutePath(const char* path) {
+    const DWORD length = GetFullPathNameA(path, 0, NULL, NULL);
+    if (length == 0) {
+        throw std::system_error(GetLastError(), std::system_category(),
+            "failed to get absolute path");
+    }
+
+    std::vector<char> buf(length);
+    GetFullPathNameA(path, length, buf.data(), NULL);
+    return std::string(buf.data());
+}
+
+std::wstring absolutePath(const wchar_t* path) {
+    const DWORD length = GetFullPathNameW(path, 0, NULL, NULL);
+    if (length == 0) {
+        throw std::system_error(GetLastError(), std::system_category(),
+            "failed to get absolute path");
+    }
+
+    std::vector<wchar_t> buf(length);
+    GetFullPathNameW(path, length, buf.data(), NULL);
+    return std::wstring(buf.data());
+}
+
+void copyFileRange(FileRef src, int64_t offset, FileRef dest, size_t length) {
+
+    // Views into the source file are mapped a chunk at a time so that we don't
+    // exhaust the address space of 32-bit processes on very large files.
+    static const size_t kViewChunkSize = 64 * 1024 * 1024;
+
+    HANDLE hFile = (HANDLE)_get_osfhandle(_fileno(src.get()));
+    if (hFile == INVALID_HANDLE_VALUE) {
+        throw std::system_error(EBADF, std::system_category(),
+                "failed to get source file handle");
+    }
+
+    HANDLE fileMap = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!fileMap) {
+        throw std::system_error(GetLastError(), std::system_category(),
+                "failed to create file map");
+    }
+
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    const int64_t granularity = info.dwAllocationGranularity;
+
+    while (length > 0) {
+        // View offsets must be a multiple of the allocation granularity.
+        const int64_t base = offset - offset % granularity;
+        const size_t delta = (size_t)(offset - base);
+        const size_t chunk = (std::min)(length, kViewChunkSize);
+
+        ULARGE_INTEGER viewOffset;
+        viewOffset.QuadPart = (ULONGLONG)base;
+
+        void* view = MapViewOfFile(fileMap, FILE_MAP_READ, viewOffset.HighPart,
+                viewOffset.LowPart, delta + chunk);
+        if (!view) {
+            auto err = GetLastError();
+            CloseHandle(fileMap);
+            throw std::system_error(err, std::system_category(),
+                    "failed to map view of file");
+        }
+
+        const size_t written = fwrite((const uint8_t*)view + delta, 1, chunk,
+                dest.get());
+
+        UnmapViewOfFile(view);
+
+        if (written != chunk) {
+            CloseHandle(fileMap);
+            throw std::system_error(errno, std::system_category(),
+                    "failed to copy file range");
+        }
+
+        offset += chunk;
+        length -= chunk;
+    }
+
+    CloseHandle(fileMap);
+}
+
 #else // !_WIN32
 
 FileRef openFile(const char* path, FileMode<char> mode) {
@@ -181,4 +319,279 @@ void deleteFile(const char* path) {
     }
 }
 
+std::string absolutePath(const char* path) {
+    if (path[0] == '/')
+        return path;
+
+    std::vector<char> buf(256);
+    while (!getcwd(buf.data(), buf.size())) {
+        if (errno != ERANGE) {
+            throw std::system_error(errno, std::system_category(),
+                "failed to get current directory");
+        }
+
+        buf.resize(buf.size() * 2);
+    }
+
+    return std::string(buf.data()) + "/" + path;
+}
+
+namespace {
+
+/**
+ * Copies a range of bytes in the kernel, if possible. The offsets and length
+ * are updated to reflect the progress made. Returns false if the kernel can't
+ * do the copy for us and the caller must fall back to copying through a
+ * buffer.
+ */
+bool kernelCopy(int in, int64_t& inOffset, int out, int64_t& outOffset,
+        size_t& length) {
+
+#if defined(__linux__)
+
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+    while (length > 0) {
+        loff_t offIn = inOffset, offOut = outOffset;
+
+        const ssize_t n = copy_file_range(in, &offIn, out, &offOut, length, 0);
+        if (n > 0) {
+            inOffset += n;
+            outOffset += n;
+            length -= (size_t)n;
+            continue;
+        }
+
+        if (n == 0) {
+            throw std::system_error(EIO, std::system_category(),
+                    "unexpected end of file while copying file range");
+        }
+
+        if (errno == EINTR)
+            continue;
+
+        // Not supported for this pair of files (e.g., they are on different
+        // file systems on older kernels). Try sendfile() instead.
+        if (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+            errno == EOPNOTSUPP)
+            break;
+
+        throw std::system_error(errno, std::system_category(),
+                "failed to copy file range");
+    }
+#endif
+
+    if (length > 0 && lseek(out, (off_t)outOffset, SEEK_SET) == -1) {
+        throw std::system_error(errno, std::system_category(),
+                "failed to seek in destination file");
+    }
+
+    while (length > 0) {
+        off_t offIn = (off_t)inOffset;
+
+        const ssize_t n = sendfile(out, in, &offIn, length);
+        if (n > 0) {
+            inOffset += n;
+            outOffset += n;
+            length -= (size_t)n;
+            continue;
+        }
+
+        if (n == 0) {
+            throw std::system_error(EIO, std::system_category(),
+                    "unexpected end of file while copying file range");
+        }
+
+        if (errno == EINTR)
+            continue;
+
+        if (errno == ENOSYS || errno == EINVAL)
+            return false;
+
+        throw std::system_error(errno, std::system_category(),
+                "failed to copy file range");
+    }
+
+    return true;
+
+#else
+    (void)in;
+    (void)inOffset;
+    (void)out;
+    (void)outOffset;
+    (void)length;
+    return false;
+#endif
+}
+
+}
+
+void copyFileRange(FileRef src, int64_t offset, FileRef dest, size_t length) {
+
+    FILE* out = dest.get();
+
+    // Anything still buffered must hit the file before we write around stdio.
+    if (fflush(out) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                "failed to flush destination file");
+    }
+
+    int64_t outOffset = ftello(out);
+    if (outOffset == -1) {
+        throw std::system_error(errno, std::system_category(),
+                "ftello() failed");
+    }
+
+    const int in = fileno(src.get());
+
+    if (!kernelCopy(in, offset, fileno(out), outOffset, length)) {
+        // Fall back to copying through a buffer.
+        std::vector<uint8_t> buf(std::min(length, (size_t)1024 * 1024));
+
+        if (fseeko(out, (off_t)outOffset, SEEK_SET) != 0) {
+            throw std::system_error(errno, std::system_category(),
+                    "fseeko() failed");
+        }
+
+        while (length > 0) {
+            const ssize_t n = pread(in, buf.data(),
+                    std::min(length, buf.size()), (off_t)offset);
+
+            if (n < 0 && errno == EINTR)
+                continue;
+
+            if (n <= 0) {
+                throw std::system_error(n == 0 ? EIO : errno,
+                        std::system_category(), "failed to read file range");
+            }
+
+            if (fwrite(buf.data(), 1, (size_t)n, out) != (size_t)n) {
+                throw std::system_error(errno, std::system_category(),
+                        "failed to write file range");
+            }
+
+            offset += n;
+            outOffset += n;
+            length -= (size_t)n;
+        }
+    }
+
+    // Put the stdio position just past what we copied.
+    if (fseeko(out, (off_t)outOffset, SEEK_SET) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                "fseeko() failed");
+    }
+}
+
+void copyFile(const char* src, const char* dest) {
+    auto in = openFile(src, FileMode<char>::readExisting);
+    auto out = openFile(dest, FileMode<char>::writeEmpty);
+
+#ifdef FICLONE
+    if (ioctl(fileno(out.get()), FICLONE, fileno(in.get())) == 0)
+        return;
+#endif
+
+    struct stat st;
+    if (fstat(fileno(in.get()), &st) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                "failed to get file length");
+    }
+
+    copyFileRange(in, 0, out, (size_t)st.st_size);
+
+    if (fflush(out.get()) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                "failed to copy file");
+    }
+}
+
 #endif // _WIN32
+
+void seekFile(FILE* f, int64_t offset) {
+    if (seek64(f, offset, SEEK_SET) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                "failed to seek in file");
+    }
+}
+
+int64_t tellFile(FILE* f) {
+    const int64_t pos = tell64(f);
+    if (pos == -1) {
+        throw std::system_error(errno, std::system_category(),
+                "failed to get file position");
+    }
+
+    return pos;
+}
+
+int64_t getFileSize(FILE* f) {
+
+    const int64_t pos = tellFile(f);
+
+    if (seek64(f, 0, SEEK_END) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                "failed to seek to end of file");
+    }
+
+    const int64_t size = tell64(f);
+    if (size == -1) {
+        throw std::system_error(errno, std::system_category(),
+                "failed to get file size");
+    }
+
+    seekFile(f, pos);
+
+    return size;
+}
+
+void preallocateFile(FILE* f, int64_t size) {
+
+    // Nothing buffered may be written past the new end afterwards.
+    if (fflush(f) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                "failed to flush file");
+    }
+
+#ifdef _WIN32
+    HANDLE h = (HANDLE)_get_osfhandle(_fileno(f));
+    if (h == INVALID_HANDLE_VALUE) {
+        throw std::system_error(EBADF, std::system_category(),
+                "failed to get file handle");
+    }
+
+    // Reserving the space is only an optimization. Not all file systems
+    // support it.
+    FILE_ALLOCATION_INFO alloc;
+    alloc.AllocationSize.QuadPart = size;
+    SetFileInformationByHandle(h, FileAllocationInfo, &alloc, sizeof(alloc));
+
+    FILE_END_OF_FILE_INFO eof;
+    eof.EndOfFile.QuadPart = size;
+    if (!SetFileInformationByHandle(h, FileEndOfFileInfo, &eof, sizeof(eof))) {
+        throw std::system_error(GetLastError(), std::system_category(),
+                "failed to set file size");
+    }
+#else
+    const int fd = fileno(f);
+
+#ifdef __linux__
+    // Reserving the space is only an optimization. Not all file systems
+    // support it. If there isn't enough space, though, better to find out now
+    // than when the pages are written.
+    int result;
+    while ((result = fallocate(fd, 0, 0, (off_t)size)) != 0 && errno == EINTR)
+        ;
+
+    if (result != 0 && errno == ENOSPC) {
+        throw std::system_error(errno, std::system_category(),
+                "failed to allocate file");
+    }
+#endif
+
+    if (ftruncate(fd, (off_t)size) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                "failed to set file size");
+    }
+#endif
+}
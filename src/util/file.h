@@ -23,6 +23,8 @@
 
 #include <cstdio>
 #include <memory>
+#include <string>
+#include <stdint.h>
 
 /**
  * Abstracts file mode so we can use them generically with other templates.
@@ -35,6 +37,10 @@ struct FileMode {
 
     static const FileMode<CharT> readExisting;
     static const FileMode<CharT> writeEmpty;
+
+    // Like writeEmpty, but the file can also be read from. This is needed to
+    // map the file into memory.
+    static const FileMode<CharT> readWriteEmpty;
 };
 
 typedef std::shared_ptr<FILE> FileRef;
@@ -58,6 +64,65 @@ void renameFile(const char* src, const char* dest);
  */
 void deleteFile(const char* path);
 
+/*
+ * Seeks to an absolute offset in a file. Unlike fseek(), this works with
+ * offsets beyond 2 GB on all platforms.
+ *
+ * Throws std::system_error if it failed.
+ */
+void seekFile(FILE* f, int64_t offset);
+
+/*
+ * Returns the current position in a file. Unlike ftell(), this works with
+ * offsets beyond 2 GB on all platforms.
+ *
+ * Throws std::system_error if it failed.
+ */
+int64_t tellFile(FILE* f);
+
+/*
+ * Sets the size of a file to `size` bytes, reserving disk space for all of it
+ * up front where the file system supports it. This avoids extending the file
+ * piece by piece as it is written. Any new bytes read as zeros.
+ *
+ * Throws std::system_error if it failed.
+ */
+void preallocateFile(FILE* f, int64_t size);
+
+/*
+ * Returns the size of a file. The position in the file is left unchanged.
+ *
+ * Throws std::system_error if it failed.
+ */
+int64_t getFileSize(FILE* f);
+
+/*
+ * Copies a range of bytes at the given offset in one file to the current
+ * position of another file. Where the platform supports it, the data is copied
+ * without passing through user-space buffers. Afterwards, the position of the
+ * destination file is just past the copied data.
+ *
+ * Throws std::system_error if it failed.
+ */
+void copyFileRange(FileRef src, int64_t offset, FileRef dest, size_t length);
+
+/*
+ * Copies a file, replacing the destination if it exists. Where the file system
+ * supports it, the copy shares its data with the original (a "reflink") until
+ * either is modified.
+ *
+ * Throws std::system_error if it failed.
+ */
+void copyFile(const char* src, const char* dest);
+
+/*
+ * Returns the absolute path of the given path relative to the current working
+ * directory.
+ *
+ * Throws std::system_error if it failed.
+ */
+std::string absolutePath(const char* path);
+
 #ifdef _WIN32
 
 FileRef openFile(const wchar_t* path, FileMode<wchar_t> mode);
@@ -65,4 +130,8 @@ FileRef openFile(const wchar_t* path, FileMode<wchar_t> mode);
 void renameFile(const wchar_t* src, const wchar_t* dest);
 void deleteFile(const wchar_t* path);
 
+void copyFile(const wchar_t* src, const wchar_t* dest);
+
+std::wstring absolutePath(const wchar_t* path);
+
 #endif // _WIN32
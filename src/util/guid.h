@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Searching for GUIDs in strings.
+ *
+ * File names in PDBs can contain GUIDs of the form
+ * "{xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx}" where each 'x' is a hexadecimal
+ * digit. Since there can be millions of such strings, this is a hand-written
+ * matcher instead of a regular expression.
+ */
+
+#pragma once
+
+#include <stddef.h> // For size_t, ptrdiff_t
+#include <cstring>
+#include <cwchar>
+
+/**
+ * Length of a GUID string, including the braces.
+ */
+const size_t kGuidLength = 38;
+
+namespace detail {
+
+/**
+ * Finds the first occurrence of a character. These use memchr/wmemchr which
+ * are vectorized by the C runtime.
+ */
+inline const char* findChar(const char* first, const char* last, char c) {
+    return (const char*)memchr(first, c, last - first);
+}
+
+inline const wchar_t* findChar(const wchar_t* first, const wchar_t* last,
+        wchar_t c) {
+    return wmemchr(first, c, last - first);
+}
+
+template<typename CharT>
+inline bool isHexDigit(CharT c) {
+    return (c >= '0' && c <= '9') ||
+           (c >= 'a' && c <= 'f') ||
+           (c >= 'A' && c <= 'F');
+}
+
+}
+
+/**
+ * Returns true if a GUID starts at the given string. There must be at least
+ * kGuidLength characters in the string.
+ */
+template<typename CharT>
+bool isGuid(const CharT* s) {
+
+    // Positions of the dashes within the GUID.
+    static const size_t dashes[] = {9, 14, 19, 24};
+
+    if (s[0] != '{' || s[kGuidLength - 1] != '}')
+        return false;
+
+    size_t d = 0;
+
+    for (size_t i = 1; i < kGuidLength - 1; ++i) {
+        if (d < 4 && i == dashes[d]) {
+            if (s[i] != '-')
+                return false;
+            ++d;
+        }
+        else if (!detail::isHexDigit(s[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Finds the first GUID in the range [first, last). Returns NULL if there is
+ * none.
+ *
+ * This gives the same result as a search for the regular expression
+ * "\{[0-9a-fA-F]{8}-[0-9a-fA-F]{4}-[0-9a-fA-F]{4}-[0-9a-fA-F]{4}-[0-9a-fA-F]{12}\}".
+ * The pattern has a fixed length and no alternatives, so the leftmost match is
+ * simply the first position where all kGuidLength characters match. Every
+ * match starts with '{', so only those positions need to be checked.
+ */
+template<typename CharT>
+const CharT* findGuid(const CharT* first, const CharT* last) {
+
+    while (last - first >= (ptrdiff_t)kGuidLength) {
+        first = detail::findChar(first, last - (kGuidLength - 1), (CharT)'{');
+        if (!first)
+            return NULL;
+
+        if (isGuid(first))
+            return first;
+
+        ++first;
+    }
+
+    return NULL;
+}
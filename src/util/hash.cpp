@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "util/hash.h"
+
+#include "util/md5.h"
+#include "util/xxh3.h"
+
+namespace {
+
+class Md5Hasher : public Hasher {
+private:
+    md5_context _ctx;
+
+public:
+    Md5Hasher() {
+        md5_starts(&_ctx);
+    }
+
+    void update(const void* data, size_t length) {
+        md5_update(&_ctx, (const unsigned char*)data, length);
+    }
+
+    void finish(uint8_t output[16]) {
+        md5_finish(&_ctx, output);
+    }
+};
+
+class Xxh3Hasher : public Hasher {
+private:
+    Xxh3_128 _state;
+
+public:
+    void update(const void* data, size_t length) {
+        _state.update(data, length);
+    }
+
+    void finish(uint8_t output[16]) {
+        _state.digest(output);
+    }
+};
+
+}
+
+HasherRef makeHasher(HashAlgorithm algorithm) {
+    switch (algorithm) {
+        case HashAlgorithm::xxh3:
+            return HasherRef(new Xxh3Hasher());
+        case HashAlgorithm::md5:
+        default:
+            return HasherRef(new Md5Hasher());
+    }
+}
+
+const char* hashAlgorithmName(HashAlgorithm algorithm) {
+    switch (algorithm) {
+        case HashAlgorithm::xxh3:
+            return "xxh3";
+        case HashAlgorithm::md5:
+        default:
+            return "md5";
+    }
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * A common interface for the 128-bit hash functions that can be used to
+ * calculate the image and PDB signatures.
+ */
+
+#pragma once
+
+#include <stdlib.h> // For size_t
+#include <stdint.h>
+
+#include <memory>
+
+enum class HashAlgorithm {
+    // The default. Gives the same signatures as previous versions.
+    md5,
+
+    // Much faster, but not cryptographic. Only a change to the input needs to
+    // produce a different signature, so this is good enough.
+    xxh3,
+};
+
+/**
+ * Incrementally computes a 128-bit hash.
+ */
+class Hasher {
+public:
+    virtual ~Hasher() {}
+
+    /**
+     * Hashes another chunk of data.
+     */
+    virtual void update(const void* data, size_t length) = 0;
+
+    /**
+     * Writes out the final hash. No more data can be added after this.
+     */
+    virtual void finish(uint8_t output[16]) = 0;
+};
+
+typedef std::unique_ptr<Hasher> HasherRef;
+
+/**
+ * Creates a new hasher for the given algorithm.
+ */
+HasherRef makeHasher(HashAlgorithm algorithm);
+
+/**
+ * Returns the name of the hash algorithm as it is given on the command line.
+ */
+const char* hashAlgorithmName(HashAlgorithm algorithm);
+
+/**
+ * Finds the hash algorithm with the given name. Returns false if there is no
+ * such algorithm.
+ */
+template<typename CharT>
+bool parseHashAlgorithm(const CharT* name, HashAlgorithm& algorithm) {
+
+    const HashAlgorithm algorithms[] = {
+        HashAlgorithm::md5,
+        HashAlgorithm::xxh3,
+    };
+
+    for (auto&& a: algorithms) {
+        const char* expected = hashAlgorithmName(a);
+
+        size_t i = 0;
+        while (expected[i] != '\0' && (CharT)expected[i] == name[i])
+            ++i;
+
+        if (expected[i] == '\0' && name[i] == 0) {
+            algorithm = a;
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "util/local_socket.h"
+
+#include <system_error>
+
+#if defined(_WIN32)
+
+#include <windows.h>
+#include <codecvt>
+#include <locale>
+
+namespace {
+
+const DWORD kPipeBufferSize = 64 * 1024;
+
+std::wstring widen(const char* s) {
+    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+    return converter.from_bytes(s);
+}
+
+}
+
+LocalSocket::LocalSocket(HANDLE handle, bool server)
+    : _handle(handle), _server(server) {
+}
+
+LocalSocket::~LocalSocket() {
+    if (_server) {
+        // Make sure the client gets everything before disconnecting.
+        FlushFileBuffers(_handle);
+        DisconnectNamedPipe(_handle);
+    }
+
+    CloseHandle(_handle);
+}
+
+LocalSocketRef LocalSocket::connect(const char* address) {
+    return connect(widen(address).c_str());
+}
+
+LocalSocketRef LocalSocket::connect(const wchar_t* address) {
+
+    while (true) {
+        HANDLE h = CreateFileW(address, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                OPEN_EXISTING, 0, NULL);
+
+        if (h != INVALID_HANDLE_VALUE)
+            return LocalSocketRef(new LocalSocket(h, false));
+
+        // All instances of the pipe are busy. Wait for one to come free.
+        const DWORD err = GetLastError();
+        if (err != ERROR_PIPE_BUSY || !WaitNamedPipeW(address, 5000)) {
+            throw std::system_error(err, std::system_category(),
+                    "Failed to connect to server");
+        }
+    }
+}
+
+size_t LocalSocket::read(void* buf, size_t length) {
+    DWORD bytesRead = 0;
+
+    if (!ReadFile(_handle, buf, (DWORD)length, &bytesRead, NULL)) {
+        const DWORD err = GetLastError();
+        if (err == ERROR_BROKEN_PIPE || err == ERROR_PIPE_NOT_CONNECTED)
+            return 0;
+
+        throw std::system_error(err, std::system_category(),
+                "Failed to read from pipe");
+    }
+
+    return bytesRead;
+}
+
+void LocalSocket::write(const void* buf, size_t length) {
+    const char* p = (const char*)buf;
+
+    while (length > 0) {
+        DWORD written = 0;
+
+        if (!WriteFile(_handle, p, (DWORD)length, &written, NULL)) {
+            throw std::system_error(GetLastError(), std::system_category(),
+                    "Failed to write to pipe");
+        }
+
+        p += written;
+        length -= written;
+    }
+}
+
+LocalServer::LocalServer(const char* address) : _address(widen(address)) {
+}
+
+LocalServer::LocalServer(const wchar_t* address) : _address(address) {
+}
+
+LocalServer::~LocalServer() {
+}
+
+LocalSocketRef LocalServer::accept() {
+
+    HANDLE h = CreateNamedPipeW(
+            _address.c_str(),
+            PIPE_ACCESS_DUPLEX,
+            PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT |
+                PIPE_REJECT_REMOTE_CLIENTS,
+            PIPE_UNLIMITED_INSTANCES,
+            kPipeBufferSize,
+            kPipeBufferSize,
+            0,
+            NULL
+            );
+
+    if (h == INVALID_HANDLE_VALUE) {
+        throw std::system_error(GetLastError(), std::system_category(),
+                "Failed to create named pipe");
+    }
+
+    // If the client connected between creating the pipe and calling
+    // ConnectNamedPipe(), it fails with ERROR_PIPE_CONNECTED.
+    if (!ConnectNamedPipe(h, NULL) && GetLastError() != ERROR_PIPE_CONNECTED) {
+        const DWORD err = GetLastError();
+        CloseHandle(h);
+        throw std::system_error(err, std::system_category(),
+                "Failed to connect named pipe");
+    }
+
+    return LocalSocketRef(new LocalSocket(h, true));
+}
+
+#else
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+namespace {
+
+sockaddr_un socketAddress(const char* path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        throw std::system_error(ENAMETOOLONG, std::system_category(),
+                "Socket path is too long");
+    }
+
+    strcpy(addr.sun_path, path);
+    return addr;
+}
+
+}
+
+LocalSocket::LocalSocket(int fd) : _fd(fd) {
+}
+
+LocalSocket::~LocalSocket() {
+    close(_fd);
+}
+
+LocalSocketRef LocalSocket::connect(const char* address) {
+    const sockaddr_un addr = socketAddress(address);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        throw std::system_error(errno, std::system_category(),
+                "Failed to create socket");
+    }
+
+    if (::connect(fd, (const sockaddr*)&addr, sizeof(addr)) == -1) {
+        auto err = errno;
+        close(fd);
+        throw std::system_error(err, std::system_category(),
+                "Failed to connect to server");
+    }
+
+    return LocalSocketRef(new LocalSocket(fd));
+}
+
+size_t LocalSocket::read(void* buf, size_t length) {
+    while (true) {
+        const ssize_t n = ::recv(_fd, buf, length, 0);
+        if (n >= 0)
+            return (size_t)n;
+
+        if (errno != EINTR) {
+            throw std::system_error(errno, std::system_category(),
+                    "Failed to read from socket");
+        }
+    }
+}
+
+void LocalSocket::write(const void* buf, size_t length) {
+    const char* p = (const char*)buf;
+
+    while (length > 0) {
+#ifdef MSG_NOSIGNAL
+        // Don't get killed by SIGPIPE if the other end went away.
+        const ssize_t n = ::send(_fd, p, length, MSG_NOSIGNAL);
+#else
+        const ssize_t n = ::send(_fd, p, length, 0);
+#endif
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+
+            throw std::system_error(errno, std::system_category(),
+                    "Failed to write to socket");
+        }
+
+        p += n;
+        length -= (size_t)n;
+    }
+}
+
+LocalServer::LocalServer(const char* address) : _fd(-1), _path(address) {
+    const sockaddr_un addr = socketAddress(address);
+
+    _fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (_fd == -1) {
+        throw std::system_error(errno, std::system_category(),
+                "Failed to create socket");
+    }
+
+    // Remove the socket of a server that was not shut down cleanly. Other
+    // kinds of files are left alone so that bind() fails instead.
+    struct stat st;
+    if (lstat(address, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(address);
+
+    if (bind(_fd, (const sockaddr*)&addr, sizeof(addr)) == -1 ||
+        listen(_fd, SOMAXCONN) == -1) {
+        auto err = errno;
+        close(_fd);
+        throw std::system_error(err, std::system_category(),
+                "Failed to listen on socket");
+    }
+}
+
+LocalServer::~LocalServer() {
+    close(_fd);
+    unlink(_path.c_str());
+}
+
+LocalSocketRef LocalServer::accept() {
+    while (true) {
+        const int fd = ::accept(_fd, NULL, NULL);
+        if (fd != -1)
+            return LocalSocketRef(new LocalSocket(fd));
+
+        if (errno != EINTR) {
+            throw std::system_error(errno, std::system_category(),
+                    "Failed to accept connection");
+        }
+    }
+}
+
+#endif
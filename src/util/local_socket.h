@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Cross-platform local (same machine) sockets. These are Unix domain sockets
+ * on POSIX systems and named pipes on Windows. On Windows, addresses should be
+ * of the form "\\.\pipe\name". Elsewhere, addresses are file system paths.
+ */
+
+#pragma once
+
+#include <stdlib.h> // For size_t
+#include <memory>
+#include <string>
+
+#ifdef _WIN32
+typedef void* HANDLE;
+#endif
+
+class LocalSocket;
+
+typedef std::shared_ptr<LocalSocket> LocalSocketRef;
+
+/**
+ * A connected local socket.
+ */
+class LocalSocket
+{
+private:
+#ifdef _WIN32
+    HANDLE _handle;
+    bool _server;
+#else
+    int _fd;
+#endif
+
+public:
+#ifdef _WIN32
+    LocalSocket(HANDLE handle, bool server);
+#else
+    explicit LocalSocket(int fd);
+#endif
+
+    ~LocalSocket();
+
+    LocalSocket(const LocalSocket&) = delete;
+    LocalSocket& operator=(const LocalSocket&) = delete;
+
+    /**
+     * Connects to the server listening on the given address.
+     *
+     * Throws std::system_error if it failed.
+     */
+    static LocalSocketRef connect(const char* address);
+
+#ifdef _WIN32
+    static LocalSocketRef connect(const wchar_t* address);
+#endif
+
+    /**
+     * Reads up to `length` bytes. Returns 0 if the other end closed the
+     * connection.
+     *
+     * Throws std::system_error if it failed.
+     */
+    size_t read(void* buf, size_t length);
+
+    /**
+     * Writes all of the given bytes.
+     *
+     * Throws std::system_error if it failed.
+     */
+    void write(const void* buf, size_t length);
+};
+
+/**
+ * Listens for connections on a local socket.
+ */
+class LocalServer
+{
+private:
+#ifdef _WIN32
+    // Named pipes don't have a listening handle. A new instance of the pipe is
+    // created for each connection instead.
+    std::wstring _address;
+#else
+    int _fd;
+    std::string _path;
+#endif
+
+public:
+
+    /**
+     * Starts listening on the given address. On POSIX systems, a stale socket
+     * file at the same path is removed first.
+     *
+     * Throws std::system_error if it failed.
+     */
+    LocalServer(const char* address);
+
+#ifdef _WIN32
+    LocalServer(const wchar_t* address);
+#endif
+
+    ~LocalServer();
+
+    LocalServer(const LocalServer&) = delete;
+    LocalServer& operator=(const LocalServer&) = delete;
+
+    /**
+     * Waits for the next client to connect.
+     *
+     * Throws std::system_error if it failed.
+     */
+    LocalSocketRef accept();
+};
@@ -21,6 +21,15 @@
 }
 #endif
 
+#ifndef MD5_LITTLE_ENDIAN
+#if defined(_WIN32) || \
+    (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define MD5_LITTLE_ENDIAN 1
+#else
+#define MD5_LITTLE_ENDIAN 0
+#endif
+#endif
+
 #ifndef PUT_ULONG_LE
 #define PUT_ULONG_LE(n,b,i)                          \
 {                                                    \
@@ -49,6 +58,13 @@ static void md5_process(md5_context *ctx, const unsigned char data[64])
 {
     unsigned int X[16], A, B, C, D;
 
+#if MD5_LITTLE_ENDIAN
+    /*
+     * The block is already in the right byte order. A single memcpy lets the
+     * compiler use plain (unaligned) word loads.
+     */
+    memcpy(X, data, sizeof(X));
+#else
     GET_ULONG_LE(X[ 0], data,  0);
     GET_ULONG_LE(X[ 1], data,  4);
     GET_ULONG_LE(X[ 2], data,  8);
@@ -65,6 +81,7 @@ static void md5_process(md5_context *ctx, const unsigned char data[64])
     GET_ULONG_LE(X[13], data, 52);
     GET_ULONG_LE(X[14], data, 56);
     GET_ULONG_LE(X[15], data, 60);
+#endif
 
 #define S(x,n) ((x << n) | ((x & 0xFFFFFFFF) >> (32 - n)))
 
@@ -99,26 +116,34 @@ static void md5_process(md5_context *ctx, const unsigned char data[64])
 
 #undef F
 
-#define F(x,y,z) (y ^ (z & (x ^ y)))
-
-    P(A, B, C, D,  1,  5, 0xF61E2562);
-    P(D, A, B, C,  6,  9, 0xC040B340);
-    P(C, D, A, B, 11, 14, 0x265E5A51);
-    P(B, C, D, A,  0, 20, 0xE9B6C7AA);
-    P(A, B, C, D,  5,  5, 0xD62F105D);
-    P(D, A, B, C, 10,  9, 0x02441453);
-    P(C, D, A, B, 15, 14, 0xD8A1E681);
-    P(B, C, D, A,  4, 20, 0xE7D3FBC8);
-    P(A, B, C, D,  9,  5, 0x21E1CDE6);
-    P(D, A, B, C, 14,  9, 0xC33707D6);
-    P(C, D, A, B,  3, 14, 0xF4D50D87);
-    P(B, C, D, A,  8, 20, 0x455A14ED);
-    P(A, B, C, D, 13,  5, 0xA9E3E905);
-    P(D, A, B, C,  2,  9, 0xFCEFA3F8);
-    P(C, D, A, B,  7, 14, 0x676F02D9);
-    P(B, C, D, A, 12, 20, 0x8D2A4C8A);
+/*
+ * G(x,y,z) = (x & z) | (y & ~z). The two terms never have bits in common, so
+ * they can be added separately. This shortens the dependency chain on b.
+ */
+#define P2(a,b,c,d,k,s,t)                               \
+{                                                       \
+    a += X[k] + t; a += (~d & c); a += (d & b);         \
+    a = S(a,s) + b;                                     \
+}
 
-#undef F
+    P2(A, B, C, D,  1,  5, 0xF61E2562);
+    P2(D, A, B, C,  6,  9, 0xC040B340);
+    P2(C, D, A, B, 11, 14, 0x265E5A51);
+    P2(B, C, D, A,  0, 20, 0xE9B6C7AA);
+    P2(A, B, C, D,  5,  5, 0xD62F105D);
+    P2(D, A, B, C, 10,  9, 0x02441453);
+    P2(C, D, A, B, 15, 14, 0xD8A1E681);
+    P2(B, C, D, A,  4, 20, 0xE7D3FBC8);
+    P2(A, B, C, D,  9,  5, 0x21E1CDE6);
+    P2(D, A, B, C, 14,  9, 0xC33707D6);
+    P2(C, D, A, B,  3, 14, 0xF4D50D87);
+    P2(B, C, D, A,  8, 20, 0x455A14ED);
+    P2(A, B, C, D, 13,  5, 0xA9E3E905);
+    P2(D, A, B, C,  2,  9, 0xFCEFA3F8);
+    P2(C, D, A, B,  7, 14, 0x676F02D9);
+    P2(B, C, D, A, 12, 20, 0x8D2A4C8A);
+
+#undef P2
 
 #define F(x,y,z) (x ^ y ^ z)
 
@@ -21,52 +21,99 @@
  */
 
 #include "util/memmap.h"
+#include "util/file.h"
 
 #if defined(_WIN32)
 
 #include <windows.h>
+#include <io.h>
+#include <stdint.h>
+#include <algorithm>
 #include <system_error>
 #include <limits>
 
-MemMap::MemMap(const char* path, size_t length)
-    : _buf(NULL), _length(0), _fileMap(NULL) {
-    _init(CreateFileA(
+MemMap::MemMap(const char* path, size_t length, bool readOnly)
+    : _buf(NULL), _length(0), _borrowed(false), _fileMap(NULL) {
+
+    HANDLE hFile = CreateFileA(
             path,
-            GENERIC_READ | GENERIC_WRITE,
-            0,
+            readOnly ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE,
+            FILE_SHARE_READ,
             NULL,
             OPEN_EXISTING,
             FILE_ATTRIBUTE_NORMAL,
             NULL
-            ), length);
+            );
+
+    if (hFile == INVALID_HANDLE_VALUE) {
+        throw std::system_error(GetLastError(), std::system_category(),
+            "Failed to open file");
+    }
+
+    try {
+        _init(hFile, length, readOnly);
+    }
+    catch (...) {
+        CloseHandle(hFile);
+        throw;
+    }
+
+    CloseHandle(hFile);
 }
 
-MemMap::MemMap(const wchar_t* path, size_t length)
-    : _buf(NULL), _length(0), _fileMap(NULL) {
-    _init(CreateFileW(
+MemMap::MemMap(const wchar_t* path, size_t length, bool readOnly)
+    : _buf(NULL), _length(0), _borrowed(false), _fileMap(NULL) {
+
+    HANDLE hFile = CreateFileW(
             path,
-            GENERIC_READ | GENERIC_WRITE,
-            0,
+            readOnly ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE,
+            FILE_SHARE_READ,
             NULL,
             OPEN_EXISTING,
             FILE_ATTRIBUTE_NORMAL,
             NULL
-            ), length);
-}
+            );
 
-void MemMap::_init(HANDLE hFile, size_t length) {
     if (hFile == INVALID_HANDLE_VALUE) {
         throw std::system_error(GetLastError(), std::system_category(),
             "Failed to open file");
     }
 
+    try {
+        _init(hFile, length, readOnly);
+    }
+    catch (...) {
+        CloseHandle(hFile);
+        throw;
+    }
+
+    CloseHandle(hFile);
+}
+
+MemMap::MemMap(FILE* f, size_t length, bool readOnly)
+    : _buf(NULL), _length(0), _borrowed(false), _fileMap(NULL) {
+
+    HANDLE hFile = (HANDLE)_get_osfhandle(_fileno(f));
+    if (hFile == INVALID_HANDLE_VALUE) {
+        throw std::system_error(EBADF, std::system_category(),
+            "Failed to get file handle");
+    }
+
+    if (!readOnly && length > 0 && (uint64_t)getFileSize(f) < length)
+        preallocateFile(f, (int64_t)length);
+
+    _init(hFile, length, readOnly);
+}
+
+void MemMap::_init(HANDLE hFile, size_t length, bool readOnly) {
+
     ULARGE_INTEGER maxSize;
     maxSize.QuadPart = length;
 
     _fileMap = CreateFileMappingW(
             hFile,            // File handle
             NULL,             // Security attributes
-            PAGE_READWRITE,   // Page protection flags
+            readOnly ? PAGE_READONLY : PAGE_READWRITE, // Page protection flags
             maxSize.HighPart, // Maximum size (high-order bytes)
             maxSize.LowPart,  // Maximum size (low-order bytes)
             NULL              // Optional name to give the object
@@ -92,32 +139,70 @@ void MemMap::_init(HANDLE hFile, size_t length) {
         length = (size_t)fileSize.QuadPart;
     }
 
-    CloseHandle(hFile);
-
     // Create a view into the file mapping
     _buf = MapViewOfFileEx(
             _fileMap,                       // File mapping object
-            FILE_MAP_READ | FILE_MAP_WRITE, // Desired access
+            readOnly ? FILE_MAP_READ : FILE_MAP_READ | FILE_MAP_WRITE, // Desired access
             0, 0,                           // File offset
             length,                         // Number of bytes to map
             NULL                            // Preferred base address
             );
 
     if (!_buf) {
-        throw std::system_error(GetLastError(), std::system_category(),
+        auto err = GetLastError();
+        CloseHandle(_fileMap);
+        _fileMap = NULL;
+        throw std::system_error(err, std::system_category(),
             "Failed to map view of file");
     }
 
     _length = length;
 }
 
+MemMap::MemMap(void* buf, size_t length)
+    : _buf(buf), _length(length), _borrowed(true), _fileMap(NULL) {
+}
+
 MemMap::~MemMap() {
-    if (_buf) UnmapViewOfFile(_buf);
+    if (_buf && !_borrowed) UnmapViewOfFile(_buf);
     if (_fileMap) CloseHandle(_fileMap);
 }
 
+void MemMap::adviseSequential() {
+    // There is no equivalent for views of files. Windows already reads ahead
+    // when pages are faulted in sequentially.
+}
+
+void MemMap::prefetch(size_t offset, size_t length) {
+#if defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0602
+    if (offset >= _length || _borrowed)
+        return;
+
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = (uint8_t*)_buf + offset;
+    range.NumberOfBytes = (std::min)(length, _length - offset);
+
+    // This is only a hint. Ignore failures.
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
 #else
+    (void)offset;
+    (void)length;
+#endif
+}
 
+void MemMap::release(size_t offset, size_t length) {
+    if (offset >= _length || _borrowed)
+        return;
+
+    // Unlocking pages that aren't locked removes them from the working set.
+    // It "fails" with ERROR_NOT_LOCKED, which is expected.
+    VirtualUnlock((uint8_t*)_buf + offset, (std::min)(length, _length - offset));
+}
+
+#else
+
+#include <algorithm>
+#include <stdint.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -125,15 +210,42 @@ MemMap::~MemMap() {
 #include <errno.h>
 #include <system_error>
 
-MemMap::MemMap(const char* path, size_t length)
-    : _buf(NULL), _length(0) {
+MemMap::MemMap(const char* path, size_t length, bool readOnly)
+    : _buf(NULL), _length(0), _borrowed(false) {
 
-    int fd = open(path, O_RDWR);
+    int fd = open(path, readOnly ? O_RDONLY : O_RDWR);
     if (fd == -1) {
         throw std::system_error(errno, std::system_category(),
                 "Failed to open file");
     }
 
+    try {
+        _init(fd, length, readOnly);
+    }
+    catch (...) {
+        close(fd);
+        throw;
+    }
+
+    // We don't need this open in order to keep the file mapped.
+    if (close(fd) == -1) {
+        throw std::system_error(errno, std::system_category(),
+                "Failed to close file");
+    }
+}
+
+MemMap::MemMap(FILE* f, size_t length, bool readOnly)
+    : _buf(NULL), _length(0), _borrowed(false) {
+
+    // Mapping past the end of the file doesn't extend it.
+    if (!readOnly && length > 0 && (uint64_t)getFileSize(f) < length)
+        preallocateFile(f, (int64_t)length);
+
+    _init(fileno(f), length, readOnly);
+}
+
+void MemMap::_init(int fd, size_t length, bool readOnly) {
+
     if (length == 0) {
         struct stat stbuf;
         if (fstat(fd, &stbuf) == -1) {
@@ -147,7 +259,7 @@ MemMap::MemMap(const char* path, size_t length)
     void* p = mmap(
             NULL,                   // Preferred base address (don't care)
             length,                 // Length of the memory map
-            PROT_READ | PROT_WRITE, // Protection flags
+            readOnly ? PROT_READ : PROT_READ | PROT_WRITE, // Protection flags
             MAP_SHARED,
             fd,                     // File descriptor
             0                       // Offset within the file
@@ -160,18 +272,56 @@ MemMap::MemMap(const char* path, size_t length)
 
     _buf = p;
     _length = length;
+}
 
-    // We don't need this open in order to keep the file mapped.
-    if (close(fd) == -1) {
-        throw std::system_error(errno, std::system_category(),
-                "Failed to close file");
-    }
+MemMap::MemMap(void* buf, size_t length)
+    : _buf(buf), _length(length), _borrowed(true) {
 }
 
 MemMap::~MemMap() {
-    if (_buf) {
+    if (_buf && !_borrowed) {
         munmap(_buf, _length);
     }
 }
 
+namespace {
+
+/**
+ * Passes advice about a range of the map to the kernel. The range is widened
+ * to whole pages. Since it is only advice, failures are ignored.
+ */
+void advise(void* buf, size_t mapLength, size_t offset, size_t length,
+        int advice) {
+
+    if (offset >= mapLength)
+        return;
+
+    length = std::min(length, mapLength - offset);
+
+    static const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+
+    const size_t start = offset / pageSize * pageSize;
+
+    madvise((uint8_t*)buf + start, length + (offset - start), advice);
+}
+
+}
+
+void MemMap::adviseSequential() {
+    if (!_borrowed)
+        advise(_buf, _length, 0, _length, MADV_SEQUENTIAL);
+}
+
+void MemMap::prefetch(size_t offset, size_t length) {
+    if (!_borrowed)
+        advise(_buf, _length, offset, length, MADV_WILLNEED);
+}
+
+void MemMap::release(size_t offset, size_t length) {
+    // For memory that isn't backed by a file, this would throw away its
+    // contents.
+    if (!_borrowed)
+        advise(_buf, _length, offset, length, MADV_DONTNEED);
+}
+
 #endif
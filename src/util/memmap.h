@@ -31,6 +31,8 @@
 #pragma once
 
 #include <stdlib.h> // For size_t
+#include <stdio.h>  // For FILE*
+#include <memory>
 
 #ifdef _WIN32
 typedef void* HANDLE;
@@ -45,19 +47,46 @@ private:
     void* _buf;
     size_t _length;
 
+    // True if the memory isn't mapped by this object, but belongs to someone
+    // else.
+    bool _borrowed;
+
 #ifdef _WIN32
     HANDLE _fileMap;
-    void _init(HANDLE hFile, size_t length = 0);
+    void _init(HANDLE hFile, size_t length, bool readOnly);
+#else
+    void _init(int fd, size_t length, bool readOnly);
 #endif
 
 public:
-    MemMap(const char* path, size_t length = 0);
+    MemMap(const char* path, size_t length = 0, bool readOnly = false);
     ~MemMap();
 
 #ifdef _WIN32
-    MemMap(const wchar_t* path, size_t length = 0);
+    MemMap(const wchar_t* path, size_t length = 0, bool readOnly = false);
 #endif
 
+    /**
+     * Maps an already open file into memory. The file is not closed and can
+     * continue to be used independently of the memory map.
+     *
+     * If the map is writable and the file is shorter than `length`, the file is
+     * first grown to that length with preallocateFile(). This can be used to
+     * create a file of a known size and fill it in through the map.
+     */
+    MemMap(FILE* f, size_t length = 0, bool readOnly = true);
+
+    /**
+     * Refers to memory that is already there instead of mapping a file. This
+     * lets anything that reads from a memory map read from a buffer as well.
+     * The memory is neither copied nor freed and must outlive this object.
+     * None of the hints below have any effect on it.
+     */
+    MemMap(void* buf, size_t length);
+
+    MemMap(const MemMap&) = delete;
+    MemMap& operator=(const MemMap&) = delete;
+
     /**
      * Returns the size of the file.
      */
@@ -71,4 +100,28 @@ public:
     void* buf() {
         return _buf;
     }
+
+    const void* buf() const {
+        return _buf;
+    }
+
+    /**
+     * Hints that the map is going to be read from start to end such that the
+     * operating system can read ahead further and drop pages behind.
+     */
+    void adviseSequential();
+
+    /**
+     * Hints that the given range is going to be read soon.
+     */
+    void prefetch(size_t offset, size_t length);
+
+    /**
+     * Takes the given range out of this process's working set. Nothing is
+     * lost. The pages are faulted back in the next time they are touched. This
+     * keeps the memory usage down when scanning through large files.
+     */
+    void release(size_t offset, size_t length);
 };
+
+typedef std::shared_ptr<MemMap> MemMapRef;
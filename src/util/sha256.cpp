@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "util/sha256.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+const uint32_t kRoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+inline uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+inline uint32_t readBigEndian(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+inline void writeBigEndian(uint8_t* p, uint32_t x) {
+    p[0] = (uint8_t)(x >> 24);
+    p[1] = (uint8_t)(x >> 16);
+    p[2] = (uint8_t)(x >> 8);
+    p[3] = (uint8_t)x;
+}
+
+}
+
+const size_t Sha256::kDigestLength;
+
+Sha256::Sha256() : _bufferedSize(0), _totalLength(0) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    memcpy(_state, initial, sizeof(_state));
+}
+
+void Sha256::compress(const uint8_t* block) {
+
+    uint32_t w[64];
+
+    for (size_t i = 0; i < 16; ++i)
+        w[i] = readBigEndian(block + 4 * i);
+
+    for (size_t i = 16; i < 64; ++i) {
+        const uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^
+            (w[i - 15] >> 3);
+        const uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^
+            (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = _state[0], b = _state[1], c = _state[2], d = _state[3];
+    uint32_t e = _state[4], f = _state[5], g = _state[6], h = _state[7];
+
+    for (size_t i = 0; i < 64; ++i) {
+        const uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+        const uint32_t ch = (e & f) ^ (~e & g);
+        const uint32_t t1 = h + s1 + ch + kRoundConstants[i] + w[i];
+        const uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+        const uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        const uint32_t t2 = s0 + maj;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    _state[0] += a;
+    _state[1] += b;
+    _state[2] += c;
+    _state[3] += d;
+    _state[4] += e;
+    _state[5] += f;
+    _state[6] += g;
+    _state[7] += h;
+}
+
+void Sha256::update(const void* data, size_t length) {
+
+    const uint8_t* p = (const uint8_t*)data;
+
+    _totalLength += length;
+
+    // Fill up a partial block first.
+    if (_bufferedSize > 0) {
+        const size_t n = std::min(length, sizeof(_buffer) - _bufferedSize);
+        memcpy(_buffer + _bufferedSize, p, n);
+        _bufferedSize += n;
+        p += n;
+        length -= n;
+
+        if (_bufferedSize < sizeof(_buffer))
+            return;
+
+        compress(_buffer);
+        _bufferedSize = 0;
+    }
+
+    // Whole blocks are hashed where they are.
+    while (length >= sizeof(_buffer)) {
+        compress(p);
+        p += sizeof(_buffer);
+        length -= sizeof(_buffer);
+    }
+
+    memcpy(_buffer, p, length);
+    _bufferedSize = length;
+}
+
+void Sha256::finish(uint8_t output[kDigestLength]) {
+
+    const uint64_t bits = _totalLength * 8;
+
+    // A single one bit, zeros up to the last 8 bytes of a block, and then the
+    // length in bits.
+    uint8_t padding[sizeof(_buffer) + 8] = {0x80};
+
+    const size_t used = (_bufferedSize + 1 + 8 <= sizeof(_buffer)) ?
+        sizeof(_buffer) - _bufferedSize :
+        2 * sizeof(_buffer) - _bufferedSize;
+
+    for (size_t i = 0; i < 8; ++i)
+        padding[used - 1 - i] = (uint8_t)(bits >> (8 * i));
+
+    update(padding, used);
+
+    for (size_t i = 0; i < 8; ++i)
+        writeBigEndian(output + 4 * i, _state[i]);
+}
+
+std::string sha256Hex(const uint8_t digest[Sha256::kDigestLength]) {
+
+    static const char hex[] = "0123456789abcdef";
+
+    std::string s;
+    for (size_t i = 0; i < Sha256::kDigestLength; ++i) {
+        s.push_back(hex[digest[i] >> 4]);
+        s.push_back(hex[digest[i] & 0xF]);
+    }
+
+    return s;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * An implementation of SHA-256 as specified in FIPS 180-4.
+ *
+ * This isn't used for signatures, which are only 128 bits. It is used for the
+ * digests of the output files that artifact stores and build systems expect.
+ */
+
+#pragma once
+
+#include <stdlib.h> // For size_t
+#include <stdint.h>
+
+#include <string>
+
+/**
+ * Incrementally computes a SHA-256 hash.
+ */
+class Sha256 {
+private:
+    uint32_t _state[8];
+    uint8_t _buffer[64];
+    size_t _bufferedSize;
+    uint64_t _totalLength;
+
+    void compress(const uint8_t* block);
+
+public:
+    /**
+     * Length of the hash, in bytes.
+     */
+    static const size_t kDigestLength = 32;
+
+    Sha256();
+
+    /**
+     * Hashes another chunk of data.
+     */
+    void update(const void* data, size_t length);
+
+    /**
+     * Writes out the final hash. No more data can be added after this.
+     */
+    void finish(uint8_t output[kDigestLength]);
+};
+
+/**
+ * Formats a SHA-256 hash as a string of lowercase hex digits.
+ */
+std::string sha256Hex(const uint8_t digest[Sha256::kDigestLength]);
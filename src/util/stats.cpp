@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "util/stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iomanip>
+#include <mutex>
+#include <vector>
+
+#if defined(_WIN32)
+#   include <windows.h>
+#   include <psapi.h>
+#   pragma comment(lib, "psapi.lib")
+#else
+#   include <sys/resource.h>
+#endif
+
+namespace {
+
+const char* const kCounterNames[] = {
+    "imageBytes",
+    "bytesRead",
+    "bytesWritten",
+    "pagesWritten",
+    "pagesCopied",
+    "writeCalls",
+    "asyncRequests",
+    "readSweeps",
+    "streamsRewritten",
+    "streamsPassedThrough",
+};
+
+static_assert(sizeof(kCounterNames) / sizeof(kCounterNames[0]) ==
+        (size_t)StatCounter::count, "missing counter names");
+
+std::atomic<bool> enabled(false);
+std::atomic<uint64_t> counters[(size_t)StatCounter::count];
+
+std::mutex phasesMutex;
+
+// Phases in the order they were first seen.
+std::vector<PhaseStat> phases;
+
+/**
+ * A phase as it is recorded in the trace.
+ */
+struct TraceSpan {
+    const char* name;
+    uint32_t thread;
+    uint64_t start;
+    uint64_t duration;
+    std::string args;
+};
+
+std::atomic<bool> tracing(false);
+
+std::mutex traceMutex;
+std::vector<TraceSpan> spans;
+
+// Spans are timed relative to this.
+std::chrono::steady_clock::time_point traceStart;
+
+// Threads are numbered in the order they first finish a span.
+std::atomic<uint32_t> threadCount(0);
+thread_local uint32_t threadId = 0;
+
+uint32_t currentThread() {
+    if (threadId == 0)
+        threadId = ++threadCount;
+
+    return threadId;
+}
+
+double milliseconds(uint64_t ns) {
+    return ns / 1e6;
+}
+
+uint64_t nanoseconds(std::chrono::steady_clock::duration d) {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(d)
+        .count();
+}
+
+/**
+ * Appends a string as a JSON string literal.
+ */
+void appendJsonString(std::string& out, const std::string& s) {
+
+    static const char hex[] = "0123456789abcdef";
+
+    out.push_back('"');
+
+    for (char c: s) {
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+            out.push_back(c);
+        }
+        else if ((unsigned char)c < 0x20) {
+            out += "\\u00";
+            out.push_back(hex[(c >> 4) & 0xF]);
+            out.push_back(hex[c & 0xF]);
+        }
+        else {
+            out.push_back(c);
+        }
+    }
+
+    out.push_back('"');
+}
+
+}
+
+void enableStats() {
+    enabled.store(true, std::memory_order_relaxed);
+}
+
+bool statsEnabled() {
+    return enabled.load(std::memory_order_relaxed);
+}
+
+void addStat(StatCounter counter, uint64_t n) {
+    if (statsEnabled())
+        counters[(size_t)counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+uint64_t getStat(StatCounter counter) {
+    return counters[(size_t)counter].load(std::memory_order_relaxed);
+}
+
+void resetStats() {
+    {
+        std::lock_guard<std::mutex> lock(phasesMutex);
+
+        phases.clear();
+
+        for (auto&& counter: counters)
+            counter.store(0, std::memory_order_relaxed);
+    }
+
+    std::lock_guard<std::mutex> lock(traceMutex);
+    spans.clear();
+}
+
+void enableTrace() {
+    std::lock_guard<std::mutex> lock(traceMutex);
+
+    if (!tracing.load(std::memory_order_relaxed)) {
+        traceStart = std::chrono::steady_clock::now();
+        tracing.store(true, std::memory_order_release);
+    }
+}
+
+bool traceEnabled() {
+    return tracing.load(std::memory_order_acquire);
+}
+
+PhaseTimer::PhaseTimer(const char* name) : _name(name) {
+    if (statsEnabled() || traceEnabled())
+        _start = std::chrono::steady_clock::now();
+}
+
+PhaseTimer::~PhaseTimer() {
+    if (!statsEnabled() && !traceEnabled())
+        return;
+
+    const auto end = std::chrono::steady_clock::now();
+    const uint64_t ns = nanoseconds(end - _start);
+
+    if (traceEnabled()) {
+        // The phase may have started before the trace did.
+        const uint64_t start = (_start > traceStart) ?
+            nanoseconds(_start - traceStart) : 0;
+
+        TraceSpan span = {_name, currentThread(), start, ns,
+            std::move(_args)};
+
+        std::lock_guard<std::mutex> lock(traceMutex);
+        spans.push_back(std::move(span));
+    }
+
+    if (!statsEnabled())
+        return;
+
+    std::lock_guard<std::mutex> lock(phasesMutex);
+
+    for (auto&& phase: phases) {
+        if (strcmp(phase.name, _name) == 0) {
+            ++phase.calls;
+            phase.nanoseconds += ns;
+            return;
+        }
+    }
+
+    PhaseStat phase = {_name, 1, ns};
+    phases.push_back(phase);
+}
+
+void PhaseTimer::addArg(const char* name, uint64_t value) {
+    if (!traceEnabled())
+        return;
+
+    if (!_args.empty())
+        _args += ", ";
+
+    appendJsonString(_args, name);
+    _args += ": " + std::to_string(value);
+}
+
+void PhaseTimer::addArg(const char* name, const std::string& value) {
+    if (!traceEnabled())
+        return;
+
+    if (!_args.empty())
+        _args += ", ";
+
+    appendJsonString(_args, name);
+    _args += ": ";
+    appendJsonString(_args, value);
+}
+
+std::vector<PhaseStat> getPhaseStats() {
+    std::lock_guard<std::mutex> lock(phasesMutex);
+    return phases;
+}
+
+uint64_t peakMemoryUsage() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return 0;
+
+    return pmc.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+
+#   if defined(__APPLE__)
+    return (uint64_t)usage.ru_maxrss;
+#   else
+    // Linux and the BSDs report this in kilobytes.
+    return (uint64_t)usage.ru_maxrss * 1024;
+#   endif
+#endif
+}
+
+void printStats(std::ostream& os) {
+
+    std::lock_guard<std::mutex> lock(phasesMutex);
+
+    os << "Phase                    Calls    Time (ms)\n";
+
+    for (auto&& phase: phases) {
+        os << std::left << std::setw(24) << phase.name << std::right
+           << std::setw(6) << phase.calls
+           << std::setw(13) << std::fixed << std::setprecision(3)
+           << milliseconds(phase.nanoseconds) << "\n";
+    }
+
+    os << "\n";
+
+    for (size_t i = 0; i < (size_t)StatCounter::count; ++i) {
+        os << std::left << std::setw(24) << kCounterNames[i] << std::right
+           << std::setw(19) << counters[i].load() << "\n";
+    }
+
+    os << std::left << std::setw(24) << "peakMemory" << std::right
+       << std::setw(19) << peakMemoryUsage() << "\n";
+}
+
+void printStatsJson(std::ostream& os) {
+
+    std::lock_guard<std::mutex> lock(phasesMutex);
+
+    os << "{\n  \"phases\": {";
+
+    for (size_t i = 0; i < phases.size(); ++i) {
+        os << (i ? ",\n" : "\n")
+           << "    \"" << phases[i].name << "\": {\"calls\": " << phases[i].calls
+           << ", \"ms\": " << std::fixed << std::setprecision(3)
+           << milliseconds(phases[i].nanoseconds) << "}";
+    }
+
+    os << "\n  },\n  \"counters\": {";
+
+    for (size_t i = 0; i < (size_t)StatCounter::count; ++i) {
+        os << (i ? ",\n" : "\n")
+           << "    \"" << kCounterNames[i] << "\": " << counters[i].load();
+    }
+
+    os << "\n  },\n  \"peakMemory\": " << peakMemoryUsage() << "\n}\n";
+}
+
+void printTrace(std::ostream& os) {
+
+    std::lock_guard<std::mutex> lock(traceMutex);
+
+    // Spans are recorded when they end. Sorting them by their start makes the
+    // file easier to read and nested spans come after their parents.
+    std::vector<const TraceSpan*> sorted;
+    for (auto&& span: spans)
+        sorted.push_back(&span);
+
+    std::stable_sort(sorted.begin(), sorted.end(),
+            [](const TraceSpan* a, const TraceSpan* b) {
+                return a->start < b->start;
+            });
+
+    // Timestamps are in microseconds.
+    os << "{\"traceEvents\": [";
+
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        const TraceSpan& span = *sorted[i];
+
+        os << (i ? ",\n" : "\n")
+           << "  {\"name\": \"" << span.name << "\", \"ph\": \"X\", \"pid\": 1"
+           << ", \"tid\": " << span.thread
+           << ", \"ts\": " << std::fixed << std::setprecision(3)
+           << span.start / 1e3
+           << ", \"dur\": " << span.duration / 1e3;
+
+        if (!span.args.empty())
+            os << ", \"args\": {" << span.args << "}";
+
+        os << "}";
+    }
+
+    os << "\n], \"displayTimeUnit\": \"ms\"}\n";
+}
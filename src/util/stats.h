@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Lightweight instrumentation for finding out where time is spent. Nothing is
+ * recorded unless stats have been enabled.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * Things that are counted.
+ */
+enum class StatCounter {
+    // Bytes of the image that were hashed.
+    imageBytes,
+
+    // Bytes of MSF streams that were read from the original PDB.
+    bytesRead,
+
+    // Bytes written to the PDB, including pages copied without a buffer.
+    bytesWritten,
+
+    // Pages written to the PDB.
+    pagesWritten,
+
+    // Pages copied straight from the original PDB.
+    pagesCopied,
+
+    // Write calls made to the PDB, not counting pages copied without a buffer.
+    writeCalls,
+
+    // Reads and writes that were queued up with asynchronous I/O.
+    asyncRequests,
+
+    // Sequential sweeps over the original PDB to copy its pages.
+    readSweeps,
+
+    // Streams that were written from memory.
+    streamsRewritten,
+
+    // Streams whose unmodified pages were copied or left as they are.
+    streamsPassedThrough,
+
+    count,
+};
+
+/**
+ * Turns on recording of stats.
+ */
+void enableStats();
+
+/**
+ * Returns true if stats are being recorded.
+ */
+bool statsEnabled();
+
+/**
+ * Adds to a counter. This is thread-safe.
+ */
+void addStat(StatCounter counter, uint64_t n);
+
+/**
+ * Returns the current value of a counter.
+ */
+uint64_t getStat(StatCounter counter);
+
+/**
+ * Clears all recorded phases and counters.
+ */
+void resetStats();
+
+/**
+ * Turns on recording of a trace. Every phase is then also recorded as a span
+ * of its own, along with the thread it ran on.
+ */
+void enableTrace();
+
+/**
+ * Returns true if a trace is being recorded.
+ */
+bool traceEnabled();
+
+/**
+ * Measures the wall time of a phase from construction to destruction. Phases
+ * with the same name are added together. This is thread-safe.
+ *
+ * If a trace is being recorded, the phase is also added to it as a span.
+ */
+class PhaseTimer
+{
+private:
+    const char* _name;
+    std::chrono::steady_clock::time_point _start;
+
+    // The arguments of the span as JSON members. Only used for the trace.
+    std::string _args;
+
+public:
+    explicit PhaseTimer(const char* name);
+    ~PhaseTimer();
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+    /**
+     * Adds an argument to the span in the trace, like the number of bytes that
+     * were processed. This does nothing unless a trace is being recorded.
+     */
+    void addArg(const char* name, uint64_t value);
+    void addArg(const char* name, const std::string& value);
+};
+
+/**
+ * The total time spent in a phase.
+ */
+struct PhaseStat {
+    const char* name;
+    uint64_t calls;
+    uint64_t nanoseconds;
+};
+
+/**
+ * Returns the phases recorded so far, in the order they were first seen.
+ */
+std::vector<PhaseStat> getPhaseStats();
+
+/**
+ * Returns the peak resident memory of this process, in bytes, or 0 if unknown.
+ */
+uint64_t peakMemoryUsage();
+
+/**
+ * Prints the stats in a human-readable form.
+ */
+void printStats(std::ostream& os);
+
+/**
+ * Prints the stats as a JSON object.
+ */
+void printStatsJson(std::ostream& os);
+
+/**
+ * Prints the recorded trace in the Chrome trace event format. It can be viewed
+ * with chrome://tracing or Perfetto.
+ */
+void printTrace(std::ostream& os);
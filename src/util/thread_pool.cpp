@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "util/thread_pool.h"
+
+ThreadPool::ThreadPool(size_t threads) : _stopping(false) {
+
+    if (threads == 0)
+        threads = hardwareThreads();
+
+    if (threads > 1) {
+        _threads.reserve(threads);
+        for (size_t i = 0; i < threads; ++i)
+            _threads.push_back(std::thread(&ThreadPool::worker, this));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+
+    _cv.notify_all();
+
+    for (auto& t: _threads)
+        t.join();
+}
+
+size_t ThreadPool::hardwareThreads() {
+    const size_t n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+void ThreadPool::enqueue(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _queue.push_back(std::move(task));
+    }
+
+    _cv.notify_one();
+}
+
+void ThreadPool::worker() {
+
+    while (true) {
+        std::function<void()> task;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+
+            _cv.wait(lock, [this]() { return _stopping || !_queue.empty(); });
+
+            // Drain the queue before stopping.
+            if (_queue.empty())
+                return;
+
+            task = std::move(_queue.front());
+            _queue.pop_front();
+        }
+
+        task();
+    }
+}
+
+bool ThreadPool::runPending() {
+
+    std::function<void()> task;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_queue.empty())
+            return false;
+
+        task = std::move(_queue.front());
+        _queue.pop_front();
+    }
+
+    task();
+    return true;
+}
+
+void ThreadPool::wait(std::vector<std::future<void>>& futures) {
+
+    for (auto& f: futures) {
+        // If nothing is queued, the task is already running on another thread
+        // (or done) and we can just block on it.
+        while (f.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            if (!runPending()) {
+                f.wait();
+                break;
+            }
+        }
+    }
+
+    for (auto& f: futures)
+        f.get();
+}
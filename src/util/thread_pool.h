@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * A simple fixed-size thread pool. Work that can be done independently (e.g.,
+ * patching unrelated PDB streams) is submitted to the pool and the results are
+ * collected via futures.
+ */
+
+#pragma once
+
+#include <stdlib.h> // For size_t
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class ThreadPool
+{
+private:
+    std::vector<std::thread> _threads;
+    std::deque<std::function<void()>> _queue;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _stopping;
+
+    void worker();
+    void enqueue(std::function<void()> task);
+
+    /**
+     * Runs one queued task on the calling thread. Returns false if the queue
+     * is empty.
+     */
+    bool runPending();
+
+public:
+
+    /**
+     * Params:
+     *   threads = Maximum number of threads to use. If 0, the number of
+     *             hardware threads is used. If 1, no worker threads are
+     *             created and tasks are run immediately when submitted.
+     */
+    explicit ThreadPool(size_t threads = 0);
+
+    /**
+     * Waits for all pending tasks to finish.
+     */
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * Returns the number of threads that do work, including the calling thread
+     * if there are no worker threads.
+     */
+    size_t threads() const {
+        return _threads.empty() ? 1 : _threads.size();
+    }
+
+    /**
+     * Returns the number of hardware threads. This is never 0.
+     */
+    static size_t hardwareThreads();
+
+    /**
+     * Submits a task to the pool. Any exception thrown by the task is rethrown
+     * by the returned future.
+     */
+    template<typename F>
+    std::future<typename std::result_of<F()>::type> submit(F f) {
+        typedef typename std::result_of<F()>::type R;
+
+        auto task = std::make_shared<std::packaged_task<R()>>(std::move(f));
+        auto future = task->get_future();
+
+        if (_threads.empty())
+            (*task)();
+        else
+            enqueue([task]() { (*task)(); });
+
+        return future;
+    }
+
+    /**
+     * Waits for all of the given futures to become ready and then rethrows the
+     * first exception, if any. Unlike calling get() on each future in turn,
+     * this guarantees that no task is still running when an exception is
+     * thrown.
+     *
+     * While waiting, the calling thread helps run queued tasks. Thus, it is
+     * safe for a task to submit more tasks and wait for them.
+     */
+    void wait(std::vector<std::future<void>>& futures);
+};
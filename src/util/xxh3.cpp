@@ -0,0 +1,487 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "util/xxh3.h"
+
+#include <cstring>
+
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   define XXH3_SSE2 1
+#   include <emmintrin.h>
+#endif
+
+namespace {
+
+const size_t kStripeLength = 64;
+const size_t kSecretConsumeRate = 8;
+const size_t kSecretMergeAccsStart = 11;
+const size_t kSecretLastAccStart = 7;
+const size_t kMidSizeMax = 240;
+const size_t kSecretSizeMin = 136;
+const size_t kSecretSize = 192;
+const size_t kBufferSize = 256;
+const size_t kStripesPerBlock = (kSecretSize - kStripeLength) / kSecretConsumeRate;
+
+const uint32_t kPrime32_1 = 0x9E3779B1U;
+const uint32_t kPrime32_2 = 0x85EBCA77U;
+const uint32_t kPrime32_3 = 0xC2B2AE3DU;
+
+const uint64_t kPrime64_1 = 0x9E3779B185EBCA87ULL;
+const uint64_t kPrime64_2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t kPrime64_3 = 0x165667B19E3779F9ULL;
+const uint64_t kPrime64_4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t kPrime64_5 = 0x27D4EB2F165667C5ULL;
+
+const uint8_t kSecret[kSecretSize] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+// Note that this assumes a little-endian machine, like the rest of Ducible.
+inline uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t swap32(uint32_t x) {
+    return ((x << 24) & 0xFF000000U) | ((x <<  8) & 0x00FF0000U) |
+           ((x >>  8) & 0x0000FF00U) | ((x >> 24) & 0x000000FFU);
+}
+
+inline uint64_t swap64(uint64_t x) {
+    return ((uint64_t)swap32((uint32_t)x) << 32) | swap32((uint32_t)(x >> 32));
+}
+
+inline uint32_t rotl32(uint32_t x, int r) {
+    return (x << r) | (x >> (32 - r));
+}
+
+inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+/**
+ * Multiplies two 64-bit integers to get a 128-bit result.
+ */
+inline void mul128(uint64_t a, uint64_t b, uint64_t& low, uint64_t& high) {
+#if defined(__SIZEOF_INT128__)
+    const unsigned __int128 product = (unsigned __int128)a * b;
+    low = (uint64_t)product;
+    high = (uint64_t)(product >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    low = _umul128(a, b, &high);
+#else
+    const uint64_t lolo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+    const uint64_t hilo = (a >> 32) * (b & 0xFFFFFFFF);
+    const uint64_t lohi = (a & 0xFFFFFFFF) * (b >> 32);
+    const uint64_t hihi = (a >> 32) * (b >> 32);
+
+    const uint64_t cross = (lolo >> 32) + (hilo & 0xFFFFFFFF) + lohi;
+    high = (hilo >> 32) + (cross >> 32) + hihi;
+    low = (cross << 32) | (lolo & 0xFFFFFFFF);
+#endif
+}
+
+inline uint64_t mul128Fold64(uint64_t a, uint64_t b) {
+    uint64_t low, high;
+    mul128(a, b, low, high);
+    return low ^ high;
+}
+
+inline uint64_t xorshift64(uint64_t x, int shift) {
+    return x ^ (x >> shift);
+}
+
+inline uint64_t avalanche(uint64_t x) {
+    x = xorshift64(x, 37);
+    x *= 0x165667919E3779F9ULL;
+    return xorshift64(x, 32);
+}
+
+inline uint64_t xxh64Avalanche(uint64_t x) {
+    x ^= x >> 33;
+    x *= kPrime64_2;
+    x ^= x >> 29;
+    x *= kPrime64_3;
+    x ^= x >> 32;
+    return x;
+}
+
+inline uint64_t mix16(const uint8_t* input, const uint8_t* secret, uint64_t seed) {
+    const uint64_t low = read64(input) ^ (read64(secret) + seed);
+    const uint64_t high = read64(input + 8) ^ (read64(secret + 8) - seed);
+    return mul128Fold64(low, high);
+}
+
+inline void mix32(uint64_t& low, uint64_t& high, const uint8_t* input1,
+        const uint8_t* input2, const uint8_t* secret, uint64_t seed) {
+    low += mix16(input1, secret, seed);
+    low ^= read64(input2) + read64(input2 + 8);
+    high += mix16(input2, secret + 16, seed);
+    high ^= read64(input1) + read64(input1 + 8);
+}
+
+/**
+ * Accumulates one 64-byte stripe.
+ */
+inline void accumulate512(uint64_t* acc, const uint8_t* input,
+        const uint8_t* secret) {
+#if defined(XXH3_SSE2)
+    __m128i* xacc = (__m128i*)acc;
+
+    for (size_t i = 0; i < kStripeLength / sizeof(__m128i); ++i) {
+        const __m128i data = _mm_loadu_si128((const __m128i*)input + i);
+        const __m128i key = _mm_loadu_si128((const __m128i*)secret + i);
+        const __m128i dataKey = _mm_xor_si128(data, key);
+
+        const __m128i dataKeyLow = _mm_shuffle_epi32(dataKey, _MM_SHUFFLE(0, 3, 0, 1));
+        const __m128i product = _mm_mul_epu32(dataKey, dataKeyLow);
+
+        const __m128i dataSwap = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+        const __m128i sum = _mm_add_epi64(_mm_loadu_si128(xacc + i), dataSwap);
+        _mm_storeu_si128(xacc + i, _mm_add_epi64(product, sum));
+    }
+#else
+    for (size_t i = 0; i < 8; ++i) {
+        const uint64_t data = read64(input + 8 * i);
+        const uint64_t dataKey = data ^ read64(secret + 8 * i);
+
+        acc[i ^ 1] += data;
+        acc[i] += (dataKey & 0xFFFFFFFF) * (dataKey >> 32);
+    }
+#endif
+}
+
+inline void scrambleAcc(uint64_t* acc, const uint8_t* secret) {
+#if defined(XXH3_SSE2)
+    __m128i* xacc = (__m128i*)acc;
+    const __m128i prime = _mm_set1_epi32((int)kPrime32_1);
+
+    for (size_t i = 0; i < kStripeLength / sizeof(__m128i); ++i) {
+        const __m128i a = _mm_loadu_si128(xacc + i);
+        const __m128i data = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+
+        const __m128i key = _mm_loadu_si128((const __m128i*)secret + i);
+        const __m128i dataKey = _mm_xor_si128(data, key);
+
+        const __m128i dataKeyHigh = _mm_shuffle_epi32(dataKey, _MM_SHUFFLE(0, 3, 0, 1));
+        const __m128i productLow = _mm_mul_epu32(dataKey, prime);
+        const __m128i productHigh = _mm_mul_epu32(dataKeyHigh, prime);
+        _mm_storeu_si128(xacc + i,
+                _mm_add_epi64(productLow, _mm_slli_epi64(productHigh, 32)));
+    }
+#else
+    for (size_t i = 0; i < 8; ++i) {
+        uint64_t a = xorshift64(acc[i], 47);
+        a ^= read64(secret + 8 * i);
+        acc[i] = a * kPrime32_1;
+    }
+#endif
+}
+
+inline void accumulate(uint64_t* acc, const uint8_t* input,
+        const uint8_t* secret, size_t stripes) {
+    for (size_t i = 0; i < stripes; ++i) {
+        accumulate512(acc, input + i * kStripeLength,
+                secret + i * kSecretConsumeRate);
+    }
+}
+
+/**
+ * Accumulates a number of stripes, scrambling the accumulator at the end of
+ * each block. Returns the new number of stripes accumulated in the current
+ * block.
+ */
+size_t consumeStripes(uint64_t* acc, size_t stripes, size_t stripesAcc,
+        const uint8_t* input) {
+
+    if (kStripesPerBlock - stripesAcc <= stripes) {
+        const size_t toEnd = kStripesPerBlock - stripesAcc;
+        const size_t afterEnd = stripes - toEnd;
+
+        accumulate(acc, input, kSecret + stripesAcc * kSecretConsumeRate, toEnd);
+        scrambleAcc(acc, kSecret + kSecretSize - kStripeLength);
+        accumulate(acc, input + toEnd * kStripeLength, kSecret, afterEnd);
+        return afterEnd;
+    }
+
+    accumulate(acc, input, kSecret + stripesAcc * kSecretConsumeRate, stripes);
+    return stripesAcc + stripes;
+}
+
+uint64_t mergeAccs(const uint64_t* acc, const uint8_t* secret, uint64_t start) {
+    uint64_t result = start;
+
+    for (size_t i = 0; i < 4; ++i) {
+        result += mul128Fold64(acc[2*i] ^ read64(secret + 16 * i),
+                acc[2*i + 1] ^ read64(secret + 16 * i + 8));
+    }
+
+    return avalanche(result);
+}
+
+void hash1to3(const uint8_t* input, size_t length, uint64_t& low, uint64_t& high) {
+    const uint32_t c1 = input[0];
+    const uint32_t c2 = input[length >> 1];
+    const uint32_t c3 = input[length - 1];
+
+    const uint32_t inputLow = (c1 << 16) | (c2 << 24) | c3 | ((uint32_t)length << 8);
+    const uint32_t inputHigh = rotl32(swap32(inputLow), 13);
+
+    const uint64_t flipLow = (uint64_t)(read32(kSecret) ^ read32(kSecret + 4));
+    const uint64_t flipHigh = (uint64_t)(read32(kSecret + 8) ^ read32(kSecret + 12));
+
+    low = xxh64Avalanche(inputLow ^ flipLow);
+    high = xxh64Avalanche(inputHigh ^ flipHigh);
+}
+
+void hash4to8(const uint8_t* input, size_t length, uint64_t& low, uint64_t& high) {
+    const uint64_t inputLow = read32(input);
+    const uint64_t inputHigh = read32(input + length - 4);
+    const uint64_t input64 = inputLow + (inputHigh << 32);
+
+    const uint64_t flip = read64(kSecret + 16) ^ read64(kSecret + 24);
+    const uint64_t keyed = input64 ^ flip;
+
+    mul128(keyed, kPrime64_1 + ((uint64_t)length << 2), low, high);
+
+    high += low << 1;
+    low ^= high >> 3;
+
+    low = xorshift64(low, 35) * 0x9FB21C651E98DF25ULL;
+    low = xorshift64(low, 28);
+    high = avalanche(high);
+}
+
+void hash9to16(const uint8_t* input, size_t length, uint64_t& low, uint64_t& high) {
+    const uint64_t flipLow = read64(kSecret + 32) ^ read64(kSecret + 40);
+    const uint64_t flipHigh = read64(kSecret + 48) ^ read64(kSecret + 56);
+    const uint64_t inputLow = read64(input);
+    uint64_t inputHigh = read64(input + length - 8);
+
+    uint64_t mulLow, mulHigh;
+    mul128(inputLow ^ inputHigh ^ flipLow, kPrime64_1, mulLow, mulHigh);
+
+    mulLow += (uint64_t)(length - 1) << 54;
+    inputHigh ^= flipHigh;
+    mulHigh += inputHigh + (uint64_t)(uint32_t)inputHigh * (kPrime32_2 - 1);
+
+    mulLow ^= swap64(mulHigh);
+
+    uint64_t resultLow, resultHigh;
+    mul128(mulLow, kPrime64_2, resultLow, resultHigh);
+    resultHigh += mulHigh * kPrime64_2;
+
+    low = avalanche(resultLow);
+    high = avalanche(resultHigh);
+}
+
+void hash0to16(const uint8_t* input, size_t length, uint64_t& low, uint64_t& high) {
+    if (length > 8)
+        hash9to16(input, length, low, high);
+    else if (length >= 4)
+        hash4to8(input, length, low, high);
+    else if (length > 0)
+        hash1to3(input, length, low, high);
+    else {
+        low = xxh64Avalanche(read64(kSecret + 64) ^ read64(kSecret + 72));
+        high = xxh64Avalanche(read64(kSecret + 80) ^ read64(kSecret + 88));
+    }
+}
+
+void finalizeMid(uint64_t lo, uint64_t hi, size_t length, uint64_t& low,
+        uint64_t& high) {
+    low = avalanche(lo + hi);
+    high = 0 - avalanche(lo * kPrime64_1 + hi * kPrime64_4 +
+            (uint64_t)length * kPrime64_2);
+}
+
+void hash17to128(const uint8_t* input, size_t length, uint64_t& low, uint64_t& high) {
+    uint64_t lo = (uint64_t)length * kPrime64_1;
+    uint64_t hi = 0;
+
+    if (length > 32) {
+        if (length > 64) {
+            if (length > 96)
+                mix32(lo, hi, input + 48, input + length - 64, kSecret + 96, 0);
+            mix32(lo, hi, input + 32, input + length - 48, kSecret + 64, 0);
+        }
+        mix32(lo, hi, input + 16, input + length - 32, kSecret + 32, 0);
+    }
+
+    mix32(lo, hi, input, input + length - 16, kSecret, 0);
+
+    finalizeMid(lo, hi, length, low, high);
+}
+
+void hash129to240(const uint8_t* input, size_t length, uint64_t& low, uint64_t& high) {
+    const size_t kStartOffset = 3;
+    const size_t kLastOffset = 17;
+    const size_t rounds = length / 32;
+
+    uint64_t lo = (uint64_t)length * kPrime64_1;
+    uint64_t hi = 0;
+
+    size_t i = 0;
+    for (; i < 4; ++i)
+        mix32(lo, hi, input + 32 * i, input + 32 * i + 16, kSecret + 32 * i, 0);
+
+    lo = avalanche(lo);
+    hi = avalanche(hi);
+
+    for (; i < rounds; ++i) {
+        mix32(lo, hi, input + 32 * i, input + 32 * i + 16,
+                kSecret + kStartOffset + 32 * (i - 4), 0);
+    }
+
+    mix32(lo, hi, input + length - 16, input + length - 32,
+            kSecret + kSecretSizeMin - kLastOffset - 16, 0);
+
+    finalizeMid(lo, hi, length, low, high);
+}
+
+}
+
+Xxh3_128::Xxh3_128() : _bufferedSize(0), _stripesAcc(0), _totalLength(0) {
+    _acc[0] = kPrime32_3;
+    _acc[1] = kPrime64_1;
+    _acc[2] = kPrime64_2;
+    _acc[3] = kPrime64_3;
+    _acc[4] = kPrime64_4;
+    _acc[5] = kPrime32_2;
+    _acc[6] = kPrime64_5;
+    _acc[7] = kPrime32_1;
+}
+
+void Xxh3_128::update(const void* data, size_t length) {
+
+    const uint8_t* input = (const uint8_t*)data;
+
+    _totalLength += length;
+
+    if (length + _bufferedSize <= kBufferSize) {
+        memcpy(_buffer + _bufferedSize, input, length);
+        _bufferedSize += length;
+        return;
+    }
+
+    const size_t bufferStripes = kBufferSize / kStripeLength;
+
+    if (_bufferedSize > 0) {
+        const size_t fill = kBufferSize - _bufferedSize;
+        memcpy(_buffer + _bufferedSize, input, fill);
+        input += fill;
+        length -= fill;
+
+        _stripesAcc = consumeStripes(_acc, bufferStripes, _stripesAcc, _buffer);
+        _bufferedSize = 0;
+    }
+
+    // The last stripe of the input is always kept in the buffer such that it
+    // can be processed specially when the digest is computed.
+    if (length > kBufferSize) {
+        do {
+            _stripesAcc = consumeStripes(_acc, bufferStripes, _stripesAcc, input);
+            input += kBufferSize;
+            length -= kBufferSize;
+        } while (length > kBufferSize);
+
+        memcpy(_buffer + kBufferSize - kStripeLength, input - kStripeLength,
+                kStripeLength);
+    }
+
+    memcpy(_buffer, input, length);
+    _bufferedSize = length;
+}
+
+void Xxh3_128::digest(uint64_t& low, uint64_t& high) const {
+
+    if (_totalLength <= kMidSizeMax) {
+        const size_t length = _bufferedSize;
+
+        if (length <= 16)
+            hash0to16(_buffer, length, low, high);
+        else if (length <= 128)
+            hash17to128(_buffer, length, low, high);
+        else
+            hash129to240(_buffer, length, low, high);
+
+        return;
+    }
+
+    uint64_t acc[8];
+    memcpy(acc, _acc, sizeof(acc));
+
+    const uint8_t* lastSecret = kSecret + kSecretSize - kStripeLength -
+        kSecretLastAccStart;
+
+    if (_bufferedSize >= kStripeLength) {
+        const size_t stripes = (_bufferedSize - 1) / kStripeLength;
+        consumeStripes(acc, stripes, _stripesAcc, _buffer);
+        accumulate512(acc, _buffer + _bufferedSize - kStripeLength, lastSecret);
+    }
+    else {
+        // The last stripe is made up of the end of the previous buffer and
+        // what is in the buffer now.
+        uint8_t lastStripe[kStripeLength];
+        const size_t catchup = kStripeLength - _bufferedSize;
+        memcpy(lastStripe, _buffer + kBufferSize - catchup, catchup);
+        memcpy(lastStripe + catchup, _buffer, _bufferedSize);
+        accumulate512(acc, lastStripe, lastSecret);
+    }
+
+    low = mergeAccs(acc, kSecret + kSecretMergeAccsStart,
+            _totalLength * kPrime64_1);
+    high = mergeAccs(acc, kSecret + kSecretSize - sizeof(acc) -
+            kSecretMergeAccsStart, ~(_totalLength * kPrime64_2));
+}
+
+void Xxh3_128::digest(uint8_t output[16]) const {
+    uint64_t low, high;
+    digest(low, high);
+
+    for (size_t i = 0; i < 8; ++i) {
+        output[i]     = (uint8_t)(high >> (56 - 8 * i));
+        output[8 + i] = (uint8_t)(low  >> (56 - 8 * i));
+    }
+}
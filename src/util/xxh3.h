@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * An implementation of the 128-bit variant of XXH3, a very fast
+ * non-cryptographic hash function, using the default secret and no seed.
+ *
+ * See https://github.com/Cyan4973/xxHash for the reference implementation.
+ */
+
+#pragma once
+
+#include <stdlib.h> // For size_t
+#include <stdint.h>
+
+/**
+ * Incrementally computes the 128-bit XXH3 hash.
+ */
+class Xxh3_128 {
+private:
+    uint64_t _acc[8];
+    uint8_t _buffer[256];
+    size_t _bufferedSize;
+    size_t _stripesAcc;
+    uint64_t _totalLength;
+
+public:
+    Xxh3_128();
+
+    /**
+     * Hashes another chunk of data.
+     */
+    void update(const void* data, size_t length);
+
+    /**
+     * Returns the hash of all the data so far. The state is not modified such
+     * that more data can still be added afterwards.
+     *
+     * Params:
+     *   low, high = The low and high 64 bits of the hash.
+     */
+    void digest(uint64_t& low, uint64_t& high) const;
+
+    /**
+     * Writes the hash to the output in canonical (big-endian) byte order.
+     */
+    void digest(uint8_t output[16]) const;
+};
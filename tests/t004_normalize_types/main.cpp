@@ -0,0 +1,24 @@
+#include <windows.h>
+
+// The hash of a user defined type is calculated from its name, from its unique
+// name, or over all of its bytes. There is a type here for each of these.
+
+// Forward reference
+struct Forward;
+Forward* forward;
+
+struct Named { int x; } named;
+union Union { int x; float y; } unionValue;
+enum Enum { EnumA, EnumB } enumValue;
+
+// Anonymous
+struct { int x; } anonymous;
+struct Outer { struct { int y; } inner; } outer;
+
+BOOL WINAPI DllMain(HINSTANCE hInst, DWORD reason, LPVOID lpReserved)
+{
+    // Scoped
+    struct Local { int z; } local = {0};
+
+    return local.z == 0;
+}
@@ -0,0 +1,11 @@
+#include <windows.h>
+
+// Each object file is a module with its own symbols, which start with the path
+// of the object file.
+
+int other(int x);
+
+BOOL WINAPI DllMain(HINSTANCE hInst, DWORD reason, LPVOID lpReserved)
+{
+    return other((int)reason) != 0;
+}
@@ -0,0 +1,9 @@
+static const char greeting[] = "hello";
+
+int other(int x)
+{
+    int i, sum = 0;
+    for (i = 0; i < x; ++i)
+        sum += greeting[i % (sizeof(greeting) - 1)];
+    return sum + 1;
+}
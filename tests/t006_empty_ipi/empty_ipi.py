@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+
+# Copyright (c) 2016 Jason White
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+
+"""
+Empties the ID info (IPI) stream of a PDB in place, like older toolsets do.
+
+The stream table is rewritten in the pages it already occupies. The pages of
+the old IPI stream are simply left unused.
+"""
+
+import sys
+import struct
+
+IPI_STREAM = 4
+
+def empty_ipi(path):
+    with open(path, 'r+b') as f:
+        data = bytearray(f.read())
+
+        page_size, _, _, table_size = struct.unpack_from('<4I', data, 32)
+        table_page_count = (table_size + page_size - 1) // page_size
+        list_page_count = (table_page_count * 4 + page_size - 1) // page_size
+
+        def pages_data(pages):
+            return b''.join(bytes(data[p * page_size:(p + 1) * page_size])
+                    for p in pages)
+
+        list_pages = struct.unpack_from('<%dI' % list_page_count, data, 52)
+        table_pages = struct.unpack_from('<%dI' % table_page_count,
+                pages_data(list_pages))
+        table = pages_data(table_pages)[:table_size]
+
+        count = struct.unpack_from('<I', table)[0]
+        if count <= IPI_STREAM:
+            raise ValueError('%s has no IPI stream' % path)
+
+        sizes = list(struct.unpack_from('<%dI' % count, table, 4))
+        offset = 4 + 4 * count
+        stream_pages = []
+        for size in sizes:
+            n = 0 if size == 0xFFFFFFFF else (size + page_size - 1) // page_size
+            stream_pages.append(table[offset:offset + 4 * n])
+            offset += 4 * n
+
+        sizes[IPI_STREAM] = 0
+        stream_pages[IPI_STREAM] = b''
+
+        new_table = (struct.pack('<%dI' % (count + 1), count, *sizes) +
+                b''.join(stream_pages))
+
+        # The new table is smaller, so it fits in the pages of the old one.
+        for i, page in enumerate(table_pages):
+            chunk = new_table[i * page_size:(i + 1) * page_size]
+            data[page * page_size:page * page_size + len(chunk)] = chunk
+
+        struct.pack_into('<I', data, 44, len(new_table))
+
+        f.seek(0)
+        f.write(data)
+
+if __name__ == '__main__':
+    for path in sys.argv[1:]:
+        empty_ipi(path)
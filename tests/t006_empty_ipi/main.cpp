@@ -0,0 +1,12 @@
+#include <windows.h>
+
+// Older toolsets write an empty ID info stream. The PDB of this DLL has its ID
+// info stream emptied after the build so that normalizing the types has to
+// skip it.
+
+struct Named { int x; } named;
+
+BOOL WINAPI DllMain(HINSTANCE hInst, DWORD reason, LPVOID lpReserved)
+{
+    return named.x == 0;
+}